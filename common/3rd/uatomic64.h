@@ -111,6 +111,17 @@ static inline int atomic64_inc_and_test( atomic64_t *v )
       return !(__sync_add_and_fetch(&v->counter, 1));
 }
 
+/**
+ * @brief increment and return
+ * @param v pointer of type atomic64_t
+ *
+ * Atomically increments @v by 1 and returns the new value.
+ */
+static inline long long atomic64_inc_return( atomic64_t *v )
+{
+      return __sync_add_and_fetch(&v->counter, 1);
+}
+
 /**
  * @brief add and test if negative
  * @param v pointer of type atomic64_t
@@ -125,4 +136,36 @@ static inline int atomic64_add_negative( int i, atomic64_t *v )
        return (__sync_add_and_fetch(&v->counter, i) < 0);
 }
 
+/**
+ * @brief exchange
+ * @param v pointer of type atomic64_t
+ * @param i new value
+ *
+ * Atomically sets @v to @i and returns the old value.
+ */
+static inline long long atomic64_xchg( atomic64_t *v, long long i )
+{
+       return __sync_lock_test_and_set(&v->counter, i);
+}
+
+/**
+ * @brief compare and exchange
+ * @param v pointer of type atomic64_t
+ * @param old expected value
+ * @param i new value
+ *
+ * Atomically sets @v to @i if it was @old and returns the value seen.
+ */
+static inline long long atomic64_cmpxchg( atomic64_t *v, long long old, long long i )
+{
+       return __sync_val_compare_and_swap(&v->counter, old, i);
+}
+
+/**
+ * Memory barriers, named after their kernel counterparts
+ */
+#define smp_mb() __sync_synchronize()
+#define smp_rmb() __sync_synchronize()
+#define smp_wmb() __sync_synchronize()
+
 #endif
@@ -236,6 +236,12 @@ int bdbm_drv_run (bdbm_drv_info_t* bdi)
 			bdbm_error ("[bdbm_drv_main] failed to create hlm");
 			goto fail;
 		}
+		if (bdi->parm_ftl.snapshot == SNAPSHOT_ENABLE &&
+			load == 1 && hlm->load != NULL) {
+			if (hlm->load (bdi, "/usr/share/bdbm_drv/hlm.dat") != 0) {
+				bdbm_msg ("[bdbm_drv_main] loading 'hlm.dat' failed");
+			}
+		}
 	}
 
 	/* create a host interface */
@@ -291,8 +297,13 @@ void bdbm_drv_close (bdbm_drv_info_t* bdi)
 	if (bdi->ptr_host_inf)
 		bdi->ptr_host_inf->close (bdi);
 
-	if (bdi->ptr_hlm_inf)
+	if (bdi->ptr_hlm_inf) {
+		if (bdi->parm_ftl.snapshot == SNAPSHOT_ENABLE && bdi->ptr_hlm_inf->store) {
+			bdbm_msg ("[bdbm_drv_main] storing hlm buffers to '/usr/share/bdbm_drv/hlm.dat'");
+			bdi->ptr_hlm_inf->store (bdi, "/usr/share/bdbm_drv/hlm.dat");
+		}
 		bdi->ptr_hlm_inf->destroy (bdi);
+	}
 
 	if (bdi->ptr_ftl_inf) {
 		if (bdi->parm_ftl.snapshot == SNAPSHOT_ENABLE && bdi->ptr_ftl_inf->store) {
@@ -125,6 +125,7 @@ void bdbm_thread_schedule_cancel (bdbm_thread_t* k)
 {
 	/* FIXME: I'm not sure wether or not to remove wait from queue */
 	remove_wait_queue (&k->wq, k->wait);
+	set_current_state (TASK_RUNNING);
 }
 
 int bdbm_thread_schedule_sleep (bdbm_thread_t* k)
@@ -323,12 +324,14 @@ void bdbm_thread_wakeup (bdbm_thread_t* k)
 		return;
 	}
 
-	/* send a wake-up signal */
-	if ((ret = bdbm_mutex_try_lock (&k->thread_sleep)) == 1) {
+	/* send a wake-up signal; it must wait for the lock because the thread
+	 * holds it between schedule_setup () and schedule_sleep (), and a signal
+	 * dropped in that window would be lost */
+	if ((ret = bdbm_mutex_lock (&k->thread_sleep)) == 0) {
 		pthread_cond_signal (&k->thread_con);
 		bdbm_mutex_unlock (&k->thread_sleep);
 	} else {
-		/*bdbm_warning ("pthread lock failed: %u %s", ret, strerror (ret));*/
+		bdbm_warning ("pthread lock failed: %u %s", ret, strerror (ret));
 	}
 }
 
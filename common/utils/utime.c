@@ -37,6 +37,8 @@ THE SOFTWARE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include "uatomic64.h"
+#include "usync.h"
 #include "utime.h"
 
 #define do_gettimeofday(a) gettimeofday (a, NULL)
@@ -52,6 +54,13 @@ ktime_t ktime_get (void);
 #endif
 
 static uint32_t _time_startup_timestamp = 0;
+static volatile int64_t _vclock_us = -1;	/* -1: disabled */
+static atomic64_t _vclock_nr_holds;	/* # of issuers running */
+static int64_t _vclock_nr_blocked;	/* # of pollers waiting for a completion */
+static int64_t _vclock_gen;	/* # of completion rounds so far */
+static bdbm_spinlock_t _vclock_lock;
+static atomic64_t _vclock_nr_host_wakes;	/* # of host reqs done and not answered yet */
+static volatile uint32_t _vclock_host_woken_at;	/* wall-clock timestamp in us */
 
 
 uint32_t time_get_timestamp_in_us (void)
@@ -97,14 +106,38 @@ int timeval_subtract (
 	return x->tv_sec < y->tv_sec;
 }
 
+#if defined(KERNEL_MODE) && \
+	defined(USE_KTIMER)
+static ktime_t __stopwatch_now (void)
+{
+	int64_t vclock_us = _vclock_us;
+
+	if (vclock_us >= 0)
+		return ns_to_ktime (vclock_us * 1000);
+	return ktime_get ();
+}
+#else
+static void __stopwatch_now (struct timeval* tv)
+{
+	int64_t vclock_us = _vclock_us;
+
+	if (vclock_us >= 0) {
+		tv->tv_sec = vclock_us / 1000000;
+		tv->tv_usec = vclock_us % 1000000;
+		return;
+	}
+	do_gettimeofday (tv);
+}
+#endif
+
 void bdbm_stopwatch_start (bdbm_stopwatch_t* sw)
 {
 	if (sw) {
 #if defined(KERNEL_MODE) && \
 	defined(USE_KTIMER)
-		sw->start = ktime_get ();
+		sw->start = __stopwatch_now ();
 #else
-		do_gettimeofday(&sw->start);
+		__stopwatch_now (&sw->start);
 #endif
 	}
 }
@@ -114,12 +147,12 @@ int64_t bdbm_stopwatch_get_elapsed_time_ms (bdbm_stopwatch_t* sw)
 	if (sw) {
 #if defined(KERNEL_MODE) && \
 	defined(USE_KTIMER)
-		ktime_t end = ktime_get ();
+		ktime_t end = __stopwatch_now ();
 		return ktime_to_ms (ktime_sub (end, sw->start));
 
 #else
 		struct timeval diff, end;
-		do_gettimeofday (&end);
+		__stopwatch_now (&end);
 		if (timeval_subtract (&diff, &end, &sw->start) == 0) {
 			return (diff.tv_sec * 1000000 + diff.tv_usec)/1000;
 		}
@@ -133,12 +166,12 @@ int64_t bdbm_stopwatch_get_elapsed_time_us (bdbm_stopwatch_t* sw)
 	if (sw) {
 #if defined(KERNEL_MODE) && \
 	defined(USE_KTIMER)
-		ktime_t end = ktime_get ();
+		ktime_t end = __stopwatch_now ();
 		return ktime_to_us (ktime_sub (end, sw->start));
 
 #else
 		struct timeval diff, end;
-		do_gettimeofday (&end);
+		__stopwatch_now (&end);
 		if (timeval_subtract (&diff, &end, &sw->start) == 0) {
 			return diff.tv_sec * 1000000 + diff.tv_usec;
 		}
@@ -154,14 +187,147 @@ struct timeval bdbm_stopwatch_get_elapsed_time (bdbm_stopwatch_t* sw)
 	if (sw) {
 #if defined(KERNEL_MODE) && \
 	defined(USE_KTIMER)
-		ktime_t end = ktime_get ();
+		ktime_t end = __stopwatch_now ();
 		diff.tv_usec = ktime_to_us (ktime_sub (end, sw->start));
 #else
 		struct timeval end;
-		do_gettimeofday (&end);
+		__stopwatch_now (&end);
 		timeval_subtract (&diff, &end, &sw->start);
 #endif
 	}
 	return diff;
 }
 
+
+/* virtual clock functions */
+void bdbm_vclock_enable (void)
+{
+	atomic64_set (&_vclock_nr_holds, 0);
+	atomic64_set (&_vclock_nr_host_wakes, 0);
+	_vclock_nr_blocked = 0;
+	_vclock_gen = 0;
+	bdbm_spin_lock_init (&_vclock_lock);
+	_vclock_us = 0;
+}
+
+void bdbm_vclock_disable (void)
+{
+	_vclock_us = -1;
+}
+
+uint8_t bdbm_vclock_is_enabled (void)
+{
+	return (_vclock_us >= 0) ? 1 : 0;
+}
+
+int64_t bdbm_vclock_get_us (void)
+{
+	return _vclock_us;
+}
+
+/* NOTE: the virtual clock never goes backward; only one context (i.e., the
+ * device emulator) may advance it */
+void bdbm_vclock_advance_to (int64_t us)
+{
+	if (_vclock_us >= 0 && us > _vclock_us)
+		_vclock_us = us;
+}
+
+/* NOTE: the device is the only one that takes virtual time; everything above
+ * it (the host, the hlm, the ftl and the llm) takes none, so the clock may
+ * move on only when none of them has anything left to do but wait for the
+ * device. Each running issuer holds the clock, and whoever wakes a sleeping
+ * issuer takes a hold on its behalf before waking it up. */
+void bdbm_vclock_hold (void)
+{
+	if (_vclock_us >= 0)
+		atomic64_inc (&_vclock_nr_holds);
+}
+
+void bdbm_vclock_release (void)
+{
+	if (_vclock_us >= 0)
+		atomic64_dec (&_vclock_nr_holds);
+}
+
+uint8_t bdbm_vclock_is_held (void)
+{
+	return (atomic64_read (&_vclock_nr_holds) > 0) ? 1 : 0;
+}
+
+/* an issuer that polls for the device (rather than sleeping) gives up its
+ * hold until the next completion, which hands it back so that the issuer can
+ * poll once more before the clock moves; it is a no-op while the issuer is
+ * still blocked from a previous call */
+void bdbm_vclock_block (bdbm_vclock_waiter_t* w)
+{
+	if (_vclock_us < 0)
+		return;
+
+	bdbm_spin_lock (&_vclock_lock);
+	if (!w->blocked || w->gen != _vclock_gen) {
+		w->gen = _vclock_gen;
+		w->blocked = 1;
+		_vclock_nr_blocked++;
+		atomic64_dec (&_vclock_nr_holds);
+	}
+	bdbm_spin_unlock (&_vclock_lock);
+}
+
+void bdbm_vclock_unblock (bdbm_vclock_waiter_t* w)
+{
+	if (_vclock_us < 0)
+		return;
+
+	bdbm_spin_lock (&_vclock_lock);
+	if (w->blocked && w->gen == _vclock_gen) {
+		_vclock_nr_blocked--;
+		atomic64_inc (&_vclock_nr_holds);
+	}
+	w->blocked = 0;
+	bdbm_spin_unlock (&_vclock_lock);
+}
+
+/* it must be called by the device after a command has completed */
+void bdbm_vclock_complete (void)
+{
+	if (_vclock_us < 0)
+		return;
+
+	bdbm_spin_lock (&_vclock_lock);
+	_vclock_gen++;
+	atomic64_add (_vclock_nr_blocked, &_vclock_nr_holds);
+	_vclock_nr_blocked = 0;
+	bdbm_spin_unlock (&_vclock_lock);
+}
+
+/* NOTE: the host is outside the driver, so it cannot hold the clock; instead,
+ * every host req that completes is taken to be answered by a new one, and the
+ * clock waits for it for a while (grace_us of wall-clock time) */
+void bdbm_vclock_host_wake (void)
+{
+	if (_vclock_us < 0)
+		return;
+
+	_vclock_host_woken_at = time_get_timestamp_in_us ();
+	atomic64_inc (&_vclock_nr_host_wakes);
+}
+
+void bdbm_vclock_host_submit (void)
+{
+	if (_vclock_us < 0)
+		return;
+
+	if (atomic64_read (&_vclock_nr_host_wakes) > 0)
+		atomic64_dec (&_vclock_nr_host_wakes);
+}
+
+uint8_t bdbm_vclock_host_is_pending (uint32_t grace_us)
+{
+	if (atomic64_read (&_vclock_nr_host_wakes) <= 0)
+		return 0;
+	if (time_get_timestamp_in_us () - _vclock_host_woken_at < grace_us)
+		return 1;
+	atomic64_set (&_vclock_nr_host_wakes, 0);	/* the host is idle */
+	return 0;
+}
@@ -62,5 +62,29 @@ int64_t bdbm_stopwatch_get_elapsed_time_ms (bdbm_stopwatch_t* sw);
 int64_t bdbm_stopwatch_get_elapsed_time_us (bdbm_stopwatch_t* sw);
 struct timeval bdbm_stopwatch_get_elapsed_time (bdbm_stopwatch_t* sw);
 
+/* virtual clock functions; while it is enabled, stopwatches run on it
+ * instead of the wall clock */
+void bdbm_vclock_enable (void);
+void bdbm_vclock_disable (void);
+uint8_t bdbm_vclock_is_enabled (void);
+int64_t bdbm_vclock_get_us (void);
+void bdbm_vclock_advance_to (int64_t us);
+
+/* the virtual clock only advances when no issuer holds it */
+typedef struct {
+	int64_t gen;
+	uint8_t blocked;
+} bdbm_vclock_waiter_t;
+
+void bdbm_vclock_hold (void);
+void bdbm_vclock_release (void);
+uint8_t bdbm_vclock_is_held (void);
+void bdbm_vclock_block (bdbm_vclock_waiter_t* w);
+void bdbm_vclock_unblock (bdbm_vclock_waiter_t* w);
+void bdbm_vclock_complete (void);
+void bdbm_vclock_host_wake (void);
+void bdbm_vclock_host_submit (void);
+uint8_t bdbm_vclock_host_is_pending (uint32_t grace_us);
+
 #endif
 
@@ -0,0 +1,266 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#if defined (KERNEL_MODE)
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#elif defined (USER_MODE)
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "debug.h"
+#include "umemory.h"
+#include "ufile.h"
+#include "dev_nand_profile.h"
+
+#define NAND_PROFILE_MAX_FILE_SIZE	(64*1024)
+#define NAND_PROFILE_NR_DMA_ENTRIES	BDBM_NR_DMA_LEVELS
+
+static inline int __profile_is_space (char c)
+{
+	return (c == ' ' || c == '\t' || c == '\r');
+}
+
+static char* __profile_trim (char* s)
+{
+	char* e = NULL;
+
+	while (__profile_is_space (*s))
+		s++;
+	e = s + strlen (s);
+	while (e > s && __profile_is_space (*(e - 1)))
+		*(--e) = '\0';
+
+	return s;
+}
+
+/* parse a list of unsigned integers separated by spaces or commas; 
+ * it returns the # of values or -1 if the list is malformed */
+static int __profile_parse_list (char* s, uint64_t* v, int max)
+{
+	int n = 0;
+
+	while (*s != '\0') {
+		uint64_t x = 0;
+
+		if (__profile_is_space (*s) || *s == ',') {
+			s++;
+			continue;
+		}
+		if (*s < '0' || *s > '9' || n == max)
+			return -1;
+		while (*s >= '0' && *s <= '9')
+			x = x * 10 + (*s++ - '0');
+		v[n++] = x;
+	}
+
+	return (n == 0) ? -1 : n;
+}
+
+static uint32_t __profile_parse_one (char* s, uint64_t* v)
+{
+	return (__profile_parse_list (s, v, 1) == 1) ? 0 : 1;
+}
+
+#ifdef DWHONG
+/* a DMA table is indexed by the # of busy channels; a shorter list repeats
+ * its last value */
+static uint32_t __profile_parse_dma (char* s, uint64_t* table)
+{
+	uint64_t v[NAND_PROFILE_NR_DMA_ENTRIES];
+	int i, n;
+
+	if ((n = __profile_parse_list (s, v, NAND_PROFILE_NR_DMA_ENTRIES)) < 0)
+		return 1;
+	for (i = 0; i < NAND_PROFILE_NR_DMA_ENTRIES; i++)
+		table[i] = (i < n) ? v[i] : v[n - 1];
+
+	return 0;
+}
+#endif
+
+static uint32_t __profile_set (
+	bdbm_device_params_t* t, 
+	char* key, 
+	char* val, 
+	int* nr_prog, 
+	int* nr_read)
+{
+	uint64_t v = 0;
+
+	if (strcmp (key, "bits_per_cell") == 0) {
+		if (__profile_parse_one (val, &v) != 0 || v == 0 || v > BDBM_MAX_PAGE_TYPES)
+			return 1;
+		t->nr_page_types = v;
+	} else if (strcmp (key, "prog_us") == 0) {
+		if ((*nr_prog = __profile_parse_list (val, t->page_type_prog_time_us, BDBM_MAX_PAGE_TYPES)) < 0)
+			return 1;
+	} else if (strcmp (key, "read_us") == 0) {
+		if ((*nr_read = __profile_parse_list (val, t->page_type_read_time_us, BDBM_MAX_PAGE_TYPES)) < 0)
+			return 1;
+	} else if (strcmp (key, "erase_us") == 0) {
+		return __profile_parse_one (val, &t->block_erase_time_us);
+	} else if (strcmp (key, "suspend_us") == 0) {
+		return __profile_parse_one (val, &t->suspend_time_us);
+	} else if (strcmp (key, "resume_us") == 0) {
+		return __profile_parse_one (val, &t->resume_time_us);
+#ifdef DWHONG
+	} else if (strcmp (key, "dma_mbps") == 0) {
+		int i;
+		/* MB/s is bytes/us; the tables keep the time per kernel page */
+		if (__profile_parse_one (val, &v) != 0 || v == 0)
+			return 1;
+		for (i = 0; i < NAND_PROFILE_NR_DMA_ENTRIES; i++) {
+			t->read_dma_time_us[i] = (KERNEL_PAGE_SIZE + v - 1) / v;
+			t->prog_dma_time_us[i] = (KERNEL_PAGE_SIZE + v - 1) / v;
+		}
+	} else if (strcmp (key, "read_dma_us") == 0) {
+		return __profile_parse_dma (val, t->read_dma_time_us);
+	} else if (strcmp (key, "prog_dma_us") == 0) {
+		return __profile_parse_dma (val, t->prog_dma_time_us);
+#endif
+	} else {
+		return 1;
+	}
+
+	return 0;
+}
+
+uint32_t dev_nand_profile_load (bdbm_device_params_t* np, const char* fn, const char* name)
+{
+	bdbm_device_params_t t = *np;
+	bdbm_file_t fp;
+	char* buf = NULL;
+	char* line = NULL;
+	char* next = NULL;
+	char* p = NULL;
+	uint64_t len, i;
+	uint32_t line_no = 0;
+	int found = 0, nr_prog = 0, nr_read = 0;
+	uint32_t ret = 1;
+
+	if (fn == NULL || fn[0] == '\0')
+		return 0;
+
+	fp = bdbm_fopen (fn, O_RDONLY, 0);
+#if defined (KERNEL_MODE)
+	if (fp == NULL) {
+#else
+	if (fp < 0) {
+#endif
+		bdbm_error ("bdbm_fopen failed (%s)", fn);
+		return 1;
+	}
+	if ((buf = (char*)bdbm_malloc (NAND_PROFILE_MAX_FILE_SIZE + 1)) == NULL) {
+		bdbm_error ("bdbm_malloc failed");
+		bdbm_fclose (fp);
+		return 1;
+	}
+	len = bdbm_fread (fp, 0, (uint8_t*)buf, NAND_PROFILE_MAX_FILE_SIZE + 1);
+	bdbm_fclose (fp);
+	if (len > NAND_PROFILE_MAX_FILE_SIZE) {
+		bdbm_error ("%s is larger than %u bytes", fn, NAND_PROFILE_MAX_FILE_SIZE);
+		goto out;
+	}
+	buf[len] = '\0';
+
+	for (line = buf; line != NULL; line = next) {
+		line_no++;
+		if ((next = strchr (line, '\n')) != NULL)
+			*next++ = '\0';
+		if ((p = strchr (line, '#')) != NULL)
+			*p = '\0';
+		if ((line = __profile_trim (line))[0] == '\0')
+			continue;
+
+		/* a new section */
+		if (line[0] == '[') {
+			if (found)
+				break;	/* the requested profile is over */
+			if ((p = strchr (line, ']')) == NULL) {
+				bdbm_error ("%s:%u: missing ']'", fn, line_no);
+				goto out;
+			}
+			*p = '\0';
+			p = __profile_trim (line + 1);
+			if (name == NULL || name[0] == '\0' || strcmp (p, name) == 0) {
+				strncpy (t.nand_profile, p, BDBM_NAND_PROFILE_LEN - 1);
+				t.nand_profile[BDBM_NAND_PROFILE_LEN - 1] = '\0';
+				found = 1;
+			}
+			continue;
+		}
+		if (!found)
+			continue;
+
+		/* key = value */
+		if ((p = strchr (line, '=')) == NULL) {
+			bdbm_error ("%s:%u: missing '='", fn, line_no);
+			goto out;
+		}
+		*p++ = '\0';
+		line = __profile_trim (line);
+		if (__profile_set (&t, line, __profile_trim (p), &nr_prog, &nr_read) != 0) {
+			bdbm_error ("%s:%u: invalid or unknown entry '%s'", fn, line_no, line);
+			goto out;
+		}
+	}
+
+	if (!found) {
+		bdbm_error ("no NAND profile '%s' in %s", name ? name : "", fn);
+		goto out;
+	}
+
+	/* every page type must have its program time; a single read time is
+	 * used for all the types */
+	if ((nr_prog == 0 && t.nr_page_types != np->nr_page_types) ||
+		(nr_prog != 0 && nr_prog != t.nr_page_types)) {
+		bdbm_error ("'%s' needs %llu values in prog_us", t.nand_profile, t.nr_page_types);
+		goto out;
+	}
+	if (nr_read > 1 && nr_read != t.nr_page_types) {
+		bdbm_error ("'%s' needs 1 or %llu values in read_us", t.nand_profile, t.nr_page_types);
+		goto out;
+	}
+	if (nr_read <= 1) {
+		for (i = 1; i < t.nr_page_types; i++)
+			t.page_type_read_time_us[i] = t.page_type_read_time_us[0];
+	}
+	t.page_read_time_us = t.page_type_read_time_us[0];
+
+	*np = t;
+	bdbm_msg ("NAND profile '%s' is loaded from %s", np->nand_profile, fn);
+	ret = 0;
+
+out:
+	bdbm_free (buf);
+	return ret;
+}
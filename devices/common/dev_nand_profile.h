@@ -0,0 +1,51 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef _BLUEDBM_DEV_NAND_PROFILE_H
+#define _BLUEDBM_DEV_NAND_PROFILE_H
+
+#include "bdbm_drv.h"
+#include "params.h"
+
+/* 
+ * NAND profiles let the timing of emulated devices be picked at load time
+ * instead of being compiled in. a profile file has one section per profile:
+ *
+ *   # comments start with '#'
+ *   [tlc]
+ *   bits_per_cell = 3
+ *   prog_us = 500 1500 2500     # one per page type (page_no % bits_per_cell)
+ *   read_us = 50 70 90
+ *   erase_us = 5000
+ *   dma_mbps = 800              # or read_dma_us/prog_dma_us (per 4KB)
+ *
+ * the profile named 'name' (or the first one in the file if it is empty)
+ * overrides the built-in defaults of get_default_device_params (); keys that
+ * a profile omits keep their defaults.
+ */
+
+uint32_t dev_nand_profile_load (bdbm_device_params_t* np, const char* fn, const char* name);
+
+#endif
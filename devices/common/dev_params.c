@@ -32,6 +32,7 @@ THE SOFTWARE.
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #else
 #error Invalid Platform (KERNEL_MODE or USER_MODE)
@@ -57,6 +58,8 @@ enum BDBM_DEFAULT_NAND_PARAMS {
 	NAND_PAGE_PROG_TIME_US = 500,		/* 1.3ms */	
 	NAND_PAGE_READ_TIME_US = 100,		/* 100us */
 	NAND_BLOCK_ERASE_TIME_US = 3000,	/* 3ms */
+	NAND_SUSPEND_TIME_US = 20,			/* 20us */
+	NAND_RESUME_TIME_US = 10,			/* 10us */
 };
 
 int _param_nr_channels 				= NR_CHANNELS;
@@ -70,6 +73,14 @@ int _param_chip_bus_trans_time_us	= NAND_CHIP_BUS_TRANS_TIME_US;
 int _param_page_prog_time_us		= NAND_PAGE_PROG_TIME_US; 		
 int _param_page_read_time_us		= NAND_PAGE_READ_TIME_US;
 int _param_block_erase_time_us		= NAND_BLOCK_ERASE_TIME_US;
+int _param_suspend_time_us			= NAND_SUSPEND_TIME_US;
+int _param_resume_time_us			= NAND_RESUME_TIME_US;
+int _param_virtual_clock			= 0;	/* 1: discrete-event emulation on a virtual clock */
+int _param_page_store				= 0;	/* 1: keep page data in a deduplicated and compressed store */
+char* _param_ramssd_image			= "";	/* a file mapped as the NAND image (user mode) */
+int _param_ramssd_sync_ms			= 0;	/* msync interval of the image (0: on store and close only) */
+char* _param_nand_profile_file		= "";	/* a file of NAND timing profiles (see dev_nand_profile.h) */
+char* _param_nand_profile			= "";	/* the profile to use ("": the first one in the file) */
 
 /* TODO: Hmm... there might be a more fancy way than this... */
 #if defined (CONFIG_DEVICE_TYPE_RAMDRIVE)
@@ -100,6 +111,14 @@ module_param (_param_chip_bus_trans_time_us, int, 0000);
 module_param (_param_page_prog_time_us, int, 0000);
 module_param (_param_page_read_time_us, int, 0000);
 module_param (_param_block_erase_time_us, int, 0000);
+module_param (_param_suspend_time_us, int, 0000);
+module_param (_param_resume_time_us, int, 0000);
+module_param (_param_virtual_clock, int, 0000);
+module_param (_param_page_store, int, 0000);
+module_param (_param_ramssd_image, charp, 0000);
+module_param (_param_ramssd_sync_ms, int, 0000);
+module_param (_param_nand_profile_file, charp, 0000);
+module_param (_param_nand_profile, charp, 0000);
 module_param (_param_device_type, int, 0000);
 
 MODULE_PARM_DESC (_param_nr_channels, "# of channels");
@@ -114,12 +133,21 @@ MODULE_PARM_DESC (_param_chip_bus_trans_time_us, "NAND bus transfer time");
 MODULE_PARM_DESC (_param_page_prog_time_us, "page program time");
 MODULE_PARM_DESC (_param_page_read_time_us, "page read time");
 MODULE_PARM_DESC (_param_block_erase_time_us, "block erasure time");
+MODULE_PARM_DESC (_param_suspend_time_us, "program/erase suspend time");
+MODULE_PARM_DESC (_param_resume_time_us, "program/erase resume overhead");
+MODULE_PARM_DESC (_param_virtual_clock, "run the timing model on a virtual clock");
+MODULE_PARM_DESC (_param_page_store, "keep page data in a deduplicated and compressed store");
+MODULE_PARM_DESC (_param_ramssd_image, "a file mapped as the NAND image (user mode only)");
+MODULE_PARM_DESC (_param_ramssd_sync_ms, "msync interval of the NAND image in ms");
+MODULE_PARM_DESC (_param_nand_profile_file, "a file of NAND timing profiles");
+MODULE_PARM_DESC (_param_nand_profile, "the NAND profile to use (default: the first one)");
 MODULE_PARM_DESC (_param_device_type, "device type"); /* it must be reset when implementing actual device modules */
 #endif
 
 bdbm_device_params_t get_default_device_params (void)
 {
 	bdbm_device_params_t p;
+	int i;
 
 	/* user-specified parameters */
 	p.nr_channels = _param_nr_channels;
@@ -130,10 +158,21 @@ bdbm_device_params_t get_default_device_params (void)
  	p.page_main_size = _param_page_main_size;
  	p.page_oob_size = _param_page_oob_size;
 	p.device_type = _param_device_type;
+	p.device_caps = 0;
+	p.virtual_clock = _param_virtual_clock;
+	p.page_store = _param_page_store;
+	strncpy (p.ramssd_image, _param_ramssd_image ? _param_ramssd_image : "", BDBM_IMAGE_PATH_LEN - 1);
+	p.ramssd_image[BDBM_IMAGE_PATH_LEN - 1] = '\0';
+	p.ramssd_sync_ms = _param_ramssd_sync_ms;
+
+	/* built-in MLC timing: even pages are MSB pages, odd pages are LSB ones */
+	strcpy (p.nand_profile, "default");
+	p.nr_page_types = 2;
+	p.page_type_prog_time_us[0] = 1050;
+	p.page_type_prog_time_us[1] = 250;
+	p.page_type_prog_time_us[2] = 1050;
+	p.page_type_prog_time_us[3] = 250;
 #ifdef DWHONG
-	p.page_lsb_prog_time_us = 250; 
-	p.page_msb_prog_time_us = 1050;
-	
 //	p.read_dma_time_us = 20;
 //	p.prog_dma_time_us = 205; //102;
 //	p.gc_read_dma_time_us = 102;	
@@ -223,9 +262,13 @@ bdbm_device_params_t get_default_device_params (void)
  	p.page_prog_time_us = _param_page_prog_time_us;
  	p.page_read_time_us = _param_page_read_time_us;
 #endif
+	for (i = 0; i < BDBM_MAX_PAGE_TYPES; i++)
+		p.page_type_read_time_us[i] = p.page_read_time_us;
 	
 
  	p.block_erase_time_us = _param_block_erase_time_us;
+	p.suspend_time_us = _param_suspend_time_us;
+	p.resume_time_us = _param_resume_time_us;
  
  	/* other parameters derived from user parameters */
  	p.nr_blocks_per_channel = p.nr_chips_per_channel * p.nr_blocks_per_chip;
@@ -251,6 +294,8 @@ bdbm_device_params_t get_default_device_params (void)
 
 void display_device_params (bdbm_device_params_t* p)
 {
+	int i;
+
     bdbm_msg ("=====================================================================");
     bdbm_msg ("DEVICE PARAMETERS");
     bdbm_msg ("=====================================================================");
@@ -264,6 +309,15 @@ void display_device_params (bdbm_device_params_t* p)
     bdbm_msg ("page oob size = %llu bytes", p->page_oob_size);
 	bdbm_msg ("device type = %u (1: ramdrv, 2: ramdrive (intr), 3: ramdrive (timing), 4: BlueDBM, 5: libdummy, 6: libramdrive)", 
 			p->device_type);
+	bdbm_msg ("virtual clock = %u (0: wall clock)", p->virtual_clock);
+	bdbm_msg ("page store = %u (0: no page data on dummy ssd)", p->page_store);
+	bdbm_msg ("ramssd image = '%s' (sync every %u ms, 0: on store and close)", p->ramssd_image, p->ramssd_sync_ms);
+	bdbm_msg ("NAND profile = '%s' (%llu bits per cell, erase %llu us)", 
+			p->nand_profile, p->nr_page_types, p->block_erase_time_us);
+	for (i = 0; i < p->nr_page_types; i++) {
+		bdbm_msg ("  page type %d: prog %llu us, read %llu us", 
+				i, p->page_type_prog_time_us[i], p->page_type_read_time_us[i]);
+	}
     bdbm_msg ("");
 }
 
@@ -37,7 +37,11 @@ extern int _param_chip_bus_trans_time_us;
 extern int _param_page_prog_time_us;
 extern int _param_page_read_time_us;
 extern int _param_block_erase_time_us;
+extern int _param_suspend_time_us;
+extern int _param_resume_time_us;
 extern int _param_ramdrv_timing_mode;
+extern char* _param_nand_profile_file;
+extern char* _param_nand_profile;
 
 bdbm_device_params_t get_default_device_params (void);
 void display_device_params (bdbm_device_params_t* p);
@@ -31,6 +31,14 @@ THE SOFTWARE.
 #elif defined (USER_MODE)
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #else
 #error Invalid Platform (KERNEL_MODE or USER_MODE)
@@ -44,23 +52,15 @@ THE SOFTWARE.
 
 //#define DATA_CHECK
 
-#ifdef DUMMY_SSD
-#ifdef DATA_CHECK
-	#error "data check is not allowed on dummy ssd mode"
-#endif
-#endif
-
-
+/* NOTE: data check on dummy ssd needs the page store (np->page_store) */
 #if defined (DATA_CHECK)
-static void* __ptr_ramssd_data = NULL;
-static uint8_t* __get_ramssd_data_addr (dev_ramssd_info_t* ri, uint64_t lpa)
+static dev_ramssd_pstore_t* __ramssd_shadow = NULL;	/* host data per lpa */
+static uint64_t __get_ramssd_data_slot (dev_ramssd_info_t* ri, uint64_t lpa)
 {
-	uint64_t ramssd_addr = -1;
 	if (ri->np->nr_subpages_per_page == 1)
-		ramssd_addr = ri->np->page_main_size * lpa;
+		return (ri->np->page_main_size / KPAGE_SIZE) * lpa;
 	else
-		ramssd_addr = KPAGE_SIZE * lpa;
-	return ((uint8_t*)__ptr_ramssd_data) + ramssd_addr;
+		return lpa;
 }
 static void __display_hex_values (uint8_t* host, uint8_t* back)
 {
@@ -124,8 +124,173 @@ static uint8_t* __ramssd_block_addr (
 	return ptr_ramssd;
 }
 
-static void* __ramssd_alloc_ssdram (bdbm_device_params_t* ptr_np)
+/* the first page-store slot of a page; a slot holds a kernel page */
+static uint64_t __ramssd_page_slot (
+	dev_ramssd_info_t* ri,
+	uint64_t channel_no,
+	uint64_t chip_no,
+	uint64_t block_no,
+	uint64_t page_no)
+{
+	uint64_t page = channel_no;
+
+	page = page * ri->np->nr_chips_per_channel + chip_no;
+	page = page * ri->np->nr_blocks_per_chip + block_no;
+	page = page * ri->np->nr_pages_per_block + page_no;
+
+	return page * (ri->np->page_main_size / KPAGE_SIZE);
+}
+
+#if defined (USER_MODE)
+#define RAMSSD_IMAGE_MAGIC		0x31444e414e4d4442ULL	/* "BDMNAND1" */
+#define RAMSSD_IMAGE_HDR_SIZE	4096	/* keeps ptr_ssdram page-aligned */
+#define RAMSSD_SYNC_POLL_MS		10
+
+/* the header of a ramssd image; the NAND image follows it */
+typedef struct {
+	uint64_t magic;
+	uint64_t nr_channels;
+	uint64_t nr_chips_per_channel;
+	uint64_t nr_blocks_per_chip;
+	uint64_t nr_pages_per_block;
+	uint64_t page_main_size;
+	uint64_t page_oob_size;
+	uint64_t page_size;	/* bytes per page in the image */
+	uint64_t clean;	/* 1: unmapped by dev_ramssd_destroy () */
+} dev_ramssd_image_hdr_t;
+
+static void __ramssd_sync_image (dev_ramssd_info_t* ri)
+{
+	if (msync (ri->image_base, ri->image_len, MS_SYNC) != 0)
+		bdbm_warning ("msync () failed for '%s'", ri->np->ramssd_image);
+}
+
+static int __ramssd_sync_thread (void* arg)
+{
+	dev_ramssd_info_t* ri = (dev_ramssd_info_t*)arg;
+	uint32_t slept = 0;
+
+	while (!ri->sync_stop) {
+		bdbm_thread_msleep (RAMSSD_SYNC_POLL_MS);
+		if ((slept += RAMSSD_SYNC_POLL_MS) < ri->np->ramssd_sync_ms)
+			continue;
+		__ramssd_sync_image (ri);
+		slept = 0;
+	}
+
+	return 0;
+}
+
+/* NOTE: the image is shared with the page cache, so whatever was written
+ * survives a crash of this process; msync only matters for the system */
+static void* __ramssd_map_image (dev_ramssd_info_t* ri, uint64_t ssd_size_in_bytes)
 {
+	bdbm_device_params_t* np = ri->np;
+	dev_ramssd_image_hdr_t* hdr = NULL;
+	uint64_t len = RAMSSD_IMAGE_HDR_SIZE + ssd_size_in_bytes;
+	uint8_t* base = NULL;
+	uint8_t is_new;
+	struct stat st;
+	int fd;
+
+	if ((fd = open (np->ramssd_image, O_RDWR | O_CREAT, 0644)) < 0) {
+		bdbm_error ("open () failed for '%s'", np->ramssd_image);
+		return NULL;
+	}
+	if (fstat (fd, &st) != 0) {
+		bdbm_error ("fstat () failed for '%s'", np->ramssd_image);
+		goto fail;
+	}
+	is_new = (st.st_size == 0) ? 1 : 0;
+	if (is_new && ftruncate (fd, len) != 0) {
+		bdbm_error ("ftruncate () failed for '%s' (size=%llu)", np->ramssd_image, len);
+		goto fail;
+	}
+	if (!is_new && (uint64_t)st.st_size != len) {
+		bdbm_error ("'%s' has %llu bytes, but %llu are expected", 
+			np->ramssd_image, (uint64_t)st.st_size, len);
+		goto fail;
+	}
+	if ((base = (uint8_t*)mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		bdbm_error ("mmap () failed for '%s'", np->ramssd_image);
+		goto fail;
+	}
+
+	hdr = (dev_ramssd_image_hdr_t*)base;
+	if (is_new) {
+		/* a new image; all the pages are erased */
+		memset (base + RAMSSD_IMAGE_HDR_SIZE, 0xFF, ssd_size_in_bytes);
+		hdr->magic = RAMSSD_IMAGE_MAGIC;
+		hdr->nr_channels = np->nr_channels;
+		hdr->nr_chips_per_channel = np->nr_chips_per_channel;
+		hdr->nr_blocks_per_chip = np->nr_blocks_per_chip;
+		hdr->nr_pages_per_block = np->nr_pages_per_block;
+		hdr->page_main_size = np->page_main_size;
+		hdr->page_oob_size = np->page_oob_size;
+		hdr->page_size = dev_ramssd_get_page_size (ri);
+		bdbm_msg ("ramssd image '%s' is created", np->ramssd_image);
+	} else if (hdr->magic != RAMSSD_IMAGE_MAGIC ||
+			hdr->nr_channels != np->nr_channels ||
+			hdr->nr_chips_per_channel != np->nr_chips_per_channel ||
+			hdr->nr_blocks_per_chip != np->nr_blocks_per_chip ||
+			hdr->nr_pages_per_block != np->nr_pages_per_block ||
+			hdr->page_main_size != np->page_main_size ||
+			hdr->page_oob_size != np->page_oob_size ||
+			hdr->page_size != dev_ramssd_get_page_size (ri)) {
+		bdbm_error ("'%s' is not an image of this geometry", np->ramssd_image);
+		munmap (base, len);
+		goto fail;
+	} else if (hdr->clean == 0) {
+		bdbm_warning ("ramssd image '%s' was not closed cleanly", np->ramssd_image);
+	} else {
+		bdbm_msg ("ramssd image '%s' is mapped", np->ramssd_image);
+	}
+	hdr->clean = 0;
+	msync (base, RAMSSD_IMAGE_HDR_SIZE, MS_SYNC);
+
+	ri->image_fd = fd;
+	ri->image_base = base;
+	ri->image_len = len;
+
+	/* sync it periodically if asked to */
+	ri->sync_thread = NULL;
+	ri->sync_stop = 0;
+	if (np->ramssd_sync_ms > 0) {
+		if ((ri->sync_thread = bdbm_thread_create (
+				__ramssd_sync_thread, ri, "__ramssd_sync_thread")) == NULL) {
+			bdbm_warning ("bdbm_thread_create failed; the image is synced on store and close only");
+		} else {
+			bdbm_thread_run (ri->sync_thread);
+		}
+	}
+
+	return base + RAMSSD_IMAGE_HDR_SIZE;
+
+fail:
+	close (fd);
+	return NULL;
+}
+
+static void __ramssd_unmap_image (dev_ramssd_info_t* ri)
+{
+	if (ri->sync_thread) {
+		ri->sync_stop = 1;
+		bdbm_thread_stop (ri->sync_thread);
+	}
+
+	__ramssd_sync_image (ri);
+	((dev_ramssd_image_hdr_t*)ri->image_base)->clean = 1;
+	msync (ri->image_base, RAMSSD_IMAGE_HDR_SIZE, MS_SYNC);
+
+	munmap (ri->image_base, ri->image_len);
+	close (ri->image_fd);
+	ri->image_fd = -1;
+}
+#endif
+
+static void* __ramssd_alloc_ssdram (dev_ramssd_info_t* ri)
+{
+	bdbm_device_params_t* ptr_np = ri->np;
 	void* ptr_ramssd = NULL;
 	uint64_t page_size_in_bytes;
 	uint64_t nr_pages_in_ssd;
@@ -161,38 +326,62 @@ static void* __ramssd_alloc_ssdram (bdbm_device_params_t* ptr_np)
 		page_size_in_bytes;
 #endif
 
-	/* allocate the memory for the SSD */
-	if ((ptr_ramssd = (void*)bdbm_malloc
-			(ssd_size_in_bytes * sizeof (uint8_t))) == NULL) {
-		bdbm_error ("bdbm_malloc failed (size=%llu)", ssd_size_in_bytes * sizeof (uint8_t));
+#if defined (USER_MODE)
+	/* map a persistent image if one is given */
+	ri->image_fd = -1;
+	if (ptr_np->ramssd_image[0] != '\0' &&
+		(ptr_ramssd = __ramssd_map_image (ri, ssd_size_in_bytes)) == NULL) {
+		bdbm_error ("__ramssd_map_image failed");
 		return NULL;
 	}
-	bdbm_memset ((uint8_t*)ptr_ramssd, 0xFF, ssd_size_in_bytes * sizeof (uint8_t));
+#else
+	if (ptr_np->ramssd_image[0] != '\0')
+		bdbm_warning ("ramssd images are supported in user mode only; '%s' is ignored", 
+			ptr_np->ramssd_image);
+#endif
+
+	/* allocate the memory for the SSD */
+	if (ptr_ramssd == NULL) {
+		if ((ptr_ramssd = (void*)bdbm_malloc
+				(ssd_size_in_bytes * sizeof (uint8_t))) == NULL) {
+			bdbm_error ("bdbm_malloc failed (size=%llu)", ssd_size_in_bytes * sizeof (uint8_t));
+			return NULL;
+		}
+		bdbm_memset ((uint8_t*)ptr_ramssd, 0xFF, ssd_size_in_bytes * sizeof (uint8_t));
+	}
 
 	bdbm_msg ("ramssd addr = %p", ptr_ramssd);
 	bdbm_msg ("");
 
 #if defined (DATA_CHECK)
-	bdbm_msg ("*** building ptr_ramssd_data begins for data curruption checks...");
-	if ((__ptr_ramssd_data = (void*)bdbm_malloc	(ssd_size_in_bytes * sizeof (uint8_t))) == NULL) {
-		bdbm_warning ("bdbm_malloc () failed for ptr_ramssd_data");
+	bdbm_msg ("*** building ramssd_shadow begins for data curruption checks...");
+	if ((__ramssd_shadow = dev_ramssd_pstore_create (
+			ptr_np->device_capacity_in_byte / KPAGE_SIZE, KPAGE_SIZE)) == NULL) {
+		bdbm_warning ("dev_ramssd_pstore_create () failed for ramssd_shadow");
 	}
-	bdbm_memset ((uint8_t*)__ptr_ramssd_data, 0xFF, ssd_size_in_bytes * sizeof (uint8_t));
-	bdbm_msg ("*** building ptr_ramssd_data done");
+	bdbm_msg ("*** building ramssd_shadow done");
 #endif
 
 	/* good; return ramssd addr */
 	return (void*)ptr_ramssd;
 }
 
-static void __ramssd_free_ssdram (void* ptr_ramssd) 
+static void __ramssd_free_ssdram (dev_ramssd_info_t* ri) 
 {
 #if defined (DATA_CHECK)
-	if (__ptr_ramssd_data) {
-		bdbm_free (__ptr_ramssd_data);
+	if (__ramssd_shadow) {
+		dev_ramssd_pstore_display (__ramssd_shadow, "ramssd_shadow");
+		dev_ramssd_pstore_destroy (__ramssd_shadow);
+		__ramssd_shadow = NULL;
 	}
 #endif
-	bdbm_free (ptr_ramssd);
+#if defined (USER_MODE)
+	if (ri->image_fd >= 0) {
+		__ramssd_unmap_image (ri);
+		return;
+	}
+#endif
+	bdbm_free (ri->ptr_ssdram);
 }
 
 static uint8_t __ramssd_read_page (
@@ -210,9 +399,11 @@ static uint8_t __ramssd_read_page (
 {
 	uint8_t ret = 0;
 	uint8_t* ptr_ramssd_addr = NULL;
-#ifndef DUMMY_SSD
-	uint32_t nr_kpages;
+#if defined (DATA_CHECK)
+	uint8_t* ptr_data_org = NULL;
 #endif
+	uint32_t nr_kpages = ri->np->page_main_size / KERNEL_PAGE_SIZE;
+	uint64_t loop;
 
 	/* get the memory address for the destined page */
 	if ((ptr_ramssd_addr = __ramssd_page_addr (ri, channel_no, chip_no, block_no, page_no)) == NULL) {
@@ -222,7 +413,6 @@ static uint8_t __ramssd_read_page (
 	}
 #ifndef DUMMY_SSD
 	/* for better performance, RAMSSD directly copies the SSD data to kernel pages */
-	nr_kpages = ri->np->page_main_size / KERNEL_PAGE_SIZE;
 	if (ri->np->page_main_size % KERNEL_PAGE_SIZE != 0) {
 		bdbm_error ("The page-cache granularity (%lu) is not matched to the flash page size (%llu)", 
 			KERNEL_PAGE_SIZE, ri->np->page_main_size);
@@ -252,6 +442,19 @@ static uint8_t __ramssd_read_page (
 		);
 	}
 #else
+	/* copy the main page data from the page store */
+	if (ri->pstore) {
+		uint64_t slot = __ramssd_page_slot (ri, channel_no, chip_no, block_no, page_no);
+		for (loop = 0; loop < nr_kpages; loop++) {
+			if (partial == 1 && kp_stt[loop] == KP_STT_DATA) continue;
+			if (ri->np->nr_subpages_per_page != 1 && partial == 0 && kp_stt[loop] != KP_STT_DATA) continue;
+			if (dev_ramssd_pstore_read (ri->pstore, slot + loop, kp_ptr[loop]) != 0) {
+				ret = 1;
+				goto fail;
+			}
+		}
+	}
+
 	/* copy the OOB data to a buffer */
 	if (partial == 0 && oob && oob_data != NULL) {
 		bdbm_memcpy (oob_data, 
@@ -264,35 +467,37 @@ static uint8_t __ramssd_read_page (
 
 
 #if defined (DATA_CHECK)
-	if (ri->np->nr_subpages_per_page == 1) {
-		uint8_t* ptr_data_org = NULL;
+	if (__ramssd_shadow && (ptr_data_org = (uint8_t*)bdbm_malloc_atomic (KPAGE_SIZE)) == NULL) {
+		bdbm_warning ("bdbm_malloc_atomic failed; skip data checks");
+	} else if (__ramssd_shadow && ri->np->nr_subpages_per_page == 1) {
 		for (loop = 0; loop < nr_kpages; loop++) {
  			int64_t lpa = ((uint64_t*)oob_data)[0];
 			if (lpa < 0 || lpa == 0xffffffffffffffff) continue;
 			if (partial == 1 && kp_stt[loop] == KP_STT_DATA)	continue;
-			ptr_data_org = (uint8_t*)__get_ramssd_data_addr (ri, lpa);
-			if (memcmp (kp_ptr[loop], ptr_data_org+(loop*KPAGE_SIZE), KPAGE_SIZE) != 0) {
-				bdbm_msg ("[DATA CORRUPTION] lpa=%llu offset=%u type: %lld", lpa, loop, type);
+			dev_ramssd_pstore_read (__ramssd_shadow, __get_ramssd_data_slot (ri, lpa) + loop, ptr_data_org);
+			if (memcmp (kp_ptr[loop], ptr_data_org, KPAGE_SIZE) != 0) {
+				bdbm_msg ("[DATA CORRUPTION] lpa=%llu offset=%llu type: %lld", lpa, loop, type);
 				bdbm_msg ("ch: %lld, way: %lld, block =%llu page=%llu", channel_no, chip_no, block_no, page_no);
-				__display_hex_values (kp_ptr[loop], ptr_data_org+(loop*KPAGE_SIZE));
+				__display_hex_values (kp_ptr[loop], ptr_data_org);
 				//bdbm_bug_on(1);
 			}
 		}
-	} else {
-		uint8_t* ptr_data_org = NULL;
+	} else if (__ramssd_shadow) {
 		for (loop = 0; loop < nr_kpages; loop++) {
 			int64_t lpa = ((uint64_t*)oob_data)[loop];
 			if (lpa < 0 || lpa == 0xffffffffffffffff) continue;
 			if (partial == 1 && kp_stt[loop] == KP_STT_DATA) continue;
 			if (partial == 0 && kp_stt[loop] != KP_STT_DATA) continue;
-			ptr_data_org = (uint8_t*)__get_ramssd_data_addr (ri, lpa);
+			dev_ramssd_pstore_read (__ramssd_shadow, __get_ramssd_data_slot (ri, lpa), ptr_data_org);
 			if (memcmp (kp_ptr[loop], ptr_data_org, KPAGE_SIZE) != 0) {
-				bdbm_msg ("[READ DATA CORRUPTION] lpa=%llu offset=%u", lpa, loop);
+				bdbm_msg ("[READ DATA CORRUPTION] lpa=%llu offset=%llu", lpa, loop);
 				bdbm_msg ("   ch: %lld, way: %lld, block =%llu page=%llu, loop:%llu", channel_no, chip_no, block_no, page_no, loop);
 				__display_hex_values (kp_ptr[loop], ptr_data_org);
 			}
 		}
 	}
+	if (ptr_data_org)
+		bdbm_free_atomic (ptr_data_org);
 #endif
 
 fail:
@@ -312,9 +517,9 @@ static uint8_t __ramssd_prog_page (
 {
 	uint8_t ret = 0;
 	uint8_t* ptr_ramssd_addr = NULL;
-#ifndef DUMMY_SSD
-	uint32_t nr_kpages;
-#endif
+	uint32_t nr_kpages = ri->np->page_main_size / KERNEL_PAGE_SIZE;
+	uint64_t loop;
+
 	/* get the memory address for the destined page */
 	if ((ptr_ramssd_addr = __ramssd_page_addr (ri, channel_no, chip_no, block_no, page_no)) == NULL) {
 		bdbm_error ("invalid ram addr (%p)", ptr_ramssd_addr);
@@ -324,7 +529,6 @@ static uint8_t __ramssd_prog_page (
 
 #ifndef DUMMY_SSD
 	/* for better performance, RAMSSD directly copies the SSD data to pages */
-	nr_kpages = ri->np->page_main_size / KERNEL_PAGE_SIZE;
 	if (ri->np->page_main_size % KERNEL_PAGE_SIZE != 0) {
 		bdbm_error ("The page-cache granularity (%lu) is not matched to the flash page size (%llu)", 
 			KERNEL_PAGE_SIZE, ri->np->page_main_size);
@@ -355,6 +559,22 @@ static uint8_t __ramssd_prog_page (
 		);
 	}
 #else
+	/* keep the main page data in the page store */
+	if (ri->pstore) {
+		uint64_t slot = __ramssd_page_slot (ri, channel_no, chip_no, block_no, page_no);
+		for (loop = 0; loop < nr_kpages; loop++) {
+			if (ri->np->nr_subpages_per_page != 1) {
+				int64_t lpa = ((int64_t*)oob_data)[loop];
+				if (lpa < 0 || lpa == 0xffffffffffffffff) continue;
+				if (kp_stt[loop] != KP_STT_DATA) continue;
+			}
+			if (dev_ramssd_pstore_write (ri->pstore, slot + loop, kp_ptr[loop]) != 0) {
+				ret = 1;
+				goto fail;
+			}
+		}
+	}
+
 	/* copy the OOB data to a buffer */
 	if (oob && oob_data != NULL) {
 		bdbm_memcpy (
@@ -367,22 +587,18 @@ static uint8_t __ramssd_prog_page (
 
 
 #if defined (DATA_CHECK)
-	if (ri->np->nr_subpages_per_page == 1) {
-		uint8_t* ptr_data_org = NULL;
+	if (__ramssd_shadow && ri->np->nr_subpages_per_page == 1) {
 		for (loop = 0; loop < nr_kpages; loop++) {
 			int64_t lpa = ((int64_t*)oob_data)[0];
 			if (lpa < 0 || lpa == 0xffffffffffffffff) continue;
-			ptr_data_org = (uint8_t*)__get_ramssd_data_addr (ri, lpa);
-			bdbm_memcpy (ptr_data_org+(loop*KPAGE_SIZE), kp_ptr[loop], KPAGE_SIZE);
+			dev_ramssd_pstore_write (__ramssd_shadow, __get_ramssd_data_slot (ri, lpa) + loop, kp_ptr[loop]);
 		}
-	} else {
-		uint8_t* ptr_data_org = NULL;
+	} else if (__ramssd_shadow) {
 		for (loop = 0; loop < nr_kpages; loop++) {
 			int64_t lpa = ((int64_t*)oob_data)[loop];
 			if (lpa < 0 || lpa == 0xffffffffffffffff) continue;
 			if (kp_stt[loop] != KP_STT_DATA) continue;
-			ptr_data_org = (uint8_t*)__get_ramssd_data_addr (ri, lpa);
-			bdbm_memcpy (ptr_data_org, kp_ptr[loop], KPAGE_SIZE);
+			dev_ramssd_pstore_write (__ramssd_shadow, __get_ramssd_data_slot (ri, lpa), kp_ptr[loop]);
 		}
 	}
 #endif
@@ -409,6 +625,13 @@ static uint8_t __ramssd_erase_block (
 	/* erase the block (set all the values to '1') */
 	//memset (ptr_ram_addr, 0xFF, dev_ramssd_get_block_size (ri));
 
+	/* erased units read as 0xFF and take no space in the page store */
+	if (ri->pstore) {
+		dev_ramssd_pstore_erase (ri->pstore,
+			__ramssd_page_slot (ri, channel_no, chip_no, block_no, 0),
+			ri->np->nr_pages_per_block * (ri->np->page_main_size / KPAGE_SIZE));
+	}
+
 	return 0;
 }
 
@@ -496,14 +719,222 @@ static uint32_t __ramssd_send_cmd (
 	return ret;
 }
 
+/* the clock the completion heap runs on: the virtual clock if it is used,
+ * otherwise a monotonic wall clock */
+static int64_t __ramssd_clock_us (dev_ramssd_info_t* ri)
+{
+#if defined (KERNEL_MODE)
+	if (ri->use_vclock)
+		return bdbm_vclock_get_us ();
+	return ktime_to_us (ktime_get ());
+#else
+	struct timespec ts;
+
+	if (ri->use_vclock)
+		return bdbm_vclock_get_us ();
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/* a binary min-heap of the busy punits ordered by the time their current
+ * command (or its current phase) completes; it must be called with
+ * ramssd_lock held */
+static void __ramssd_timer_swap (dev_ramssd_info_t* ri, int64_t i, int64_t j)
+{
+	dev_ramssd_timer_t t = ri->timers[i];
+
+	ri->timers[i] = ri->timers[j];
+	ri->timers[j] = t;
+	ri->timer_pos[ri->timers[i].punit_id] = i;
+	ri->timer_pos[ri->timers[j].punit_id] = j;
+}
+
+static void __ramssd_timer_up (dev_ramssd_info_t* ri, int64_t i)
+{
+	while (i > 0 && ri->timers[(i - 1) / 2].due_us > ri->timers[i].due_us) {
+		__ramssd_timer_swap (ri, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void __ramssd_timer_down (dev_ramssd_info_t* ri, int64_t i)
+{
+	for (;;) {
+		int64_t l = 2 * i + 1, r = 2 * i + 2, min = i;
+
+		if (l < ri->nr_timers && ri->timers[l].due_us < ri->timers[min].due_us)
+			min = l;
+		if (r < ri->nr_timers && ri->timers[r].due_us < ri->timers[min].due_us)
+			min = r;
+		if (min == i)
+			break;
+		__ramssd_timer_swap (ri, i, min);
+		i = min;
+	}
+}
+
+static void __ramssd_timer_disarm (dev_ramssd_info_t* ri, uint64_t punit_id)
+{
+	int64_t i = ri->timer_pos[punit_id];
+
+	if (i < 0)
+		return;
+	ri->timer_pos[punit_id] = -1;
+	if (i != --ri->nr_timers) {
+		ri->timers[i] = ri->timers[ri->nr_timers];
+		ri->timer_pos[ri->timers[i].punit_id] = i;
+		__ramssd_timer_up (ri, i);
+		__ramssd_timer_down (ri, ri->timer_pos[ri->timers[i].punit_id]);
+	}
+}
+
+/* returns 1 if the punit has become the earliest one to complete */
+static uint8_t __ramssd_timer_arm (dev_ramssd_info_t* ri, uint64_t punit_id)
+{
+	dev_ramssd_punit_t* punit = &ri->ptr_punits[punit_id];
+	int64_t remaining_us, i;
+
+	if (punit->ptr_req == NULL) {
+		__ramssd_timer_disarm (ri, punit_id);
+		return 0;
+	}
+
+	remaining_us = punit->target_elapsed_time_us - bdbm_stopwatch_get_elapsed_time_us (&punit->sw);
+	if ((i = ri->timer_pos[punit_id]) < 0) {
+		i = ri->nr_timers++;
+		ri->timers[i].punit_id = punit_id;
+		ri->timer_pos[punit_id] = i;
+	}
+	ri->timers[i].due_us = __ramssd_clock_us (ri) + ((remaining_us > 0) ? remaining_us : 0);
+	__ramssd_timer_up (ri, i);
+	__ramssd_timer_down (ri, ri->timer_pos[punit_id]);
+
+	return (ri->timer_pos[punit_id] == 0) ? 1 : 0;
+}
+
+#ifdef DYNAMIC_DMA
+/* mark a channel busy and pick the DMA time by the # of busy channels */
+static uint64_t __ramssd_dma_level (dev_ramssd_info_t* ri, uint64_t channel_no)
+{
+	uint64_t ch, count = 0;
+
+	if (ri->is_busy[channel_no] == 0)
+		ri->is_busy[channel_no] = 1;
+
+	for (ch = 0; ch < ri->np->nr_channels; ch++) {
+		if (ri->is_busy[ch] != 0)
+			count++;
+	}
+
+	return (count < BDBM_NR_DMA_LEVELS) ? count : BDBM_NR_DMA_LEVELS - 1;
+}
+#endif
+
+/* returns 1 if the punit is still busy with ptr_req */
+static uint32_t __ramssd_punit_cmd_done (dev_ramssd_info_t* ri, uint64_t loop)
+{
+	dev_ramssd_punit_t* punit = &ri->ptr_punits[loop];
+	int64_t elapsed_time_in_us;
+
+	bdbm_spin_lock (&ri->ramssd_lock);
+	if (punit->ptr_req == NULL) {
+		__ramssd_timer_disarm (ri, loop);
+		bdbm_spin_unlock (&ri->ramssd_lock);
+		return 0;
+	}
+
+	elapsed_time_in_us = bdbm_stopwatch_get_elapsed_time_us (&punit->sw);
+
+	if (elapsed_time_in_us >= punit->target_elapsed_time_us) 
+	{
+		void* ptr_req = punit->ptr_req;
+
+		if (punit->dma_reflected != 0)
+		{
+			// program, erase and after DMA for read request.
+			punit->ptr_req = NULL;
+			if (punit->ptr_suspended_req != NULL)
+			{
+				// the read is done; resume the suspended program/erase.
+				punit->ptr_req = punit->ptr_suspended_req;
+				punit->ptr_suspended_req = NULL;
+				punit->dma_reflected = 1;
+				bdbm_stopwatch_start (&punit->sw);
+				punit->target_elapsed_time_us = punit->suspended_remaining_us + ri->np->resume_time_us;
+			}
+			__ramssd_timer_arm (ri, loop);
+			bdbm_spin_unlock (&ri->ramssd_lock);
+			
+			/* call the interrupt handler */
+			ri->intr_handler (ptr_req);
+			bdbm_vclock_complete ();
+		}
+		else
+		{
+			// read operation after tR done.
+			int64_t count = 0;
+			bdbm_llm_req_t* req_ptr = (bdbm_llm_req_t*)(punit->ptr_req);
+			int64_t dma = req_ptr->dma + punit->mp_dma;	// fused reads share tR, not DMA.
+			int64_t dma_time_us = ri->np->read_dma_time_us[count] * dma;
+			dev_ramssd_channel_t* ptr_channels = ri->ptr_channels + req_ptr->phyaddr.channel_no;
+
+			if (dma != 0)
+			{					
+#ifdef DYNAMIC_DMA
+				count = __ramssd_dma_level (ri, req_ptr->phyaddr.channel_no);
+#endif
+				dma_time_us = ri->np->read_dma_time_us[count] * dma;
+			}
+				
+			elapsed_time_in_us = bdbm_stopwatch_get_elapsed_time_us (&(ptr_channels->sw));
+			if (elapsed_time_in_us >= ptr_channels->target_elapsed_time_us)
+			{	// channel is idle.
+				// start time update.
+				bdbm_stopwatch_start (&(ptr_channels->sw));
+				ptr_channels->target_elapsed_time_us = dma_time_us;
+			}
+			else
+			{	// channel is busy - busy time will be accumulated.
+				ptr_channels->target_elapsed_time_us += dma_time_us;
+				dma_time_us = (ptr_channels->target_elapsed_time_us - elapsed_time_in_us);
+			}
+
+			punit->target_elapsed_time_us = dma_time_us;
+			punit->dma_reflected = 1;
+			__ramssd_timer_arm (ri, loop);
+			
+			bdbm_spin_unlock (&ri->ramssd_lock);
+		}
+	} 
+	else 
+	{
+		__ramssd_timer_arm (ri, loop);
+		bdbm_spin_unlock (&ri->ramssd_lock);
+	}
+
+	return 1;
+}
+
+static void __ramssd_channel_check (dev_ramssd_info_t* ri, uint64_t channel)
+{
+	if (ri->is_busy[channel] != 0)
+	{
+		uint64_t elapsed_time_in_us = bdbm_stopwatch_get_elapsed_time_us(&(ri->ptr_channels[channel].sw));
+		if (elapsed_time_in_us >= ri->ptr_channels[channel].target_elapsed_time_us)
+		{
+			ri->is_busy[channel] = 0;
+			//atomic_dec(&ri->busy_channel);
+		}
+	}
+}
+
 void __ramssd_cmd_done (dev_ramssd_info_t* ri)
 {
-	uint64_t loop, nr_parallel_units;
 	uint64_t nr_channels, nr_ways;
 	uint64_t channel, way;
 	uint32_t check;
 
-	nr_parallel_units = dev_ramssd_get_chips_per_ssd (ri);
 	nr_channels = dev_ramssd_get_channles_per_ssd(ri);
 	nr_ways = dev_ramssd_get_chips_per_channel(ri);
 
@@ -512,109 +943,151 @@ void __ramssd_cmd_done (dev_ramssd_info_t* ri)
 		check = 0;
 		for (way = 0; way < nr_ways; way++)
 		{
-			loop = channel*nr_ways + way;
+			if (__ramssd_punit_cmd_done (ri, channel*nr_ways + way))
+				check = 1;
+		}
+		
+		if (check != 0)
+			__ramssd_channel_check (ri, channel);
+	}
+}
 
-			bdbm_spin_lock (&ri->ramssd_lock);
-			if (ri->ptr_punits[loop].ptr_req != NULL) 
-			{
-				dev_ramssd_punit_t* punit;
-				int64_t elapsed_time_in_us;
-
-				punit = &ri->ptr_punits[loop];
-				elapsed_time_in_us = bdbm_stopwatch_get_elapsed_time_us (&punit->sw);
-
-				if (elapsed_time_in_us >= punit->target_elapsed_time_us) 
-				{
-					void* ptr_req = punit->ptr_req;
-
-					if (punit->dma_reflected != 0)
-					{
-						// program, erase and after DMA for read request.
-						punit->ptr_req = NULL;
-						bdbm_spin_unlock (&ri->ramssd_lock);
-						
-						/* call the interrupt handler */
-						ri->intr_handler (ptr_req);
-					}
-					else
-					{
-						// read operation after tR done.
-						int64_t count = 0;
-						bdbm_llm_req_t* req_ptr = (bdbm_llm_req_t*)(ri->ptr_punits[loop].ptr_req);
-						int64_t dma_time_us = ri->np->read_dma_time_us[count] * req_ptr->dma;
-						dev_ramssd_channel_t* ptr_channels = ri->ptr_channels + req_ptr->phyaddr.channel_no;
-
-						if (req_ptr->dma != 0)
-						{					
-#ifdef DYNAMIC_DMA
-							int64_t ch;
-							// check the channel busy time
-							if (ri->is_busy[req_ptr->phyaddr.channel_no] == 0)
-							{
-								ri->is_busy[req_ptr->phyaddr.channel_no] = 1;
-								//atomic_inc(&ri->busy_channel);
-							}
-
-							for (ch = 0; ch < 8; ch++)
-							{
-								if (ri->is_busy[ch] != 0)
-								{
-									count++;
-								}
-							}
-#endif
-							dma_time_us = ri->np->read_dma_time_us[count] * req_ptr->dma;
-						}
-							
-						elapsed_time_in_us = bdbm_stopwatch_get_elapsed_time_us (&(ptr_channels->sw));
-						if (elapsed_time_in_us >= ptr_channels->target_elapsed_time_us)
-						{	// channel is idle.
-							// start time update.
-							bdbm_stopwatch_start (&(ptr_channels->sw));
-							ptr_channels->target_elapsed_time_us = dma_time_us;
-						}
-						else
-						{	// channel is busy - busy time will be accumulated.
-							ptr_channels->target_elapsed_time_us += dma_time_us;
-							dma_time_us = (ptr_channels->target_elapsed_time_us - elapsed_time_in_us);
-						}
-
-						punit->target_elapsed_time_us = dma_time_us;
-						punit->dma_reflected = 1;
-						
-						bdbm_spin_unlock (&ri->ramssd_lock);
-					}
-				} 
-				else 
-				{
-					bdbm_spin_unlock (&ri->ramssd_lock);
-				}
+/* completes the commands due by now without scanning all the punits;
+ * returns the time the next one is due, or -1 if all the punits are idle */
+static int64_t __ramssd_timer_run (dev_ramssd_info_t* ri)
+{
+	int64_t next = -1;
 
-				check = 1;
-			} else {
-				bdbm_spin_unlock (&ri->ramssd_lock);
+	for (;;) {
+		uint64_t punit_id;
+
+		bdbm_spin_lock (&ri->ramssd_lock);
+		if (ri->nr_timers == 0) {
+			next = -1;
+			bdbm_spin_unlock (&ri->ramssd_lock);
+			break;
+		}
+		if ((next = ri->timers[0].due_us) > __ramssd_clock_us (ri)) {
+			bdbm_spin_unlock (&ri->ramssd_lock);
+			break;
+		}
+		punit_id = ri->timers[0].punit_id;
+		__ramssd_timer_disarm (ri, punit_id);
+		bdbm_spin_unlock (&ri->ramssd_lock);
+
+		/* it re-arms the timer if the punit is still busy */
+		__ramssd_punit_cmd_done (ri, punit_id);
+		__ramssd_channel_check (ri, punit_id / dev_ramssd_get_chips_per_channel (ri));
+	}
+
+	return next;
+}
+
+/* how late the kernel may wake the timer thread up (default: 50 us) */
+#define RAMSSD_TIMER_SLACK_NS	1000
+
+/* returns the virtual time of the next completion, or -1 if all the punits
+ * are idle */
+static int64_t __ramssd_vclock_next_event (dev_ramssd_info_t* ri)
+{
+	int64_t next = -1;
+
+	bdbm_spin_lock (&ri->ramssd_lock);
+	if (ri->nr_timers > 0)
+		next = ri->timers[0].due_us;
+	bdbm_spin_unlock (&ri->ramssd_lock);
+
+	return next;
+}
+
+/* NOTE: on the virtual clock, the host and the ftl take no time; the clock
+ * jumps to the next completion once every issuer is blocked on the device
+ * or idle (see bdbm_vclock_hold ()), i.e., once the reqs that the last
+ * completions unblocked have reached the device. The host is only waited
+ * for RAMSSD_VCLOCK_HOST_US after its reqs complete */
+#define RAMSSD_VCLOCK_HOST_US	50
+
+/* returns 1 if a punit is still busy */
+static uint8_t __ramssd_vclock_step (dev_ramssd_info_t* ri)
+{
+	int64_t next;
+
+	__ramssd_timer_run (ri);
+
+	if ((next = __ramssd_vclock_next_event (ri)) < 0)
+		return 0;
+	if (next <= bdbm_vclock_get_us ())
+		return 1;	/* e.g., a read moving from tR to DMA */
+	if (bdbm_vclock_is_held () || bdbm_vclock_host_is_pending (RAMSSD_VCLOCK_HOST_US))
+		return 1;
+
+	bdbm_vclock_advance_to (next);
+	ri->nr_vclock_events++;
+	__ramssd_timer_run (ri);
+
+	return 1;
+}
+
+#if defined (USER_MODE)
+static void __ramssd_timer_kick (dev_ramssd_info_t* ri)
+{
+	pthread_mutex_lock (&ri->timer_mutex);
+	ri->timer_kick = 1;
+	pthread_cond_signal (&ri->timer_cond);
+	pthread_mutex_unlock (&ri->timer_mutex);
+}
+
+/* NOTE: it sleeps until the earliest completion (or, on the virtual clock,
+ * until a command comes in) and is kicked when an earlier one is armed */
+static int __ramssd_timer_thread (void* arg)
+{
+	dev_ramssd_info_t* ri = (dev_ramssd_info_t*)arg;
+
+	prctl (PR_SET_TIMERSLACK, RAMSSD_TIMER_SLACK_NS);
+
+	while (!ri->timer_stop) {
+		int64_t next;
+
+		if (ri->use_vclock) {
+			if (__ramssd_vclock_step (ri)) {
+				bdbm_thread_yield ();
+				continue;
 			}
+			next = -1;
+		} else {
+			next = __ramssd_timer_run (ri);
 		}
-		
-		if ((check != 0) && (ri->is_busy[channel] != 0))
-		{
-			uint64_t elapsed_time_in_us = bdbm_stopwatch_get_elapsed_time_us(&(ri->ptr_channels[channel].sw));
-			if (elapsed_time_in_us >= ri->ptr_channels[channel].target_elapsed_time_us)
-			{
-				ri->is_busy[channel] = 0;
-				//atomic_dec(&ri->busy_channel);
+
+		pthread_mutex_lock (&ri->timer_mutex);
+		if (!ri->timer_kick && !ri->timer_stop) {
+			if (next < 0) {
+				pthread_cond_wait (&ri->timer_cond, &ri->timer_mutex);
+			} else {
+				struct timespec ts;
+
+				ts.tv_sec = next / 1000000;
+				ts.tv_nsec = (next % 1000000) * 1000;
+				pthread_cond_timedwait (&ri->timer_cond, &ri->timer_mutex, &ts);
 			}
 		}
+		ri->timer_kick = 0;
+		pthread_mutex_unlock (&ri->timer_mutex);
 	}
-}
 
+	return 0;
+}
+#endif
 
 #if defined (KERNEL_MODE)
 static void __dev_ramssd_fops_wq_handler (struct work_struct *w)
 {
 	dev_ramssd_wq_t* work = (dev_ramssd_wq_t*)w;
+	dev_ramssd_info_t* ri = (dev_ramssd_info_t*)work->ri;
 
-	__ramssd_cmd_done ((dev_ramssd_info_t*)work->ri);
+	if (ri->use_vclock)
+		__ramssd_vclock_step (ri);
+	else
+		__ramssd_timer_run (ri);
 }
 
 static enum hrtimer_restart __ramssd_timing_hrtimer_cmd_done (struct hrtimer *ptr_hrtimer)
@@ -641,10 +1114,9 @@ uint32_t __ramssd_timing_register_schedule (dev_ramssd_info_t* ri)
 	case DEVICE_TYPE_USER_RAMDRIVE:
 		__ramssd_cmd_done (ri);
 		break;
-#if defined (KERNEL_MODE)
 	case DEVICE_TYPE_RAMDRIVE_TIMING:
+		/* the hrtimer (kernel) or the timer thread (user) completes it */
 		break;
-#endif
 	default:
 		__ramssd_cmd_done (ri);
 		break;
@@ -657,52 +1129,101 @@ uint32_t __ramssd_timing_create (dev_ramssd_info_t* ri)
 {
 	uint32_t ret = 0;
 
+	ri->nr_vclock_events = 0;
+	if (ri->use_vclock)
+		bdbm_vclock_enable ();
+
 	switch (ri->emul_mode) {
 	case DEVICE_TYPE_RAMDRIVE:
 	case DEVICE_TYPE_USER_RAMDRIVE:
 		break;
-#if defined (KERNEL_MODE)
 	case DEVICE_TYPE_RAMDRIVE_TIMING: 
+#if defined (KERNEL_MODE)
 		{
-			/* create a timer */
 			ktime_t ktime;
+
+			/* create wq; the timer queues work on it as soon as it fires */
+			if ((ri->wq = create_singlethread_workqueue ("bdbm_ramssd_wq")) == NULL) {
+				bdbm_error ("create_singlethread_workqueue failed");
+				ret = 1;
+				break;
+			}
+			ri->works.ri = (void*)ri;
+			INIT_WORK (&ri->works.work, __dev_ramssd_fops_wq_handler);
+
+			/* create a timer */
 			hrtimer_init (&ri->hrtimer, CLOCK_REALTIME, HRTIMER_MODE_REL);
 			ri->hrtimer.function = __ramssd_timing_hrtimer_cmd_done;
 			ktime = ktime_set (0, 500 * 1000);
 			hrtimer_start (&ri->hrtimer, ktime, HRTIMER_MODE_REL);
-
-			/* create wq */
-			ri->wq = create_singlethread_workqueue ("bdbm_ramssd_wq");
-			ri->works.ri = (void*)ri;
-			INIT_WORK (&ri->works.work, __dev_ramssd_fops_wq_handler);
 		}
-		break;
+#else
+		{
+			/* create a timer thread; its deadlines are on CLOCK_MONOTONIC */
+			pthread_condattr_t attr;
+
+			pthread_mutex_init (&ri->timer_mutex, NULL);
+			pthread_condattr_init (&attr);
+			pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+			pthread_cond_init (&ri->timer_cond, &attr);
+			pthread_condattr_destroy (&attr);
+			ri->timer_kick = 0;
+			ri->timer_stop = 0;
+
+			if ((ri->timer_thread = bdbm_thread_create (
+					__ramssd_timer_thread, ri, "__ramssd_timer_thread")) == NULL) {
+				bdbm_error ("bdbm_thread_create failed");
+				pthread_cond_destroy (&ri->timer_cond);
+				pthread_mutex_destroy (&ri->timer_mutex);
+				ret = 1;
+				break;
+			}
+			bdbm_thread_run (ri->timer_thread);
+		}
 #endif
+		break;
 	default:
 		bdbm_error ("invalid timing mode: %d", ri->emul_mode);
 		ret = 1;
 		break;
 	}
 
+	if (ret != 0 && ri->use_vclock)
+		bdbm_vclock_disable ();
+
 	return ret;
 }
 
 void __ramssd_timing_destory (dev_ramssd_info_t* ri)
 {
+	if (ri->use_vclock) {
+		bdbm_msg ("virtual clock = %lld us (%llu events)", 
+			bdbm_vclock_get_us (), ri->nr_vclock_events);
+	}
+
 	switch (ri->emul_mode) {
 	case DEVICE_TYPE_RAMDRIVE:
 	case DEVICE_TYPE_USER_RAMDRIVE:
 		break;
-#if defined (KERNEL_MODE)
 	case DEVICE_TYPE_RAMDRIVE_TIMING:
+#if defined (KERNEL_MODE)
 		hrtimer_cancel (&ri->hrtimer);
 		if (ri->wq) 
 			destroy_workqueue (ri->wq);
-		break;
+#else
+		ri->timer_stop = 1;
+		__ramssd_timer_kick (ri);
+		bdbm_thread_stop (ri->timer_thread);
+		pthread_cond_destroy (&ri->timer_cond);
+		pthread_mutex_destroy (&ri->timer_mutex);
 #endif
+		break;
 	default:
 		break;
 	}
+
+	if (ri->use_vclock)
+		bdbm_vclock_disable ();
 }
 
 /* Functions Exposed to External Files */
@@ -724,14 +1245,46 @@ dev_ramssd_info_t* dev_ramssd_create (
 	ri->intr_handler = intr_handler;
 	ri->emul_mode = ptr_np->device_type;
 	ri->np = ptr_np;
+	ri->use_vclock = (ri->emul_mode == DEVICE_TYPE_RAMDRIVE_TIMING && ptr_np->virtual_clock) ? 1 : 0;
+
+	/* create spin_lock; the timer thread takes it as soon as it runs */
+	bdbm_spin_lock_init (&ri->ramssd_lock);
 
 	/* allocate ssdram space */
 	if ((ri->ptr_ssdram = 
-			__ramssd_alloc_ssdram (ri->np)) == NULL) {
+			__ramssd_alloc_ssdram (ri)) == NULL) {
 		bdbm_error ("__ramssd_alloc_ssdram failed");
 		goto fail_ssdram;
 	}
 
+	/* create a page store for the main data */
+	ri->pstore = NULL;
+	if (ptr_np->page_store) {
+#ifdef DUMMY_SSD
+		if (ptr_np->page_main_size % KPAGE_SIZE != 0) {
+			bdbm_error ("the page size (%llu) is not a multiple of the kernel page size", 
+				ptr_np->page_main_size);
+			goto fail_pstore;
+		}
+		if ((ri->pstore = dev_ramssd_pstore_create (
+				dev_ramssd_get_pages_per_ssd (ri) * (ptr_np->page_main_size / KPAGE_SIZE),
+				KPAGE_SIZE)) == NULL) {
+			bdbm_error ("dev_ramssd_pstore_create failed");
+			goto fail_pstore;
+		}
+#else
+		bdbm_warning ("the page store is ignored; ramssd keeps all the page data");
+#endif
+		if (ptr_np->ramssd_image[0] != '\0')
+			bdbm_warning ("the page store is not part of the ramssd image");
+	}
+#if defined (DUMMY_SSD) && defined (DATA_CHECK)
+	if (ri->pstore == NULL) {
+		bdbm_error ("data check on dummy ssd needs the page store");
+		goto fail_pstore;
+	}
+#endif
+
 	/* create parallel units */
 	nr_parallel_units = dev_ramssd_get_chips_per_ssd (ri);
 
@@ -742,14 +1295,33 @@ dev_ramssd_info_t* dev_ramssd_create (
 	}
 	for (loop = 0; loop < nr_parallel_units; loop++) {
 		ri->ptr_punits[loop].ptr_req = NULL;
+		ri->ptr_punits[loop].dma_reflected = 0;
+		ri->ptr_punits[loop].target_elapsed_time_us = 0;
+		ri->ptr_punits[loop].mp_dma = 0;
+		ri->ptr_punits[loop].ptr_suspended_req = NULL;
+		ri->ptr_punits[loop].suspended_remaining_us = 0;
 	}
 
+	/* create a completion heap */
+	if ((ri->timers = (dev_ramssd_timer_t*)
+			bdbm_malloc_atomic (sizeof (dev_ramssd_timer_t) * nr_parallel_units)) == NULL ||
+		(ri->timer_pos = (int64_t*)
+			bdbm_malloc_atomic (sizeof (int64_t) * nr_parallel_units)) == NULL) {
+		bdbm_error ("bdbm_malloc_atomic failed");
+		goto fail_timers;
+	}
+	for (loop = 0; loop < nr_parallel_units; loop++)
+		ri->timer_pos[loop] = -1;
+	ri->nr_timers = 0;
+
 #ifdef DWHONG
 	/* create channel busy checker */
 	if ((ri->ptr_channels = (dev_ramssd_channel_t*)
-			bdbm_malloc_atomic (sizeof (dev_ramssd_channel_t) * ri->np->nr_channels)) == NULL) {
+			bdbm_malloc_atomic (sizeof (dev_ramssd_channel_t) * ri->np->nr_channels)) == NULL ||
+		(ri->is_busy = (uint32_t*)
+			bdbm_malloc_atomic (sizeof (uint32_t) * ri->np->nr_channels)) == NULL) {
 		bdbm_error ("bdbm_malloc_atomic failed");
-		goto fail_punits;
+		goto fail_channels;
 	}
 
 	for (loop = 0; loop < ri->np->nr_channels; loop++) {
@@ -762,25 +1334,38 @@ dev_ramssd_info_t* dev_ramssd_create (
 	atomic_set(&ri->busy_channel,0);
 #endif
 
-	/* create and register a tasklet */
+	/* create and register a tasklet; everything the timer uses must be
+	 * set up by now */
 	if (__ramssd_timing_create (ri) != 0) {
 		bdbm_error ("__ramssd_timing_create () failed");
 		goto fail_timing;
 	}
 
-	/* create spin_lock */
-	bdbm_spin_lock_init (&ri->ramssd_lock);
-
 	/* done */
 	ri->is_init = 1;
 
 	return ri;
 
 fail_timing:
+#ifdef DWHONG
+fail_channels:
+	if (ri->is_busy)
+		bdbm_free_atomic (ri->is_busy);
+	if (ri->ptr_channels)
+		bdbm_free_atomic (ri->ptr_channels);
+#endif
+	bdbm_free_atomic (ri->timer_pos);
+
+fail_timers:
+	if (ri->timers)
+		bdbm_free_atomic (ri->timers);
 	bdbm_free_atomic (ri->ptr_punits);
 
 fail_punits:
-	__ramssd_free_ssdram (ri->ptr_ssdram);
+	dev_ramssd_pstore_destroy (ri->pstore);
+
+fail_pstore:
+	__ramssd_free_ssdram (ri);
 
 fail_ssdram:
 	bdbm_free_atomic (ri);
@@ -795,18 +1380,61 @@ void dev_ramssd_destroy (dev_ramssd_info_t* ri)
 	__ramssd_timing_destory (ri);
 
 	/* free ssdram */
-	__ramssd_free_ssdram (ri->ptr_ssdram);
+	if (ri->pstore) {
+		dev_ramssd_pstore_display (ri->pstore, "page store");
+		dev_ramssd_pstore_destroy (ri->pstore);
+	}
+	__ramssd_free_ssdram (ri);
 
 	/* release other stuff */
+#ifdef DWHONG
+	bdbm_free_atomic (ri->is_busy);
+	bdbm_free_atomic (ri->ptr_channels);
+#endif
+	bdbm_free_atomic (ri->timer_pos);
+	bdbm_free_atomic (ri->timers);
 	bdbm_free_atomic (ri->ptr_punits);
 	bdbm_free_atomic (ri);
 }
 
+/* NOTE: a read may only suspend a program or an erase, and only one at a
+ * time; the caller (i.e., llm) decides how often it does so */
+static uint8_t __ramssd_can_suspend (
+	dev_ramssd_info_t* ri, 
+	dev_ramssd_punit_t* punit, 
+	bdbm_llm_req_t* r)
+{
+	bdbm_llm_req_t* cur = (bdbm_llm_req_t*)punit->ptr_req;
+
+	if (ri->emul_mode != DEVICE_TYPE_RAMDRIVE_TIMING)
+		return 0;
+	if (!bdbm_is_read (r->req_type) || punit->ptr_suspended_req != NULL)
+		return 0;
+	if (!bdbm_is_write (cur->req_type) && !bdbm_is_erase (cur->req_type))
+		return 0;
+	return 1;
+}
+
 uint32_t dev_ramssd_send_cmd (dev_ramssd_info_t* ri, bdbm_llm_req_t* r)
 {
 	uint32_t ret;
+	bdbm_llm_req_t* f;
+	int64_t mp_dma = 0;
+
+	ret = __ramssd_send_cmd (ri, r);
+
+	/* reqs fused into r by the llm complete together with r; reads to
+	 * other planes share r's tR, and programs/erases are run back to back */
+	for (f = (bdbm_llm_req_t*)r->ptr_mp_next; ret == 0 && f != NULL; f = (bdbm_llm_req_t*)f->ptr_mp_next) {
+		ret = __ramssd_send_cmd (ri, f);
+		if (bdbm_is_read (f->req_type))
+			mp_dma += f->dma;
+	}
 
-	if ((ret = __ramssd_send_cmd (ri, r)) == 0) {
+	if (ret == 0) {
+		dev_ramssd_punit_t* punit;
+		uint8_t earliest;
+		int32_t dma_reflected;
 		int64_t target_elapsed_time_us = 0;
 		uint64_t punit_id = r->phyaddr.punit_id;
 		int64_t dma_time_us = 0;
@@ -816,7 +1444,6 @@ uint32_t dev_ramssd_send_cmd (dev_ramssd_info_t* ri, bdbm_llm_req_t* r)
 		if (ri->emul_mode == DEVICE_TYPE_RAMDRIVE_TIMING) {
 			dev_ramssd_channel_t* ptr_channels; 
 			uint64_t count = 0;
-			uint64_t ch;
 			uint64_t dma_count = ri->np->nr_subpages_per_page * ri->np->nr_planes;
 
 			switch (r->req_type) {
@@ -827,20 +1454,7 @@ uint32_t dev_ramssd_send_cmd (dev_ramssd_info_t* ri, bdbm_llm_req_t* r)
 			case REQTYPE_META_WRITE:
 
 #ifdef DYNAMIC_DMA
-				// check the channel busy time
-				if (ri->is_busy[r->phyaddr.channel_no] == 0)
-				{
-					ri->is_busy[r->phyaddr.channel_no] = 1;
-					//atomic_inc(&ri->busy_channel);
-				}
-				
-				for (ch = 0; ch < 8; ch++)
-				{
-					if (ri->is_busy[ch] != 0)
-					{
-						count++;
-					}
-				}
+				count = __ramssd_dma_level (ri, r->phyaddr.channel_no);
 #endif
 				dma_time_us = ri->np->prog_dma_time_us[count] * dma_count;
 				
@@ -861,15 +1475,8 @@ uint32_t dev_ramssd_send_cmd (dev_ramssd_info_t* ri, bdbm_llm_req_t* r)
 				//channel busy time + NAND Operation.
 				target_elapsed_time_us = dma_time_us;
 
-				#define NR_PAGE_PER_WORDLINE  (2)
-				if (r->phyaddr.page_no % NR_PAGE_PER_WORDLINE)
-				{	// LSB page
-					target_elapsed_time_us += ri->np->page_lsb_prog_time_us;
-				}
-				else
-				{	// MSB.
-					target_elapsed_time_us += ri->np->page_msb_prog_time_us;
-				}
+				// the program time depends on the page type (LSB/CSB/MSB...)
+				target_elapsed_time_us += ri->np->page_type_prog_time_us[r->phyaddr.page_no % ri->np->nr_page_types];
 
 				break;
 
@@ -877,7 +1484,7 @@ uint32_t dev_ramssd_send_cmd (dev_ramssd_info_t* ri, bdbm_llm_req_t* r)
 			case REQTYPE_READ:
 			case REQTYPE_RMW_READ:
 			case REQTYPE_META_READ:
-				target_elapsed_time_us = ri->np->page_read_time_us;
+				target_elapsed_time_us = ri->np->page_type_read_time_us[r->phyaddr.page_no % ri->np->nr_page_types];
 				break;
 				
 			case REQTYPE_GC_ERASE:
@@ -893,20 +1500,59 @@ uint32_t dev_ramssd_send_cmd (dev_ramssd_info_t* ri, bdbm_llm_req_t* r)
 				break;
 			}
 
-			ri->ptr_punits[punit_id].dma_reflected = (bdbm_is_read (r->req_type)) ? 0 : 1;
+			/* batched programs (cache program): the data of the next page is
+			 * transferred while the previous one is being programmed */
+			for (f = (bdbm_llm_req_t*)r->ptr_mp_next; f != NULL && !bdbm_is_read (r->req_type); f = (bdbm_llm_req_t*)f->ptr_mp_next) {
+				int64_t prog_time_us;
+
+				if (bdbm_is_erase (f->req_type)) {
+					target_elapsed_time_us += ri->np->block_erase_time_us;
+					continue;
+				}
+
+				dma_count = (f->req_type == REQTYPE_GC_WRITE) ? 
+					f->dma : ri->np->nr_subpages_per_page * ri->np->nr_planes;
+#ifdef DYNAMIC_DMA
+				count = __ramssd_dma_level (ri, f->phyaddr.channel_no);
+#endif
+				dma_time_us = ri->np->prog_dma_time_us[count] * dma_count;
+				ri->ptr_channels[f->phyaddr.channel_no].target_elapsed_time_us += dma_time_us;
+
+				prog_time_us = ri->np->page_type_prog_time_us[f->phyaddr.page_no % ri->np->nr_page_types];
+				target_elapsed_time_us += (prog_time_us > dma_time_us) ? prog_time_us : dma_time_us;
+			}
+
+			dma_reflected = (bdbm_is_read (r->req_type)) ? 0 : 1;
 		} 
 		else {
 			target_elapsed_time_us = 0;
-			ri->ptr_punits[punit_id].dma_reflected = 1;
+			dma_reflected = 1;
 		}
 
 
 		/* register reqs */
 		bdbm_spin_lock (&ri->ramssd_lock);
-		if (ri->ptr_punits[punit_id].ptr_req == NULL) {
-			ri->ptr_punits[punit_id].ptr_req = (void*)r;
-			bdbm_stopwatch_start (&ri->ptr_punits[punit_id].sw);
-			ri->ptr_punits[punit_id].target_elapsed_time_us = target_elapsed_time_us;
+		punit = &ri->ptr_punits[punit_id];
+		if (punit->ptr_req == NULL) {
+			punit->ptr_req = (void*)r;
+			punit->dma_reflected = dma_reflected;
+			punit->mp_dma = mp_dma;
+			bdbm_stopwatch_start (&punit->sw);
+			punit->target_elapsed_time_us = target_elapsed_time_us;
+		} else if (__ramssd_can_suspend (ri, punit, r)) {
+			/* suspend the program/erase in progress; it resumes with the
+			 * remaining time when the read is done */
+			int64_t elapsed_time_in_us = bdbm_stopwatch_get_elapsed_time_us (&punit->sw);
+
+			punit->ptr_suspended_req = punit->ptr_req;
+			punit->suspended_remaining_us = 
+				(punit->target_elapsed_time_us > elapsed_time_in_us) ? 
+				(punit->target_elapsed_time_us - elapsed_time_in_us) : 0;
+			punit->ptr_req = (void*)r;
+			punit->dma_reflected = dma_reflected;
+			punit->mp_dma = mp_dma;
+			bdbm_stopwatch_start (&punit->sw);
+			punit->target_elapsed_time_us = ri->np->suspend_time_us + target_elapsed_time_us;
 		} else {
 			bdbm_error ("More than two requests are assigned to the same parallel unit (ptr=%p, punit=%llu)",
 				ri->ptr_punits[punit_id].ptr_req, punit_id);
@@ -914,8 +1560,15 @@ uint32_t dev_ramssd_send_cmd (dev_ramssd_info_t* ri, bdbm_llm_req_t* r)
 			ret = 1;
 			goto fail;
 		}
+		earliest = __ramssd_timer_arm (ri, punit_id);
 		bdbm_spin_unlock (&ri->ramssd_lock);
 
+#if defined (USER_MODE)
+		/* the timer thread sleeps until the earliest deadline it knows of */
+		if (ri->emul_mode == DEVICE_TYPE_RAMDRIVE_TIMING && (earliest || ri->use_vclock))
+			__ramssd_timer_kick (ri);
+#endif
+
 		/* register reqs for callback */
 		__ramssd_timing_register_schedule (ri);
 	}
@@ -936,6 +1589,16 @@ uint32_t dev_ramssd_load (dev_ramssd_info_t* ri, const char* fn)
 		bdbm_error ("ptr_ssdram is NULL");
 		return 1;
 	}
+	if (ri->pstore) {
+		bdbm_warning ("the page store is not part of a snapshot");
+	}
+#if defined (USER_MODE)
+	if (ri->image_fd >= 0) {
+		/* the mapped image is already up to date */
+		bdbm_msg ("dev_ramssd_load - skipped ('%s' is mapped)", ri->np->ramssd_image);
+		return 0;
+	}
+#endif
 	
 	if ((fp = bdbm_fopen (fn, O_RDWR, 0777)) == 0) {
 		bdbm_error ("bdbm_fopen failed");
@@ -966,6 +1629,17 @@ uint32_t dev_ramssd_store (dev_ramssd_info_t* ri, const char* fn)
 		bdbm_error ("ptr_ssdram is NULL");
 		return 1;
 	}
+	if (ri->pstore) {
+		bdbm_warning ("the page store is not part of a snapshot");
+	}
+#if defined (USER_MODE)
+	if (ri->image_fd >= 0) {
+		/* flushing the mapped image is enough */
+		__ramssd_sync_image (ri);
+		bdbm_msg ("dev_ramssd_store - end ('%s' is synced)", ri->np->ramssd_image);
+		return 0;
+	}
+#endif
 	
 	if ((fp = bdbm_fopen (fn, O_CREAT | O_WRONLY, 0777)) == 0) {
 		bdbm_error ("bdbm_fopen failed");
@@ -34,6 +34,7 @@ THE SOFTWARE.
 #elif defined (USER_MODE)
 #include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #else
 #error Invalid Platform (KERNEL_MODE or USER_MODE)
@@ -42,6 +43,8 @@ THE SOFTWARE.
 #include "bdbm_drv.h"
 #include "params.h"
 #include "utime.h"
+#include "uthread.h"
+#include "dev_ramssd_pstore.h"
 
 
 #define DUMMY_SSD		// to reduce DRAM footprint
@@ -51,8 +54,21 @@ typedef struct {
 	int32_t dma_reflected;
 	int64_t target_elapsed_time_us;
 	bdbm_stopwatch_t sw;
+
+	/* # of subpages to move for the reads fused into ptr_req */
+	int64_t mp_dma;
+
+	/* a program/erase suspended by the read in ptr_req */
+	void* ptr_suspended_req;
+	int64_t suspended_remaining_us;
 } dev_ramssd_punit_t;
 
+/* an entry of the completion heap */
+typedef struct {
+	int64_t due_us;
+	uint64_t punit_id;
+} dev_ramssd_timer_t;
+
 #ifdef DWHONG
 typedef struct {
 	int64_t target_elapsed_time_us;
@@ -72,6 +88,15 @@ typedef struct {
 	uint8_t emul_mode;
 	bdbm_device_params_t* np;
 	void* ptr_ssdram; /* DRAM memory for SSD */
+	dev_ramssd_pstore_t* pstore;	/* main data on dummy ssd (np->page_store) */
+#if defined (USER_MODE)
+	/* a persistent image mapped to ptr_ssdram (np->ramssd_image) */
+	int image_fd;	/* -1: ptr_ssdram is not mapped */
+	uint8_t* image_base;
+	uint64_t image_len;
+	bdbm_thread_t* sync_thread;
+	volatile uint8_t sync_stop;
+#endif
 	dev_ramssd_punit_t* ptr_punits;	/* parallel units */
 	bdbm_spinlock_t ramssd_lock;
 	void (*intr_handler) (void*);
@@ -82,10 +107,26 @@ typedef struct {
 	dev_ramssd_wq_t works;
 #endif
 
+	/* pending completions, earliest first (under ramssd_lock) */
+	dev_ramssd_timer_t* timers;
+	int64_t* timer_pos;	/* index in timers per punit (-1: idle) */
+	int64_t nr_timers;
+#if defined (USER_MODE)
+	bdbm_thread_t* timer_thread;
+	pthread_mutex_t timer_mutex;
+	pthread_cond_t timer_cond;
+	uint8_t timer_kick;
+	volatile uint8_t timer_stop;
+#endif
+
+	/* for the virtual clock (np->virtual_clock) */
+	uint8_t use_vclock;
+	uint64_t nr_vclock_events;
+
 #ifdef DWHONG
 	dev_ramssd_channel_t* ptr_channels;	/* channel */
 
-	uint32_t is_busy[16];
+	uint32_t* is_busy;	/* per channel */
 	atomic_t busy_channel;
 #endif
 } dev_ramssd_info_t;
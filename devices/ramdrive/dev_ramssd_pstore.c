@@ -0,0 +1,475 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#if defined (KERNEL_MODE)
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#elif defined (USER_MODE)
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "debug.h"
+#include "umemory.h"
+#include "bdbm_drv.h"
+#include "dev_ramssd_pstore.h"
+
+#define PSTORE_CHUNK_SHIFT	8	/* 256 entries per chunk */
+#define PSTORE_CHUNK_SIZE	(1 << PSTORE_CHUNK_SHIFT)
+#define PSTORE_MIN_BUCKETS	1024
+
+/* 
+ * the LZ codec: a token byte below 0x80 is followed by (token+1) literals;
+ * otherwise, it is a match of ((token & 0x7F) + PSTORE_LZ_MIN_MATCH) bytes
+ * followed by a 16-bit little-endian offset. it is deterministic, so two
+ * units are identical iff their compressed forms are.
+ */
+#define PSTORE_LZ_HASH_BITS	10
+#define PSTORE_LZ_MIN_MATCH	4
+#define PSTORE_LZ_MAX_MATCH	(0x7F + PSTORE_LZ_MIN_MATCH)
+#define PSTORE_LZ_MAX_LITERALS	0x80
+#define PSTORE_LZ_NONE		0xFFFF
+
+static inline uint32_t __pstore_lz_read32 (uint8_t* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | 
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t __pstore_lz_literals (
+	uint8_t* in, uint32_t from, uint32_t to, 
+	uint8_t* out, uint32_t op, uint32_t cap)
+{
+	while (from < to) {
+		uint32_t n = to - from;
+		if (n > PSTORE_LZ_MAX_LITERALS)
+			n = PSTORE_LZ_MAX_LITERALS;
+		if (op + 1 + n > cap)
+			return cap + 1;
+		out[op++] = (uint8_t)(n - 1);
+		bdbm_memcpy (out + op, in + from, n);
+		op += n;
+		from += n;
+	}
+	return op;
+}
+
+/* returns the compressed length, or 0 if it does not fit in 'cap' */
+static uint32_t __pstore_lz_compress (
+	uint8_t* in, uint32_t n, uint8_t* out, uint32_t cap)
+{
+	uint16_t table[1 << PSTORE_LZ_HASH_BITS];
+	uint32_t ip = 0, anchor = 0, op = 0;
+	uint32_t i;
+
+	for (i = 0; i < (1 << PSTORE_LZ_HASH_BITS); i++)
+		table[i] = PSTORE_LZ_NONE;
+
+	while (ip + PSTORE_LZ_MIN_MATCH <= n) {
+		uint32_t v = __pstore_lz_read32 (in + ip);
+		uint32_t h = (v * 2654435761U) >> (32 - PSTORE_LZ_HASH_BITS);
+		uint32_t ref = table[h];
+		uint32_t len = PSTORE_LZ_MIN_MATCH;
+
+		table[h] = (uint16_t)ip;
+		if (ref == PSTORE_LZ_NONE || __pstore_lz_read32 (in + ref) != v) {
+			ip++;
+			continue;
+		}
+		while (ip + len < n && len < PSTORE_LZ_MAX_MATCH && in[ref + len] == in[ip + len])
+			len++;
+
+		if ((op = __pstore_lz_literals (in, anchor, ip, out, op, cap)) + 3 > cap)
+			return 0;
+		out[op++] = (uint8_t)(0x80 | (len - PSTORE_LZ_MIN_MATCH));
+		out[op++] = (uint8_t)((ip - ref) & 0xFF);
+		out[op++] = (uint8_t)((ip - ref) >> 8);
+		ip += len;
+		anchor = ip;
+	}
+
+	if ((op = __pstore_lz_literals (in, anchor, n, out, op, cap)) > cap)
+		return 0;
+
+	return op;
+}
+
+static uint32_t __pstore_lz_decompress (
+	uint8_t* in, uint32_t len, uint8_t* out, uint32_t n)
+{
+	uint32_t ip = 0, op = 0;
+
+	while (ip < len) {
+		uint32_t c = in[ip++];
+		if (c < 0x80) {
+			if (ip + c + 1 > len || op + c + 1 > n)
+				return 1;
+			bdbm_memcpy (out + op, in + ip, c + 1);
+			ip += c + 1;
+			op += c + 1;
+		} else {
+			uint32_t cnt = (c & 0x7F) + PSTORE_LZ_MIN_MATCH;
+			uint32_t off;
+			if (ip + 2 > len)
+				return 1;
+			off = (uint32_t)in[ip] | ((uint32_t)in[ip+1] << 8);
+			ip += 2;
+			if (off == 0 || off > op || op + cnt > n)
+				return 1;
+			/* matches may overlap; copy byte by byte */
+			for (; cnt > 0; cnt--, op++)
+				out[op] = out[op - off];
+		}
+	}
+
+	return (op == n) ? 0 : 1;
+}
+
+/* entries */
+static inline dev_ramssd_pstore_entry_t* __pstore_entry (
+	dev_ramssd_pstore_t* s, uint32_t e)
+{
+	return &s->chunks[e >> PSTORE_CHUNK_SHIFT][e & (PSTORE_CHUNK_SIZE - 1)];
+}
+
+static uint32_t __pstore_alloc_entry (dev_ramssd_pstore_t* s)
+{
+	dev_ramssd_pstore_entry_t* chunk;
+	uint32_t e, i;
+
+	if (s->free_entry == 0) {
+		if (s->nr_chunks == s->max_chunks) {
+			bdbm_error ("no more entries (%u chunks)", s->nr_chunks);
+			return 0;
+		}
+		if ((chunk = (dev_ramssd_pstore_entry_t*)bdbm_malloc_atomic 
+				(sizeof (dev_ramssd_pstore_entry_t) * PSTORE_CHUNK_SIZE)) == NULL) {
+			bdbm_error ("bdbm_malloc_atomic failed");
+			return 0;
+		}
+		s->chunks[s->nr_chunks] = chunk;
+		for (i = 0; i < PSTORE_CHUNK_SIZE; i++)
+			chunk[i].refs = 0;
+		/* entry 0 stands for erased slots; never hand it out */
+		for (i = PSTORE_CHUNK_SIZE; i > (s->nr_chunks == 0 ? 1 : 0); i--) {
+			chunk[i-1].next = s->free_entry;
+			s->free_entry = (s->nr_chunks << PSTORE_CHUNK_SHIFT) + i - 1;
+		}
+		s->nr_chunks++;
+	}
+
+	e = s->free_entry;
+	s->free_entry = __pstore_entry (s, e)->next;
+
+	return e;
+}
+
+static uint32_t __pstore_lookup (
+	dev_ramssd_pstore_t* s, uint64_t hash, uint64_t word, uint8_t* data, uint32_t len)
+{
+	uint32_t e = s->buckets[hash & (s->nr_buckets - 1)];
+
+	while (e != 0) {
+		dev_ramssd_pstore_entry_t* x = __pstore_entry (s, e);
+		if (x->hash == hash && x->len == len) {
+			if (len == 0 && x->word == word)
+				return e;
+			if (len != 0 && memcmp (x->data, data, len) == 0)
+				return e;
+		}
+		e = x->next;
+	}
+
+	return 0;
+}
+
+static void __pstore_put (dev_ramssd_pstore_t* s, uint32_t e)
+{
+	dev_ramssd_pstore_entry_t* x;
+	uint32_t* link;
+
+	if (e == 0)
+		return;
+
+	x = __pstore_entry (s, e);
+	if (--x->refs > 0)
+		return;
+
+	/* unlink it from its bucket */
+	link = &s->buckets[x->hash & (s->nr_buckets - 1)];
+	while (*link != e)
+		link = &__pstore_entry (s, *link)->next;
+	*link = x->next;
+
+	if (x->len == 0)
+		s->nr_word_entries--;
+	else {
+		if (x->len == s->unit_size)
+			s->nr_raw_entries--;
+		s->stored_bytes -= x->len;
+		bdbm_free_atomic (x->data);
+		x->data = NULL;
+	}
+	s->nr_used_entries--;
+
+	x->next = s->free_entry;
+	s->free_entry = e;
+}
+
+dev_ramssd_pstore_t* dev_ramssd_pstore_create (uint64_t nr_slots, uint64_t unit_size)
+{
+	dev_ramssd_pstore_t* s = NULL;
+	uint64_t loop;
+
+	if (unit_size == 0 || unit_size % sizeof (uint64_t) != 0 || unit_size >= PSTORE_LZ_NONE) {
+		bdbm_error ("invalid unit size (%llu)", unit_size);
+		return NULL;
+	}
+
+	if ((s = (dev_ramssd_pstore_t*)bdbm_zmalloc (sizeof (dev_ramssd_pstore_t))) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		return NULL;
+	}
+	s->unit_size = unit_size;
+	s->nr_slots = nr_slots;
+	s->max_chunks = (nr_slots + 2 + PSTORE_CHUNK_SIZE - 1) / PSTORE_CHUNK_SIZE;
+	for (s->nr_buckets = PSTORE_MIN_BUCKETS; s->nr_buckets < nr_slots / 4; s->nr_buckets <<= 1)
+		;
+
+	if ((s->slots = (uint32_t*)bdbm_malloc (sizeof (uint32_t) * nr_slots)) == NULL ||
+		(s->buckets = (uint32_t*)bdbm_malloc (sizeof (uint32_t) * s->nr_buckets)) == NULL ||
+		(s->chunks = (dev_ramssd_pstore_entry_t**)bdbm_malloc 
+			(sizeof (dev_ramssd_pstore_entry_t*) * s->max_chunks)) == NULL) {
+		bdbm_error ("bdbm_malloc failed");
+		dev_ramssd_pstore_destroy (s);
+		return NULL;
+	}
+	for (loop = 0; loop < nr_slots; loop++)
+		s->slots[loop] = 0;
+	for (loop = 0; loop < s->nr_buckets; loop++)
+		s->buckets[loop] = 0;
+
+	bdbm_spin_lock_init (&s->lock);
+
+	return s;
+}
+
+void dev_ramssd_pstore_destroy (dev_ramssd_pstore_t* s)
+{
+	uint32_t c, i;
+
+	if (s == NULL)
+		return;
+
+	for (c = 0; c < s->nr_chunks; c++) {
+		for (i = 0; i < PSTORE_CHUNK_SIZE; i++) {
+			if (s->chunks[c][i].refs > 0 && s->chunks[c][i].len > 0)
+				bdbm_free_atomic (s->chunks[c][i].data);
+		}
+		bdbm_free_atomic (s->chunks[c]);
+	}
+	if (s->chunks)
+		bdbm_free (s->chunks);
+	if (s->buckets)
+		bdbm_free (s->buckets);
+	if (s->slots)
+		bdbm_free (s->slots);
+	bdbm_free (s);
+}
+
+uint32_t dev_ramssd_pstore_write (dev_ramssd_pstore_t* s, uint64_t slot, uint8_t* data)
+{
+	uint64_t* words = (uint64_t*)data;
+	uint64_t nr_words = s->unit_size / sizeof (uint64_t);
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint8_t is_word = 1;
+	uint8_t* buf = NULL;
+	uint32_t len = 0;
+	uint32_t e;
+	uint64_t loop;
+
+	if (slot >= s->nr_slots) {
+		bdbm_error ("invalid slot (%llu >= %llu)", slot, s->nr_slots);
+		return 1;
+	}
+
+	for (loop = 0; loop < nr_words; loop++) {
+		hash = (hash ^ words[loop]) * 0x100000001b3ULL;
+		if (words[loop] != words[0])
+			is_word = 0;
+	}
+
+	/* compress it outside the lock; units that save less than 1/8 are 
+	 * kept as they are */
+	if (!is_word) {
+		if ((buf = (uint8_t*)bdbm_malloc_atomic (s->unit_size)) == NULL) {
+			bdbm_error ("bdbm_malloc_atomic failed");
+			return 1;
+		}
+		if ((len = __pstore_lz_compress (data, s->unit_size, buf, 
+				s->unit_size - s->unit_size / 8)) == 0) {
+			bdbm_memcpy (buf, data, s->unit_size);
+			len = s->unit_size;
+		}
+	}
+
+	bdbm_spin_lock (&s->lock);
+
+	if ((e = __pstore_lookup (s, hash, words[0], buf, len)) != 0) {
+		__pstore_entry (s, e)->refs++;
+		s->nr_dedup_hits++;
+	} else {
+		dev_ramssd_pstore_entry_t* x;
+		uint8_t* copy = NULL;
+
+		if (len > 0 && (copy = (uint8_t*)bdbm_malloc_atomic (len)) == NULL) {
+			bdbm_error ("bdbm_malloc_atomic failed");
+			goto fail;
+		}
+		if ((e = __pstore_alloc_entry (s)) == 0) {
+			if (copy)
+				bdbm_free_atomic (copy);
+			goto fail;
+		}
+
+		x = __pstore_entry (s, e);
+		x->hash = hash;
+		x->word = words[0];
+		x->len = len;
+		x->data = copy;
+		x->refs = 1;
+		if (len > 0)
+			bdbm_memcpy (copy, buf, len);
+		x->next = s->buckets[hash & (s->nr_buckets - 1)];
+		s->buckets[hash & (s->nr_buckets - 1)] = e;
+
+		if (len == 0)
+			s->nr_word_entries++;
+		else if (len == s->unit_size)
+			s->nr_raw_entries++;
+		s->stored_bytes += len;
+		s->nr_used_entries++;
+	}
+
+	if (s->slots[slot] == 0)
+		s->nr_used_slots++;
+	else
+		__pstore_put (s, s->slots[slot]);
+	s->slots[slot] = e;
+	s->nr_writes++;
+
+	bdbm_spin_unlock (&s->lock);
+
+	if (buf)
+		bdbm_free_atomic (buf);
+	return 0;
+
+fail:
+	bdbm_spin_unlock (&s->lock);
+	if (buf)
+		bdbm_free_atomic (buf);
+	return 1;
+}
+
+uint32_t dev_ramssd_pstore_read (dev_ramssd_pstore_t* s, uint64_t slot, uint8_t* data)
+{
+	dev_ramssd_pstore_entry_t* x;
+	uint32_t ret = 0;
+	uint64_t loop;
+
+	if (slot >= s->nr_slots) {
+		bdbm_error ("invalid slot (%llu >= %llu)", slot, s->nr_slots);
+		return 1;
+	}
+
+	bdbm_spin_lock (&s->lock);
+
+	if (s->slots[slot] == 0) {
+		bdbm_memset (data, 0xFF, s->unit_size);
+	} else {
+		x = __pstore_entry (s, s->slots[slot]);
+		if (x->len == 0) {
+			for (loop = 0; loop < s->unit_size / sizeof (uint64_t); loop++)
+				((uint64_t*)data)[loop] = x->word;
+		} else if (x->len == s->unit_size) {
+			bdbm_memcpy (data, x->data, s->unit_size);
+		} else if (__pstore_lz_decompress (x->data, x->len, data, s->unit_size) != 0) {
+			bdbm_error ("corrupted entry (slot=%llu, len=%u)", slot, x->len);
+			ret = 1;
+		}
+	}
+
+	bdbm_spin_unlock (&s->lock);
+
+	return ret;
+}
+
+void dev_ramssd_pstore_erase (dev_ramssd_pstore_t* s, uint64_t slot, uint64_t nr_slots)
+{
+	uint64_t loop;
+
+	bdbm_spin_lock (&s->lock);
+	for (loop = slot; loop < slot + nr_slots && loop < s->nr_slots; loop++) {
+		if (s->slots[loop] == 0)
+			continue;
+		__pstore_put (s, s->slots[loop]);
+		s->slots[loop] = 0;
+		s->nr_used_slots--;
+	}
+	bdbm_spin_unlock (&s->lock);
+}
+
+/* the DRAM actually used by the store (in bytes) */
+uint64_t dev_ramssd_pstore_footprint (dev_ramssd_pstore_t* s)
+{
+	return sizeof (uint32_t) * (s->nr_slots + s->nr_buckets) +
+		sizeof (dev_ramssd_pstore_entry_t*) * s->max_chunks +
+		sizeof (dev_ramssd_pstore_entry_t) * PSTORE_CHUNK_SIZE * s->nr_chunks +
+		s->stored_bytes;
+}
+
+void dev_ramssd_pstore_display (dev_ramssd_pstore_t* s, const char* name)
+{
+	uint64_t logical = s->nr_used_slots * s->unit_size;
+	uint64_t footprint = dev_ramssd_pstore_footprint (s);
+
+	bdbm_msg ("%s: %llu units (%llu KB) in %llu KB (%llu%%), %llu unique entries "
+		"(%llu repeated words, %llu uncompressed), %llu of %llu writes deduplicated",
+		name,
+		s->nr_used_slots,
+		BDBM_SIZE_KB (logical),
+		BDBM_SIZE_KB (footprint),
+		logical > 0 ? footprint * 100 / logical : 0,
+		s->nr_used_entries,
+		s->nr_word_entries,
+		s->nr_raw_entries,
+		s->nr_dedup_hits,
+		s->nr_writes);
+}
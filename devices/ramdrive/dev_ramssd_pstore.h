@@ -0,0 +1,91 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef _BLUEDBM_DEV_RAMSSD_PSTORE_H
+#define _BLUEDBM_DEV_RAMSSD_PSTORE_H
+
+#if defined (KERNEL_MODE)
+#include <linux/types.h>
+
+#elif defined (USER_MODE)
+#include <stdint.h>
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "bdbm_drv.h"
+
+/* 
+ * a page store for ramssd main data (np->page_store).
+ *
+ * every unit (i.e., a kernel page) of the flash is a slot that refers to a
+ * shared entry; identical units share one entry, units filled with a
+ * repeated 8-byte word (e.g., zeros or 0xFF) keep only that word, and the
+ * others are compressed by a small LZ codec (or kept as they are if they do
+ * not compress). slots that are never written or erased read as 0xFF.
+ */
+
+typedef struct {
+	uint64_t hash;
+	uint64_t word;	/* the repeated word (len == 0) */
+	uint8_t* data;	/* compressed data (len < unit), raw data (len == unit) */
+	uint32_t len;
+	uint32_t refs;	/* # of slots referring to the entry (0: free) */
+	uint32_t next;	/* the next entry in the same bucket (or free list) */
+} dev_ramssd_pstore_entry_t;
+
+typedef struct {
+	uint64_t unit_size;
+	uint64_t nr_slots;
+	uint32_t* slots;	/* entry per slot (0: erased) */
+
+	dev_ramssd_pstore_entry_t** chunks;	/* entries, allocated on demand */
+	uint32_t nr_chunks;
+	uint32_t max_chunks;
+	uint32_t free_entry;	/* head of the free list (0: none) */
+	uint32_t* buckets;
+	uint64_t nr_buckets;	/* must be a power of 2 */
+	bdbm_spinlock_t lock;
+
+	/* memory accounting */
+	uint64_t nr_used_slots;
+	uint64_t nr_used_entries;
+	uint64_t nr_word_entries;
+	uint64_t nr_raw_entries;
+	uint64_t stored_bytes;	/* bytes kept for the entries' data */
+	uint64_t nr_writes;
+	uint64_t nr_dedup_hits;
+} dev_ramssd_pstore_t;
+
+dev_ramssd_pstore_t* dev_ramssd_pstore_create (uint64_t nr_slots, uint64_t unit_size);
+void dev_ramssd_pstore_destroy (dev_ramssd_pstore_t* s);
+uint32_t dev_ramssd_pstore_write (dev_ramssd_pstore_t* s, uint64_t slot, uint8_t* data);
+uint32_t dev_ramssd_pstore_read (dev_ramssd_pstore_t* s, uint64_t slot, uint8_t* data);
+void dev_ramssd_pstore_erase (dev_ramssd_pstore_t* s, uint64_t slot, uint64_t nr_slots);
+uint64_t dev_ramssd_pstore_footprint (dev_ramssd_pstore_t* s);
+void dev_ramssd_pstore_display (dev_ramssd_pstore_t* s, const char* name);
+
+#endif /* _BLUEDBM_DEV_RAMSSD_PSTORE_H */
@@ -37,6 +37,7 @@ THE SOFTWARE.
 #include "dm_ramdrive.h"
 #include "dev_params.h"
 #include "dev_ramssd.h"
+#include "dev_nand_profile.h"
 
 #include "utime.h"
 #include "umemory.h"
@@ -72,9 +73,13 @@ static void __dm_ramdrive_ih (void* arg)
 	bdi->ptr_dm_inf->end_req (bdi, ptr_llm_req);
 }
 
-static void __dm_setup_device_params (bdbm_device_params_t* params)
+static uint32_t __dm_setup_device_params (bdbm_device_params_t* params)
 {
 	*params = get_default_device_params ();
+	params->device_caps = DEVICE_CAP_SUSPEND | DEVICE_CAP_MP_READ | DEVICE_CAP_BATCH;
+
+	/* NAND timing from a profile file (if any) */
+	return dev_nand_profile_load (params, _param_nand_profile_file, _param_nand_profile);
 }
 
 uint32_t dm_ramdrive_probe (bdbm_drv_info_t* bdi, bdbm_device_params_t* params)
@@ -82,7 +87,10 @@ uint32_t dm_ramdrive_probe (bdbm_drv_info_t* bdi, bdbm_device_params_t* params)
 	dm_ramssd_private_t* p = NULL;
 
 	/* setup NAND parameters according to users' inputs */
-	__dm_setup_device_params (params);
+	if (__dm_setup_device_params (params) != 0) {
+		bdbm_error ("__dm_setup_device_params failed");
+		goto fail;
+	}
 
 	display_device_params (params);
 
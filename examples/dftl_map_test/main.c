@@ -0,0 +1,574 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* standalone test of the DFTL mapping table: packed entries, lookups,
+ * eviction and promotion in the segmented LRU. It drives dftl_map.c the
+ * way dftl.c does, with a DRAM array standing in for the mapping pages on
+ * flash, and then reports the hit ratio on skewed random reads */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "bdbm_drv.h"
+#include "debug.h"
+#include "umemory.h"
+#include "ufile.h"
+#include "algo/dftl_map.h"
+
+#define DMT_PAGE_SIZE	4096
+
+static bdbm_device_params_t np;
+static dftl_packed_entry_t** flash = NULL;	/* the mapping page of each slot on flash */
+static uint64_t nr_failed = 0;
+
+#define DMT_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			bdbm_warning ("check failed: %s", #cond); \
+			nr_failed++; \
+		} \
+	} while (0)
+
+static void dmt_setup_params (
+	uint64_t nr_channels,
+	uint64_t nr_chips_per_channel,
+	uint64_t nr_blocks_per_chip,
+	uint64_t nr_pages_per_block)
+{
+	memset (&np, 0x00, sizeof (np));
+	np.nr_channels = nr_channels;
+	np.nr_chips_per_channel = nr_chips_per_channel;
+	np.nr_blocks_per_chip = nr_blocks_per_chip;
+	np.nr_pages_per_block = nr_pages_per_block;
+	np.page_main_size = DMT_PAGE_SIZE;
+	np.nr_pages_per_ssd = nr_channels * nr_chips_per_channel * nr_blocks_per_chip * nr_pages_per_block;
+}
+
+static dftl_mapping_table_t* dmt_create (uint64_t nr_cached_slots)
+{
+	dftl_mapping_table_t* mt = NULL;
+	uint64_t i;
+
+	if ((mt = bdbm_dftl_create_mapping_table (&np, nr_cached_slots * DMT_PAGE_SIZE)) == NULL)
+		return NULL;
+	flash = (dftl_packed_entry_t**)bdbm_zmalloc (sizeof (dftl_packed_entry_t*) * mt->nr_total_dir_slots);
+	for (i = 0; i < mt->nr_total_dir_slots; i++) {
+		flash[i] = (dftl_packed_entry_t*)bdbm_malloc (DMT_PAGE_SIZE);
+		memset (flash[i], 0xFF, DMT_PAGE_SIZE);	/* DFTL_PACKED_NOT_MAPPED */
+	}
+
+	return mt;
+}
+
+static void dmt_destroy (dftl_mapping_table_t* mt)
+{
+	uint64_t i;
+
+	for (i = 0; i < mt->nr_total_dir_slots; i++)
+		bdbm_free (flash[i]);
+	bdbm_free (flash);
+	flash = NULL;
+	bdbm_dftl_destroy_mapping_table (mt);
+}
+
+/* write back (if dirty) and drop the victim that the cache picks, if any */
+static directory_slot_t* dmt_evict (dftl_mapping_table_t* mt)
+{
+	directory_slot_t* ds = NULL;
+	bdbm_phyaddr_t phyaddr;
+
+	if ((ds = bdbm_dftl_prepare_victim_mapblk (mt)) == NULL)
+		return NULL;
+
+	if (ds->status == DFTL_DIR_DIRTY)
+		memcpy (flash[ds->id], ds->me, DMT_PAGE_SIZE);
+	memset (&phyaddr, 0x00, sizeof (phyaddr));
+	phyaddr.block_no = ds->id;
+	bdbm_dftl_finish_victim_mapblk (mt, ds, &phyaddr);
+
+	return ds;
+}
+
+/* bring the slot of lpa into DRAM, as a mapping-page load does */
+static void dmt_load (dftl_mapping_table_t* mt, uint64_t lpa)
+{
+	directory_slot_t* ds = NULL;
+
+	dmt_evict (mt);
+	if ((ds = bdbm_dftl_missing_dir_prepare (mt, lpa)) != NULL)
+		bdbm_dftl_missing_dir_done (mt, ds, flash[ds->id]);
+}
+
+/* a host lookup; returns 1 on a hit */
+static int dmt_access (dftl_mapping_table_t* mt, uint64_t lpa)
+{
+	if (bdbm_dftl_lookup_mapping_entry (mt, lpa) == 0)
+		return 1;
+	dmt_load (mt, lpa);
+	return 0;
+}
+
+static uint64_t dmt_lpa (dftl_mapping_table_t* mt, uint64_t slot)
+{
+	return slot * mt->nr_entires_per_dir_slot;
+}
+
+static void test_packed_entries (void)
+{
+	dftl_mapping_table_t* mt = NULL;
+	mapping_entry_t me, got;
+	uint64_t lpa;
+
+	dmt_setup_params (4, 4, 64, 128);
+	if ((mt = dmt_create (4)) == NULL) {
+		nr_failed++;
+		return;
+	}
+	DMT_CHECK (mt->mapping_entry_size == 4);
+	DMT_CHECK (mt->nr_entires_per_dir_slot == DMT_PAGE_SIZE / 4);
+
+	/* nothing is in DRAM yet */
+	lpa = dmt_lpa (mt, 1) + 7;
+	DMT_CHECK (bdbm_dftl_check_mapping_entry (mt, lpa) == 1);
+	got = bdbm_dftl_get_mapping_entry (mt, lpa);
+	DMT_CHECK (got.status == DFTL_PAGE_NOT_EXIST);
+
+	/* a slot that was never written starts in DRAM, unmapped */
+	dmt_load (mt, lpa);
+	DMT_CHECK (bdbm_dftl_check_mapping_entry (mt, lpa) == 0);
+	got = bdbm_dftl_get_mapping_entry (mt, lpa);
+	DMT_CHECK (got.status == DFTL_PAGE_NOT_MAPPED);
+
+	/* the last page of the device survives packing */
+	me.status = DFTL_PAGE_VALID;
+	me.phyaddr.channel_no = 3;
+	me.phyaddr.chip_no = 3;
+	me.phyaddr.block_no = 63;
+	me.phyaddr.page_no = 127;
+	bdbm_dftl_set_mapping_entry (mt, lpa, &me);
+	got = bdbm_dftl_get_mapping_entry (mt, lpa);
+	DMT_CHECK (got.status == DFTL_PAGE_VALID);
+	DMT_CHECK (got.phyaddr.channel_no == 3 && got.phyaddr.chip_no == 3);
+	DMT_CHECK (got.phyaddr.block_no == 63 && got.phyaddr.page_no == 127);
+	DMT_CHECK (mt->dir[1].status == DFTL_DIR_DIRTY);
+
+	me.phyaddr.channel_no = 1;
+	me.phyaddr.chip_no = 2;
+	me.phyaddr.block_no = 5;
+	me.phyaddr.page_no = 0;
+	bdbm_dftl_set_mapping_entry (mt, lpa + 1, &me);
+	got = bdbm_dftl_get_mapping_entry (mt, lpa + 1);
+	DMT_CHECK (got.status == DFTL_PAGE_VALID);
+	DMT_CHECK (got.phyaddr.channel_no == 1 && got.phyaddr.chip_no == 2);
+	DMT_CHECK (got.phyaddr.block_no == 5 && got.phyaddr.page_no == 0);
+
+	bdbm_dftl_invalidate_mapping_entry (mt, lpa + 1);
+	got = bdbm_dftl_get_mapping_entry (mt, lpa + 1);
+	DMT_CHECK (got.status == DFTL_PAGE_INVALID);
+
+	/* the neighbours were not touched */
+	got = bdbm_dftl_get_mapping_entry (mt, lpa - 1);
+	DMT_CHECK (got.status == DFTL_PAGE_NOT_MAPPED);
+	got = bdbm_dftl_get_mapping_entry (mt, lpa + 2);
+	DMT_CHECK (got.status == DFTL_PAGE_NOT_MAPPED);
+
+	dmt_destroy (mt);
+}
+
+static void test_lookup (void)
+{
+	dftl_mapping_table_t* mt = NULL;
+	uint64_t lpa;
+
+	dmt_setup_params (4, 4, 64, 128);
+	if ((mt = dmt_create (4)) == NULL) {
+		nr_failed++;
+		return;
+	}
+	lpa = dmt_lpa (mt, 2);
+
+	/* a miss counts as a lookup only; check () is not counted at all */
+	DMT_CHECK (dmt_access (mt, lpa) == 0);
+	DMT_CHECK (atomic64_read (&mt->nr_lookups) == 1);
+	DMT_CHECK (atomic64_read (&mt->nr_hits) == 0);
+	DMT_CHECK (bdbm_dftl_check_mapping_entry (mt, lpa) == 0);
+	DMT_CHECK (atomic64_read (&mt->nr_lookups) == 1);
+
+	/* any lpa of a cached slot hits */
+	DMT_CHECK (dmt_access (mt, lpa + mt->nr_entires_per_dir_slot - 1) == 1);
+	DMT_CHECK (atomic64_read (&mt->nr_lookups) == 2);
+	DMT_CHECK (atomic64_read (&mt->nr_hits) == 1);
+
+	/* a second load of a slot under load is not issued */
+	mt->dir[3].status = DFTL_DIR_FLASH;
+	mt->dir[3].phyaddr.channel_no = 0;
+	mt->dir[3].phyaddr.chip_no = 0;
+	mt->dir[3].phyaddr.block_no = 3;
+	mt->dir[3].phyaddr.page_no = 0;
+	DMT_CHECK (bdbm_dftl_missing_dir_prepare (mt, dmt_lpa (mt, 3)) == &mt->dir[3]);
+	DMT_CHECK (mt->dir[3].is_under_load == 1);
+	DMT_CHECK (bdbm_dftl_missing_dir_prepare (mt, dmt_lpa (mt, 3)) == NULL);
+	bdbm_dftl_missing_dir_done (mt, &mt->dir[3], flash[3]);
+	DMT_CHECK (mt->dir[3].is_under_load == 0);
+	DMT_CHECK (mt->dir[3].status == DFTL_DIR_CLEAN);
+	DMT_CHECK (mt->dir[3].segment == DFTL_SEG_PROBATION);
+
+	dmt_destroy (mt);
+}
+
+static void test_eviction (void)
+{
+	dftl_mapping_table_t* mt = NULL;
+	directory_slot_t* ds = NULL;
+	mapping_entry_t me, got;
+	uint64_t i, nr_slots = 8;
+
+	dmt_setup_params (4, 4, 64, 128);
+	if ((mt = dmt_create (nr_slots)) == NULL) {
+		nr_failed++;
+		return;
+	}
+	DMT_CHECK (mt->max_cached_dir_slots == nr_slots);
+
+	/* nothing is evicted until the cache is full */
+	for (i = 0; i < nr_slots; i++) {
+		DMT_CHECK (bdbm_dftl_prepare_victim_mapblk (mt) == NULL);
+		dmt_load (mt, dmt_lpa (mt, i));
+	}
+	DMT_CHECK (atomic64_read (&mt->nr_cached_slots) == nr_slots);
+
+	/* a dirty slot is evicted first if it is the coldest, and comes back
+	 * with its entries */
+	me.status = DFTL_PAGE_VALID;
+	me.phyaddr.channel_no = 2;
+	me.phyaddr.chip_no = 1;
+	me.phyaddr.block_no = 9;
+	me.phyaddr.page_no = 33;
+	bdbm_dftl_set_mapping_entry (mt, dmt_lpa (mt, 0) + 5, &me);
+
+	ds = dmt_evict (mt);
+	DMT_CHECK (ds == &mt->dir[0]);
+	DMT_CHECK (mt->dir[0].status == DFTL_DIR_FLASH);
+	DMT_CHECK (mt->dir[0].segment == DFTL_SEG_NONE);
+	DMT_CHECK (atomic64_read (&mt->nr_cached_slots) == nr_slots - 1);
+	DMT_CHECK (bdbm_dftl_check_mapping_entry (mt, dmt_lpa (mt, 0)) == 1);
+
+	/* the cache has room again, so this load evicts nothing */
+	dmt_load (mt, dmt_lpa (mt, 0) + 5);
+	DMT_CHECK (atomic64_read (&mt->nr_cached_slots) == nr_slots);
+	DMT_CHECK (mt->dir[1].status == DFTL_DIR_DIRTY);
+	got = bdbm_dftl_get_mapping_entry (mt, dmt_lpa (mt, 0) + 5);
+	DMT_CHECK (got.status == DFTL_PAGE_VALID);
+	DMT_CHECK (got.phyaddr.channel_no == 2 && got.phyaddr.chip_no == 1);
+	DMT_CHECK (got.phyaddr.block_no == 9 && got.phyaddr.page_no == 33);
+	DMT_CHECK (mt->dir[0].status == DFTL_DIR_CLEAN);
+
+	/* the least recently loaded probationary slot goes next */
+	ds = dmt_evict (mt);
+	DMT_CHECK (ds == &mt->dir[1]);
+	dmt_load (mt, dmt_lpa (mt, nr_slots));
+	DMT_CHECK (atomic64_read (&mt->nr_cached_slots) == nr_slots);
+
+	/* a hit soon after the load moves a probationary slot to the hot end
+	 * of its segment, ahead of the slot loaded after it */
+	DMT_CHECK (dmt_access (mt, dmt_lpa (mt, 0)) == 1);
+	DMT_CHECK (mt->dir[0].segment == DFTL_SEG_PROBATION);
+	ds = list_entry (mt->probation_list.prev, directory_slot_t, list);
+	DMT_CHECK (ds == &mt->dir[0]);
+	ds = dmt_evict (mt);
+	DMT_CHECK (ds == &mt->dir[2]);
+
+	dmt_destroy (mt);
+}
+
+static void test_promotion (void)
+{
+	dftl_mapping_table_t* mt = NULL;
+	directory_slot_t* ds = NULL;
+	uint64_t i, nr_slots = 10, next = 0, max_protected;
+
+	dmt_setup_params (4, 4, 64, 128);
+	if ((mt = dmt_create (nr_slots)) == NULL) {
+		nr_failed++;
+		return;
+	}
+	max_protected = nr_slots * DFTL_PROTECTED_RATIO / 100;
+	DMT_CHECK (mt->max_protected_slots == max_protected);
+
+	/* references right after the load do not promote a slot */
+	dmt_load (mt, dmt_lpa (mt, next++));
+	for (i = 0; i < 4; i++)
+		DMT_CHECK (dmt_access (mt, dmt_lpa (mt, 0) + i) == 1);
+	DMT_CHECK (mt->dir[0].segment == DFTL_SEG_PROBATION);
+	DMT_CHECK (mt->nr_protected_slots == 0);
+
+	/* a reference after DFTL_CORRELATED_LOADS more loads does */
+	while (next <= DFTL_CORRELATED_LOADS)
+		dmt_load (mt, dmt_lpa (mt, next++));
+	DMT_CHECK (dmt_access (mt, dmt_lpa (mt, 0)) == 1);
+	DMT_CHECK (mt->dir[0].segment == DFTL_SEG_PROTECTED);
+	DMT_CHECK (mt->nr_protected_slots == 1);
+
+	/* a scan much larger than the cache leaves the protected slot alone */
+	for (i = 0; i < 8 * nr_slots; i++)
+		DMT_CHECK (dmt_access (mt, dmt_lpa (mt, next++)) == 0);
+	DMT_CHECK (mt->dir[0].segment == DFTL_SEG_PROTECTED);
+	DMT_CHECK (dmt_access (mt, dmt_lpa (mt, 0)) == 1);
+
+	/* victims come from probation while it has any slot */
+	ds = dmt_evict (mt);
+	DMT_CHECK (ds != NULL && ds != &mt->dir[0]);
+	DMT_CHECK (mt->nr_protected_slots == 1);
+
+	dmt_destroy (mt);
+
+	/* once the protected segment is full, promoting one more slot demotes
+	 * the coldest protected slot to the hot end of probation */
+	nr_slots = 100;
+	if ((mt = dmt_create (nr_slots)) == NULL) {
+		nr_failed++;
+		return;
+	}
+	max_protected = mt->max_protected_slots;
+	for (i = 0; i < nr_slots; i++)
+		dmt_load (mt, dmt_lpa (mt, i));
+	for (i = 0; i < max_protected; i++)
+		DMT_CHECK (dmt_access (mt, dmt_lpa (mt, i)) == 1);
+	DMT_CHECK (mt->nr_protected_slots == max_protected);
+	DMT_CHECK (mt->dir[0].segment == DFTL_SEG_PROTECTED);
+
+	DMT_CHECK (dmt_access (mt, dmt_lpa (mt, max_protected)) == 1);
+	DMT_CHECK (mt->nr_protected_slots == max_protected);
+	DMT_CHECK (mt->dir[max_protected].segment == DFTL_SEG_PROTECTED);
+	DMT_CHECK (mt->dir[0].segment == DFTL_SEG_PROBATION);
+	ds = list_entry (mt->probation_list.prev, directory_slot_t, list);
+	DMT_CHECK (ds == &mt->dir[0]);
+
+	/* a hit on a protected slot keeps it protected */
+	DMT_CHECK (dmt_access (mt, dmt_lpa (mt, 1)) == 1);
+	DMT_CHECK (mt->dir[1].segment == DFTL_SEG_PROTECTED);
+	ds = list_entry (mt->protected_list.prev, directory_slot_t, list);
+	DMT_CHECK (ds == &mt->dir[1]);
+
+	dmt_destroy (mt);
+}
+
+static void test_clean (void)
+{
+	dftl_mapping_table_t* mt = NULL;
+	directory_slot_t* dss[DFTL_CLEAN_BATCH];
+	mapping_entry_t me;
+	uint64_t i, nr_slots = 40;
+
+	dmt_setup_params (4, 4, 64, 128);
+	if ((mt = dmt_create (nr_slots)) == NULL) {
+		nr_failed++;
+		return;
+	}
+
+	/* new slots start dirty, but nothing is picked while the cache has room */
+	for (i = 0; i < nr_slots / 2; i++)
+		dmt_load (mt, dmt_lpa (mt, i));
+	DMT_CHECK (bdbm_dftl_prepare_clean_mapblks (mt, dss, DFTL_CLEAN_BATCH) == 0);
+
+	/* fill it up; the coldest dirty slots are picked as one batch */
+	for (; i < nr_slots; i++)
+		dmt_load (mt, dmt_lpa (mt, i));
+	DMT_CHECK (bdbm_dftl_prepare_clean_mapblks (mt, dss, DFTL_CLEAN_BATCH) == DFTL_CLEAN_BATCH);
+	for (i = 0; i < DFTL_CLEAN_BATCH; i++)
+		DMT_CHECK (dss[i] == &mt->dir[i]);
+
+	/* after they are cleaned, fewer dirty slots than a batch are left in
+	 * the eviction window, so nothing is picked */
+	for (i = 0; i < nr_slots; i++) {
+		mt->dir[i].status = DFTL_DIR_CLEAN;
+	}
+	me.status = DFTL_PAGE_VALID;
+	memset (&me.phyaddr, 0x00, sizeof (me.phyaddr));
+	bdbm_dftl_set_mapping_entry (mt, dmt_lpa (mt, 3), &me);
+	DMT_CHECK (bdbm_dftl_prepare_clean_mapblks (mt, dss, DFTL_CLEAN_BATCH) == 0);
+
+	dmt_destroy (mt);
+}
+
+/*
+ * hit ratio on skewed random reads. The LPA space is split into 64-LPA
+ * extents whose popularity follows a Zipf distribution; the extents are
+ * scattered over the LPA space, so a hot mapping page also holds cold
+ * entries. A plain LRU over the same slots is simulated for reference.
+ */
+#define DMT_EXTENT	64
+
+struct dmt_lru {
+	uint64_t nr_slots;
+	uint64_t max_slots;
+	int64_t* prev;
+	int64_t* next;
+	uint8_t* cached;
+	int64_t head;	/* the hottest */
+	int64_t tail;	/* the coldest */
+};
+
+static void dmt_lru_unlink (struct dmt_lru* l, int64_t s)
+{
+	if (l->prev[s] >= 0) l->next[l->prev[s]] = l->next[s]; else l->head = l->next[s];
+	if (l->next[s] >= 0) l->prev[l->next[s]] = l->prev[s]; else l->tail = l->prev[s];
+}
+
+static int dmt_lru_access (struct dmt_lru* l, int64_t s)
+{
+	int hit = l->cached[s];
+
+	if (hit) {
+		dmt_lru_unlink (l, s);
+	} else {
+		if (l->nr_slots == l->max_slots) {
+			int64_t v = l->tail;
+			dmt_lru_unlink (l, v);
+			l->cached[v] = 0;
+			l->nr_slots--;
+		}
+		l->cached[s] = 1;
+		l->nr_slots++;
+	}
+	l->prev[s] = -1;
+	l->next[s] = l->head;
+	if (l->head >= 0) l->prev[l->head] = s; else l->tail = s;
+	l->head = s;
+
+	return hit;
+}
+
+static void dmt_hit_ratio (double theta, uint64_t cache_pct)
+{
+	dftl_mapping_table_t* mt = NULL;
+	struct dmt_lru l;
+	double* cdf = NULL;
+	uint64_t* perm = NULL;
+	uint64_t nr_extents, nr_total_slots, nr_reads, nr_warmup, i;
+	uint64_t nr_hits = 0, nr_lru_hits = 0, seed = 88172645463325252ULL;
+	double sum = 0;
+
+	dmt_setup_params (8, 8, 256, 128);
+	nr_total_slots = np.nr_pages_per_ssd / (DMT_PAGE_SIZE / sizeof (dftl_packed_entry_t));
+	if ((mt = dmt_create (nr_total_slots * cache_pct / 100)) == NULL) {
+		nr_failed++;
+		return;
+	}
+
+	/* popularity of the extents, scattered by a random permutation */
+	nr_extents = np.nr_pages_per_ssd / DMT_EXTENT;
+	cdf = (double*)bdbm_malloc (sizeof (double) * nr_extents);
+	perm = (uint64_t*)bdbm_malloc (sizeof (uint64_t) * nr_extents);
+	for (i = 0; i < nr_extents; i++) {
+		sum += 1.0 / pow ((double)(i + 1), theta);
+		cdf[i] = sum;
+		perm[i] = i;
+	}
+	for (i = nr_extents - 1; i > 0; i--) {
+		uint64_t j, t;
+		seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+		j = seed % (i + 1);
+		t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+	}
+
+	memset (&l, 0x00, sizeof (l));
+	l.max_slots = mt->max_cached_dir_slots;
+	l.prev = (int64_t*)bdbm_malloc (sizeof (int64_t) * nr_total_slots);
+	l.next = (int64_t*)bdbm_malloc (sizeof (int64_t) * nr_total_slots);
+	l.cached = (uint8_t*)bdbm_zmalloc (nr_total_slots);
+	l.head = l.tail = -1;
+
+	nr_warmup = nr_total_slots * 20;
+	nr_reads = nr_total_slots * 100;
+	for (i = 0; i < nr_warmup + nr_reads; i++) {
+		double u;
+		uint64_t lo = 0, hi = nr_extents - 1, lpa;
+		int hit, lru_hit;
+
+		seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+		u = (double)(seed >> 11) / (double)(1ULL << 53) * sum;
+		while (lo < hi) {
+			uint64_t mid = (lo + hi) / 2;
+			if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+		}
+		lpa = perm[lo] * DMT_EXTENT + (seed % DMT_EXTENT);
+
+		hit = dmt_access (mt, lpa);
+		lru_hit = dmt_lru_access (&l, lpa / mt->nr_entires_per_dir_slot);
+		if (i == nr_warmup) {
+			atomic64_set (&mt->nr_lookups, 0);
+			atomic64_set (&mt->nr_hits, 0);
+		}
+		if (i >= nr_warmup) {
+			nr_hits += hit;
+			nr_lru_hits += lru_hit;
+		}
+	}
+	DMT_CHECK (atomic64_read (&mt->nr_hits) + 1 >= nr_hits && atomic64_read (&mt->nr_hits) <= nr_hits);
+
+	printf ("zipf=%.2f cache=%llu%% (%llu of %llu slots, %llu KB): hit ratio %.1f%% (plain LRU %.1f%%)\n",
+		theta, (unsigned long long)cache_pct,
+		(unsigned long long)mt->max_cached_dir_slots, (unsigned long long)nr_total_slots,
+		(unsigned long long)(mt->max_cached_dir_slots * DMT_PAGE_SIZE / 1024),
+		100.0 * nr_hits / nr_reads, 100.0 * nr_lru_hits / nr_reads);
+
+	bdbm_free (l.cached);
+	bdbm_free (l.next);
+	bdbm_free (l.prev);
+	bdbm_free (perm);
+	bdbm_free (cdf);
+	dmt_destroy (mt);
+}
+
+int main (int argc, char** argv)
+{
+	static const double thetas[] = { 0.8, 0.99, 1.2 };
+	static const uint64_t cache_pcts[] = { 5, 10, 20, 40 };
+	uint64_t i, j;
+
+	test_packed_entries ();
+	test_lookup ();
+	test_eviction ();
+	test_promotion ();
+	test_clean ();
+
+	if (nr_failed != 0) {
+		printf ("dftl_map_test: %llu checks failed\n", (unsigned long long)nr_failed);
+		return -1;
+	}
+	printf ("dftl_map_test: all checks passed\n");
+
+	if (argc > 1 && strcmp (argv[1], "-q") == 0)
+		return 0;
+
+	for (i = 0; i < sizeof (thetas) / sizeof (thetas[0]); i++)
+		for (j = 0; j < sizeof (cache_pcts) / sizeof (cache_pcts[0]); j++)
+			dmt_hit_ratio (thetas[i], cache_pcts[j]);
+
+	return (nr_failed != 0) ? -1 : 0;
+}
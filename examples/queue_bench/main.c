@@ -0,0 +1,197 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* queue-only microbenchmark for bdbm_prior_queue: several producers put
+ * requests into per-punit queues while a single consumer dispatches and
+ * completes them, as the llm thread does */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "bdbm_drv.h"
+#include "debug.h"
+#include "utime.h"
+#include "queue/prior_queue.h"
+
+struct qbench_args {
+	uint64_t nr_punits;
+	uint64_t nr_producers;
+	uint64_t nr_items;	/* per producer */
+	uint64_t nr_lpas;
+	uint64_t window;
+	uint64_t depth;	/* in-flight reqs per punit */
+};
+
+struct qbench_producer {
+	pthread_t thread;
+	uint64_t id;
+	uint64_t nr_retries;
+};
+
+static struct qbench_args args = {
+	.nr_punits = 64,
+	.nr_producers = 4,
+	.nr_items = 1000000,
+	.nr_lpas = 1 << 20,
+	.window = 8,
+	.depth = 1,
+};
+
+static bdbm_prior_queue_t* q = NULL;
+
+static void* qbench_producer_thread (void* arg)
+{
+	struct qbench_producer* pr = (struct qbench_producer*)arg;
+	uint64_t seed = pr->id * 2654435761ULL + 1;
+	uint64_t i;
+
+	for (i = 0; i < args.nr_items; i++) {
+		bdbm_prior_queue_attr_t a;
+		uint64_t lpa, qid;
+
+		/* xorshift; cheap enough not to hide the queue cost */
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		lpa = seed % args.nr_lpas;
+		qid = lpa % args.nr_punits;
+
+		a.lpa = lpa;
+		a.blk = lpa / args.nr_punits;
+		a.kind = PRIOR_QUEUE_KIND_READ;
+		a.prio = PRIOR_QUEUE_PRIO_NORMAL;
+		a.cls = 0;
+		a.deadline = 0;
+		while (bdbm_prior_queue_enqueue (q, qid, &a, (void*)(lpa + 1))) {
+			pr->nr_retries++;
+			sched_yield ();
+		}
+	}
+
+	return NULL;
+}
+
+/* each pass lets every punit have up to args.depth requests in flight and
+ * completes them at the end of the pass; returns the # of passes taken */
+static uint64_t qbench_consume (uint64_t nr_total)
+{
+	bdbm_prior_queue_item_t** inflight = NULL;
+	uint64_t nr_done = 0, nr_passes = 0;
+	uint64_t qid, i;
+
+	inflight = calloc (args.nr_punits * args.depth, sizeof (bdbm_prior_queue_item_t*));
+
+	while (nr_done < nr_total) {
+		uint64_t nr_dispatched = 0;
+
+		for (qid = 0; qid < args.nr_punits; qid++) {
+			for (i = 0; i < args.depth; i++) {
+				bdbm_prior_queue_item_t** qitem = &inflight[qid * args.depth + i];
+
+				if (bdbm_prior_queue_dequeue (q, qid, qitem) == NULL)
+					break;
+				nr_dispatched++;
+			}
+		}
+
+		for (qid = 0; qid < args.nr_punits * args.depth; qid++) {
+			if (inflight[qid] == NULL)
+				continue;
+			bdbm_prior_queue_remove (q, inflight[qid], qid / args.depth);
+			inflight[qid] = NULL;
+		}
+
+		/* let producers run if every queue was empty */
+		if (nr_dispatched == 0)
+			sched_yield ();
+		else
+			nr_passes++;
+		nr_done += nr_dispatched;
+	}
+
+	free (inflight);
+
+	return nr_passes;
+}
+
+int main (int argc, char** argv)
+{
+	struct qbench_producer* pr = NULL;
+	bdbm_stopwatch_t sw;
+	uint64_t nr_total, nr_retries = 0, nr_passes, elapsed_us, i;
+
+	if (argc > 1) args.nr_punits = strtoull (argv[1], NULL, 10);
+	if (argc > 2) args.nr_producers = strtoull (argv[2], NULL, 10);
+	if (argc > 3) args.nr_items = strtoull (argv[3], NULL, 10);
+	if (argc > 4) args.nr_lpas = strtoull (argv[4], NULL, 10);
+	if (argc > 5) args.window = strtoull (argv[5], NULL, 10);
+	if (argc > 6) args.depth = strtoull (argv[6], NULL, 10);
+	if (args.nr_punits == 0 || args.nr_producers == 0 || args.depth == 0) {
+		fprintf (stderr, "usage: %s [nr_punits] [nr_producers] [nr_items_per_producer] [nr_lpas] [window] [depth]\n", argv[0]);
+		return -1;
+	}
+	nr_total = args.nr_producers * args.nr_items;
+
+	if ((q = bdbm_prior_queue_create (args.nr_punits, INFINITE_PRIOR_QUEUE, args.window)) == NULL) {
+		bdbm_error ("bdbm_prior_queue_create failed");
+		return -1;
+	}
+	if ((pr = calloc (args.nr_producers, sizeof (struct qbench_producer))) == NULL) {
+		bdbm_error ("calloc failed");
+		bdbm_prior_queue_destroy (q);
+		return -1;
+	}
+
+	bdbm_stopwatch_start (&sw);
+	for (i = 0; i < args.nr_producers; i++) {
+		pr[i].id = i;
+		pthread_create (&pr[i].thread, NULL, qbench_producer_thread, &pr[i]);
+	}
+	nr_passes = qbench_consume (nr_total);
+	for (i = 0; i < args.nr_producers; i++) {
+		pthread_join (pr[i].thread, NULL);
+		nr_retries += pr[i].nr_retries;
+	}
+	elapsed_us = bdbm_stopwatch_get_elapsed_time_us (&sw);
+
+	printf ("punits=%llu producers=%llu items=%llu window=%llu depth=%llu: %llu us, %.2f Mops/s, "
+		"full-ring retries=%llu, slot utilization=%.1f%%\n",
+		(unsigned long long)args.nr_punits,
+		(unsigned long long)args.nr_producers,
+		(unsigned long long)nr_total,
+		(unsigned long long)args.window,
+		(unsigned long long)args.depth,
+		(unsigned long long)elapsed_us,
+		(double)nr_total / (elapsed_us ? elapsed_us : 1),
+		(unsigned long long)nr_retries,
+		100.0 * nr_total / (nr_passes * args.nr_punits * args.depth));
+
+	bdbm_prior_queue_destroy (q);
+	free (pr);
+
+	return 0;
+}
@@ -162,15 +162,17 @@ uint32_t blkio_stub_open (bdbm_drv_info_t* bdi)
 		return 1;
 	}
 
-	/* create hlm_reqs pool */
-	if (bdi->parm_dev.nr_subpages_per_page == 1)
+	/* create hlm_reqs pool; block-level FTLs map whole pages */
+	if (bdi->parm_dev.nr_subpages_per_page == 1 ||
+		bdi->parm_ftl.mapping_type == MAPPING_POLICY_BLOCK)
 		mapping_unit_size = bdi->parm_dev.page_main_size;
 	else
 		mapping_unit_size = KERNEL_PAGE_SIZE;
 
 	if ((p->hlm_reqs_pool = bdbm_hlm_reqs_pool_create (
 			mapping_unit_size,	/* mapping unit */
-			bdi->parm_dev.page_main_size	/* io unit */	
+			bdi->parm_dev.page_main_size,	/* io unit */
+			bdi->parm_dev.device_capacity_in_byte / mapping_unit_size	/* # of lpas */
 			)) == NULL) {
 		bdbm_warning ("bdbm_hlm_reqs_pool_create () failed");
 		return 1;
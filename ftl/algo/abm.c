@@ -174,10 +174,12 @@ bdbm_abm_info_t* bdbm_abm_create (
 	bai->list_head_clean = (struct list_head**)bdbm_zmalloc (sizeof (struct list_head*) * np->nr_channels);
 	bai->list_head_dirty = (struct list_head**)bdbm_zmalloc (sizeof (struct list_head*) * np->nr_channels);
 	bai->list_head_bad = (struct list_head**)bdbm_zmalloc (sizeof (struct list_head*) * np->nr_channels);
+	bai->anr_free_blks = (uint64_t**)bdbm_zmalloc (sizeof (uint64_t*) * np->nr_channels);
 	if (bai->list_head_free == NULL || 
 		bai->list_head_clean == NULL || 
 		bai->list_head_dirty == NULL || 
-		bai->list_head_bad == NULL) {
+		bai->list_head_bad == NULL ||
+		bai->anr_free_blks == NULL) {
 		bdbm_error ("bdbm_zmalloc failed");
 		goto fail;
 	}
@@ -192,11 +194,14 @@ bdbm_abm_info_t* bdbm_abm_create (
 			(sizeof (struct list_head) * np->nr_chips_per_channel);
 		bai->list_head_bad[loop] = (struct list_head*)bdbm_zmalloc 
 			(sizeof (struct list_head) * np->nr_chips_per_channel);
+		bai->anr_free_blks[loop] = (uint64_t*)bdbm_zmalloc 
+			(sizeof (uint64_t) * np->nr_chips_per_channel);
 
 		if (bai->list_head_free[loop] == NULL || 
 			bai->list_head_clean[loop] == NULL || 
 			bai->list_head_dirty[loop] == NULL ||
-			bai->list_head_bad[loop] == NULL) {
+			bai->list_head_bad[loop] == NULL ||
+			bai->anr_free_blks[loop] == NULL) {
 			bdbm_error ("bdbm_zmalloc failed");
 			goto fail;
 		}
@@ -264,6 +269,13 @@ void bdbm_abm_destroy (bdbm_abm_info_t* bai)
 			bdbm_free (bai->list_head_bad[loop]);
 		bdbm_free (bai->list_head_bad);
 	}
+	if (bai->anr_free_blks != NULL) {
+		for (loop = 0; loop < bai->np->nr_channels; loop++)
+			bdbm_free (bai->anr_free_blks[loop]);
+		bdbm_free (bai->anr_free_blks);
+	}
+	if (bai->pnr_blk_invalid != NULL)
+		bdbm_free (bai->pnr_blk_invalid);
 	if (bai->blocks != NULL) {
 		for (loop = 0; loop < bai->np->nr_blocks_per_ssd; loop++)
 			__bdbm_abm_destory_pst (bai->blocks[loop].pst);
@@ -468,10 +480,13 @@ void bdbm_abm_erase_block (
 	}
 	
 	// last page will be used meta information, so it will not have any valid date.
-	uint64_t meta_page_count = 1;			
-	blk->nr_invalid_subpages = meta_page_count * bai->np->nr_subpages_per_page;
-	uint8_t* pst = (uint8_t*)blk->pst + (bai->np->nr_pages_per_block - meta_page_count);
-	bdbm_memset (pst, 0x0, meta_page_count); // clear validbitmap.
+	// (only for FTLs that keep a pst; block-ftl writes every page of a block)
+	if (blk->pst) {
+		uint64_t meta_page_count = 1;
+		uint8_t* pst = (uint8_t*)blk->pst + (bai->np->nr_pages_per_block - meta_page_count);
+		blk->nr_invalid_subpages = meta_page_count * bai->np->nr_subpages_per_page;
+		bdbm_memset (pst, 0x0, meta_page_count); // clear validbitmap.
+	}
 
 	if ((channel_no == 0) && (chip_no == 0))
 	{
@@ -92,7 +92,7 @@ typedef struct {
 
 	uint64_t nr_gc_ondemand_threshold;
 	uint64_t nr_gc_background_threshold;
-	uint64_t anr_free_blks[8][8];
+	uint64_t** anr_free_blks;	/* # of free blocks per chip [channel][chip] */
 	uint32_t* pnr_blk_invalid;
 } bdbm_abm_info_t;
 
@@ -41,9 +41,10 @@ THE SOFTWARE.
 #include "debug.h"
 #include "abm.h"
 #include "umemory.h"
+#include "utime.h"
+#include "hlm_reqs_pool.h"
 #include "block_ftl.h"
 
-#define DBG_ALLOW_INPLACE_UPDATE
 /*#define ENABLE_LOG*/
 
 /* FTL interface */
@@ -88,8 +89,41 @@ typedef struct {
 	uint64_t block_no;
 	int64_t rw_pg_ofs; /* recently-written page offset */
 	uint8_t* pst;	/* status of pages in a block */
+	int64_t log_no;	/* log block absorbing overwrites (-1: none) */
+	int64_t hole_ofs;	/* a page a merge left erased for its overwrite (-1: none) */
 } bdbm_block_mapping_entry_t;
 
+/* a page-mapped log block (BAST); it belongs to one data block at a time */
+typedef struct {
+	uint8_t status;	/* BDBM_BFTL_BLOCK_STATUS */
+	uint64_t channel_no;
+	uint64_t chip_no;
+	uint64_t block_no;
+	int64_t rw_pg_ofs; /* recently-written page offset */
+	uint8_t is_seq;	/* page i of the log holds page i of the data block */
+	uint64_t seg_no;	/* the data block that owns the log */
+	uint64_t blk_no;
+	uint64_t last_used;	/* log clock of the last write */
+	int64_t* pg_map;	/* page offset -> the newest copy in the log (-1: none) */
+} bdbm_block_log_entry_t;
+
+enum BDBM_BFTL_MERGE_TYPE {
+	BFTL_MERGE_SWITCH = 0,
+	BFTL_MERGE_PARTIAL,
+	BFTL_MERGE_FULL,
+};
+
+/* a data block to merge in a merge pass */
+typedef struct {
+	uint64_t seg_no;
+	uint64_t blk_no;
+	uint8_t type;	/* BDBM_BFTL_MERGE_TYPE */
+	uint64_t req_ofs;	/* the first copy request in gc_hlm */
+	uint64_t nr_copies;
+	bdbm_abm_block_t* dst;	/* the new data block of a full merge */
+	int64_t hole;	/* the page being overwritten; it is left erased (-1: none) */
+} bdbm_block_merge_t;
+
 typedef struct {
 	uint64_t nr_segs;	/* a segment is the unit of mapping */
 	uint64_t nr_pgs_per_seg;	/* how many pages belong to a segment */
@@ -104,12 +138,39 @@ typedef struct {
 	uint64_t* nr_trim_pgs;
 	uint64_t* nr_valid_pgs;
 	int64_t nr_dead_segs;
+	uint64_t nr_gc_reqs;
+	bdbm_block_merge_t* merges;	/* up to one merge per channel in a pass */
+	bdbm_llm_req_t* gc_erase_reqs;
+
+	/* the data block replaced by the last merge with a hole; it keeps the 
+	 * previous copy of the hole for RMW until the next merge pass erases it */
+	bdbm_abm_block_t* retired;
+	bdbm_block_mapping_entry_t* retired_e;
+
+	/* log blocks for the hybrid mapping (0: pure block mapping) */
+	uint64_t nr_log_blks;
+	bdbm_block_log_entry_t* logs;
+	uint64_t log_clock;
+
+	/* write and merge statistics */
+	bdbm_stopwatch_t sw;
+	int64_t first_write_us;
+	int64_t last_write_us;
+	uint64_t nr_host_writes;
+	uint64_t nr_log_writes;
+	uint64_t nr_switch_merges;
+	uint64_t nr_partial_merges;
+	uint64_t nr_full_merges;
+	uint64_t nr_merge_copies;
+	uint64_t nr_merge_passes;
+	uint64_t nr_gc_erases;
 } bdbm_block_ftl_private_t;
 
 
 /* function prototypes */
 uint32_t __bdbm_block_ftl_do_gc_segment (bdbm_drv_info_t* bdi, uint64_t seg_no);
-uint32_t __bdbm_block_ftl_do_gc_block_merge (bdbm_drv_info_t* bdi, uint64_t seg_no, uint64_t blk_no);
+uint32_t __bdbm_block_ftl_do_gc_block_merge (bdbm_drv_info_t* bdi, uint64_t seg_no, uint64_t blk_no, int64_t hole);
+static uint32_t __bdbm_block_ftl_merge_logs (bdbm_drv_info_t* bdi, int64_t log_no);
 //uint32_t __hlm_rsd_make_rm_seg (bdbm_drv_info_t* bdi, uint32_t seg_no);
 
 
@@ -132,6 +193,42 @@ uint64_t __bdbm_block_ftl_get_page_ofs (bdbm_block_ftl_private_t *p, uint64_t lp
 	return (lpa % p->nr_pgs_per_seg) / p->nr_blks_per_seg;
 }
 
+static inline
+uint64_t __bdbm_block_ftl_get_lpa (bdbm_block_ftl_private_t *p, uint64_t seg_no, uint64_t blk_no, uint64_t page_ofs) 
+{
+	return seg_no * p->nr_pgs_per_seg + page_ofs * p->nr_blks_per_seg + blk_no;
+}
+
+static inline
+void __bdbm_block_ftl_reset_log (bdbm_block_log_entry_t* lg, uint64_t nr_pages_per_block)
+{
+	uint64_t i;
+
+	lg->status = BFTL_NOT_ALLOCATED;
+	lg->channel_no = -1;
+	lg->chip_no = -1;
+	lg->block_no = -1;
+	lg->rw_pg_ofs = -1;
+	lg->is_seq = 1;
+	lg->seg_no = -1;
+	lg->blk_no = -1;
+	lg->last_used = 0;
+	for (i = 0; i < nr_pages_per_block; i++)
+		lg->pg_map[i] = -1;
+}
+
+
+/* wait for the gc reqs sent to llm; hlm counts them in nr_llm_reqs_done
+ * (it does not unlock hlm_gc->done), as page-ftl waits for them */
+static void __bdbm_block_ftl_wait_gc_reqs (bdbm_hlm_req_gc_t* hlm_gc)
+{
+	bdbm_vclock_waiter_t w = { 0, 0 };
+
+	while (atomic64_read (&hlm_gc->nr_llm_reqs_done) != hlm_gc->nr_llm_reqs)
+		bdbm_vclock_block (&w);
+	bdbm_vclock_unblock (&w);
+}
+
 
 /* functions for block-level FTL */
 uint32_t bdbm_block_ftl_create (bdbm_drv_info_t* bdi)
@@ -169,7 +266,7 @@ uint32_t bdbm_block_ftl_create (bdbm_drv_info_t* bdi)
 	/* calculate # of mapping entries */
 	nr_blks_per_seg = np->nr_chips_per_channel * np->nr_channels;
 	nr_pgs_per_seg = np->nr_pages_per_block * nr_blks_per_seg;
-	nr_segs = np->nr_blocks_per_chip;
+	nr_segs = np->nr_blocks_per_chip / np->nr_planes;	/* see __bdbm_block_ftl_get_free_block */
 
 	/* intiailize variables for ftl */
 	p->nr_segs = nr_segs;
@@ -177,6 +274,10 @@ uint32_t bdbm_block_ftl_create (bdbm_drv_info_t* bdi)
 	p->nr_blks_per_seg = nr_blks_per_seg;
 	p->nr_pgs_per_seg = nr_pgs_per_seg;
 	p->abm = abm;
+	p->nr_gc_reqs = (nr_blks_per_seg > np->nr_channels * np->nr_pages_per_block) ? 
+		nr_blks_per_seg : np->nr_channels * np->nr_pages_per_block;
+	p->first_write_us = -1;
+	bdbm_stopwatch_start (&p->sw);
 
 	bdbm_spin_lock_init (&p->ftl_lock);
 
@@ -199,6 +300,8 @@ uint32_t bdbm_block_ftl_create (bdbm_drv_info_t* bdi)
 			p->mt[i][j].chip_no = -1;
 			p->mt[i][j].block_no = -1;
 			p->mt[i][j].rw_pg_ofs = -1;
+			p->mt[i][j].log_no = -1;
+			p->mt[i][j].hole_ofs = -1;
 			
 			/* initialized with BFTL_PG_FREE */
 			p->mt[i][j].pst = (uint8_t*)bdbm_zmalloc (sizeof (uint8_t) * np->nr_pages_per_block);
@@ -214,21 +317,53 @@ uint32_t bdbm_block_ftl_create (bdbm_drv_info_t* bdi)
 		goto fail;
 	} 
 
-	/* initialize gc_hlm */
+	/* initialize log blocks; RSD writes whole segments, so only block mapping uses them */
+	if (dp->mapping_type == MAPPING_POLICY_BLOCK)
+		p->nr_log_blks = dp->nr_log_blocks;
+	if (p->nr_log_blks > 0) {
+		if ((p->logs = (bdbm_block_log_entry_t*)bdbm_zmalloc 
+				(sizeof (bdbm_block_log_entry_t) * p->nr_log_blks)) == NULL) {
+			bdbm_error ("bdbm_zmalloc failed");
+			goto fail;
+		}
+		for (i = 0; i < p->nr_log_blks; i++) {
+			if ((p->logs[i].pg_map = (int64_t*)bdbm_malloc 
+					(sizeof (int64_t) * np->nr_pages_per_block)) == NULL) {
+				bdbm_error ("bdbm_malloc failed");
+				goto fail;
+			}
+			__bdbm_block_ftl_reset_log (&p->logs[i], np->nr_pages_per_block);
+		}
+	}
+
+	/* initialize gc_hlm; a merge pass copies up to a block of pages per channel,
+	 * and erases up to a data block and a log block per channel */
 	if ((p->gc_bab = (bdbm_abm_block_t**)bdbm_zmalloc 
 			(sizeof (bdbm_abm_block_t*) * p->nr_blks_per_seg)) == NULL) {
 		bdbm_error ("bdbm_zmalloc failed");
 		goto fail;
 	}
+	if ((p->merges = (bdbm_block_merge_t*)bdbm_zmalloc
+			(sizeof (bdbm_block_merge_t) * np->nr_channels)) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		goto fail;
+	}
+	if ((p->gc_erase_reqs = (bdbm_llm_req_t*)bdbm_zmalloc
+			(sizeof (bdbm_llm_req_t) * 
+			((p->nr_blks_per_seg > 2 * np->nr_channels + 1) ? p->nr_blks_per_seg : 2 * np->nr_channels + 1))) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		goto fail;
+	}
 	if ((p->gc_hlm.llm_reqs = (bdbm_llm_req_t*)bdbm_zmalloc
-			(sizeof (bdbm_llm_req_t) * p->nr_blks_per_seg)) == NULL) {
+			(sizeof (bdbm_llm_req_t) * p->nr_gc_reqs)) == NULL) {
 		bdbm_error ("bdbm_zmalloc failed");
 		goto fail;
 	}
 	bdbm_sema_init (&p->gc_hlm.done);
+	hlm_reqs_pool_allocate_llm_reqs (p->gc_hlm.llm_reqs, p->nr_gc_reqs, RP_MEM_PHY);
 
-	bdbm_msg ("nr_segs = %llu, nr_blks_per_seg = %llu, nr_pgs_per_seg = %llu",
-		p->nr_segs, p->nr_blks_per_seg, p->nr_pgs_per_seg);
+	bdbm_msg ("nr_segs = %llu, nr_blks_per_seg = %llu, nr_pgs_per_seg = %llu, nr_log_blks = %llu",
+		p->nr_segs, p->nr_blks_per_seg, p->nr_pgs_per_seg, p->nr_log_blks);
 
 	return 0;
 
@@ -245,14 +380,40 @@ void bdbm_block_ftl_destroy (
 
 	if (p == NULL)
 		return;
+	if (p->nr_host_writes > 0) {
+		uint64_t nr_writes = p->nr_host_writes + p->nr_merge_copies;
+		int64_t elapsed_us = p->last_write_us - p->first_write_us + 1;
+
+		bdbm_msg ("[BLOCK-FTL] log blocks: %llu, host writes: %llu (%llu absorbed by log blocks)",
+			p->nr_log_blks, p->nr_host_writes, p->nr_log_writes);
+		bdbm_msg ("[BLOCK-FTL] merges: switch %llu, partial %llu, full %llu in %llu passes (copies: %llu, erases: %llu)",
+			p->nr_switch_merges, p->nr_partial_merges, p->nr_full_merges, 
+			p->nr_merge_passes, p->nr_merge_copies, p->nr_gc_erases);
+		bdbm_msg ("[BLOCK-FTL] write amplification: %llu.%02llu, host write IOPS: %llu",
+			nr_writes / p->nr_host_writes, (nr_writes * 100 / p->nr_host_writes) % 100,
+			p->nr_host_writes * 1000000 / elapsed_us);
+	}
+	if (p->logs != NULL) {
+		for (i = 0; i < p->nr_log_blks; i++)
+			if (p->logs[i].pg_map)
+				bdbm_free (p->logs[i].pg_map);
+		bdbm_free (p->logs);
+	}
 	if (p->nr_valid_pgs != NULL)
 		bdbm_free (p->nr_valid_pgs);
 	if (p->nr_trim_pgs != NULL)
 		bdbm_free (p->nr_trim_pgs);
 	if (p->gc_bab)
 		bdbm_free (p->gc_bab);
-	if (p->gc_hlm.llm_reqs)
+	if (p->merges)
+		bdbm_free (p->merges);
+	if (p->gc_erase_reqs)
+		bdbm_free (p->gc_erase_reqs);
+	if (p->gc_hlm.llm_reqs) {
+		hlm_reqs_pool_release_llm_reqs (p->gc_hlm.llm_reqs, p->nr_gc_reqs, RP_MEM_PHY);
+		bdbm_sema_free (&p->gc_hlm.done);
 		bdbm_free (p->gc_hlm.llm_reqs);
+	}
 	if (p->mt != NULL) {
 		for (i = 0; i < p->nr_segs; i++) {
 			if (p->mt[i] != NULL) {
@@ -282,6 +443,8 @@ uint32_t bdbm_block_ftl_get_ppa (
 	uint64_t page_ofs;
 
 	segment_no = __bdbm_block_ftl_get_segment_no (p, lpa);
+	if (segment_no >= p->nr_segs)
+		return 1;
 	block_no = __bdbm_block_ftl_get_block_no (p, lpa);
 	page_ofs = __bdbm_block_ftl_get_page_ofs (p, lpa);
 	e = &p->mt[segment_no][block_no];
@@ -304,6 +467,30 @@ uint32_t bdbm_block_ftl_get_ppa (
 	bdbm_bug_on (e->chip_no == -1);
 	bdbm_bug_on (e->block_no == -1);
 
+	/* the previous copy of a hole stays in the retired block until it is written */
+	if (e->hole_ofs == page_ofs && p->retired_e == e) {
+		ppa->channel_no = p->retired->channel_no;
+		ppa->chip_no = p->retired->chip_no;
+		ppa->block_no = p->retired->block_no;
+		ppa->page_no = page_ofs;
+		ppa->punit_id = BDBM_GET_PUNIT_ID (bdi, ppa);
+		*sp_off = 0;
+		return 0;
+	}
+
+	/* the newest copy could be in the log block */
+	if (e->log_no != -1 && p->logs[e->log_no].pg_map[page_ofs] != -1) {
+		bdbm_block_log_entry_t* lg = &p->logs[e->log_no];
+
+		ppa->channel_no = lg->channel_no;
+		ppa->chip_no = lg->chip_no;
+		ppa->block_no = lg->block_no;
+		ppa->page_no = lg->pg_map[page_ofs];
+		ppa->punit_id = BDBM_GET_PUNIT_ID (bdi, ppa);
+		*sp_off = 0;
+		return 0;
+	}
+
 	/* return a phyical page address */
 	ppa->channel_no = e->channel_no;
 	ppa->chip_no = e->chip_no;
@@ -318,9 +505,6 @@ uint32_t bdbm_block_ftl_get_ppa (
 	return 0;
 }
 
-/* allocate a block one by one */
-static uint64_t problem_seg_no = -1;
-
 uint32_t __bdbm_block_ftl_is_allocated (
 	bdbm_drv_info_t* bdi, 
 	int64_t segment_no)
@@ -347,6 +531,155 @@ uint32_t __bdbm_block_ftl_is_allocated (
 	return nr_alloc_blks;
 }
 
+/* log blocks for the hybrid mapping */
+/* the device programs and erases all the planes of a block at once, so a
+ * block of block-ftl is a group of nr_planes adjacent blocks (as in page-ftl);
+ * only the first one is addressed, and its pages hold the data */
+static bdbm_abm_block_t* __bdbm_block_ftl_get_free_block (
+	bdbm_block_ftl_private_t* p, 
+	uint64_t channel_no, 
+	uint64_t chip_no)
+{
+	bdbm_device_params_t* np = p->abm->np;
+	bdbm_abm_block_t* b = NULL;
+	bdbm_abm_block_t* pb = NULL;
+	uint64_t plane;
+
+	for (plane = 0; plane < np->nr_planes; plane++) {
+		if ((pb = bdbm_abm_get_free_block_prepare (p->abm, channel_no, chip_no)) == NULL) {
+			while (plane-- > 0)
+				bdbm_abm_get_free_block_rollback (p->abm, &b[plane]);
+			return NULL;
+		}
+		if (plane == 0)
+			b = pb;
+		bdbm_bug_on (pb != &b[plane]);
+	}
+	for (plane = 0; plane < np->nr_planes; plane++)
+		bdbm_abm_get_free_block_commit (p->abm, &b[plane]);
+
+	return b;
+}
+
+static void __bdbm_block_ftl_erase_abm_block (
+	bdbm_block_ftl_private_t* p, 
+	uint64_t channel_no, 
+	uint64_t chip_no,
+	uint64_t block_no,
+	uint8_t is_bad)
+{
+	uint64_t plane;
+
+	for (plane = 0; plane < p->abm->np->nr_planes; plane++)
+		bdbm_abm_erase_block (p->abm, channel_no, chip_no, block_no + plane, is_bad);
+}
+
+static int64_t __bdbm_block_ftl_get_free_log (bdbm_block_ftl_private_t* p)
+{
+	uint64_t i;
+
+	for (i = 0; i < p->nr_log_blks; i++)
+		if (p->logs[i].status == BFTL_NOT_ALLOCATED)
+			return i;
+
+	return -1;
+}
+
+/* the least recently written log block; -1 matches any channel or chip */
+static int64_t __bdbm_block_ftl_get_victim_log (
+	bdbm_block_ftl_private_t* p, 
+	uint64_t channel_no, 
+	uint64_t chip_no)
+{
+	int64_t victim = -1;
+	uint64_t i;
+
+	for (i = 0; i < p->nr_log_blks; i++) {
+		bdbm_block_log_entry_t* lg = &p->logs[i];
+
+		if (lg->status != BFTL_ALLOCATED)
+			continue;
+		if (channel_no != -1 && lg->channel_no != channel_no)
+			continue;
+		if (chip_no != -1 && lg->chip_no != chip_no)
+			continue;
+		if (victim == -1 || lg->last_used < p->logs[victim].last_used)
+			victim = i;
+	}
+
+	return victim;
+}
+
+/* merge a log block on a chip to give a free block back to it */
+static uint32_t __bdbm_block_ftl_reclaim_log (
+	bdbm_drv_info_t* bdi, 
+	uint64_t channel_no, 
+	uint64_t chip_no)
+{
+	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
+	int64_t victim;
+
+	if ((victim = __bdbm_block_ftl_get_victim_log (p, channel_no, chip_no)) == -1)
+		return 1;
+
+	return __bdbm_block_ftl_do_gc_block_merge (bdi, 
+		p->logs[victim].seg_no, p->logs[victim].blk_no, -1);
+}
+
+static bdbm_block_log_entry_t* __bdbm_block_ftl_get_log (
+	bdbm_drv_info_t* bdi, 
+	uint64_t seg_no,
+	uint64_t blk_no)
+{
+	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
+	bdbm_block_mapping_entry_t* e = &p->mt[seg_no][blk_no];
+	bdbm_block_log_entry_t* lg = NULL;
+	bdbm_abm_block_t* b = NULL;
+	int64_t log_no;
+
+	if (e->log_no != -1)
+		return &p->logs[e->log_no];
+
+	/* if all the log blocks are in use, merge the least recently written one */
+	if ((log_no = __bdbm_block_ftl_get_free_log (p)) == -1) {
+		if ((log_no = __bdbm_block_ftl_get_victim_log (p, -1, -1)) == -1)
+			return NULL;
+		__bdbm_block_ftl_merge_logs (bdi, log_no);
+	}
+
+	/* a log block stays on the chip of its data block, so merges never cross chips */
+	if ((b = __bdbm_block_ftl_get_free_block (p, e->channel_no, e->chip_no)) == NULL) {
+		if (__bdbm_block_ftl_reclaim_log (bdi, e->channel_no, e->chip_no) != 0 ||
+			(b = __bdbm_block_ftl_get_free_block (p, e->channel_no, e->chip_no)) == NULL)
+			return NULL;
+	}
+
+	lg = &p->logs[log_no];
+	lg->status = BFTL_ALLOCATED;
+	lg->channel_no = b->channel_no;
+	lg->chip_no = b->chip_no;
+	lg->block_no = b->block_no;
+	lg->rw_pg_ofs = -1;
+	lg->is_seq = 1;
+	lg->seg_no = seg_no;
+	lg->blk_no = blk_no;
+	lg->last_used = ++p->log_clock;
+	e->log_no = log_no;
+
+	return lg;
+}
+
+static void __bdbm_block_ftl_release_log (
+	bdbm_drv_info_t* bdi, 
+	bdbm_block_mapping_entry_t* e)
+{
+	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+
+	__bdbm_block_ftl_reset_log (&p->logs[e->log_no], np->nr_pages_per_block);
+	e->log_no = -1;
+}
+
 int32_t __bdbm_block_ftl_allocate_segment (
 	bdbm_drv_info_t* bdi, 
 	int64_t segment_no)
@@ -362,14 +695,21 @@ int32_t __bdbm_block_ftl_allocate_segment (
 		bdbm_abm_block_t* b = NULL;
 
 		bdbm_bug_on (e->status != BFTL_NOT_ALLOCATED);
+
+		/* log blocks could hold the last free blocks of the chip */
+		if ((b = __bdbm_block_ftl_get_free_block (p, channel_no, chip_no)) == NULL &&
+			__bdbm_block_ftl_reclaim_log (bdi, channel_no, chip_no) == 0) {
+			b = __bdbm_block_ftl_get_free_block (p, channel_no, chip_no);
+		}
 	
-		if ((b = bdbm_abm_get_free_block_prepare (p->abm, channel_no, chip_no)) != NULL) {
-			bdbm_abm_get_free_block_commit (p->abm, b);
+		if (b != NULL) {
 			e->status = BFTL_ALLOCATED;
 			e->channel_no = b->channel_no;
 			e->chip_no = b->chip_no;
 			e->block_no = b->block_no;
 			e->rw_pg_ofs = -1;
+			e->log_no = -1;
+			e->hole_ofs = -1;
 		} else {
 			bdbm_error ("oops! bdbm_abm_get_free_block_prepare failed (%llu %llu)", channel_no, chip_no);
 			goto error;
@@ -388,13 +728,19 @@ uint32_t bdbm_block_ftl_get_free_ppa (
 	bdbm_phyaddr_t* ppa)
 {
 	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
 	bdbm_block_mapping_entry_t* e = NULL;
+	bdbm_block_log_entry_t* lg = NULL;
 	uint64_t segment_no;
 	uint64_t block_no;
 	int64_t page_ofs;
 	uint32_t ret = 1;
 
 	segment_no = __bdbm_block_ftl_get_segment_no (p, lpa);
+	if (segment_no >= p->nr_segs) {
+		bdbm_error ("oops! lpa %lld is beyond block-level mapping (%llu segments)", lpa, p->nr_segs);
+		return 1;
+	}
 
 	/* [STEP1] see if the desired segment is empty or full */
 	if (__bdbm_block_ftl_is_allocated (bdi, segment_no) == 0) {
@@ -425,10 +771,11 @@ uint32_t bdbm_block_ftl_get_free_ppa (
 	bdbm_bug_on (e == NULL);
 
 	/* [STEP4] is it already mapped? */
+retry:
 	if (e->status == BFTL_ALLOCATED) {
 		/* if so, see if the target block is writable or not */
-		if (e->rw_pg_ofs < page_ofs) {
-			/* [CASE 1] it is a writable block */
+		if (e->rw_pg_ofs < page_ofs || e->hole_ofs == page_ofs) {
+			/* [CASE 1] it is a writable block (or a hole left for this page) */
 			ppa->channel_no = e->channel_no;
 			ppa->chip_no = e->chip_no;
 			ppa->block_no = e->block_no;
@@ -436,7 +783,7 @@ uint32_t bdbm_block_ftl_get_free_ppa (
 			ppa->punit_id = BDBM_GET_PUNIT_ID (bdi, ppa);
 			ret = 0;
 
-			if ((e->rw_pg_ofs + 1) != page_ofs) {
+			if ((e->rw_pg_ofs + 1) != page_ofs && e->hole_ofs != page_ofs) {
 				bdbm_msg ("INFO: seg: %llu, %llu %lld", segment_no, (e->rw_pg_ofs + 1), page_ofs);
 			}
 
@@ -444,32 +791,28 @@ uint32_t bdbm_block_ftl_get_free_ppa (
 			bdbm_msg ("INFO: seg: %llu, lpa: %llu, rw_pg_ofs: %llu, page_ofs: %llu",
 				segment_no, lpa, e->rw_pg_ofs, page_ofs);
 			*/
-		} else {
-			/* [CASE 2] it is a not-writable block */
-#ifdef DBG_ALLOW_INPLACE_UPDATE
-			/* TODO: it will be an error case in our final implementation,
-			 * but we temporarly allows this case */
-			ppa->channel_no = e->channel_no;
-			ppa->chip_no = e->chip_no;
-			ppa->block_no = e->block_no;
-			ppa->page_no = page_ofs;
+		} else if (p->nr_log_blks > 0 && 
+				   (lg = __bdbm_block_ftl_get_log (bdi, segment_no, block_no)) != NULL) {
+			/* [CASE 2] an overwrite goes to the next page of the log block */
+			if (lg->rw_pg_ofs == np->nr_pages_per_block - 1) {
+				/* the log block is full; merge it and try again */
+				__bdbm_block_ftl_merge_logs (bdi, e->log_no);
+				goto retry;
+			}
+			ppa->channel_no = lg->channel_no;
+			ppa->chip_no = lg->chip_no;
+			ppa->block_no = lg->block_no;
+			ppa->page_no = lg->rw_pg_ofs + 1;
 			ppa->punit_id = BDBM_GET_PUNIT_ID (bdi, ppa);
 			ret = 0;
-
-			problem_seg_no = segment_no;
-
-			/*#else*/
-		
-			bdbm_msg("[%llu] [OVERWRITE] %llu %llu", 
-				segment_no,	p->nr_trim_pgs[segment_no], p->nr_valid_pgs[segment_no]);
-
-			bdbm_msg ("[%llu] [OVERWRITE] this should not occur (rw_pg_ofs:%lld page_ofs:%llu)", 
-				segment_no, e->rw_pg_ofs, page_ofs);
-
-			bdbm_msg ("[%llu] [# of trimmed pages = %llu, lpa = %llu",
-				segment_no, p->nr_trim_pgs[segment_no], lpa);
-			/*bdbm_bug_on (1);*/
-#endif
+		} else {
+			/* [CASE 3] no log block could absorb the overwrite; merge the block 
+			 * into a new one that leaves this page erased, and try again */
+			if (__bdbm_block_ftl_do_gc_block_merge (bdi, segment_no, block_no, page_ofs) != 0) {
+				bdbm_error ("oops! __bdbm_block_ftl_do_gc_block_merge failed (%llu %llu)", segment_no, block_no);
+				return 1;
+			}
+			goto retry;
 		}
 	} else {
 		bdbm_error ("'e->status' is not valid (%u)", e->status);
@@ -613,6 +956,49 @@ uint32_t bdbm_block_ftl_map_lpa_to_ppa (
 	page_ofs = __bdbm_block_ftl_get_page_ofs (p, lpa);
 	e = &p->mt[segment_no][block_no];
 
+	/* is it an overwrite absorbed by the log block? */
+	if (e->status == BFTL_ALLOCATED && e->log_no != -1 &&
+		p->logs[e->log_no].block_no == ppa->block_no) {
+		bdbm_block_log_entry_t* lg = &p->logs[e->log_no];
+
+		bdbm_bug_on (lg->channel_no != ppa->channel_no);
+		bdbm_bug_on (lg->chip_no != ppa->chip_no);
+		bdbm_bug_on (lg->rw_pg_ofs + 1 != ppa->page_no);
+
+		lg->rw_pg_ofs = ppa->page_no;
+		lg->pg_map[page_ofs] = ppa->page_no;
+		lg->last_used = ++p->log_clock;
+		if (ppa->page_no != page_ofs)
+			lg->is_seq = 0;
+
+		/* the old copy becomes stale, but the page itself stays valid */
+		if (e->pst[page_ofs] == BFTL_PG_INVALID)
+			p->nr_trim_pgs[segment_no]--;
+		if (e->pst[page_ofs] != BFTL_PG_VALID) {
+			e->pst[page_ofs] = BFTL_PG_VALID;
+			p->nr_valid_pgs[segment_no]++;
+		}
+		p->nr_log_writes++;
+
+		goto done;
+	}
+
+	/* is it an overwrite into the hole a merge left for it? the page is 
+	 * programmed after the later pages of the block, but it was never written */
+	if (e->status == BFTL_ALLOCATED && e->hole_ofs == page_ofs) {
+		bdbm_bug_on (e->block_no != ppa->block_no);
+
+		e->hole_ofs = -1;
+		if (e->rw_pg_ofs < page_ofs)
+			e->rw_pg_ofs = page_ofs;
+		if (e->pst[page_ofs] != BFTL_PG_VALID) {
+			e->pst[page_ofs] = BFTL_PG_VALID;
+			p->nr_valid_pgs[segment_no]++;
+		}
+
+		goto done;
+	}
+
 	bdbm_bug_on (e->pst[page_ofs] != BFTL_PG_FREE);
 
 	/* is it already mapped? */
@@ -644,6 +1030,10 @@ uint32_t bdbm_block_ftl_map_lpa_to_ppa (
 	p->nr_valid_pgs[segment_no]++;
 
 done:
+	if (p->nr_host_writes++ == 0)
+		p->first_write_us = bdbm_stopwatch_get_elapsed_time_us (&p->sw);
+	p->last_write_us = bdbm_stopwatch_get_elapsed_time_us (&p->sw);
+
 #ifdef ENABLE_LOG
 	bdbm_msg ("M: [%llu] lap: %llu, rw_pg_ofs: %llu, # of used pages: %llu", 
 		segment_no, lpa, e->rw_pg_ofs, p->nr_valid_pgs[segment_no]);
@@ -662,6 +1052,10 @@ uint32_t bdbm_block_ftl_invalidate_lpa (
 	uint64_t block_no;
 	uint64_t page_ofs;
 
+	/* hlm passes unused lpa slots of a request (-1) as well */
+	if (lpa < 0 || lpa >= p->nr_segs * p->nr_pgs_per_seg)
+		return 0;
+
 	segment_no = __bdbm_block_ftl_get_segment_no (p, lpa);
 	block_no = __bdbm_block_ftl_get_block_no (p, lpa);
 	page_ofs = __bdbm_block_ftl_get_page_ofs (p, lpa);
@@ -721,6 +1115,7 @@ uint32_t bdbm_block_ftl_invalidate_lpa (
 uint8_t bdbm_block_ftl_is_gc_needed (bdbm_drv_info_t* bdi, int64_t lpa)
 {
 	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
 	bdbm_block_mapping_entry_t* e = NULL;
 	uint64_t segment_no;
 	uint64_t block_no;
@@ -728,6 +1123,8 @@ uint8_t bdbm_block_ftl_is_gc_needed (bdbm_drv_info_t* bdi, int64_t lpa)
 	uint32_t ret = 0;
 
 	segment_no = __bdbm_block_ftl_get_segment_no (p, lpa);
+	if (segment_no >= p->nr_segs)
+		return 0;
 	block_no = __bdbm_block_ftl_get_block_no (p, lpa);
 	page_ofs = __bdbm_block_ftl_get_page_ofs (p, lpa);
 	e = &p->mt[segment_no][block_no];
@@ -738,14 +1135,22 @@ uint8_t bdbm_block_ftl_is_gc_needed (bdbm_drv_info_t* bdi, int64_t lpa)
 			/* see if all the segment are invalid */
 			if (p->nr_valid_pgs[segment_no] == 0) {
 				ret = 1; /* trigger GC */
+			} else if (p->nr_log_blks > 0) {
+				/* merge only if the overwrite cannot go to a log block */
+				if (e->log_no != -1)
+					ret = (p->logs[e->log_no].rw_pg_ofs == np->nr_pages_per_block - 1);
+				else
+					ret = (__bdbm_block_ftl_get_free_log (p) == -1);
 			} else {
 				bdbm_ftl_params* dp = BDBM_GET_DRIVER_PARAMS(bdi);
 				if (dp->mapping_type == MAPPING_POLICY_RSD) {
 					/* this case should not happen with RSD */
 					bdbm_error ("[%llu] OOPS!!! # of valid pages: %llu, # of trimmed pages: %llu",
 						segment_no,	p->nr_valid_pgs[segment_no], p->nr_trim_pgs[segment_no]);
+					ret = 1;
 				}
-				ret = 1;
+				/* with pure block mapping, get_free_ppa merges the block 
+				 * around the overwritten page (CASE 3) */
 			}
 		}
 	}
@@ -772,7 +1177,7 @@ uint32_t __bdbm_block_ftl_erase_block (bdbm_drv_info_t* bdi, uint64_t seg_no)
 
 		/* FIXME: this block has not been used -- it must be more general */
 		if (e->rw_pg_ofs == -1) {
-			bdbm_abm_erase_block (p->abm, e->channel_no, e->chip_no, e->block_no, 0);
+			__bdbm_block_ftl_erase_abm_block (p, e->channel_no, e->chip_no, e->block_no, 0);
 			continue;
 		}
 
@@ -802,28 +1207,73 @@ uint32_t __bdbm_block_ftl_erase_block (bdbm_drv_info_t* bdi, uint64_t seg_no)
 	hlm_gc->req_type = REQTYPE_GC_ERASE;
 	hlm_gc->nr_llm_reqs = j;
 	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
-	bdbm_sema_lock (&hlm_gc->done);
 	for (i = 0; i < j; i++) {
 		if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[i])) != 0) {
 			bdbm_error ("llm_make_req failed");
 			bdbm_bug_on (1);
 		}
 	}
-	bdbm_sema_lock (&hlm_gc->done);
-	bdbm_sema_unlock (&hlm_gc->done);
+	__bdbm_block_ftl_wait_gc_reqs (hlm_gc);
 
 	for (i = 0; i < j; i++) {
 		uint8_t is_bad = 0;
 		bdbm_abm_block_t* b = p->gc_bab[i];
 		if (hlm_gc->llm_reqs[i].ret != 0)
 			is_bad = 1; /* bad block */
-		bdbm_abm_erase_block (p->abm, b->channel_no, b->chip_no, b->block_no, is_bad);
+		__bdbm_block_ftl_erase_abm_block (p, b->channel_no, b->chip_no, b->block_no, is_bad);
 	}
+	p->nr_gc_erases += j;
 
 	/* measure gc elapsed time */
 	return 0;
 }
 
+static void __bdbm_block_ftl_submit_gc_reqs (
+	bdbm_drv_info_t* bdi, 
+	uint32_t req_type, 
+	bdbm_llm_req_t* reqs,
+	uint64_t nr_reqs)
+{
+	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
+	bdbm_hlm_req_gc_t* hlm_gc = &p->gc_hlm;
+	uint64_t i;
+
+	if (nr_reqs == 0)
+		return;
+
+	hlm_gc->req_type = req_type;
+	hlm_gc->nr_llm_reqs = nr_reqs;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	for (i = 0; i < nr_reqs; i++) {
+		reqs[i].req_type = req_type;
+		if ((bdi->ptr_llm_inf->make_req (bdi, &reqs[i])) != 0) {
+			bdbm_error ("llm_make_req failed");
+			bdbm_bug_on (1);
+		}
+	}
+	__bdbm_block_ftl_wait_gc_reqs (hlm_gc);
+}
+
+static void __bdbm_block_ftl_build_erase_req (
+	bdbm_drv_info_t* bdi,
+	bdbm_llm_req_t* r,
+	uint64_t channel_no,
+	uint64_t chip_no,
+	uint64_t block_no)
+{
+	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
+
+	r->req_type = REQTYPE_GC_ERASE;
+	r->logaddr.lpa[0] = -1ULL; /* lpa is not available now */
+	r->phyaddr.channel_no = channel_no;
+	r->phyaddr.chip_no = chip_no;
+	r->phyaddr.block_no = block_no;
+	r->phyaddr.page_no = 0;
+	r->phyaddr.punit_id = BDBM_GET_PUNIT_ID (bdi, (&r->phyaddr));
+	r->ptr_hlm_req = (void*)&p->gc_hlm;
+	r->ret = 0;
+}
+
 uint32_t __bdbm_block_ftl_do_gc_segment (
 	bdbm_drv_info_t* bdi,
 	uint64_t seg_no)
@@ -831,7 +1281,25 @@ uint32_t __bdbm_block_ftl_do_gc_segment (
 	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
 	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
 	bdbm_block_mapping_entry_t* e = NULL;
-	uint64_t i;
+	uint64_t i, nr_erases = 0;
+
+	/* step 2: drop the log blocks of the victim; all of their pages are dead */
+	for (i = 0; i < p->nr_blks_per_seg; i++) {
+		e = &p->mt[seg_no][i];
+		if (e->log_no != -1) {
+			bdbm_block_log_entry_t* lg = &p->logs[e->log_no];
+			__bdbm_block_ftl_build_erase_req (bdi, &p->gc_erase_reqs[nr_erases++],
+				lg->channel_no, lg->chip_no, lg->block_no);
+			__bdbm_block_ftl_release_log (bdi, e);
+		}
+	}
+	__bdbm_block_ftl_submit_gc_reqs (bdi, REQTYPE_GC_ERASE, p->gc_erase_reqs, nr_erases);
+	for (i = 0; i < nr_erases; i++) {
+		bdbm_llm_req_t* r = &p->gc_erase_reqs[i];
+		__bdbm_block_ftl_erase_abm_block (p, r->phyaddr.channel_no, r->phyaddr.chip_no, 
+			r->phyaddr.block_no, (r->ret != 0) ? 1 : 0);
+	}
+	p->nr_gc_erases += nr_erases;
 
 	/* step 3: erase all the blocks that belong to the victim */
 	if (__bdbm_block_ftl_erase_block (bdi, seg_no) != 0) {
@@ -858,6 +1326,7 @@ uint32_t __bdbm_block_ftl_do_gc_segment (
 		e->chip_no = -1;
 		e->block_no = -1;
 		e->rw_pg_ofs = -1;
+		e->hole_ofs = -1;
 		bdbm_memset (e->pst, BFTL_PG_FREE, sizeof (uint8_t) * np->nr_pages_per_block);
 	}
 
@@ -872,159 +1341,324 @@ uint32_t __bdbm_block_ftl_do_gc_segment (
 	return 0;
 }
 
-#include "hlm_reqs_pool.h"
+static void __bdbm_block_ftl_build_copy_req (
+	bdbm_drv_info_t* bdi,
+	bdbm_llm_req_t* r,
+	uint64_t lpa,
+	uint64_t channel_no,
+	uint64_t chip_no,
+	uint64_t block_no,
+	uint64_t page_no)
+{
+	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+	uint64_t i;
 
-uint32_t __bdbm_block_ftl_do_gc_block_merge (
+	hlm_reqs_pool_reset_fmain (&r->fmain, BDBM_MAX_PAGES);
+	hlm_reqs_pool_reset_logaddr (&r->logaddr, BDBM_MAX_PAGES);
+
+	/* a block-level lpa covers the whole page, so copy all of its subpages */
+	r->logaddr.lpa[0] = lpa;
+	for (i = 0; i < np->nr_subpages_per_page; i++)
+		r->fmain.kp_stt[i] = KP_STT_DATA;
+	r->req_type = REQTYPE_GC_READ;
+	r->phyaddr.channel_no = channel_no;
+	r->phyaddr.chip_no = chip_no;
+	r->phyaddr.block_no = block_no;
+	r->phyaddr.page_no = page_no;
+	r->phyaddr.punit_id = BDBM_GET_PUNIT_ID (bdi, (&r->phyaddr));
+	r->ptr_hlm_req = (void*)&p->gc_hlm;
+	r->ret = 0;
+}
+
+/* turn a copy read into a write to the same page offset of 'block_no' */
+static void __bdbm_block_ftl_retarget_copy_req (
 	bdbm_drv_info_t* bdi,
-	uint64_t seg_no,
-	uint64_t blk_no)
+	bdbm_llm_req_t* r,
+	uint64_t block_no)
 {
 	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
-	bdbm_block_mapping_entry_t* e = &p->mt[seg_no][blk_no];
 	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+	uint64_t i;
+
+	bdbm_bug_on (r->fmain.kp_stt[0] != KP_STT_DATA);
+
+	r->phyaddr.block_no = block_no;
+	r->phyaddr.page_no = __bdbm_block_ftl_get_page_ofs (p, r->logaddr.lpa[0]);
+	r->phyaddr.punit_id = BDBM_GET_PUNIT_ID (bdi, (&r->phyaddr));
+	for (i = 0; i < np->nr_subpages_per_page; i++)
+		((uint64_t*)r->foob.data)[i] = r->logaddr.lpa[0];
+}
+
+/* issue the copies of p->merges one from each merge in turn; make_req
+ * blocks while the punit of a request has no credit, so issuing the copies
+ * of a merge in a row would hold back the merges on the other channels */
+static void __bdbm_block_ftl_submit_copy_reqs (
+	bdbm_drv_info_t* bdi, 
+	uint32_t req_type, 
+	uint64_t nr_merges,
+	uint64_t nr_copies)
+{
+	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
 	bdbm_hlm_req_gc_t* hlm_gc = &p->gc_hlm;
-	uint64_t j, k, nr_valid_pgs = 0, nr_trim_pgs = 0;
+	uint64_t i, k, nr_issued = 0;
 
-	if (e->status == BFTL_NOT_ALLOCATED)
-		return 0; /* if it is, ignore it */
+	if (nr_copies == 0)
+		return;
 
-	/* ---------------------------------------------------------------- */
-	/* [STEP1] build hlm_req_gc for reads */
-	for (j = 0; j < np->nr_pages_per_block; j++) {
-		/* are there any valid page in a block */
-		if (e->pst[j] == BFTL_PG_VALID) {
-			bdbm_llm_req_t* r = &hlm_gc->llm_reqs[nr_valid_pgs++];
-
-			hlm_reqs_pool_reset_fmain (&r->fmain, BDBM_MAX_PAGES);
-			hlm_reqs_pool_reset_logaddr (&r->logaddr, BDBM_MAX_PAGES);
-
-			r->logaddr.lpa[0] = -1; /* the subpage contains new data */
-			r->fmain.kp_stt[0] = KP_STT_DATA;
-			r->req_type = REQTYPE_GC_READ;
-			r->phyaddr.channel_no = e->channel_no;
-			r->phyaddr.chip_no = e->chip_no;
-			r->phyaddr.block_no = e->block_no;
-			r->phyaddr.page_no = j;
-			r->phyaddr.punit_id = BDBM_GET_PUNIT_ID (bdi, (&r->phyaddr));
-			r->ptr_hlm_req = (void*)hlm_gc;
-			r->ret = 0;
-		} else if (e->pst[j] == BFTL_PG_INVALID) {
-			nr_trim_pgs++;
+	hlm_gc->req_type = req_type;
+	hlm_gc->nr_llm_reqs = nr_copies;
+	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
+	for (k = 0; nr_issued < nr_copies; k++) {
+		for (i = 0; i < nr_merges; i++) {
+			bdbm_block_merge_t* m = &p->merges[i];
+			bdbm_llm_req_t* r = &hlm_gc->llm_reqs[m->req_ofs + k];
+
+			if (k >= m->nr_copies)
+				continue;
+			r->req_type = req_type;
+			if ((bdi->ptr_llm_inf->make_req (bdi, r)) != 0) {
+				bdbm_error ("llm_make_req failed");
+				bdbm_bug_on (1);
+			}
+			nr_issued++;
 		}
 	}
+	__bdbm_block_ftl_wait_gc_reqs (hlm_gc);
+}
 
-	bdbm_msg ("[MERGE-BEGIN] valid: %llu invalid: %llu", nr_valid_pgs, nr_trim_pgs);
+/* merge data blocks with their log blocks (if any); the merges in 
+ * p->merges run as one pipeline, so that the reads, erases and programs 
+ * of the victims on different channels are in flight at the same time.
+ * switch and partial merges reuse a sequential log block, and
+ * a full merge gathers the newest copies into a fresh block */
+static uint32_t __bdbm_block_ftl_do_gc_merges (
+	bdbm_drv_info_t* bdi,
+	uint64_t nr_merges)
+{
+	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+	bdbm_hlm_req_gc_t* hlm_gc = &p->gc_hlm;
+	uint64_t i, j, nr_copies = 0, nr_erases = 0;
+
+	/* ---------------------------------------------------------------- */
+	/* [STEP1] choose a merge type by the log content and build reads */
+	for (i = 0; i < nr_merges; i++) {
+		bdbm_block_merge_t* m = &p->merges[i];
+		bdbm_block_mapping_entry_t* e = &p->mt[m->seg_no][m->blk_no];
+		bdbm_block_log_entry_t* lg = (e->log_no != -1) ? &p->logs[e->log_no] : NULL;
+
+		bdbm_bug_on (e->status != BFTL_ALLOCATED);
+
+		m->req_ofs = nr_copies;
+		m->dst = NULL;
+		if (lg != NULL && lg->is_seq && m->hole == -1) {
+			/* fill the rest of the log block with the valid pages of the data block */
+			m->type = (lg->rw_pg_ofs == np->nr_pages_per_block - 1) ? 
+				BFTL_MERGE_SWITCH : BFTL_MERGE_PARTIAL;
+			for (j = lg->rw_pg_ofs + 1; j < np->nr_pages_per_block; j++) {
+				if (e->pst[j] != BFTL_PG_VALID)
+					continue;
+				__bdbm_block_ftl_build_copy_req (bdi, &hlm_gc->llm_reqs[nr_copies++],
+					__bdbm_block_ftl_get_lpa (p, m->seg_no, m->blk_no, j),
+					e->channel_no, e->chip_no, e->block_no, j);
+			}
+		} else {
+			/* read the newest copy of every valid page */
+			m->type = BFTL_MERGE_FULL;
+			for (j = 0; j < np->nr_pages_per_block; j++) {
+				uint64_t lpa = __bdbm_block_ftl_get_lpa (p, m->seg_no, m->blk_no, j);
+
+				if (e->pst[j] != BFTL_PG_VALID || j == m->hole)
+					continue;
+				if (lg != NULL && lg->pg_map[j] != -1) {
+					__bdbm_block_ftl_build_copy_req (bdi, &hlm_gc->llm_reqs[nr_copies++], lpa,
+						lg->channel_no, lg->chip_no, lg->block_no, lg->pg_map[j]);
+				} else {
+					__bdbm_block_ftl_build_copy_req (bdi, &hlm_gc->llm_reqs[nr_copies++], lpa,
+						e->channel_no, e->chip_no, e->block_no, j);
+				}
+			}
+		}
+		m->nr_copies = nr_copies - m->req_ofs;
+	}
 
 	/* wait until Q in llm becomes empty 
 	 * TODO: it might be possible to further optimize this */
 	bdi->ptr_llm_inf->flush (bdi);
 
-	/* send read reqs to llm */
-	if (nr_valid_pgs > 0) {
-		hlm_gc->req_type = REQTYPE_GC_READ;
-		hlm_gc->nr_llm_reqs = nr_valid_pgs;
-		atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
-		bdbm_sema_lock (&hlm_gc->done);
-		for (j = 0; j < nr_valid_pgs; j++) {
-			if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[j])) != 0) {
-				bdbm_error ("llm_make_req failed");
-				bdbm_bug_on (1);
-			}
+	__bdbm_block_ftl_submit_copy_reqs (bdi, REQTYPE_GC_READ, nr_merges, nr_copies);
+
+	/* ---------------------------------------------------------------- */
+	/* [STEP2] erase the replaced blocks (do not consider wear-leveling now);
+	 * the copies are in memory, and a full merge leaves its chip a free block.
+	 * a merge with a hole keeps its old data block as the retired one, and 
+	 * the one retired before (no RMW reads it now) is erased instead */
+	if (p->retired != NULL) {
+		__bdbm_block_ftl_build_erase_req (bdi, &p->gc_erase_reqs[nr_erases++], 
+			p->retired->channel_no, p->retired->chip_no, p->retired->block_no);
+		if (p->retired_e->hole_ofs != -1) {
+			bdbm_warning ("the hole at %lld was never written", p->retired_e->hole_ofs);
 		}
-		bdbm_sema_lock (&hlm_gc->done);
-		bdbm_sema_unlock (&hlm_gc->done);
+		p->retired = NULL;
+		p->retired_e = NULL;
 	}
+	for (i = 0; i < nr_merges; i++) {
+		bdbm_block_merge_t* m = &p->merges[i];
+		bdbm_block_mapping_entry_t* e = &p->mt[m->seg_no][m->blk_no];
 
-	/* ---------------------------------------------------------------- */
-	/* [STEP2] erase a block (do not consider wear-leveling new) */
-	{
-		uint8_t is_bad = 0;
-		//bdbm_llm_req_t* r = &hlm_gc->llm_reqs[0];
-		bdbm_llm_req_t rr;
-		bdbm_llm_req_t* r = &rr;
-
-		/* setup an erase request */
-		r->req_type = REQTYPE_GC_ERASE;
-		r->logaddr.lpa[0] = -1ULL; /* lpa is not available now */
-		r->phyaddr.channel_no = e->channel_no;
-		r->phyaddr.chip_no = e->chip_no;
-		r->phyaddr.block_no = e->block_no;
-		r->phyaddr.page_no = 0;
-		r->phyaddr.punit_id = BDBM_GET_PUNIT_ID (bdi, (&r->phyaddr));
-		r->ptr_hlm_req = (void*)hlm_gc;
-		r->ret = 0;
-
-		/* send erase reqs to llm */
-		hlm_gc->req_type = REQTYPE_GC_ERASE;
-		hlm_gc->nr_llm_reqs = 1;
-		atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
-		bdbm_sema_lock (&hlm_gc->done);
-		if ((bdi->ptr_llm_inf->make_req (bdi, r)) != 0) {
-			bdbm_error ("llm_make_req failed");
-			bdbm_bug_on (1);
+		if (m->hole != -1) {
+			p->retired = bdbm_abm_get_block (p->abm, e->channel_no, e->chip_no, e->block_no);
+			p->retired_e = e;
+			continue;
+		}
+		__bdbm_block_ftl_build_erase_req (bdi, &p->gc_erase_reqs[nr_erases++], 
+			e->channel_no, e->chip_no, e->block_no);
+		if (m->type == BFTL_MERGE_FULL && e->log_no != -1) {
+			bdbm_block_log_entry_t* lg = &p->logs[e->log_no];
+			__bdbm_block_ftl_build_erase_req (bdi, &p->gc_erase_reqs[nr_erases++], 
+				lg->channel_no, lg->chip_no, lg->block_no);
 		}
-		bdbm_sema_lock (&hlm_gc->done);
-		bdbm_sema_unlock (&hlm_gc->done);
+	}
+	__bdbm_block_ftl_submit_gc_reqs (bdi, REQTYPE_GC_ERASE, p->gc_erase_reqs, nr_erases);
+	for (i = 0; i < nr_erases; i++) {
+		bdbm_llm_req_t* r = &p->gc_erase_reqs[i];
+		uint8_t is_bad = 0;
 
 		if (r->ret != 0)
 			is_bad = 1; /* bad block */
-		bdbm_abm_erase_block (p->abm, e->channel_no, e->chip_no, e->block_no, is_bad);
-
-		/* reset all the variables */
-		e->status = BFTL_NOT_ALLOCATED;
-		e->channel_no = -1;
-		e->chip_no = -1;
-		e->block_no = -1;
-		e->rw_pg_ofs = -1;
-		bdbm_memset (e->pst, BFTL_PG_FREE, sizeof (uint8_t) * np->nr_pages_per_block);
-
-		bdbm_bug_on (nr_trim_pgs > p->nr_trim_pgs[seg_no]);
-		bdbm_bug_on (nr_valid_pgs > p->nr_valid_pgs[seg_no]); 	
-		p->nr_trim_pgs[seg_no] -= nr_trim_pgs;
-		p->nr_valid_pgs[seg_no] -= nr_valid_pgs;
+		__bdbm_block_ftl_erase_abm_block (p, 
+			r->phyaddr.channel_no, r->phyaddr.chip_no, r->phyaddr.block_no, is_bad);
 	}
+	p->nr_gc_erases += nr_erases;
 
 	/* ---------------------------------------------------------------- */
-	/* [STEP3] build hlm_req_gc for writes */
-	if (nr_valid_pgs > 0) {
-		for (j = 0; j < nr_valid_pgs; j++) {
-			bdbm_llm_req_t* r = &hlm_gc->llm_reqs[j];
-
-			bdbm_bug_on (r->fmain.kp_stt[0] != KP_STT_DATA);
-
-			r->req_type = REQTYPE_GC_WRITE;	/* change to write */
-			r->logaddr.lpa[0] = ((uint64_t*)r->foob.data)[0];
-
-			if (bdbm_block_ftl_get_free_ppa (bdi, r->logaddr.lpa[0], &r->phyaddr) != 0) {
-				bdbm_error ("bdbm_page_ftl_get_free_ppa failed");
-				bdbm_bug_on (1);
-			}
-			if (bdbm_block_ftl_map_lpa_to_ppa (bdi, &r->logaddr, &r->phyaddr, 0) != 0) {
-				bdbm_error ("bdbm_page_ftl_map_lpa_to_ppa failed");
+	/* [STEP3] write the copies to their new data blocks */
+	for (i = 0; i < nr_merges; i++) {
+		bdbm_block_merge_t* m = &p->merges[i];
+		bdbm_block_mapping_entry_t* e = &p->mt[m->seg_no][m->blk_no];
+		uint64_t block_no;
+
+		if (m->type == BFTL_MERGE_FULL) {
+			if ((m->dst = __bdbm_block_ftl_get_free_block (p, e->channel_no, e->chip_no)) == NULL) {
+				bdbm_error ("oops! no free block to merge into (%llu %llu)", e->channel_no, e->chip_no);
 				bdbm_bug_on (1);
+				return 1;
 			}
+			block_no = m->dst->block_no;
+		} else {
+			block_no = p->logs[e->log_no].block_no;
 		}
+		for (j = m->req_ofs; j < m->req_ofs + m->nr_copies; j++)
+			__bdbm_block_ftl_retarget_copy_req (bdi, &hlm_gc->llm_reqs[j], block_no);
+	}
+	__bdbm_block_ftl_submit_copy_reqs (bdi, REQTYPE_GC_WRITE, nr_merges, nr_copies);
 
-		/* send write reqs to llm */
-		hlm_gc->req_type = REQTYPE_GC_WRITE;
-		hlm_gc->nr_llm_reqs = nr_valid_pgs;
-		atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
-		bdbm_sema_lock (&hlm_gc->done);
-		for (j = 0; j < nr_valid_pgs; j++) {
-			if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[j])) != 0) {
-				bdbm_error ("llm_make_req failed");
-				bdbm_bug_on (1);
+	/* ---------------------------------------------------------------- */
+	/* [STEP4] update the mapping entries */
+	for (i = 0; i < nr_merges; i++) {
+		bdbm_block_merge_t* m = &p->merges[i];
+		bdbm_block_mapping_entry_t* e = &p->mt[m->seg_no][m->blk_no];
+		int64_t rw_pg_ofs = -1;
+
+		switch (m->type) {
+		case BFTL_MERGE_SWITCH:
+		case BFTL_MERGE_PARTIAL:
+			rw_pg_ofs = p->logs[e->log_no].rw_pg_ofs;
+			e->block_no = p->logs[e->log_no].block_no;
+			if (m->type == BFTL_MERGE_SWITCH)
+				p->nr_switch_merges++;
+			else
+				p->nr_partial_merges++;
+			break;
+		case BFTL_MERGE_FULL:
+			e->block_no = m->dst->block_no;
+			p->nr_full_merges++;
+			break;
+		default:
+			bdbm_bug_on (1);
+			break;
+		}
+		if (m->nr_copies > 0)
+			rw_pg_ofs = hlm_gc->llm_reqs[m->req_ofs + m->nr_copies - 1].phyaddr.page_no;
+
+		/* trimmed pages have no copy in the new data block */
+		for (j = 0; j < np->nr_pages_per_block; j++) {
+			if (e->pst[j] == BFTL_PG_INVALID) {
+				e->pst[j] = BFTL_PG_FREE;
+				p->nr_trim_pgs[m->seg_no]--;
 			}
 		}
-		bdbm_sema_lock (&hlm_gc->done);
-		bdbm_sema_unlock (&hlm_gc->done);
+		e->rw_pg_ofs = rw_pg_ofs;
+		e->hole_ofs = m->hole;
+
+		if (e->log_no != -1)
+			__bdbm_block_ftl_release_log (bdi, e);
 	}
+	p->nr_merge_copies += nr_copies;
+	p->nr_merge_passes++;
 
-	bdbm_msg ("[MERGE-END] valid: %llu invalid: %llu", nr_valid_pgs, nr_trim_pgs);
+	bdbm_msg ("[MERGE] blocks: %llu copies: %llu erases: %llu (switch: %llu, partial: %llu, full: %llu)", 
+		nr_merges, nr_copies, nr_erases,
+		p->nr_switch_merges, p->nr_partial_merges, p->nr_full_merges);
 
 	return 0;
 }
 
+uint32_t __bdbm_block_ftl_do_gc_block_merge (
+	bdbm_drv_info_t* bdi,
+	uint64_t seg_no,
+	uint64_t blk_no,
+	int64_t hole)
+{
+	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
+
+	if (p->mt[seg_no][blk_no].status == BFTL_NOT_ALLOCATED)
+		return 0; /* if it is, ignore it */
+
+	p->merges[0].seg_no = seg_no;
+	p->merges[0].blk_no = blk_no;
+	p->merges[0].hole = hole;
+
+	return __bdbm_block_ftl_do_gc_merges (bdi, 1);
+}
+
+/* merge a log block; if the log pool is exhausted, the least recently 
+ * written log block of every other channel is merged along with it */
+static uint32_t __bdbm_block_ftl_merge_logs (
+	bdbm_drv_info_t* bdi,
+	int64_t log_no)
+{
+	bdbm_block_ftl_private_t* p = BDBM_FTL_PRIV (bdi);
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+	bdbm_block_log_entry_t* lg = &p->logs[log_no];
+	uint64_t nr_merges = 0;
+	uint64_t channel_no;
+	int64_t victim;
+
+	bdbm_bug_on (lg->status != BFTL_ALLOCATED);
+
+	p->merges[nr_merges].seg_no = lg->seg_no;
+	p->merges[nr_merges].blk_no = lg->blk_no;
+	p->merges[nr_merges].hole = -1;
+	nr_merges++;
+
+	if (__bdbm_block_ftl_get_free_log (p) == -1) {
+		for (channel_no = 0; channel_no < np->nr_channels; channel_no++) {
+			if (channel_no == lg->channel_no)
+				continue;
+			if ((victim = __bdbm_block_ftl_get_victim_log (p, channel_no, -1)) == -1)
+				continue;
+			p->merges[nr_merges].seg_no = p->logs[victim].seg_no;
+			p->merges[nr_merges].blk_no = p->logs[victim].blk_no;
+			p->merges[nr_merges].hole = -1;
+			nr_merges++;
+		}
+	}
+
+	return __bdbm_block_ftl_do_gc_merges (bdi, nr_merges);
+}
+
 uint32_t bdbm_block_ftl_do_gc (
 	bdbm_drv_info_t* bdi,
 	int64_t lpa)
@@ -1062,8 +1696,19 @@ uint32_t bdbm_block_ftl_do_gc (
 
 	if (p->nr_valid_pgs[segment_no] == 0) {
 		return __bdbm_block_ftl_do_gc_segment (bdi, segment_no);
+	} else if (p->nr_log_blks > 0 && p->mt[segment_no][block_no].log_no == -1) {
+		/* make room in the log pool for the coming overwrite */
+		int64_t victim;
+
+		if (__bdbm_block_ftl_get_free_log (p) != -1)
+			return 0;
+		if ((victim = __bdbm_block_ftl_get_victim_log (p, -1, -1)) == -1)
+			return 1;
+		return __bdbm_block_ftl_merge_logs (bdi, victim);
+	} else if (p->mt[segment_no][block_no].log_no != -1) {
+		return __bdbm_block_ftl_merge_logs (bdi, p->mt[segment_no][block_no].log_no);
 	} else
-		return __bdbm_block_ftl_do_gc_block_merge (bdi, segment_no, block_no);
+		return __bdbm_block_ftl_do_gc_block_merge (bdi, segment_no, block_no, -1);
 }
 
 uint64_t bdbm_block_ftl_get_segno (bdbm_drv_info_t* bdi, uint64_t lpa)
@@ -1119,15 +1764,13 @@ void __bdbm_block_ftl_badblock_scan_eraseblks (bdbm_drv_info_t* bdi, uint64_t bl
 	hlm_gc->req_type = REQTYPE_GC_ERASE;
 	hlm_gc->nr_llm_reqs = p->nr_blks_per_seg;
 	atomic64_set (&hlm_gc->nr_llm_reqs_done, 0);
-	bdbm_sema_lock (&hlm_gc->done);
 	for (i = 0; i < p->nr_blks_per_seg; i++) {
 		if ((bdi->ptr_llm_inf->make_req (bdi, &hlm_gc->llm_reqs[i])) != 0) {
 			bdbm_error ("llm_make_req failed");
 			bdbm_bug_on (1);
 		}
 	}
-	bdbm_sema_lock (&hlm_gc->done);
-	bdbm_sema_unlock (&hlm_gc->done);
+	__bdbm_block_ftl_wait_gc_reqs (hlm_gc);
 
 	for (i = 0; i < p->nr_blks_per_seg; i++) {
 		uint8_t is_bad = 0;
@@ -1189,10 +1832,14 @@ uint32_t bdbm_block_ftl_badblock_scan (bdbm_drv_info_t* bdi)
 			me[j].chip_no = -1;
 			me[j].block_no = -1;
 			me[j].rw_pg_ofs = -1;
+			me[j].log_no = -1;
+			me[j].hole_ofs = -1;
 			bdbm_memset ((uint8_t*)me[j].pst, BFTL_PG_FREE, sizeof (uint8_t) * np->nr_pages_per_block);
 		}
 		p->nr_trim_pgs[i] = 0;
 	}
+	for (i = 0; i < p->nr_log_blks; i++)
+		__bdbm_block_ftl_reset_log (&p->logs[i], np->nr_pages_per_block);
 	p->nr_dead_segs = 0;
 
 	/* step2: erase all the blocks */
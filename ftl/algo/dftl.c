@@ -73,6 +73,11 @@ bdbm_ftl_inf_t _ftl_dftl = {
 	.finish_mapblk_load = bdbm_dftl_finish_mapblk_load,
 };
 
+/* b->info: translation pages are written to their own blocks, 
+ * so that they are never mixed with data pages in a GC victim */
+#define DFTL_BLK_DATA	0
+#define DFTL_BLK_MAP	1
+
 typedef struct {
 	bdbm_abm_info_t* bai;
 	dftl_mapping_table_t* mt;
@@ -84,19 +89,36 @@ typedef struct {
 	uint64_t curr_page_ofs;
 	bdbm_abm_block_t** ac_bab;
 
+	/* active blocks for translation pages */
+	uint64_t map_puid;
+	uint64_t map_page_ofs;
+	bdbm_abm_block_t** ac_bab_map;
+
 	/* reserved for gc (reused whenever gc is invoked) */
 	bdbm_abm_block_t** gc_bab;
+	bdbm_abm_block_t** gc_bab_map;	/* translation-block victims */
 	bdbm_hlm_req_gc_t gc_hlm;
+	uint64_t* gc_order;	/* gc_hlm.llm_reqs sorted by translation page */
+
+	/* gc statistics */
+	uint64_t gc_nr_blks;
+	uint64_t gc_nr_map_blks;
+	uint64_t gc_nr_map_loads;	/* translation pages read by gc */
+	uint64_t gc_nr_map_dirtied;	/* clean translation pages dirtied by gc */
 
 	/* for bad-block scanning */
 	bdbm_sema_t badblk;
+
+	/* for batched mapping-page loads */
+	bdbm_sema_t fetch_lock;
 } bdbm_dftl_private_t;
 
 
 uint32_t __bdbm_dftl_get_active_blocks (
 	bdbm_device_params_t* np,
 	bdbm_abm_info_t* bai,
-	bdbm_abm_block_t** bab)
+	bdbm_abm_block_t** bab,
+	uint8_t kind)
 {
 	uint64_t i, j;
 
@@ -106,6 +128,7 @@ uint32_t __bdbm_dftl_get_active_blocks (
 			/* prepare & commit free blocks */
 			if ((*bab = bdbm_abm_get_free_block_prepare (bai, i, j))) {
 				bdbm_abm_get_free_block_commit (bai, *bab);
+				(*bab)->info = kind;
 				/*bdbm_msg ("active blk = %p", *bab);*/
 				bab++;
 			} else {
@@ -120,7 +143,8 @@ uint32_t __bdbm_dftl_get_active_blocks (
 
 bdbm_abm_block_t** __bdbm_dftl_create_active_blocks (
 	bdbm_device_params_t* np,
-	bdbm_abm_info_t* bai)
+	bdbm_abm_info_t* bai,
+	uint8_t kind)
 {
 	uint64_t nr_punits;
 	bdbm_abm_block_t** bab = NULL;
@@ -137,7 +161,7 @@ bdbm_abm_block_t** __bdbm_dftl_create_active_blocks (
 	}
 
 	/* get a set of free blocks for active blocks */
-	if (__bdbm_dftl_get_active_blocks (np, bai, bab) != 0) {
+	if (__bdbm_dftl_get_active_blocks (np, bai, bab, kind) != 0) {
 		bdbm_error ("__bdbm_dftl_get_active_blocks failed");
 		goto fail;
 	}
@@ -178,6 +202,7 @@ uint32_t bdbm_dftl_create (bdbm_drv_info_t* bdi)
 	p->curr_page_ofs = 0;
 	p->nr_punits = np->nr_chips_per_channel * np->nr_channels;
 	bdbm_spin_lock_init (&p->ftl_lock);
+	bdbm_sema_init (&p->fetch_lock);
 	_ftl_dftl.ptr_private = (void*)p;
 
 	/* create 'bdbm_abm_info' with pst */
@@ -188,14 +213,20 @@ uint32_t bdbm_dftl_create (bdbm_drv_info_t* bdi)
 	}
 
 	/* create a mapping table */
-	if ((p->mt = bdbm_dftl_create_mapping_table (np)) == NULL) {
+	if ((p->mt = bdbm_dftl_create_mapping_table (np, 
+			(uint64_t)bdi->parm_ftl.dftl_cache_kb * 1024)) == NULL) {
 		bdbm_error ("__bdbm_dftl_create_mapping_table failed");
 		bdbm_dftl_destroy (bdi);
 		return 1;
 	}
 
 	/* allocate active blocks */
-	if ((p->ac_bab = __bdbm_dftl_create_active_blocks (np, p->bai)) == NULL) {
+	if ((p->ac_bab = __bdbm_dftl_create_active_blocks (np, p->bai, DFTL_BLK_DATA)) == NULL) {
+		bdbm_error ("__bdbm_dftl_create_active_blocks failed");
+		bdbm_dftl_destroy (bdi);
+		return 1;
+	}
+	if ((p->ac_bab_map = __bdbm_dftl_create_active_blocks (np, p->bai, DFTL_BLK_MAP)) == NULL) {
 		bdbm_error ("__bdbm_dftl_create_active_blocks failed");
 		bdbm_dftl_destroy (bdi);
 		return 1;
@@ -208,12 +239,24 @@ uint32_t bdbm_dftl_create (bdbm_drv_info_t* bdi)
 		bdbm_dftl_destroy (bdi);
 		return 1;
 	}
+	if ((p->gc_bab_map = (bdbm_abm_block_t**)bdbm_zmalloc 
+			(sizeof (bdbm_abm_block_t*) * p->nr_punits)) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		bdbm_dftl_destroy (bdi);
+		return 1;
+	}
 	if ((p->gc_hlm.llm_reqs = (bdbm_llm_req_t*)bdbm_zmalloc
 			(sizeof (bdbm_llm_req_t) * p->nr_punits * np->nr_pages_per_block)) == NULL) {
 		bdbm_error ("bdbm_zmalloc failed");
 		bdbm_dftl_destroy (bdi);
 		return 1;
 	}
+	if ((p->gc_order = (uint64_t*)bdbm_zmalloc
+			(sizeof (uint64_t) * p->nr_punits * np->nr_pages_per_block)) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		bdbm_dftl_destroy (bdi);
+		return 1;
+	}
 
 	while (i < p->nr_punits * np->nr_pages_per_block) {
 		bdbm_llm_req_t* r = &p->gc_hlm.llm_reqs[i];
@@ -237,6 +280,16 @@ void bdbm_dftl_destroy (bdbm_drv_info_t* bdi)
 	if (!p)
 		return;
 
+	if (p->gc_nr_blks) {
+		bdbm_msg ("[dftl] gc: %llu blocks (%llu translation blocks), "
+			"translation pages per block: %llu.%02llu loaded, %llu.%02llu dirtied",
+			p->gc_nr_blks, p->gc_nr_map_blks,
+			p->gc_nr_map_loads / p->gc_nr_blks, 
+			(p->gc_nr_map_loads * 100 / p->gc_nr_blks) % 100,
+			p->gc_nr_map_dirtied / p->gc_nr_blks, 
+			(p->gc_nr_map_dirtied * 100 / p->gc_nr_blks) % 100);
+	}
+
 	if (p->gc_hlm.llm_reqs) {
 		uint64_t i = 0, j = 0;
 		uint64_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;	/* e.g., 2 = 8 KB / 4 KB */
@@ -250,14 +303,21 @@ void bdbm_dftl_destroy (bdbm_drv_info_t* bdi)
 		}
 		bdbm_free (p->gc_hlm.llm_reqs);
 	}
+	if (p->gc_order)
+		bdbm_free (p->gc_order);
+	if (p->gc_bab_map)
+		bdbm_free (p->gc_bab_map);
 	if (p->gc_bab)
 		bdbm_free (p->gc_bab);
+	if (p->ac_bab_map)
+		__bdbm_dftl_destroy_active_blocks (p->ac_bab_map);
 	if (p->ac_bab)
 		__bdbm_dftl_destroy_active_blocks (p->ac_bab);
 	if (p->mt) 
 		bdbm_dftl_destroy_mapping_table (p->mt);
 	if (p->bai)
 		bdbm_abm_destroy (p->bai);
+	bdbm_sema_free (&p->fetch_lock);
 	bdbm_free (p);
 }
 
@@ -269,16 +329,22 @@ uint32_t bdbm_dftl_get_free_ppa (bdbm_drv_info_t* bdi, uint64_t lpa, bdbm_phyadd
 	uint64_t curr_channel;
 	uint64_t curr_chip;
 
+	/* translation pages (lpa = -2) go to their own active blocks */
+	uint8_t kind = ((int64_t)lpa == -2LL) ? DFTL_BLK_MAP : DFTL_BLK_DATA;
+	uint64_t* curr_puid = (kind == DFTL_BLK_MAP) ? &p->map_puid : &p->curr_puid;
+	uint64_t* curr_page_ofs = (kind == DFTL_BLK_MAP) ? &p->map_page_ofs : &p->curr_page_ofs;
+	bdbm_abm_block_t** ac_bab = (kind == DFTL_BLK_MAP) ? p->ac_bab_map : p->ac_bab;
+
 	/* get the channel & chip numbers */
-	curr_channel = p->curr_puid % np->nr_channels;
-	curr_chip = p->curr_puid / np->nr_channels;
+	curr_channel = *curr_puid % np->nr_channels;
+	curr_chip = *curr_puid / np->nr_channels;
 
 	/* get the physical offset of the active blocks */
-	b = p->ac_bab[curr_channel * np->nr_chips_per_channel + curr_chip];
+	b = ac_bab[curr_channel * np->nr_chips_per_channel + curr_chip];
 	ppa->channel_no =  b->channel_no;
 	ppa->chip_no = b->chip_no;
 	ppa->block_no = b->block_no;
-	ppa->page_no = p->curr_page_ofs;
+	ppa->page_no = *curr_page_ofs;
 	ppa->punit_id = BDBM_GET_PUNIT_ID (bdi, ppa);
 
 	/* check some error cases before returning the physical address */
@@ -287,14 +353,14 @@ uint32_t bdbm_dftl_get_free_ppa (bdbm_drv_info_t* bdi, uint64_t lpa, bdbm_phyadd
 	bdbm_bug_on (ppa->page_no >= np->nr_pages_per_block);
 
 	/* go to the next parallel unit */
-	if ((p->curr_puid + 1) == p->nr_punits) {
-		p->curr_puid = 0;
-		p->curr_page_ofs++;	/* go to the next page */
+	if ((*curr_puid + 1) == p->nr_punits) {
+		*curr_puid = 0;
+		(*curr_page_ofs)++;	/* go to the next page */
 
 		/* see if there are sufficient free pages or not */
-		if (p->curr_page_ofs == np->nr_pages_per_block) {
+		if (*curr_page_ofs == np->nr_pages_per_block) {
 			/* get active blocks */
-			if (__bdbm_dftl_get_active_blocks (np, p->bai, p->ac_bab) != 0) {
+			if (__bdbm_dftl_get_active_blocks (np, p->bai, ac_bab, kind) != 0) {
 				/*
 				bdbm_msg ("free_blks: %llu clean_blks: %llu, dirty_blks: %llu, total_blks: %llu",
 						bdbm_abm_get_nr_free_blocks (p->bai),
@@ -308,11 +374,11 @@ uint32_t bdbm_dftl_get_free_ppa (bdbm_drv_info_t* bdi, uint64_t lpa, bdbm_phyadd
 			}
 			/* ok; go ahead with 0 offset */
 			/*bdbm_msg ("curr_puid = %llu", p->curr_puid);*/
-			p->curr_page_ofs = 0;
+			*curr_page_ofs = 0;
 		}
 	} else {
 		/*bdbm_msg ("curr_puid = %llu", p->curr_puid);*/
-		p->curr_puid++;
+		(*curr_puid)++;
 	}
 
 	return 0;
@@ -505,38 +571,113 @@ bdbm_abm_block_t* __bdbm_dftl_victim_selection (
 }
 
 /* VICTIM SELECTION - Greedy:
- * select a dirty block with a small number of valid pages */
-bdbm_abm_block_t* __bdbm_dftl_victim_selection_greedy (
+ * select a dirty data block and a dirty translation block with a small 
+ * number of valid pages; the dirty list is walked once for both kinds */
+void __bdbm_dftl_victim_selection_greedy (
 	bdbm_drv_info_t* bdi,
 	uint64_t channel_no,
-	uint64_t chip_no)
+	uint64_t chip_no,
+	bdbm_abm_block_t** vd,
+	bdbm_abm_block_t** vm)
 {
 	bdbm_dftl_private_t* p = _ftl_dftl.ptr_private;
 	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
 	bdbm_abm_block_t* a = NULL;
+	bdbm_abm_block_t* m = NULL;
 	bdbm_abm_block_t* b = NULL;
-	bdbm_abm_block_t* v = NULL;
+	bdbm_abm_block_t** v = NULL;
 	struct list_head* pos = NULL;
 
 	a = p->ac_bab[channel_no*np->nr_chips_per_channel + chip_no];
+	m = p->ac_bab_map[channel_no*np->nr_chips_per_channel + chip_no];
+	*vd = *vm = NULL;
 
 	bdbm_abm_list_for_each_dirty_block (pos, p->bai, channel_no, chip_no) {
 		b = bdbm_abm_fetch_dirty_block (pos);
-		if (a == b)
-			continue;
-		if (b->nr_invalid_pages == np->nr_pages_per_block) {
-			v = b;
-			break;
-		}
-		if (v == NULL) {
-			v = b;
+		if (a == b || m == b)
 			continue;
+		v = (b->info == DFTL_BLK_MAP) ? vm : vd;
+		if (*v != NULL && (*v)->nr_invalid_subpages == np->nr_subpages_per_block)
+			continue; /* nothing beats a fully invalid block */
+		if (*v == NULL || b->nr_invalid_subpages > (*v)->nr_invalid_subpages)
+			*v = b;
+	}
+}
+
+/* select one data victim and one translation victim per parallel unit 
+ * into bab and bab_map; nr_data_invalid and nr_map_invalid get the # of 
+ * invalid pages each set frees, or 0 if some unit has no victim of it */
+static void __bdbm_dftl_select_victims (
+	bdbm_drv_info_t* bdi,
+	bdbm_abm_block_t** bab,
+	bdbm_abm_block_t** bab_map,
+	uint64_t* nr_data_invalid,
+	uint64_t* nr_map_invalid)
+{
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+	uint64_t i, j, k = 0;
+	uint8_t no_data = 0, no_map = 0;
+
+	*nr_data_invalid = *nr_map_invalid = 0;
+	for (i = 0; i < np->nr_channels; i++) {
+		for (j = 0; j < np->nr_chips_per_channel; j++, k++) {
+			__bdbm_dftl_victim_selection_greedy (bdi, i, j, &bab[k], &bab_map[k]);
+			if (bab[k] == NULL)
+				no_data = 1;
+			else
+				*nr_data_invalid += bab[k]->nr_invalid_subpages;
+			if (bab_map[k] == NULL)
+				no_map = 1;
+			else
+				*nr_map_invalid += bab_map[k]->nr_invalid_subpages;
 		}
-		if (a->nr_invalid_pages > v->nr_invalid_pages)
-			v = b;
 	}
 
-	return v;
+	if (no_data)
+		*nr_data_invalid = 0;
+	if (no_map)
+		*nr_map_invalid = 0;
+}
+
+/* sort gc reqs by the translation page of their lpa, so that relocated 
+ * pages that share a translation page are fetched and remapped together; 
+ * translation pages and unmapped pages go to the end */
+static uint64_t __bdbm_dftl_gc_key (
+	bdbm_dftl_private_t* p,
+	bdbm_device_params_t* np,
+	bdbm_llm_req_t* r)
+{
+	uint64_t lpa = ((uint64_t*)r->foob.data)[0];
+
+	/* -1 (unmapped) and -2 (translation page) are above any valid lpa */
+	if (lpa >= np->nr_pages_per_ssd)
+		return -1ULL;
+	return lpa / p->mt->nr_entires_per_dir_slot;
+}
+
+static void __bdbm_dftl_sort_gc_reqs (
+	bdbm_dftl_private_t* p,
+	bdbm_device_params_t* np,
+	uint64_t nr_llm_reqs)
+{
+	bdbm_llm_req_t* reqs = p->gc_hlm.llm_reqs;
+	uint64_t* order = p->gc_order;
+	uint64_t gap, i, j, t;
+
+	for (i = 0; i < nr_llm_reqs; i++)
+		order[i] = i;
+
+	/* shell sort; a victim set is at most a few thousand pages */
+	for (gap = nr_llm_reqs / 2; gap > 0; gap /= 2) {
+		for (i = gap; i < nr_llm_reqs; i++) {
+			t = order[i];
+			for (j = i; j >= gap && 
+					__bdbm_dftl_gc_key (p, np, &reqs[order[j - gap]]) > 
+					__bdbm_dftl_gc_key (p, np, &reqs[t]); j -= gap)
+				order[j] = order[j - gap];
+			order[j] = t;
+		}
+	}
 }
 
 /* TODO: need to improve it for background gc */
@@ -545,33 +686,33 @@ uint32_t bdbm_dftl_do_gc (bdbm_drv_info_t* bdi)
 	bdbm_dftl_private_t* p = _ftl_dftl.ptr_private;
 	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
 	bdbm_hlm_req_gc_t* hlm_gc = &p->gc_hlm;
+	bdbm_abm_block_t** bab = p->gc_bab;
 	uint64_t nr_gc_blks = 0;
 	uint64_t nr_llm_reqs = 0;
 	uint64_t nr_punits = 0;
+	uint64_t nr_data_invalid, nr_map_invalid;
 	uint64_t i, j;
 
 	nr_punits = np->nr_channels * np->nr_chips_per_channel;
 
-	/* choose victim blocks for individual parallel units */
-	bdbm_memset (p->gc_bab, 0x00, sizeof (bdbm_abm_block_t*) * nr_punits);
-	for (i = 0, nr_gc_blks = 0; i < np->nr_channels; i++) {
-		for (j = 0; j < np->nr_chips_per_channel; j++) {
-			bdbm_abm_block_t* b; 
-			if ((b = __bdbm_dftl_victim_selection_greedy (bdi, i, j))) {
-				p->gc_bab[nr_gc_blks] = b;
-				nr_gc_blks++;
-			}
-		}
-	}
-	if (nr_gc_blks < nr_punits) {
+	/* choose victim blocks for individual parallel units; a round takes
+	 * either data blocks or translation blocks, whichever frees more */
+	__bdbm_dftl_select_victims (bdi, p->gc_bab, p->gc_bab_map, 
+		&nr_data_invalid, &nr_map_invalid);
+	if (nr_map_invalid > nr_data_invalid) {
+		bab = p->gc_bab_map;
+		p->gc_nr_map_blks += nr_punits;
+	} else if (nr_data_invalid == 0) {
 		/* TODO: we need to implement a load balancing feature to avoid this */
 		/*bdbm_warning ("TODO: this warning will be removed with load-balancing");*/
 		return 0;
 	}
+	nr_gc_blks = nr_punits;
+	p->gc_nr_blks += nr_gc_blks;
 
 	/* build hlm_req_gc for reads */
 	for (i = 0, nr_llm_reqs = 0; i < nr_gc_blks; i++) {
-		bdbm_abm_block_t* b = p->gc_bab[i];
+		bdbm_abm_block_t* b = bab[i];
 		if (b == NULL)
 			break;
 		for (j = 0; j < np->nr_pages_per_block; j++) {
@@ -613,49 +754,55 @@ uint32_t bdbm_dftl_do_gc (bdbm_drv_info_t* bdi)
 	bdbm_sema_lock (&hlm_gc->gc_done);
 	bdbm_sema_unlock (&hlm_gc->gc_done);
 
+	/* group the relocated pages by translation page */
+	__bdbm_dftl_sort_gc_reqs (p, np, nr_llm_reqs);
+
 	/* load mapping entries that do existing in DRAM */
 	{
-		bdbm_llm_req_t** rr = (bdbm_llm_req_t**)bdbm_malloc (sizeof (bdbm_llm_req_t*)*nr_llm_reqs);
+		bdbm_dftl_fetch_t* f = NULL;
 
-		/* FIXME: need to improve to exploit parallelism */
+		if ((f = bdbm_dftl_fetch_create (nr_llm_reqs)) == NULL) {
+			bdbm_error ("bdbm_dftl_fetch_create failed");
+			bdbm_bug_on (1);
+		}
+
+		/* send the loads of all the missing slots at once */
 		for (i = 0; i < nr_llm_reqs; i++) {
-			uint64_t lpa = ((uint64_t*)hlm_gc->llm_reqs[i].ptr_oob)[0]; /* update LPA */
+			uint64_t lpa = ((uint64_t*)hlm_gc->llm_reqs[p->gc_order[i]].foob.data)[0]; /* update LPA */
 
 			/* is it a mapping entry? */
 			if ((int64_t)lpa == -2LL) {
 				continue;
 			}
 
-			if ((int64_t)lpa >= np->nr_pages_per_ssd || (int64_t)lpa < 0) {
+			if (lpa >= np->nr_pages_per_ssd) {
 				/*bdbm_msg ("what??? %llu", lpa);*/
 				continue;
 			}
 
-			/* see if lpa exists in DRAM */
-			if (bdbm_dftl_check_mapblk (bdi, lpa) == 0) 
-				continue;	/* a mapping entry exists, so go to the next req */
-
 			/* load missing maing entries from Flash */
-			if ((rr[i] = bdbm_dftl_prepare_mapblk_load (bdi, lpa)) == NULL)
-				continue;
-
-			/* send reqs to llm */
-			bdbm_sema_lock (rr[i]->done);
-			bdi->ptr_llm_inf->make_req (bdi, rr[i]);
-		}
-		for (i = 0; i < nr_llm_reqs; i++) {
-			if (rr[i]) {
-				bdbm_sema_lock (rr[i]->done);
-				bdbm_dftl_finish_mapblk_load (bdi, rr[i]);
-			}
+			bdbm_dftl_fetch_add (bdi, f, lpa);
 		}
+		p->gc_nr_map_loads += f->nr_reqs;
 
-		bdbm_free (rr);
+		/* wait for the last one */
+		bdbm_dftl_fetch_wait (bdi, f);
+		bdbm_dftl_fetch_destroy (f);
 	}
 
-	/* build hlm_req_gc for writes */
+	/* build hlm_req_gc for writes; the remapping goes translation page 
+	 * by translation page, so each one is dirtied (and later written) once */
 	for (i = 0; i < nr_llm_reqs; i++) {
-		bdbm_llm_req_t* r = &hlm_gc->llm_reqs[i];
+		bdbm_llm_req_t* r = &hlm_gc->llm_reqs[p->gc_order[i]];
+		uint64_t key = __bdbm_dftl_gc_key (p, np, r);
+
+		if (key != -1ULL && (i == 0 || 
+				key != __bdbm_dftl_gc_key (p, np, &hlm_gc->llm_reqs[p->gc_order[i-1]]))) {
+			/* the first page of a new group */
+			if (p->mt->dir[key].status != DFTL_DIR_DIRTY)
+				p->gc_nr_map_dirtied++;
+		}
+
 		r->req_type = REQTYPE_GC_WRITE;	/* change to write */
 		r->lpa = ((uint64_t*)r->ptr_oob)[0]; /* update LPA */
 
@@ -709,7 +856,7 @@ uint32_t bdbm_dftl_do_gc (bdbm_drv_info_t* bdi)
 	/* erase blocks */
 erase_blks:
 	for (i = 0; i < nr_gc_blks; i++) {
-		bdbm_abm_block_t* b = p->gc_bab[i];
+		bdbm_abm_block_t* b = bab[i];
 		bdbm_llm_req_t* r = &hlm_gc->llm_reqs[i];
 		r->req_type = REQTYPE_GC_ERASE;
 		r->lpa = -1ULL; /* lpa is not available now */
@@ -741,7 +888,7 @@ erase_blks:
 	/* FIXME: what happens if block erasure fails */
 	for (i = 0; i < nr_gc_blks; i++) {
 		uint8_t ret = 0;
-		bdbm_abm_block_t* b = p->gc_bab[i];
+		bdbm_abm_block_t* b = bab[i];
 		if (hlm_gc->llm_reqs[i].ret != 0) 
 			ret = 1;	/* bad block */
 		bdbm_abm_erase_block (p->bai, b->channel_no, b->chip_no, b->block_no, ret);
@@ -750,17 +897,136 @@ erase_blks:
 	return 0;
 }
 
-/* for snapshot */
+/* for snapshot:
+ * abm goes to abm.dat (as page-ftl does); 'fn' keeps the kind of every
+ * block, the active blocks and where they are written up to, and the
+ * mapping table (see bdbm_dftl_store_mapping_table) */
+#define DFTL_SNAPSHOT_MAGIC	0x4446544CULL	/* "DFTL" */
+
 uint32_t bdbm_dftl_load (bdbm_drv_info_t* bdi, const char* fn)
 {
-	bdbm_warning ("bdbm_dftl_load is not implemented yet");
-	return 1;
+	bdbm_dftl_private_t* p = _ftl_dftl.ptr_private;
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+	bdbm_file_t fp = 0;
+	uint64_t hdr[4] = {0, };
+	uint64_t i, blk, pos = 0;
+	uint32_t ret = 1;
+
+	/* step1: load abm */
+	if (bdbm_abm_load (p->bai, "/usr/share/bdbm_drv/abm.dat") != 0) {
+		bdbm_error ("bdbm_abm_load failed");
+		return 1;
+	}
+
+	fp = bdbm_fopen (fn, O_RDWR, 0777);
+#if defined (KERNEL_MODE)
+	if (fp == NULL) {
+#else
+	if (fp < 0) {
+#endif
+		bdbm_error ("bdbm_fopen failed");
+		return 1;
+	}
+
+	/* step2: see if the snapshot was taken with the same geometry */
+	pos += bdbm_fread (fp, pos, (uint8_t*)hdr, sizeof (hdr));
+	if (hdr[0] != DFTL_SNAPSHOT_MAGIC || 
+		hdr[1] != np->nr_blocks_per_ssd ||
+		hdr[2] != p->mt->nr_total_dir_slots ||
+		hdr[3] != p->mt->nr_entires_per_dir_slot) {
+		bdbm_error ("'%s' is not a dftl snapshot of this device", fn);
+		goto out;
+	}
+
+	/* step3: the kind of blocks */
+	for (i = 0; i < np->nr_blocks_per_ssd; i++)
+		pos += bdbm_fread (fp, pos, &p->bai->blocks[i].info, sizeof (uint8_t));
+
+	/* step4: active blocks */
+	pos += bdbm_fread (fp, pos, (uint8_t*)&p->curr_puid, sizeof (p->curr_puid));
+	pos += bdbm_fread (fp, pos, (uint8_t*)&p->curr_page_ofs, sizeof (p->curr_page_ofs));
+	pos += bdbm_fread (fp, pos, (uint8_t*)&p->map_puid, sizeof (p->map_puid));
+	pos += bdbm_fread (fp, pos, (uint8_t*)&p->map_page_ofs, sizeof (p->map_page_ofs));
+	for (i = 0; i < p->nr_punits; i++) {
+		uint64_t channel_no = i / np->nr_chips_per_channel;
+		uint64_t chip_no = i % np->nr_chips_per_channel;
+
+		pos += bdbm_fread (fp, pos, (uint8_t*)&blk, sizeof (blk));
+		p->ac_bab[i] = bdbm_abm_get_block (p->bai, channel_no, chip_no, blk);
+		pos += bdbm_fread (fp, pos, (uint8_t*)&blk, sizeof (blk));
+		p->ac_bab_map[i] = bdbm_abm_get_block (p->bai, channel_no, chip_no, blk);
+		if (p->ac_bab[i] == NULL || p->ac_bab_map[i] == NULL) {
+			bdbm_error ("invalid active block (punit: %llu)", i);
+			goto out;
+		}
+	}
+
+	/* step5: the mapping table and its hot set */
+	bdbm_dftl_init_mapping_table (p->mt, np);
+	if (bdbm_dftl_load_mapping_table (p->mt, fp, &pos) != 0) {
+		bdbm_error ("bdbm_dftl_load_mapping_table failed");
+		goto out;
+	}
+	ret = 0;
+
+out:
+	bdbm_fclose (fp);
+
+	return ret;
 }
 
 uint32_t bdbm_dftl_store (bdbm_drv_info_t* bdi, const char* fn)
 {
-	bdbm_warning ("bdbm_dftl_store is not implemented yet");
-	return 1;
+	bdbm_dftl_private_t* p = _ftl_dftl.ptr_private;
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+	bdbm_file_t fp = 0;
+	uint64_t hdr[4];
+	uint64_t i, pos = 0;
+
+	/* step1: store abm */
+	if (bdbm_abm_store (p->bai, "/usr/share/bdbm_drv/abm.dat") != 0) {
+		bdbm_error ("bdbm_abm_store failed");
+		return 1;
+	}
+
+	fp = bdbm_fopen (fn, O_CREAT | O_WRONLY, 0777);
+#if defined (KERNEL_MODE)
+	if (fp == NULL) {
+#else
+	if (fp < 0) {
+#endif
+		bdbm_error ("bdbm_fopen failed");
+		return 1;
+	}
+
+	/* step2: header */
+	hdr[0] = DFTL_SNAPSHOT_MAGIC;
+	hdr[1] = np->nr_blocks_per_ssd;
+	hdr[2] = p->mt->nr_total_dir_slots;
+	hdr[3] = p->mt->nr_entires_per_dir_slot;
+	pos += bdbm_fwrite (fp, pos, (uint8_t*)hdr, sizeof (hdr));
+
+	/* step3: the kind of blocks (abm does not keep it) */
+	for (i = 0; i < np->nr_blocks_per_ssd; i++)
+		pos += bdbm_fwrite (fp, pos, &p->bai->blocks[i].info, sizeof (uint8_t));
+
+	/* step4: active blocks; they are resumed, not thrown away */
+	pos += bdbm_fwrite (fp, pos, (uint8_t*)&p->curr_puid, sizeof (p->curr_puid));
+	pos += bdbm_fwrite (fp, pos, (uint8_t*)&p->curr_page_ofs, sizeof (p->curr_page_ofs));
+	pos += bdbm_fwrite (fp, pos, (uint8_t*)&p->map_puid, sizeof (p->map_puid));
+	pos += bdbm_fwrite (fp, pos, (uint8_t*)&p->map_page_ofs, sizeof (p->map_page_ofs));
+	for (i = 0; i < p->nr_punits; i++) {
+		pos += bdbm_fwrite (fp, pos, (uint8_t*)&p->ac_bab[i]->block_no, sizeof (uint64_t));
+		pos += bdbm_fwrite (fp, pos, (uint8_t*)&p->ac_bab_map[i]->block_no, sizeof (uint64_t));
+	}
+
+	/* step5: the mapping table and its hot set */
+	bdbm_dftl_store_mapping_table (p->mt, fp, &pos);
+
+	bdbm_fsync (fp);
+	bdbm_fclose (fp);
+
+	return 0;
 }
 
 static void __bdbm_dftl_badblock_scan_eraseblks (
@@ -879,12 +1145,15 @@ uint32_t bdbm_dftl_badblock_scan (bdbm_drv_info_t* bdi)
 
 	/* step4: get active blocks */
 	bdbm_msg ("step2: get active blocks");
-	if (__bdbm_dftl_get_active_blocks (np, p->bai, p->ac_bab) != 0) {
+	if (__bdbm_dftl_get_active_blocks (np, p->bai, p->ac_bab, DFTL_BLK_DATA) != 0 ||
+		__bdbm_dftl_get_active_blocks (np, p->bai, p->ac_bab_map, DFTL_BLK_MAP) != 0) {
 		bdbm_error ("__bdbm_dftl_get_active_blocks failed");
 		return 1;
 	}
 	p->curr_puid = 0;
 	p->curr_page_ofs = 0;
+	p->map_puid = 0;
+	p->map_page_ofs = 0;
 
 	bdbm_msg ("done");
 	 
@@ -923,12 +1192,15 @@ uint32_t bdbm_dftl_badblock_scan (bdbm_drv_info_t* bdi)
 
 	/* step4: get active blocks */
 	bdbm_msg ("step2: get active blocks");
-	if (__bdbm_dftl_get_active_blocks (np, p->bai, p->ac_bab) != 0) {
+	if (__bdbm_dftl_get_active_blocks (np, p->bai, p->ac_bab, DFTL_BLK_DATA) != 0 ||
+		__bdbm_dftl_get_active_blocks (np, p->bai, p->ac_bab_map, DFTL_BLK_MAP) != 0) {
 		bdbm_error ("__bdbm_dftl_get_active_blocks failed");
 		return 1;
 	}
 	p->curr_puid = 0;
 	p->curr_page_ofs = 0;
+	p->map_puid = 0;
+	p->map_page_ofs = 0;
 
 	bdbm_msg ("[summary] Total: %llu, Free: %llu, Clean: %llu, Dirty: %llu",
 		bdbm_abm_get_nr_total_blocks (p->bai),
@@ -950,7 +1222,7 @@ uint8_t bdbm_dftl_check_mapblk (
 {
 	bdbm_dftl_private_t* p = (bdbm_dftl_private_t*)BDBM_FTL_PRIV (bdi);
 
-	return bdbm_dftl_check_mapping_entry (p->mt, lpa);
+	return bdbm_dftl_lookup_mapping_entry (p->mt, lpa);
 }
 
 bdbm_llm_req_t* bdbm_dftl_prepare_mapblk_load (
@@ -959,7 +1231,7 @@ bdbm_llm_req_t* bdbm_dftl_prepare_mapblk_load (
 {
 	bdbm_dftl_private_t* p = (bdbm_dftl_private_t*)BDBM_FTL_PRIV (bdi);
 	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
-	mapping_entry_t* me = NULL;
+	dftl_packed_entry_t* me = NULL;
 	directory_slot_t* ds = NULL;
 	bdbm_llm_req_t* r = NULL;
 	uint32_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
@@ -974,9 +1246,9 @@ bdbm_llm_req_t* bdbm_dftl_prepare_mapblk_load (
 	/* create a hlm_req that stores mapping entries */
 	r = (bdbm_llm_req_t*)bdbm_malloc(sizeof (bdbm_llm_req_t));
 	r->pptr_kpgs = (uint8_t**)bdbm_malloc(sizeof (uint8_t*) * nr_kp_per_fp);
-	me = (mapping_entry_t*)bdbm_malloc(
-			(sizeof (mapping_entry_t) * p->mt->nr_entires_per_dir_slot));
-	bdbm_bug_on ((sizeof (mapping_entry_t) * p->mt->nr_entires_per_dir_slot) != 4096);
+	me = (dftl_packed_entry_t*)bdbm_malloc(
+			(sizeof (dftl_packed_entry_t) * p->mt->nr_entires_per_dir_slot));
+	bdbm_bug_on ((sizeof (dftl_packed_entry_t) * p->mt->nr_entires_per_dir_slot) != np->page_main_size);
 	for (i = 0; i < nr_kp_per_fp; i++)
 		r->pptr_kpgs[i] = (uint8_t*)(me) + (i * KERNEL_PAGE_SIZE);
 
@@ -1014,10 +1286,10 @@ void bdbm_dftl_finish_mapblk_load (
 {
 	bdbm_dftl_private_t* p = (bdbm_dftl_private_t*)BDBM_FTL_PRIV (bdi);
 	directory_slot_t* ds = (directory_slot_t*)r->ds;
-	mapping_entry_t* me = NULL;
+	dftl_packed_entry_t* me = NULL;
 
 	/* copy mapping entries to ds */
-	me = (mapping_entry_t*)r->pptr_kpgs[0];
+	me = (dftl_packed_entry_t*)r->pptr_kpgs[0];
 
 	if (((int64_t*)r->ptr_oob)[0] != -2LL) {
 		/*
@@ -1053,29 +1325,181 @@ void bdbm_dftl_finish_mapblk_load (
 #endif
 }
 
-bdbm_llm_req_t* bdbm_dftl_prepare_mapblk_eviction (
-	bdbm_drv_info_t* bdi)
+/* 
+ * batched mapping-page loads: all the missing directory slots of a request
+ * (or of a GC victim) are sent to llm before anything waits, so that the
+ * reads are spread over channels and the caller sleeps only until the last
+ * one arrives. A slot that another batch is already loading is not read
+ * again; the batch joins that load and waits for it to be finished.
+ */
+bdbm_dftl_fetch_t* bdbm_dftl_fetch_create (uint64_t max_reqs)
+{
+	bdbm_dftl_fetch_t* f = NULL;
+
+	if ((f = (bdbm_dftl_fetch_t*)bdbm_zmalloc 
+			(sizeof (bdbm_dftl_fetch_t))) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		return NULL;
+	}
+
+	/* the counters start from 1, so nobody wakes us up until all the loads are sent */
+	atomic_set (&f->nr_loading, 1);
+	atomic_set (&f->nr_joined, 1);
+	bdbm_sema_init (&f->loaded);
+	bdbm_sema_init (&f->joined);
+	bdbm_sema_lock (&f->loaded);
+	bdbm_sema_lock (&f->joined);
+
+	if ((f->rr = (bdbm_llm_req_t**)bdbm_zmalloc 
+			(sizeof (bdbm_llm_req_t*) * max_reqs)) == NULL ||
+		(f->dd = (void**)bdbm_zmalloc 
+			(sizeof (void*) * max_reqs)) == NULL ||
+		(f->ww = (bdbm_dftl_fetch_waiter_t*)bdbm_zmalloc 
+			(sizeof (bdbm_dftl_fetch_waiter_t) * max_reqs)) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		bdbm_dftl_fetch_destroy (f);
+		return NULL;
+	}
+	f->max_reqs = max_reqs;
+
+	return f;
+}
+
+void bdbm_dftl_fetch_destroy (bdbm_dftl_fetch_t* f)
+{
+	bdbm_sema_free (&f->loaded);
+	bdbm_sema_free (&f->joined);
+	if (f->ww)
+		bdbm_free (f->ww);
+	if (f->dd)
+		bdbm_free (f->dd);
+	if (f->rr)
+		bdbm_free (f->rr);
+	bdbm_free (f);
+}
+
+void bdbm_dftl_fetch_add (
+	bdbm_drv_info_t* bdi, 
+	bdbm_dftl_fetch_t* f,
+	uint64_t lpa)
+{
+	bdbm_dftl_private_t* p = (bdbm_dftl_private_t*)BDBM_FTL_PRIV (bdi);
+	directory_slot_t* ds = &p->mt->dir[lpa / p->mt->nr_entires_per_dir_slot];
+	bdbm_dftl_fetch_waiter_t* w = NULL;
+	bdbm_llm_req_t* r = NULL;
+	uint64_t i;
+
+	/* see if lpa exists in DRAM */
+	if (bdbm_dftl_check_mapping_entry (p->mt, lpa) == 0)
+		return;
+
+	bdbm_sema_lock (&p->fetch_lock);
+
+	/* this batch is already loading (or waiting for) the slot */
+	if (ds->loader == (void*)f)
+		goto out;
+	for (i = 0; i < f->nr_waiters; i++) {
+		if (f->ww[i].ds == (void*)ds)
+			goto out;
+	}
+	bdbm_bug_on (f->nr_reqs + f->nr_waiters >= f->max_reqs);
+
+	if (ds->is_under_load == 1) {
+		/* another batch is loading it; join the load instead of reading it again */
+		w = &f->ww[f->nr_waiters++];
+		w->ds = (void*)ds;
+		w->f = f;
+		atomic_inc (&f->nr_joined);
+		list_add_tail (&w->list, &ds->load_waiters);
+		goto out;
+	}
+
+	/* the slot was never written before, so there is nothing to read */
+	if ((r = bdbm_dftl_prepare_mapblk_load (bdi, lpa)) == NULL)
+		goto out;
+
+	ds->loader = (void*)f;
+	r->ptr_hlm_req = (void*)f;	/* see bdbm_dftl_fetch_arrived () */
+	f->dd[f->nr_reqs] = (void*)ds;
+	f->rr[f->nr_reqs++] = r;
+	atomic_inc (&f->nr_loading);
+	bdbm_sema_unlock (&p->fetch_lock);
+
+	/* send a read req to llm */
+	if (bdi->ptr_llm_inf->make_req (bdi, r) != 0) {
+		bdbm_error ("llm_make_req failed");
+		bdbm_bug_on (1);
+	}
+	return;
+
+out:
+	bdbm_sema_unlock (&p->fetch_lock);
+}
+
+void bdbm_dftl_fetch_wait (
+	bdbm_drv_info_t* bdi, 
+	bdbm_dftl_fetch_t* f)
+{
+	bdbm_dftl_private_t* p = (bdbm_dftl_private_t*)BDBM_FTL_PRIV (bdi);
+	struct list_head* next, *temp;
+	uint64_t i;
+
+	/* wait until the last of our loads arrives */
+	if (!atomic_dec_and_test (&f->nr_loading))
+		bdbm_sema_lock (&f->loaded);
+
+	/* install the loaded slots and wake up the batches that joined them */
+	bdbm_sema_lock (&p->fetch_lock);
+	for (i = 0; i < f->nr_reqs; i++) {
+		directory_slot_t* ds = (directory_slot_t*)f->dd[i];
+
+		bdbm_dftl_finish_mapblk_load (bdi, f->rr[i]);
+		f->rr[i] = NULL;
+		ds->loader = NULL;
+
+		list_for_each_safe (next, temp, &ds->load_waiters) {
+			bdbm_dftl_fetch_waiter_t* w = 
+				list_entry (next, bdbm_dftl_fetch_waiter_t, list);
+			list_del (&w->list);
+			if (atomic_dec_and_test (&w->f->nr_joined))
+				bdbm_sema_unlock (&w->f->joined);
+		}
+	}
+	f->nr_reqs = 0;
+	bdbm_sema_unlock (&p->fetch_lock);
+
+	/* wait until the slots loaded by others are installed */
+	if (!atomic_dec_and_test (&f->nr_joined))
+		bdbm_sema_lock (&f->joined);
+}
+
+/* called by llm when a load sent by bdbm_dftl_fetch_add () arrives */
+void bdbm_dftl_fetch_arrived (bdbm_llm_req_t* r)
+{
+	bdbm_dftl_fetch_t* f = (bdbm_dftl_fetch_t*)r->ptr_hlm_req;
+
+	if (atomic_dec_and_test (&f->nr_loading))
+		bdbm_sema_unlock (&f->loaded);
+}
+
+/* build a llm_req that writes the mapping entries of ds to flash */
+static bdbm_llm_req_t* __bdbm_dftl_build_mapblk_write (
+	bdbm_drv_info_t* bdi,
+	directory_slot_t* ds)
 {
 	bdbm_dftl_private_t* p = (bdbm_dftl_private_t*)BDBM_FTL_PRIV (bdi);
 	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
-	mapping_entry_t* me = NULL;
-	directory_slot_t* ds = NULL;
+	dftl_packed_entry_t* me = NULL;
 	bdbm_llm_req_t* r = NULL;
 	uint32_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
 	uint32_t i;
 
-	/* is there a victim mapblk to evict to flash */
-	if ((ds = bdbm_dftl_prepare_victim_mapblk (p->mt)) == NULL) {
-		/* there are enough space to keep in-memory mapping entries */
-		return NULL;
-	}
-
 	/* create a hlm_req that stores mapping entries */
 	r = (bdbm_llm_req_t*)bdbm_malloc(sizeof (bdbm_llm_req_t));
 	r->pptr_kpgs = (uint8_t**)bdbm_malloc(sizeof (uint8_t*) * nr_kp_per_fp);
-	me = (mapping_entry_t*)bdbm_malloc(
-			(sizeof (mapping_entry_t) * p->mt->nr_entires_per_dir_slot));
-	bdbm_bug_on ((sizeof (mapping_entry_t) * p->mt->nr_entires_per_dir_slot) != 4096);
+	me = (dftl_packed_entry_t*)bdbm_malloc(
+			(sizeof (dftl_packed_entry_t) * p->mt->nr_entires_per_dir_slot));
+	bdbm_bug_on ((sizeof (dftl_packed_entry_t) * p->mt->nr_entires_per_dir_slot) != np->page_main_size);
 	for (i = 0; i < nr_kp_per_fp; i++)
 		r->pptr_kpgs[i] = (uint8_t*)(me) + (i * KERNEL_PAGE_SIZE);
 
@@ -1117,13 +1541,14 @@ bdbm_llm_req_t* bdbm_dftl_prepare_mapblk_eviction (
 	return r;
 }
 
-void bdbm_dftl_finish_mapblk_eviction (
+static void __bdbm_dftl_finish_mapblk_write (
 	bdbm_drv_info_t* bdi, 
-	bdbm_llm_req_t* r)
+	bdbm_llm_req_t* r,
+	uint8_t evict)
 {
 	bdbm_dftl_private_t* p = (bdbm_dftl_private_t*)BDBM_FTL_PRIV (bdi);
 	directory_slot_t* ds = (directory_slot_t*)r->ds;
-	mapping_entry_t* me = (mapping_entry_t*)r->pptr_kpgs[0];
+	dftl_packed_entry_t* me = (dftl_packed_entry_t*)r->pptr_kpgs[0];
 
 	/* invalidate an old page if ds was kept in flash before */
 	if (ds->status != DFTL_DIR_CLEAN) {
@@ -1146,8 +1571,15 @@ void bdbm_dftl_finish_mapblk_eviction (
 		}
 	}
 
-	/* finish the eviction */
-	bdbm_dftl_finish_victim_mapblk (p->mt, ds, r->phyaddr);
+	if (evict) {
+		/* finish the eviction */
+		bdbm_dftl_finish_victim_mapblk (p->mt, ds, r->phyaddr);
+	} else {
+		/* the slot stays in DRAM, but it is clean now */
+		if (ds->status != DFTL_DIR_CLEAN)
+			bdbm_dftl_update_dir_phyaddr (p->mt, ds->id, r->phyaddr);
+		ds->status = DFTL_DIR_CLEAN;
+	}
 
 	/* remove a llm_req */
 	bdbm_free(r->done);
@@ -1160,3 +1592,56 @@ void bdbm_dftl_finish_mapblk_eviction (
 	bdbm_msg ("[dftl] [Evict] dir: %llu (done)\n", ds->id);
 #endif
 }
+
+bdbm_llm_req_t* bdbm_dftl_prepare_mapblk_eviction (
+	bdbm_drv_info_t* bdi)
+{
+	bdbm_dftl_private_t* p = (bdbm_dftl_private_t*)BDBM_FTL_PRIV (bdi);
+	directory_slot_t* ds = NULL;
+
+	/* is there a victim mapblk to evict to flash */
+	if ((ds = bdbm_dftl_prepare_victim_mapblk (p->mt)) == NULL) {
+		/* there are enough space to keep in-memory mapping entries */
+		return NULL;
+	}
+
+	return __bdbm_dftl_build_mapblk_write (bdi, ds);
+}
+
+void bdbm_dftl_finish_mapblk_eviction (
+	bdbm_drv_info_t* bdi, 
+	bdbm_llm_req_t* r)
+{
+	__bdbm_dftl_finish_mapblk_write (bdi, r, 1);
+}
+
+/* write back a batch of dirty slots that are close to eviction, so that
+ * eviction finds them clean and does not have to program them itself */
+uint64_t bdbm_dftl_clean_mapblks (
+	bdbm_drv_info_t* bdi)
+{
+	bdbm_dftl_private_t* p = (bdbm_dftl_private_t*)BDBM_FTL_PRIV (bdi);
+	directory_slot_t* dss[DFTL_CLEAN_BATCH];
+	bdbm_llm_req_t* rr[DFTL_CLEAN_BATCH];
+	uint64_t i, nr_dirty;
+
+	if ((nr_dirty = bdbm_dftl_prepare_clean_mapblks (
+			p->mt, dss, DFTL_CLEAN_BATCH)) == 0)
+		return 0;
+
+	/* send all the writes first, so that they go to different channels */
+	for (i = 0; i < nr_dirty; i++) {
+		rr[i] = __bdbm_dftl_build_mapblk_write (bdi, dss[i]);
+		bdbm_sema_lock (rr[i]->done);
+		if (bdi->ptr_llm_inf->make_req (bdi, rr[i]) != 0) {
+			bdbm_error ("llm_make_req failed");
+			bdbm_bug_on (1);
+		}
+	}
+	for (i = 0; i < nr_dirty; i++) {
+		bdbm_sema_lock (rr[i]->done);
+		__bdbm_dftl_finish_mapblk_write (bdi, rr[i], 0);
+	}
+
+	return nr_dirty;
+}
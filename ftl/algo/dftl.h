@@ -45,10 +45,37 @@ bdbm_llm_req_t* bdbm_dftl_prepare_mapblk_eviction (bdbm_drv_info_t* bdi);
 void bdbm_dftl_finish_mapblk_eviction (bdbm_drv_info_t* bdi, bdbm_llm_req_t* r);
 bdbm_llm_req_t* bdbm_dftl_prepare_mapblk_load (bdbm_drv_info_t* bdi, uint64_t lpa);
 void bdbm_dftl_finish_mapblk_load (bdbm_drv_info_t* bdi, bdbm_llm_req_t* r);
+uint64_t bdbm_dftl_clean_mapblks (bdbm_drv_info_t* bdi);
 
 void bdbm_dftl_finish_mapblk_load_2 (
 	bdbm_drv_info_t* bdi, 
 	bdbm_llm_req_t* r);
 
+/* a batch of mapping-page loads that are sent together and waited for once */
+typedef struct {
+	struct list_head list;	/* linked to the load_waiters of a directory slot */
+	void* ds;
+	struct bdbm_dftl_fetch* f;
+} bdbm_dftl_fetch_waiter_t;
+
+typedef struct bdbm_dftl_fetch {
+	atomic_t nr_loading;	/* loads sent by this batch that have not arrived yet */
+	atomic_t nr_joined;	/* loads sent by other batches that have not finished yet */
+	bdbm_sema_t loaded;
+	bdbm_sema_t joined;
+	uint64_t max_reqs;
+	uint64_t nr_reqs;
+	uint64_t nr_waiters;
+	bdbm_llm_req_t** rr;
+	void** dd;	/* the directory slot rr[i] loads */
+	bdbm_dftl_fetch_waiter_t* ww;
+} bdbm_dftl_fetch_t;
+
+bdbm_dftl_fetch_t* bdbm_dftl_fetch_create (uint64_t max_reqs);
+void bdbm_dftl_fetch_destroy (bdbm_dftl_fetch_t* f);
+void bdbm_dftl_fetch_add (bdbm_drv_info_t* bdi, bdbm_dftl_fetch_t* f, uint64_t lpa);
+void bdbm_dftl_fetch_wait (bdbm_drv_info_t* bdi, bdbm_dftl_fetch_t* f);
+void bdbm_dftl_fetch_arrived (bdbm_llm_req_t* r);
+
 #endif /* _BLUEDBM_FTL_DFTL_H */
 
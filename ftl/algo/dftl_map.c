@@ -42,12 +42,113 @@ THE SOFTWARE.
 #include "debug.h"
 #include "utime.h"
 #include "ufile.h"
+#include "umemory.h"
 
 #include "algo/abm.h"
 #include "algo/dftl_map.h"
 
 
-dftl_mapping_table_t* bdbm_dftl_create_mapping_table (bdbm_device_params_t* np)
+static dftl_packed_entry_t __dftl_pack_entry (
+	dftl_mapping_table_t* mt, 
+	mapping_entry_t* me)
+{
+	uint64_t ppa;
+
+	if (me->status == DFTL_PAGE_INVALID)
+		return DFTL_PACKED_INVALID;
+	if (me->status != DFTL_PAGE_VALID)
+		return DFTL_PACKED_NOT_MAPPED;
+
+	ppa = me->phyaddr.channel_no;
+	ppa = ppa * mt->nr_chips_per_channel + me->phyaddr.chip_no;
+	ppa = ppa * mt->nr_blocks_per_chip + me->phyaddr.block_no;
+	ppa = ppa * mt->nr_pages_per_block + me->phyaddr.page_no;
+	bdbm_bug_on (ppa > DFTL_PACKED_MAX_PPA);
+
+	return (dftl_packed_entry_t)ppa;
+}
+
+static void __dftl_unpack_entry (
+	dftl_mapping_table_t* mt, 
+	dftl_packed_entry_t e,
+	mapping_entry_t* me)
+{
+	uint64_t ppa = e;
+
+	if (e == DFTL_PACKED_NOT_MAPPED || e == DFTL_PACKED_INVALID) {
+		me->status = (e == DFTL_PACKED_INVALID) ? 
+			DFTL_PAGE_INVALID : DFTL_PAGE_NOT_MAPPED;
+		me->phyaddr.channel_no = DFTL_PAGE_INVALID_ADDR;
+		me->phyaddr.chip_no = DFTL_PAGE_INVALID_ADDR;
+		me->phyaddr.block_no = DFTL_PAGE_INVALID_ADDR;
+		me->phyaddr.page_no = DFTL_PAGE_INVALID_ADDR;
+		return;
+	}
+
+	me->status = DFTL_PAGE_VALID;
+	me->phyaddr.page_no = ppa % mt->nr_pages_per_block;
+	ppa /= mt->nr_pages_per_block;
+	me->phyaddr.block_no = ppa % mt->nr_blocks_per_chip;
+	ppa /= mt->nr_blocks_per_chip;
+	me->phyaddr.chip_no = ppa % mt->nr_chips_per_channel;
+	me->phyaddr.channel_no = ppa / mt->nr_chips_per_channel;
+}
+
+static void __dftl_slot_insert (
+	dftl_mapping_table_t* mt, 
+	directory_slot_t* ds)
+{
+	ds->segment = DFTL_SEG_PROBATION;
+	ds->load_seq = mt->nr_loads++;
+	atomic64_inc (&mt->nr_cached_slots);
+	list_add_tail (&ds->list, &mt->probation_list);
+}
+
+static void __dftl_slot_remove (
+	dftl_mapping_table_t* mt, 
+	directory_slot_t* ds)
+{
+	if (ds->segment == DFTL_SEG_PROTECTED)
+		mt->nr_protected_slots--;
+	ds->segment = DFTL_SEG_NONE;
+	atomic64_dec (&mt->nr_cached_slots);
+	list_del (&ds->list);
+}
+
+static void __dftl_slot_touch (
+	dftl_mapping_table_t* mt, 
+	directory_slot_t* ds)
+{
+	directory_slot_t* cold = NULL;
+
+	if (ds->segment == DFTL_SEG_PROTECTED) {
+		list_move_tail (&ds->list, &mt->protected_list);
+		return;
+	}
+
+	/* a run of references right after the load (e.g., a scan over the
+	 * slot's lpas) is not a sign that the slot is hot */
+	if (mt->nr_loads - ds->load_seq < DFTL_CORRELATED_LOADS) {
+		list_move_tail (&ds->list, &mt->probation_list);
+		return;
+	}
+
+	ds->segment = DFTL_SEG_PROTECTED;
+	mt->nr_protected_slots++;
+	list_move_tail (&ds->list, &mt->protected_list);
+
+	/* demote the coldest protected slot if the segment is full */
+	if (mt->nr_protected_slots > mt->max_protected_slots) {
+		cold = list_entry (mt->protected_list.next, directory_slot_t, list);
+		cold->segment = DFTL_SEG_PROBATION;
+		mt->nr_protected_slots--;
+		list_move_tail (&cold->list, &mt->probation_list);
+	}
+}
+
+dftl_mapping_table_t* bdbm_dftl_create_mapping_table (
+	bdbm_device_params_t* np, 
+	uint64_t cache_bytes)
 {
 	dftl_mapping_table_t* mt = NULL;
 	uint64_t i;
@@ -57,19 +158,40 @@ dftl_mapping_table_t* bdbm_dftl_create_mapping_table (bdbm_device_params_t* np)
 			(sizeof (dftl_mapping_table_t))) == NULL) {
 		return NULL;
 	}
-	INIT_LIST_HEAD (&mt->lru_list);
-	mt->mapping_entry_size = sizeof (mapping_entry_t);
+	INIT_LIST_HEAD (&mt->probation_list);
+	INIT_LIST_HEAD (&mt->protected_list);
+	mt->nr_chips_per_channel = np->nr_chips_per_channel;
+	mt->nr_blocks_per_chip = np->nr_blocks_per_chip;
+	mt->nr_pages_per_block = np->nr_pages_per_block;
+	if (np->nr_pages_per_ssd > (uint64_t)DFTL_PACKED_MAX_PPA + 1) {
+		bdbm_error ("DFTL: %llu pages do not fit in a 4-byte mapping entry", 
+			np->nr_pages_per_ssd);
+		bdbm_free (mt);
+		return NULL;
+	}
+
+	mt->mapping_entry_size = sizeof (dftl_packed_entry_t);
 	mt->nr_entires_per_dir_slot = np->page_main_size / mt->mapping_entry_size;
 	mt->nr_total_dir_slots = np->nr_pages_per_ssd / mt->nr_entires_per_dir_slot;
-	/*mt->max_cached_dir_slots = 20000;*/
-	/*mt->max_cached_dir_slots = 20;*/
-	mt->max_cached_dir_slots = mt->nr_total_dir_slots * 0.2;
+
+	/* a cached slot costs one flash page of DRAM */
+	mt->max_cached_dir_slots = cache_bytes / np->page_main_size;
+	if (mt->max_cached_dir_slots > mt->nr_total_dir_slots)
+		mt->max_cached_dir_slots = mt->nr_total_dir_slots;
+	if (mt->max_cached_dir_slots == 0)
+		mt->max_cached_dir_slots = 1;
+	mt->max_protected_slots = mt->max_cached_dir_slots * DFTL_PROTECTED_RATIO / 100;
 	atomic64_set (&mt->nr_cached_slots, 0);
+	atomic64_set (&mt->nr_lookups, 0);
+	atomic64_set (&mt->nr_hits, 0);
 
 	bdbm_msg ("DFTL: mapping_entry_size: %llu", mt->mapping_entry_size);
 	bdbm_msg ("DFTL: nr_entires_per_dir_slot: %llu", mt->nr_entires_per_dir_slot);
 	bdbm_msg ("DFTL: nr_total_dir_slots: %llu", mt->nr_total_dir_slots);
-	bdbm_msg ("DFTL: # of cached dir slots: %llu", mt->max_cached_dir_slots);
+	bdbm_msg ("DFTL: # of cached dir slots: %llu (%llu KB, %llu%% of LPAs)", 
+		mt->max_cached_dir_slots,
+		mt->max_cached_dir_slots * np->page_main_size / 1024,
+		mt->max_cached_dir_slots * 100 / mt->nr_total_dir_slots);
 
 	/* create a directory */
 	if ((mt->dir = (directory_slot_t*)bdbm_zmalloc (
@@ -84,6 +206,9 @@ dftl_mapping_table_t* bdbm_dftl_create_mapping_table (bdbm_device_params_t* np)
 		ds->id = i;
 		ds->status = DFTL_DIR_EMPTY;
 		ds->is_under_load = 0;
+		ds->segment = DFTL_SEG_NONE;
+		ds->loader = NULL;
+		INIT_LIST_HEAD (&ds->load_waiters);
 		ds->phyaddr.channel_no = DFTL_PAGE_INVALID_ADDR;
 		ds->phyaddr.chip_no = DFTL_PAGE_INVALID_ADDR;
 		ds->phyaddr.block_no = DFTL_PAGE_INVALID_ADDR;
@@ -91,23 +216,17 @@ dftl_mapping_table_t* bdbm_dftl_create_mapping_table (bdbm_device_params_t* np)
 		ds->me = NULL;
 
 #if 0
-		ds->me = (mapping_entry_t*)bdbm_malloc_atomic
-			(sizeof (mapping_entry_t) * mt->nr_entires_per_dir_slot);
+		ds->me = (dftl_packed_entry_t*)bdbm_malloc_atomic
+			(sizeof (dftl_packed_entry_t) * mt->nr_entires_per_dir_slot);
 		bdbm_bug_on (ds->me == NULL);
 
 		/* initialize all the entries */
-		for (j = 0; j < mt->nr_entires_per_dir_slot; j++) {
-			ds->me[j].status = DFTL_PAGE_NOT_MAPPED;
-			ds->me[j].phyaddr.channel_no = DFTL_PAGE_INVALID_ADDR;
-			ds->me[j].phyaddr.chip_no = DFTL_PAGE_INVALID_ADDR;
-			ds->me[j].phyaddr.block_no = DFTL_PAGE_INVALID_ADDR;
-			ds->me[j].phyaddr.page_no = DFTL_PAGE_INVALID_ADDR;
-		}
+		for (j = 0; j < mt->nr_entires_per_dir_slot; j++)
+			ds->me[j] = DFTL_PACKED_NOT_MAPPED;
 		ds->status = DFTL_DIR_CLEAN;
 		
-		/* add the directory slot to the tail of the dirty linked-list */
-		atomic64_inc (&mt->nr_cached_slots);
-		list_add_tail (&ds->list, &mt->lru_list);
+		/* add the directory slot to the probationary segment */
+		__dftl_slot_insert (mt, ds);
 		/******/
 #endif
 	}
@@ -121,9 +240,19 @@ void bdbm_dftl_destroy_mapping_table (dftl_mapping_table_t* mt)
 {
 	struct list_head* next, *temp;
 	int i = 0;
+	uint64_t nr_lookups = atomic64_read (&mt->nr_lookups);
 
-	/* empty dirty list */
-	list_for_each_safe (next, temp, &mt->lru_list) {
+	bdbm_msg ("DFTL: cache hits: %llu / %llu lookups (%llu%%)", 
+		atomic64_read (&mt->nr_hits), nr_lookups,
+		nr_lookups ? atomic64_read (&mt->nr_hits) * 100 / nr_lookups : 0);
+
+	/* empty the cached slots */
+	list_for_each_safe (next, temp, &mt->probation_list) {
+		directory_slot_t* ds = NULL;
+		ds = list_entry (next, directory_slot_t, list);
+		list_del (&ds->list);
+	}
+	list_for_each_safe (next, temp, &mt->protected_list) {
 		directory_slot_t* ds = NULL;
 		ds = list_entry (next, directory_slot_t, list);
 		list_del (&ds->list);
@@ -151,6 +280,9 @@ void bdbm_dftl_init_mapping_table (dftl_mapping_table_t* mt, bdbm_device_params_
 		ds->id = i;
 		ds->status = DFTL_DIR_EMPTY;
 		ds->is_under_load = 0;
+		ds->segment = DFTL_SEG_NONE;
+		ds->loader = NULL;
+		INIT_LIST_HEAD (&ds->load_waiters);
 		ds->phyaddr.channel_no = DFTL_PAGE_INVALID_ADDR;
 		ds->phyaddr.chip_no = DFTL_PAGE_INVALID_ADDR;
 		ds->phyaddr.block_no = DFTL_PAGE_INVALID_ADDR;
@@ -160,12 +292,19 @@ void bdbm_dftl_init_mapping_table (dftl_mapping_table_t* mt, bdbm_device_params_
 		ds->me = NULL;
 	}
 
-	/* empty dirty list */
-	list_for_each_safe (next, temp, &mt->lru_list) {
+	/* empty the cached slots */
+	list_for_each_safe (next, temp, &mt->probation_list) {
+		directory_slot_t* ds = NULL;
+		ds = list_entry (next, directory_slot_t, list);
+		list_del (&ds->list);
+	}
+	list_for_each_safe (next, temp, &mt->protected_list) {
 		directory_slot_t* ds = NULL;
 		ds = list_entry (next, directory_slot_t, list);
 		list_del (&ds->list);
 	}
+	atomic64_set (&mt->nr_cached_slots, 0);
+	mt->nr_protected_slots = 0;
 }
 
 mapping_entry_t bdbm_dftl_get_mapping_entry (dftl_mapping_table_t* mt, uint64_t lpa)
@@ -187,7 +326,7 @@ mapping_entry_t bdbm_dftl_get_mapping_entry (dftl_mapping_table_t* mt, uint64_t
 	if (ds->status == DFTL_DIR_DIRTY || 
 		ds->status == DFTL_DIR_CLEAN) {
 		/* get the mapping entry */
-		me = ds->me[map_idx];
+		__dftl_unpack_entry (mt, ds->me[map_idx], &me);
 		goto found;
 	}
 
@@ -218,13 +357,9 @@ int bdbm_dftl_set_mapping_entry (dftl_mapping_table_t* mt, uint64_t lpa, mapping
 	bdbm_bug_on (ds->me == NULL);
 
 	/* update the mapping entry */
-	ds->me[map_idx] = *me;
+	ds->me[map_idx] = __dftl_pack_entry (mt, me);
 	ds->status = DFTL_DIR_DIRTY;
 
-	/* the directory slot is moved to the tail */
-	list_del (&ds->list);
-	list_add_tail (&ds->list, &mt->lru_list);
-
 	return 0;
 }
 
@@ -243,7 +378,7 @@ int bdbm_dftl_invalidate_mapping_entry (dftl_mapping_table_t* mt, uint64_t lpa)
 	bdbm_bug_on (ds->me == NULL);
 
 	/* update the mapping entry */
-	ds->me[map_idx].status = DFTL_PAGE_INVALID;
+	ds->me[map_idx] = DFTL_PACKED_INVALID;
 	ds->status = DFTL_DIR_DIRTY;
 
 	return 0;
@@ -275,6 +410,23 @@ int bdbm_dftl_check_mapping_entry (
 	return 0; 
 }
 
+/* the same as bdbm_dftl_check_mapping_entry, but counted in the hit ratio
+ * and in the replacement policy; it is used once per lpa of a host request */
+int bdbm_dftl_lookup_mapping_entry (
+	dftl_mapping_table_t* mt, 
+	uint64_t lpa)
+{
+	int ret = bdbm_dftl_check_mapping_entry (mt, lpa);
+
+	atomic64_inc (&mt->nr_lookups);
+	if (ret == 0) {
+		atomic64_inc (&mt->nr_hits);
+		__dftl_slot_touch (mt, &mt->dir[lpa / mt->nr_entires_per_dir_slot]);
+	}
+
+	return ret;
+}
+
 directory_slot_t* bdbm_dftl_missing_dir_prepare (
 	dftl_mapping_table_t* mt,
 	uint64_t lpa)
@@ -296,23 +448,17 @@ directory_slot_t* bdbm_dftl_missing_dir_prepare (
 		int j = 0;
 
 		/* this directory slot is not written before */
-		ds->me = (mapping_entry_t*)bdbm_malloc
-			(sizeof (mapping_entry_t) * mt->nr_entires_per_dir_slot);
+		ds->me = (dftl_packed_entry_t*)bdbm_malloc
+			(sizeof (dftl_packed_entry_t) * mt->nr_entires_per_dir_slot);
 		bdbm_bug_on (ds->me == NULL);
 
 		/* initialize all the entries */
-		for (j = 0; j < mt->nr_entires_per_dir_slot; j++) {
-			ds->me[j].status = DFTL_PAGE_NOT_MAPPED;
-			ds->me[j].phyaddr.channel_no = DFTL_PAGE_INVALID_ADDR;
-			ds->me[j].phyaddr.chip_no = DFTL_PAGE_INVALID_ADDR;
-			ds->me[j].phyaddr.block_no = DFTL_PAGE_INVALID_ADDR;
-			ds->me[j].phyaddr.page_no = DFTL_PAGE_INVALID_ADDR;
-		}
+		for (j = 0; j < mt->nr_entires_per_dir_slot; j++)
+			ds->me[j] = DFTL_PACKED_NOT_MAPPED;
 		ds->status = DFTL_DIR_DIRTY; /* this table is newly created, so it starts with dirty */
 
-		/* add the directory slot to the tail of the dirty linked-list */
-		atomic64_inc (&mt->nr_cached_slots);
-		list_add_tail (&ds->list, &mt->lru_list);
+		/* add the directory slot to the probationary segment */
+		__dftl_slot_insert (mt, ds);
 
 		return NULL;
 	}
@@ -328,15 +474,16 @@ directory_slot_t* bdbm_dftl_missing_dir_prepare (
 int bdbm_dftl_missing_dir_done (
 	dftl_mapping_table_t* mt, 
 	directory_slot_t* ds,
-	mapping_entry_t* me)
+	dftl_packed_entry_t* me)
 {
 	uint32_t i;
 
-	/* build mapping entires for ds */
+	/* build mapping entires for ds; a slot restored from a checkpoint is
+	 * on flash without a DRAM copy (see bdbm_dftl_load_mapping_table ()) */
 	if (ds->me == NULL) {
-		bdbm_bug_on (ds->status != DFTL_DIR_EMPTY);
-		ds->me = (mapping_entry_t*)bdbm_malloc
-			(sizeof (mapping_entry_t) * mt->nr_entires_per_dir_slot);
+		bdbm_bug_on (ds->status != DFTL_DIR_EMPTY && ds->status != DFTL_DIR_FLASH);
+		ds->me = (dftl_packed_entry_t*)bdbm_malloc
+			(sizeof (dftl_packed_entry_t) * mt->nr_entires_per_dir_slot);
 	}
 
 	for (i = 0; i < mt->nr_entires_per_dir_slot; i++) {
@@ -349,8 +496,7 @@ int bdbm_dftl_missing_dir_done (
 	ds->status = DFTL_DIR_CLEAN;
 	ds->is_under_load = 0;
 
-	atomic64_inc (&mt->nr_cached_slots);
-	list_add_tail (&ds->list, &mt->lru_list);
+	__dftl_slot_insert (mt, ds);
 
 	return 0;
 }
@@ -358,15 +504,14 @@ int bdbm_dftl_missing_dir_done (
 int bdbm_dftl_missing_dir_done_error (
 	dftl_mapping_table_t* mt, 
 	directory_slot_t* ds,
-	mapping_entry_t* me)
+	dftl_packed_entry_t* me)
 {
 	uint32_t i;
 
 	bdbm_bug_on (ds->status == DFTL_DIR_EMPTY);
 
 	if (ds->status == DFTL_DIR_FLASH) {
-		atomic64_inc (&mt->nr_cached_slots);
-		list_add_tail (&ds->list, &mt->lru_list);
+		__dftl_slot_insert (mt, ds);
 		ds->status = DFTL_DIR_CLEAN;
 	}
 	ds->is_under_load = 0;
@@ -387,19 +532,54 @@ directory_slot_t* bdbm_dftl_prepare_victim_mapblk (
 		return NULL;
 	}
 
-	/* get a victim dir from lru-list */
-	list_for_each (pos, &mt->lru_list) {
+	/* get a victim dir from the cold end of the probationary segment */
+	if (!list_empty (&mt->probation_list))
+		pos = mt->probation_list.next;
+	else
+		pos = mt->protected_list.next;
+	ds = list_entry (pos, directory_slot_t, list);
+	bdbm_bug_on (ds == NULL);
+
+	__dftl_slot_remove (mt, ds);
+
+	return ds;
+}
+
+/* pick the dirty slots that are about to be evicted, so that they can be
+ * written back in one batch before eviction needs them clean. Nothing is
+ * picked until a full batch has piled up; until then, more updates to
+ * the same slots are absorbed in DRAM. */
+uint64_t bdbm_dftl_prepare_clean_mapblks (
+	dftl_mapping_table_t* mt, 
+	directory_slot_t** dss,
+	uint64_t max)
+{
+	directory_slot_t* ds = NULL;
+	struct list_head* pos = NULL;
+	uint64_t window = mt->max_cached_dir_slots - mt->max_protected_slots;
+	uint64_t nr_scanned = 0, nr_dirty = 0;
+
+	if (max > window)
+		max = window;
+	if (max == 0)
+		return 0;
+
+	/* wait until the cache is almost full */
+	if (atomic64_read (&mt->nr_cached_slots) + window < mt->max_cached_dir_slots)
+		return 0;
+
+	list_for_each (pos, &mt->probation_list) {
+		if (nr_scanned++ >= window || nr_dirty >= max)
+			break;
 		ds = list_entry (pos, directory_slot_t, list);
-		bdbm_bug_on (ds == NULL);
-		break;
+		if (ds->status == DFTL_DIR_DIRTY)
+			dss[nr_dirty++] = ds;
 	}
 
-	/* temp */
-	list_del (&ds->list);
-	atomic64_dec (&mt->nr_cached_slots);
-	/* end */
+	if (nr_dirty < max)
+		return 0;
 
-	return ds;
+	return nr_dirty;
 }
 
 void bdbm_dftl_finish_victim_mapblk (
@@ -433,3 +613,141 @@ void bdbm_dftl_update_dir_phyaddr (
 	ds->phyaddr = *phyaddr;
 }
 
+/* 
+ * checkpoint: the state and the flash location of every directory slot
+ * (the global translation directory), followed by the cached slots from
+ * the hottest to the coldest together with their entries. The entries of
+ * dirty slots exist nowhere else, so they must be kept; those of clean
+ * slots let a restore warm the cache without reading flash.
+ */
+static uint64_t __dftl_store_hot_slots (
+	dftl_mapping_table_t* mt, 
+	struct list_head* head,
+	bdbm_file_t fp,
+	uint64_t* pos)
+{
+	directory_slot_t* ds = NULL;
+	struct list_head* next = NULL;
+	uint64_t nr_slots = 0;
+	uint32_t status;
+
+	for (next = head->prev; next != head; next = next->prev) {
+		ds = list_entry (next, directory_slot_t, list);
+		status = ds->status;
+		*pos += bdbm_fwrite (fp, *pos, (uint8_t*)&ds->id, sizeof (ds->id));
+		*pos += bdbm_fwrite (fp, *pos, (uint8_t*)&status, sizeof (status));
+		*pos += bdbm_fwrite (fp, *pos, (uint8_t*)ds->me, 
+			sizeof (dftl_packed_entry_t) * mt->nr_entires_per_dir_slot);
+		nr_slots++;
+	}
+
+	return nr_slots;
+}
+
+uint32_t bdbm_dftl_store_mapping_table (
+	dftl_mapping_table_t* mt, 
+	bdbm_file_t fp,
+	uint64_t* pos)
+{
+	uint64_t i, nr_hot_slots;
+	uint32_t status;
+
+	/* step1: the directory */
+	for (i = 0; i < mt->nr_total_dir_slots; i++) {
+		directory_slot_t* ds = &mt->dir[i];
+		status = ds->status;
+		*pos += bdbm_fwrite (fp, *pos, (uint8_t*)&status, sizeof (status));
+		*pos += bdbm_fwrite (fp, *pos, (uint8_t*)&ds->phyaddr, sizeof (ds->phyaddr));
+	}
+
+	/* step2: the hot set; the protected segment first */
+	nr_hot_slots = atomic64_read (&mt->nr_cached_slots);
+	*pos += bdbm_fwrite (fp, *pos, (uint8_t*)&nr_hot_slots, sizeof (nr_hot_slots));
+	i = __dftl_store_hot_slots (mt, &mt->protected_list, fp, pos);
+	i += __dftl_store_hot_slots (mt, &mt->probation_list, fp, pos);
+	bdbm_bug_on (i != nr_hot_slots);
+
+	bdbm_msg ("DFTL: stored %llu dir slots (%llu cached)", 
+		mt->nr_total_dir_slots, nr_hot_slots);
+
+	return 0;
+}
+
+uint32_t bdbm_dftl_load_mapping_table (
+	dftl_mapping_table_t* mt, 
+	bdbm_file_t fp,
+	uint64_t* pos)
+{
+	uint64_t size = sizeof (dftl_packed_entry_t) * mt->nr_entires_per_dir_slot;
+	uint64_t i, j, id, nr_hot_slots = 0, nr_warm = 0, nr_protected = 0;
+	dftl_packed_entry_t* me = NULL;
+	uint32_t status;
+
+	/* step1: the directory; every slot starts on flash */
+	for (i = 0; i < mt->nr_total_dir_slots; i++) {
+		directory_slot_t* ds = &mt->dir[i];
+		*pos += bdbm_fread (fp, *pos, (uint8_t*)&status, sizeof (status));
+		*pos += bdbm_fread (fp, *pos, (uint8_t*)&ds->phyaddr, sizeof (ds->phyaddr));
+		ds->status = (status == DFTL_DIR_EMPTY) ? DFTL_DIR_EMPTY : DFTL_DIR_FLASH;
+	}
+
+	/* step2: warm the cache with the hot set, the hottest first */
+	if ((me = (dftl_packed_entry_t*)bdbm_malloc (size)) == NULL) {
+		bdbm_error ("bdbm_malloc failed");
+		return 1;
+	}
+	if (bdbm_fread (fp, *pos, (uint8_t*)&nr_hot_slots, sizeof (nr_hot_slots)) != sizeof (nr_hot_slots)) {
+		bdbm_error ("DFTL: the hot-set list is missing");
+		bdbm_free (me);
+		return 1;
+	}
+	*pos += sizeof (nr_hot_slots);
+
+	for (i = 0; i < nr_hot_slots; i++) {
+		directory_slot_t* ds = NULL;
+
+		*pos += bdbm_fread (fp, *pos, (uint8_t*)&id, sizeof (id));
+		*pos += bdbm_fread (fp, *pos, (uint8_t*)&status, sizeof (status));
+		*pos += bdbm_fread (fp, *pos, (uint8_t*)me, size);
+		if (id >= mt->nr_total_dir_slots) {
+			bdbm_error ("DFTL: invalid dir slot in the hot-set list (%llu)", id);
+			bdbm_free (me);
+			return 1;
+		}
+		ds = &mt->dir[id];
+
+		/* clean slots are only a hint; dirty ones must come back */
+		if (status != DFTL_DIR_DIRTY && nr_warm >= mt->max_cached_dir_slots)
+			continue;
+
+		if (ds->me == NULL && (ds->me = (dftl_packed_entry_t*)bdbm_malloc (size)) == NULL) {
+			bdbm_error ("bdbm_malloc failed");
+			bdbm_free (me);
+			return 1;
+		}
+		for (j = 0; j < mt->nr_entires_per_dir_slot; j++)
+			ds->me[j] = me[j];
+		ds->status = (status == DFTL_DIR_DIRTY) ? DFTL_DIR_DIRTY : DFTL_DIR_CLEAN;
+
+		/* the list is in hottest-first order, so each slot goes in 
+		 * at the cold end of its segment */
+		ds->load_seq = mt->nr_loads++;
+		if (nr_protected < mt->max_protected_slots) {
+			ds->segment = DFTL_SEG_PROTECTED;
+			list_add (&ds->list, &mt->protected_list);
+			mt->nr_protected_slots++;
+			nr_protected++;
+		} else {
+			ds->segment = DFTL_SEG_PROBATION;
+			list_add (&ds->list, &mt->probation_list);
+		}
+		atomic64_inc (&mt->nr_cached_slots);
+		nr_warm++;
+	}
+	bdbm_free (me);
+
+	bdbm_msg ("DFTL: loaded %llu dir slots (%llu of %llu hot slots cached)", 
+		mt->nr_total_dir_slots, nr_warm, nr_hot_slots);
+
+	return 0;
+}
@@ -34,6 +34,20 @@ typedef enum {
 	DFTL_DIR_DIRTY = DFTL_DIR_DRAM | 0x2,
 } dir_stat;
 
+/* the cached slots are kept in a segmented LRU: a slot enters the
+ * probationary segment when it is loaded and moves to the protected one
+ * only when it is referenced again later on. A sequential scan therefore
+ * churns through the probationary segment and leaves the hot set alone. */
+enum BDBM_DFTL_SEGMENT {
+	DFTL_SEG_NONE = 0,
+	DFTL_SEG_PROBATION,
+	DFTL_SEG_PROTECTED,
+};
+
+#define DFTL_PROTECTED_RATIO	80	/* % of the cached slots that may be protected */
+#define DFTL_CORRELATED_LOADS	8	/* references within this many loads are one reference */
+#define DFTL_CLEAN_BATCH		8	/* # of dirty slots written back together */
+
 enum BDBM_DFTL_PAGE_STATUS {
 	DFTL_PAGE_NOT_EXIST = 0,
 	DFTL_PAGE_NOT_MAPPED,
@@ -54,29 +68,55 @@ typedef struct {
 	mapblk_phyaddr_t phyaddr; /* physical location */
 } mapping_entry_t;
 
+/* a mapping entry as it is kept in DRAM and in mapping pages: the flat
+ * physical page number ((((ch * chips) + chip) * blocks + blk) * pages + pg),
+ * or one of the reserved values below */
+typedef uint32_t dftl_packed_entry_t;
+
+#define DFTL_PACKED_NOT_MAPPED	((dftl_packed_entry_t)-1)
+#define DFTL_PACKED_INVALID		((dftl_packed_entry_t)-2)
+#define DFTL_PACKED_MAX_PPA		((dftl_packed_entry_t)-3)
+
 typedef struct {
 	/* linked-list: to quickly find a victim for eviction */
 	struct list_head list;
 	uint64_t id;
 	dir_stat status;
 	bdbm_phyaddr_t phyaddr;	/* the physical location where mapping entries are stored */
-	mapping_entry_t* me;	/* the size of me is equal to a single flash size */
+	dftl_packed_entry_t* me;	/* the size of me is equal to a single flash size */
 
 	uint32_t is_under_load;
+	uint8_t segment;
+	uint64_t load_seq;	/* mt->nr_loads when the slot was brought in */
+	void* loader;	/* the fetch batch that issued the load */
+	struct list_head load_waiters;	/* fetch batches waiting for the load */
 } directory_slot_t;
 
 typedef struct {
-	struct list_head lru_list; /* dirty-list header */
+	struct list_head probation_list;	/* cold end first */
+	struct list_head protected_list;	/* cold end first */
+	uint64_t nr_protected_slots;
+	uint64_t max_protected_slots;
+	uint64_t nr_loads;
 	uint64_t mapping_entry_size;
 	uint64_t nr_entires_per_dir_slot;
 	uint64_t nr_total_dir_slots;
 	uint64_t max_cached_dir_slots;
 	atomic64_t nr_cached_slots;
 	directory_slot_t* dir;	/* always maintained in DRAM */
+
+	/* geometry used to pack physical addresses */
+	uint64_t nr_chips_per_channel;
+	uint64_t nr_blocks_per_chip;
+	uint64_t nr_pages_per_block;
+
+	/* lookups by host requests and how many of them found the slot in DRAM */
+	atomic64_t nr_lookups;
+	atomic64_t nr_hits;
 } dftl_mapping_table_t;
 
 
-dftl_mapping_table_t* bdbm_dftl_create_mapping_table (bdbm_device_params_t* np);
+dftl_mapping_table_t* bdbm_dftl_create_mapping_table (bdbm_device_params_t* np, uint64_t cache_bytes);
 void bdbm_dftl_destroy_mapping_table (dftl_mapping_table_t* mt);
 void bdbm_dftl_init_mapping_table (dftl_mapping_table_t* mt, bdbm_device_params_t* np);
 
@@ -87,9 +127,13 @@ int bdbm_dftl_invalidate_mapping_entry (dftl_mapping_table_t* mt, uint64_t lpa);
 
 /* management of directory slots */
 int bdbm_dftl_check_mapping_entry (dftl_mapping_table_t* mt, uint64_t lpa);
+int bdbm_dftl_lookup_mapping_entry (dftl_mapping_table_t* mt, uint64_t lpa);
 directory_slot_t* 
 bdbm_dftl_prepare_victim_mapblk (dftl_mapping_table_t* mt);
 
+uint64_t
+bdbm_dftl_prepare_clean_mapblks (dftl_mapping_table_t* mt, directory_slot_t** dss, uint64_t max);
+
 void 
 bdbm_dftl_finish_victim_mapblk (dftl_mapping_table_t* mt, directory_slot_t* ds, bdbm_phyaddr_t* phyaddr);
 
@@ -97,7 +141,7 @@ directory_slot_t*
 bdbm_dftl_missing_dir_prepare (dftl_mapping_table_t* mt, uint64_t lpa);
 
 int 
-bdbm_dftl_missing_dir_done (dftl_mapping_table_t* mt, directory_slot_t* ds, mapping_entry_t* me);
+bdbm_dftl_missing_dir_done (dftl_mapping_table_t* mt, directory_slot_t* ds, dftl_packed_entry_t* me);
 
 void bdbm_dftl_update_dir_phyaddr (
 	dftl_mapping_table_t* mt, 
@@ -108,7 +152,11 @@ int
 bdbm_dftl_missing_dir_done_error (
 	dftl_mapping_table_t* mt, 
 	directory_slot_t* ds,
-	mapping_entry_t* me);
+	dftl_packed_entry_t* me);
+
+/* checkpoint of the directory and of the cached slots (the hot set) */
+uint32_t bdbm_dftl_store_mapping_table (dftl_mapping_table_t* mt, bdbm_file_t fp, uint64_t* pos);
+uint32_t bdbm_dftl_load_mapping_table (dftl_mapping_table_t* mt, bdbm_file_t fp, uint64_t* pos);
 
 
 #endif
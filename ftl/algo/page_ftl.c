@@ -60,6 +60,7 @@ bdbm_ftl_inf_t _ftl_page_ftl = {
 	.invalidate_lpa = bdbm_page_ftl_invalidate_lpa,
 	.do_gc = bdbm_page_ftl_do_gc,
 	.is_gc_needed = bdbm_page_ftl_is_gc_needed,
+	.is_gc_urgent = bdbm_page_ftl_is_gc_urgent,
 	.scan_badblocks = bdbm_page_badblock_scan,
 
 	.get_token = bdbm_page_ftl_get_token,
@@ -112,17 +113,17 @@ typedef struct {
 	bdbm_sema_t badblk;
 
 	// infomative data.	
-	uint64_t host_write_count[64];
-	uint64_t total_write_count[64];
-	uint64_t invald_page_count[64];
+	uint64_t* host_write_count;	/* for each ch x way */
+	uint64_t* total_write_count;
+	uint64_t* invald_page_count;
 	uint64_t block_info[MAX_COPY_BACK+1];
 
 	uint64_t src_valid;
 	uint64_t src_valid_page_count;
 	uint64_t src_unit_hand;
 	uint64_t src_plane_hand;	
-	uint64_t src_unit_idx[PLANE_NUMBER][64];
-	uint64_t src_plane_idx[PLANE_NUMBER][64];	
+	uint64_t* src_unit_idx[PLANE_NUMBER];	// for each ch x way.
+	uint64_t* src_plane_idx[PLANE_NUMBER];
 
 	uint64_t partial_read_start;
 	uint64_t partial_read_end;
@@ -384,6 +385,7 @@ uint32_t bdbm_page_ftl_create (bdbm_drv_info_t* bdi)
 		{
 			bdbm_error ("bdbm_zmalloc failed");
 			bdbm_page_ftl_destroy (bdi);		
+			return 1;
 		}
 
 		p->block_info[i] = 0;
@@ -394,15 +396,28 @@ uint32_t bdbm_page_ftl_create (bdbm_drv_info_t* bdi)
 	for (i = 0; i < np->nr_planes; i++)
 	{
 		if ((p->gc_src_blk_offs[i] = (uint64_t*)bdbm_zmalloc
+				(sizeof(uint64_t) * p->nr_punits)) == NULL ||
+			(p->src_unit_idx[i] = (uint64_t*)bdbm_zmalloc
+				(sizeof(uint64_t) * p->nr_punits)) == NULL ||
+			(p->src_plane_idx[i] = (uint64_t*)bdbm_zmalloc
 				(sizeof(uint64_t) * p->nr_punits)) == NULL)
 		{
 			bdbm_error ("bdbm_zmalloc failed");
 			bdbm_page_ftl_destroy (bdi);		
+			return 1;
 		}
 	}
+
+	// informative data for each ch x way.
+	if ((p->host_write_count = (uint64_t*)bdbm_zmalloc (sizeof (uint64_t) * p->nr_punits)) == NULL ||
+		(p->total_write_count = (uint64_t*)bdbm_zmalloc (sizeof (uint64_t) * p->nr_punits)) == NULL ||
+		(p->invald_page_count = (uint64_t*)bdbm_zmalloc (sizeof (uint64_t) * p->nr_punits)) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		bdbm_page_ftl_destroy (bdi);
+		return 1;
+	}
 	
-//	for (i = 0; i < p->nr_punits; i++)
-	for (i = 0; i < 64; i++)
+	for (i = 0; i < p->nr_punits; i++)
 	{
 		for (k = 0; k < np->nr_planes; k++)
 		{
@@ -535,6 +550,26 @@ void bdbm_page_ftl_destroy (bdbm_drv_info_t* bdi)
 	}
 	if (p->gc_src_bab)
 		bdbm_free (p->gc_src_bab);
+	for (idx = 0; idx < MAX_COPY_BACK; idx++) {
+		if (p->gc_dst_bab[idx])
+			bdbm_free (p->gc_dst_bab[idx]);
+		if (p->gc_dst_blk_offs[idx])
+			bdbm_free (p->gc_dst_blk_offs[idx]);
+	}
+	for (idx = 0; idx < PLANE_NUMBER; idx++) {
+		if (p->gc_src_blk_offs[idx])
+			bdbm_free (p->gc_src_blk_offs[idx]);
+		if (p->src_unit_idx[idx])
+			bdbm_free (p->src_unit_idx[idx]);
+		if (p->src_plane_idx[idx])
+			bdbm_free (p->src_plane_idx[idx]);
+	}
+	if (p->host_write_count)
+		bdbm_free (p->host_write_count);
+	if (p->total_write_count)
+		bdbm_free (p->total_write_count);
+	if (p->invald_page_count)
+		bdbm_free (p->invald_page_count);
 	if (p->ac_bab)
 		__bdbm_page_ftl_destroy_active_blocks (p->ac_bab);
 	if (p->ptr_mapping_table)
@@ -588,6 +623,23 @@ void bdbm_page_ftl_print_blocks(bdbm_drv_info_t* bdi)
 		}
 	}
 }
+/* print a counter of each ch x way as a comma-separated line */
+static void __bdbm_page_ftl_print_units (const char* tag, uint64_t* v, uint64_t n)
+{
+	char* line = NULL;
+	uint64_t i, len = 0, size = 24 * (n + 1);
+
+	if ((line = (char*)bdbm_malloc (size)) == NULL) {
+		bdbm_error ("bdbm_malloc failed");
+		return;
+	}
+	len = snprintf (line, size, "%s", tag);
+	for (i = 0; i < n && len < size; i++)
+		len += snprintf (line + len, size - len, "%s%llu", (i == 0) ? (tag[0] ? " " : "") : ",", v[i]);
+	bdbm_msg ("%s", line);
+	bdbm_free (line);
+}
+
 void bdbm_page_ftl_print_freeblocks(bdbm_drv_info_t* bdi)
 {
 	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
@@ -598,15 +650,7 @@ void bdbm_page_ftl_print_freeblocks(bdbm_drv_info_t* bdi)
 	bdbm_msg("FreeBlock");
 	for (ch = 0; ch < np->nr_channels;	ch++)
 	{				
-		bdbm_msg("%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld",
-				p->bai->anr_free_blks[ch][0], 
-				p->bai->anr_free_blks[ch][1], 
-				p->bai->anr_free_blks[ch][2], 
-				p->bai->anr_free_blks[ch][3], 
-				p->bai->anr_free_blks[ch][4], 
-				p->bai->anr_free_blks[ch][5], 
-				p->bai->anr_free_blks[ch][6], 
-				p->bai->anr_free_blks[ch][7]);
+		__bdbm_page_ftl_print_units ("", p->bai->anr_free_blks[ch], np->nr_chips_per_channel);
 	}
 }
 
@@ -619,9 +663,14 @@ void bdbm_page_ftl_print_totalEC(bdbm_drv_info_t* bdi)
 	uint64_t ch, way, blk;
 	uint64_t blk_idx;
 	bdbm_abm_block_t* pblk = NULL;
-	uint64_t erase_count[64];
+	uint64_t* erase_count = NULL;
 	uint64_t unit;
 
+	if ((erase_count = (uint64_t*)bdbm_malloc (sizeof (uint64_t) * p->nr_punits)) == NULL) {
+		bdbm_error ("bdbm_malloc failed");
+		return;
+	}
+
 	for (ch = 0; ch < np->nr_channels;	ch++)
 	{	
 		for (way = 0; way < np->nr_chips_per_channel; way++)
@@ -641,57 +690,32 @@ void bdbm_page_ftl_print_totalEC(bdbm_drv_info_t* bdi)
 		}
 	}		
 
-	bdbm_msg("EC, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,  %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld",
-		erase_count[0],erase_count[1],erase_count[2],erase_count[3],erase_count[4],erase_count[5],erase_count[6],erase_count[7],
-		erase_count[8],erase_count[9],erase_count[10],erase_count[11],erase_count[12],erase_count[13],erase_count[14],erase_count[15],
-		erase_count[16],erase_count[17],erase_count[18],erase_count[19],erase_count[20],erase_count[21],erase_count[22],erase_count[23],
-		erase_count[24],erase_count[25],erase_count[26],erase_count[27],erase_count[28],erase_count[29],erase_count[30],erase_count[31],
-		erase_count[32],erase_count[33],erase_count[34],erase_count[35],erase_count[36],erase_count[37],erase_count[38],erase_count[39],
-		erase_count[40],erase_count[41],erase_count[42],erase_count[43],erase_count[44],erase_count[45],erase_count[46],erase_count[47],
-		erase_count[48],erase_count[49],erase_count[50],erase_count[51],erase_count[52],erase_count[53],erase_count[54],erase_count[55],
-		erase_count[56],erase_count[57],erase_count[58],erase_count[59],erase_count[60],erase_count[61],erase_count[62],erase_count[63]);
+	__bdbm_page_ftl_print_units ("EC,", erase_count, p->nr_punits);
+	bdbm_free (erase_count);
 }
 
 void bdbm_page_ftl_print_hostWrite(void)
 {
 	bdbm_page_ftl_private_t* p = _ftl_page_ftl.ptr_private;
 
-	if (p->nr_punits == 64)
-	{
-		bdbm_msg("hostW, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,  %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,   %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,  %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld", 
-			p->host_write_count[0],p->host_write_count[1],p->host_write_count[2],p->host_write_count[3],p->host_write_count[4],p->host_write_count[5],p->host_write_count[6],p->host_write_count[7], 
-			p->host_write_count[8],p->host_write_count[9],p->host_write_count[10],p->host_write_count[11],p->host_write_count[12],p->host_write_count[13],p->host_write_count[14],p->host_write_count[15], 
-			p->host_write_count[16],p->host_write_count[17],p->host_write_count[18],p->host_write_count[19],p->host_write_count[20],p->host_write_count[21],p->host_write_count[22],p->host_write_count[23], 
-			p->host_write_count[24],p->host_write_count[25],p->host_write_count[26],p->host_write_count[27],p->host_write_count[28],p->host_write_count[29],p->host_write_count[30],p->host_write_count[31], 
-			p->host_write_count[32],p->host_write_count[33],p->host_write_count[34],p->host_write_count[35],p->host_write_count[36],p->host_write_count[37],p->host_write_count[38],p->host_write_count[39], 
-			p->host_write_count[40],p->host_write_count[41],p->host_write_count[42],p->host_write_count[43],p->host_write_count[44],p->host_write_count[45],p->host_write_count[46],p->host_write_count[47], 
-			p->host_write_count[48],p->host_write_count[49],p->host_write_count[50],p->host_write_count[51],p->host_write_count[52],p->host_write_count[53],p->host_write_count[54],p->host_write_count[55], 
-			p->host_write_count[56],p->host_write_count[57],p->host_write_count[58],p->host_write_count[59],p->host_write_count[60],p->host_write_count[61],p->host_write_count[62],p->host_write_count[63]);
-	}
-	else if (p->nr_punits == 32)
-	{
-		bdbm_msg("hostW, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,  %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld",  
-			p->host_write_count[0],p->host_write_count[1],p->host_write_count[2],p->host_write_count[3],p->host_write_count[4],p->host_write_count[5],p->host_write_count[6],p->host_write_count[7], 
-			p->host_write_count[8],p->host_write_count[9],p->host_write_count[10],p->host_write_count[11],p->host_write_count[12],p->host_write_count[13],p->host_write_count[14],p->host_write_count[15], 
-			p->host_write_count[16],p->host_write_count[17],p->host_write_count[18],p->host_write_count[19],p->host_write_count[20],p->host_write_count[21],p->host_write_count[22],p->host_write_count[23], 
-			p->host_write_count[24],p->host_write_count[25],p->host_write_count[26],p->host_write_count[27],p->host_write_count[28],p->host_write_count[29],p->host_write_count[30],p->host_write_count[31]);
-	}						
-	else
-	{
-		bdbm_msg("hostW, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld",
-			p->host_write_count[0],p->host_write_count[1],p->host_write_count[2],p->host_write_count[3],p->host_write_count[4],p->host_write_count[5],p->host_write_count[6],p->host_write_count[7], 
-			p->host_write_count[8],p->host_write_count[9],p->host_write_count[10],p->host_write_count[11],p->host_write_count[12],p->host_write_count[13],p->host_write_count[14],p->host_write_count[15]); 
-	}
+	__bdbm_page_ftl_print_units ("hostW,", p->host_write_count, p->nr_punits);
 }
 
 void bdbm_page_ftl_print_WAF(void)
 {
 	bdbm_page_ftl_private_t* p = _ftl_page_ftl.ptr_private;
+	uint64_t* waf = NULL;
+	uint64_t unit;
 
-	bdbm_msg("WAF %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld, %lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld", 
-	(p->total_write_count[0])*100/p->invald_page_count[0], (p->total_write_count[1])*100/p->invald_page_count[1],(p->total_write_count[2])*100/p->invald_page_count[2],(p->total_write_count[3])*100/p->invald_page_count[3],p->total_write_count[4]*100/p->invald_page_count[4],p->total_write_count[5]*100/p->invald_page_count[5],p->total_write_count[6]*100/p->invald_page_count[6],
-		p->total_write_count[7]*100/p->invald_page_count[7], p->total_write_count[8]*100/p->invald_page_count[8],p->total_write_count[9]*100/p->invald_page_count[9],p->total_write_count[10]*100/p->invald_page_count[10],p->total_write_count[11]*100/p->invald_page_count[11],p->total_write_count[12]*100/p->invald_page_count[12],p->total_write_count[13]*100/p->invald_page_count[13],p->total_write_count[14]*100/p->invald_page_count[14],p->total_write_count[15]*100/p->invald_page_count[15], p->total_write_count[16]*100/p->invald_page_count[16],p->total_write_count[17]*100/p->invald_page_count[17],p->total_write_count[18]*100/p->invald_page_count[18],p->total_write_count[19]*100/p->invald_page_count[19],p->total_write_count[20]*100/p->invald_page_count[20],p->total_write_count[21]*100/p->invald_page_count[21],p->total_write_count[22]*100/p->invald_page_count[22],p->total_write_count[23]*100/p->invald_page_count[23],p->total_write_count[24]*100/p->invald_page_count[24],p->total_write_count[25]*100/p->invald_page_count[25],p->total_write_count[26]*100/p->invald_page_count[26], p->total_write_count[27]*100/p->invald_page_count[27],		p->total_write_count[28]*100/p->invald_page_count[28],		p->total_write_count[29]*100/p->invald_page_count[29],		p->total_write_count[30]*100/p->invald_page_count[30],		p->total_write_count[31]*100/p->invald_page_count[31],		p->total_write_count[32]*100/p->invald_page_count[32],		p->total_write_count[33]*100/p->invald_page_count[33],		p->total_write_count[34]*100/p->invald_page_count[34],		p->total_write_count[35]*100/p->invald_page_count[35],		p->total_write_count[36]*100/p->invald_page_count[36],		p->total_write_count[37]*100/p->invald_page_count[37],		p->total_write_count[38]*100/p->invald_page_count[38],		p->total_write_count[39]*100/p->invald_page_count[39],		p->total_write_count[40]*100/p->invald_page_count[40],		p->total_write_count[41]*100/p->invald_page_count[41],		p->total_write_count[42]*100/p->invald_page_count[42],		p->total_write_count[43]*100/p->invald_page_count[43],		p->total_write_count[44]*100/p->invald_page_count[44],		p->total_write_count[45]*100/p->invald_page_count[45],		p->total_write_count[46]*100/p->invald_page_count[46],		p->total_write_count[47]*100/p->invald_page_count[47],		p->total_write_count[48]*100/p->invald_page_count[48],		p->total_write_count[49]*100/p->invald_page_count[49],		p->total_write_count[50]*100/p->invald_page_count[50],		p->total_write_count[51]*100/p->invald_page_count[51],		p->total_write_count[52]*100/p->invald_page_count[52],		p->total_write_count[53]*100/p->invald_page_count[53],		p->total_write_count[54]*100/p->invald_page_count[54],		p->total_write_count[55]*100/p->invald_page_count[55],		p->total_write_count[56]*100/p->invald_page_count[56],		p->total_write_count[57]*100/p->invald_page_count[57],		p->total_write_count[58]*100/p->invald_page_count[58],p->total_write_count[59]*100/p->invald_page_count[59],		p->total_write_count[60]*100/p->invald_page_count[60],p->total_write_count[61]*100/p->invald_page_count[61],p->total_write_count[62]*100/p->invald_page_count[62],p->total_write_count[63]*100/p->invald_page_count[63]);
+	if ((waf = (uint64_t*)bdbm_malloc (sizeof (uint64_t) * p->nr_punits)) == NULL) {
+		bdbm_error ("bdbm_malloc failed");
+		return;
+	}
+	for (unit = 0; unit < p->nr_punits; unit++)
+		waf[unit] = p->total_write_count[unit] * 100 / p->invald_page_count[unit];
 
+	__bdbm_page_ftl_print_units ("WAF", waf, p->nr_punits);
+	bdbm_free (waf);
 }
 
 void bdbm_page_ftl_print_copyback_info(bdbm_drv_info_t* bdi)
@@ -1069,6 +1093,19 @@ uint32_t bdbm_page_ftl_map_lpa_to_ppa (
 		return 0;
 	}
 
+	/* the same on-demand condition as above, but without touching the
+	 * token state; the llm polls it to bound read-over-write priority */
+	uint8_t bdbm_page_ftl_is_gc_urgent (bdbm_drv_info_t* bdi)
+	{
+		bdbm_page_ftl_private_t* p = _ftl_page_ftl.ptr_private;
+
+		/* the llm may come up before the ftl */
+		if (p == NULL || p->bai == NULL)
+			return 0;
+
+		return (bdbm_abm_get_nr_free_blocks (p->bai) <= p->bai->nr_gc_ondemand_threshold) ? 1 : 0;
+	}
+
 	/* VICTIM SELECTION - First Selection:
 	 * select the first dirty block in a list */
 	bdbm_abm_block_t* __bdbm_page_ftl_victim_selection (
@@ -1617,27 +1654,23 @@ void bdbm_page_ftl_alloc_srcblk(bdbm_drv_info_t* bdi)
 //	bdbm_msg("GC %lld,V %lld,U %lld,M %lld, %lld", p->gc_count, p->src_valid_page_count, p->utilization, p->gc_mode,bdbm_abm_get_nr_free_blocks (p->bai)); 
 }
 
-void check_valid_bitmap(bdbm_abm_block_t* blk)
+void check_valid_bitmap(bdbm_device_params_t* np, bdbm_abm_block_t* blk)
 {
-	uint64_t index;
 	uint64_t expected_valid_page;
 	uint64_t count = 0;
+	uint8_t* bitmap = (uint8_t*)blk->pst;	// byte for page, bit for subpage.
+	uint64_t page;
 	
-	expected_valid_page =	128*4 - blk->nr_invalid_subpages;
+	expected_valid_page = np->nr_subpages_per_block - blk->nr_invalid_subpages;
 
-	for (index = 0; index < 16; index++)
+	for (page = 0; page < np->nr_pages_per_block; page++)
 	{
-		uint8_t* bitmap = (uint8_t*)(blk->pst + index);
 		uint64_t bit_idx;
-		uint64_t byte_idx;
-		for (byte_idx = 0; byte_idx < 8; byte_idx++)
+		for (bit_idx = 0; bit_idx < np->nr_subpages_per_page; bit_idx++)
 		{
-			for (bit_idx = 0; bit_idx < 8; bit_idx++)
+			if (bitmap[page] & (0x01 << bit_idx))
 			{
-				if (bitmap[byte_idx] & (0x01 << bit_idx))
-				{
-					count++;
-				}
+				count++;
 			}
 		}
 	}
@@ -1758,6 +1791,7 @@ void __bdbm_page_ftl_load_meta(bdbm_drv_info_t* bdi)
 	uint64_t unit, plane;
 	bdbm_hlm_req_gc_t* hlm_gc = &p->gc_hlm; // used for host meta write.
 	bdbm_abm_block_t* src_blk = NULL;
+	bdbm_vclock_waiter_t w = { 0, 0 };
 
 //	bdbm_msg("__bdbm_page_ftl_load_meta start: %lld,  %lld", hlm_gc->nr_llm_reqs, atomic64_read(&hlm_gc->nr_llm_reqs_done));
 
@@ -1803,7 +1837,9 @@ void __bdbm_page_ftl_load_meta(bdbm_drv_info_t* bdi)
 	while (hlm_gc->nr_llm_reqs != atomic64_read(&hlm_gc->nr_llm_reqs_done))
 	{
 		// wait.
+		bdbm_vclock_block (&w);
 	}
+	bdbm_vclock_unblock (&w);
 
 	uint32_t* copyback_count = (uint32_t*)(hlm_gc->llm_reqs[p->meta_load_idx_start].fmain.kp_ptr[0]);
 	//p->dst_index = copyback_count[0]+1;
@@ -2941,7 +2977,7 @@ uint32_t bdbm_page_badblock_scan (bdbm_drv_info_t* bdi)
 uint32_t bdbm_page_ftl_get_token (bdbm_drv_info_t* bdi)
 {
 	bdbm_page_ftl_private_t* p = _ftl_page_ftl.ptr_private;
-	uint32_t token = 1024;
+	uint32_t token = p->gc_subpages_move_unit * 2; // two flushes of ch x way x plane pages (1024 for 8x8)
 
 	if (p->token_mode)
 	{
@@ -53,6 +53,7 @@ uint32_t bdbm_page_ftl_get_ppa (bdbm_drv_info_t* bdi, int64_t lpa, bdbm_phyaddr_
 uint32_t bdbm_page_ftl_map_lpa_to_ppa (bdbm_drv_info_t* bdi, bdbm_logaddr_t* logaddr, bdbm_phyaddr_t* ppa, uint32_t info);
 uint32_t bdbm_page_ftl_invalidate_lpa (bdbm_drv_info_t* bdi, int64_t lpa, uint64_t len);
 uint8_t bdbm_page_ftl_is_gc_needed (bdbm_drv_info_t* bdi, int64_t lpa);
+uint8_t bdbm_page_ftl_is_gc_urgent (bdbm_drv_info_t* bdi);
 uint32_t bdbm_page_ftl_do_gc (bdbm_drv_info_t* bdi, int64_t lpa);
 uint32_t bdbm_page_badblock_scan (bdbm_drv_info_t* bdi);
 uint32_t bdbm_page_ftl_load (bdbm_drv_info_t* bdi, const char* fn);
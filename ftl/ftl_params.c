@@ -57,6 +57,16 @@ int _param_llm_type					= LLM_MULTI_QUEUE;
 //int _param_llm_type					= LLM_NO_QUEUE;
 int _param_hlm_type					= HLM_BUFFER;
 //int _param_hlm_type					= HLM_NO_BUFFER;
+int _param_dispatch_window			= 8;	/* 1: in-order dispatch */
+int _param_read_prio_bypass			= 16;	/* 0: no read priority */
+int _param_read_prio_gc_bypass		= READ_PRIO_GC_BYPASS;	/* 0: FIFO while GC is urgent */
+int _param_max_suspends				= 2;	/* 0: no program/erase suspension */
+int _param_mp_read_fusion			= 1;	/* 0: one command per plane */
+int _param_cmd_batch				= 4;	/* 0 or 1: one command per program/erase */
+int _param_llm_credits				= 4;	/* per punit; 0: no flow control */
+int _param_qos_sched				= 1;	/* 0: read priority with read_prio_bypass */
+int _param_dftl_cache_kb			= 4096;	/* DRAM for cached DFTL mapping pages */
+int _param_nr_log_blocks			= 64;	/* block-mapping log blocks; 0: pure block mapping */
 
 bdbm_ftl_params get_default_ftl_params (void)
 {
@@ -72,6 +82,16 @@ bdbm_ftl_params get_default_ftl_params (void)
 	p.mapping_type = _param_mapping_type;
 	p.llm_type = _param_llm_type;
 	p.hlm_type = _param_hlm_type;
+	p.dispatch_window = _param_dispatch_window;
+	p.read_prio_bypass = _param_read_prio_bypass;
+	p.read_prio_gc_bypass = _param_read_prio_gc_bypass;
+	p.max_suspends = _param_max_suspends;
+	p.mp_read_fusion = _param_mp_read_fusion;
+	p.cmd_batch = _param_cmd_batch;
+	p.llm_credits = _param_llm_credits;
+	p.qos_sched = _param_qos_sched;
+	p.dftl_cache_kb = _param_dftl_cache_kb;
+	p.nr_log_blocks = _param_nr_log_blocks;
 
 	return p;
 }
@@ -91,6 +111,16 @@ void display_ftl_params (bdbm_ftl_params* p)
 	bdbm_msg ("wl policy = %d (1: none, 2: swap)", p->wl_policy);
 	bdbm_msg ("trim mode = %d (1: enable, 2: disable)", p->trim);
 	bdbm_msg ("kernel sector = %d bytes", p->kernel_sector_size);
+	bdbm_msg ("dispatch window = %d", p->dispatch_window);
+	bdbm_msg ("read priority bypass = %d (0: disable)", p->read_prio_bypass);
+	bdbm_msg ("read priority bypass under GC = %d", p->read_prio_gc_bypass);
+	bdbm_msg ("max suspends per program/erase = %d (0: disable)", p->max_suspends);
+	bdbm_msg ("multi-plane read fusion = %d (0: disable)", p->mp_read_fusion);
+	bdbm_msg ("max programs/erases per command = %d (0 or 1: disable)", p->cmd_batch);
+	bdbm_msg ("llm credits per punit = %d (0: unlimited)", p->llm_credits);
+	bdbm_msg ("qos scheduling = %d (1: deadline, 0: read priority)", p->qos_sched);
+	bdbm_msg ("dftl mapping cache = %d KB", p->dftl_cache_kb);
+	bdbm_msg ("block-mapping log blocks = %d (0: pure block mapping)", p->nr_log_blocks);
 
 	bdbm_msg ("copyback_threshold = %d", MAX_COPY_BACK - 1);
 
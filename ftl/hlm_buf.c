@@ -46,7 +46,10 @@ THE SOFTWARE.
 #include "algo/block_ftl.h"
 #include "algo/page_ftl.h"
 #include "queue/queue.h"
+#include "queue/credit.h"
 
+/* # of host reqs that can wait in the hlm queue */
+#define HLM_BUF_CREDITS	160
 
 /* interface for hlm_buf */
 bdbm_hlm_inf_t _hlm_buf_inf = {
@@ -63,7 +66,9 @@ struct bdbm_hlm_buf_private {
 
 	/* for thread management */
 	bdbm_queue_t* q;
+	bdbm_credit_t* credits;	/* taken by make_req and returned on dequeue */
 	bdbm_thread_t* hlm_thread;
+	atomic64_t is_idle;	/* 1: the thread does not hold the virtual clock */
 };
 
 
@@ -80,6 +85,19 @@ int __hlm_buf_thread (void* arg)
 
 	for (;;) {
 		if (bdbm_queue_is_all_empty (p->q)) {
+			/* let the virtual clock go unless a req came in meanwhile; if
+			 * one does later, make_req holds it for us */
+			if (atomic64_read (&p->is_idle) == 0) {
+				atomic64_set (&p->is_idle, 1);
+				smp_mb ();
+				if (!bdbm_queue_is_all_empty (p->q)) {
+					if (atomic64_xchg (&p->is_idle, 0) == 0)
+						bdbm_vclock_release ();	/* make_req held it for us */
+					continue;
+				}
+				bdbm_vclock_release ();
+			}
+
 			idle_count++;
 			if ((idle_count % 10000000) == 0)
 			{
@@ -103,7 +121,10 @@ int __hlm_buf_thread (void* arg)
 			{
 				uint32_t ret; 
 				uint32_t utilization = 0;
+				bdbm_vclock_waiter_t w = { 0, 0 };
 
+				/* GC is polled; it only waits for the device between calls */
+				bdbm_vclock_hold ();
 				hlm_nobuf_flush_buffer(bdi);
 
 				if (idle_loop == 0)
@@ -114,8 +135,12 @@ int __hlm_buf_thread (void* arg)
 				do 
 				{
 					ret = ftl->do_gc (bdi, utilization);
+					if (ret != 0)
+						bdbm_vclock_block (&w);
 				}
 				while ((ret != 0));
+				bdbm_vclock_unblock (&w);
+				bdbm_vclock_release ();
 			}
 			bdbm_thread_yield();
 		}
@@ -138,6 +163,7 @@ int __hlm_buf_thread (void* arg)
 
 //			bdbm_msg(" 3. hlm_nobuf_make_req");
 			if ((r = (bdbm_hlm_req_t*)bdbm_queue_dequeue (p->q, qIdx)) != NULL) {
+				bdbm_credit_put (p->credits, 0, CREDIT_CLASS_HOST);
 				if (hlm_nobuf_make_req (bdi, r)) {
 					/* if it failed, we directly call 'ptr_host_inf->end_req' */
 					bdi->ptr_host_inf->end_req (bdi, r);
@@ -177,25 +203,36 @@ uint32_t hlm_buf_create (bdbm_drv_info_t* bdi)
 {
 	struct bdbm_hlm_buf_private* p;
 
-	hlm_nobuf_create(bdi);
+	if (hlm_nobuf_create (bdi) != 0)
+		return 1;
 
 	/* create private */
 	if ((p = (struct bdbm_hlm_buf_private*)bdbm_malloc_atomic
 			(sizeof(struct bdbm_hlm_buf_private))) == NULL) {
 		bdbm_error ("bdbm_malloc_atomic failed");
+		hlm_nobuf_destroy (bdi);
 		return 1;
 	}
+	p->q = NULL;
+	p->credits = NULL;
+	atomic64_set (&p->is_idle, 1);
 
 	/* setup FTL function pointers */
 	if ((p->ptr_ftl_inf = BDBM_GET_FTL_INF (bdi)) == NULL) {
 		bdbm_error ("ftl is not valid");
-		return 1;
+		goto fail;
 	}
 
 	/* create a single queue */
 	if ((p->q = bdbm_queue_create (2, INFINITE_QUEUE)) == NULL) {
 		bdbm_error ("bdbm_queue_create failed");
-		return -1;
+		goto fail;
+	}
+
+	/* create credits for the queue */
+	if ((p->credits = bdbm_credit_create (1, HLM_BUF_CREDITS)) == NULL) {
+		bdbm_error ("bdbm_credit_create failed");
+		goto fail;
 	}
 
 	/* keep the private structure */
@@ -206,11 +243,22 @@ uint32_t hlm_buf_create (bdbm_drv_info_t* bdi)
 	if ((p->hlm_thread = bdbm_thread_create (
 			__hlm_buf_thread, bdi, "__hlm_buf_thread")) == NULL) {
 		bdbm_error ("kthread_create failed");
-		return -1;
+		goto fail;
 	}
 	bdbm_thread_run (p->hlm_thread);
 
 	return 0;
+
+fail:
+	bdi->ptr_hlm_inf->ptr_private = NULL;
+	_hlm_buf_inf.ptr_private = NULL;
+	if (p->credits)
+		bdbm_credit_destroy (p->credits);
+	if (p->q)
+		bdbm_queue_destroy (p->q);
+	bdbm_free_atomic (p);
+	hlm_nobuf_destroy (bdi);
+	return -1;
 }
 
 void hlm_buf_destroy (bdbm_drv_info_t* bdi)
@@ -228,6 +276,7 @@ void hlm_buf_destroy (bdbm_drv_info_t* bdi)
 
 	/* destroy queue */
 	bdbm_queue_destroy (p->q);
+	bdbm_credit_destroy (p->credits);
 
 	/* free priv */
 	bdbm_free_atomic (p);
@@ -249,9 +298,13 @@ uint32_t hlm_buf_make_req (
 		bdbm_bug_on (1);
 	} 
 
-	while (bdbm_queue_get_nr_items (p->q) >= 160) {
-		bdbm_thread_yield ();
-	}
+	/* the caller holds the virtual clock until r is queued; the hold then
+	 * goes to the hlm thread if it was idle */
+	bdbm_vclock_host_submit ();
+	bdbm_vclock_hold ();
+
+	/* wait until the queue has room for r */
+	bdbm_credit_get (p->credits, 0, CREDIT_CLASS_HOST);
 	
 	/* put a request into Q */
 	
@@ -262,6 +315,10 @@ uint32_t hlm_buf_make_req (
 
 	if ((ret = bdbm_queue_enqueue (p->q, queue_idx, (void*)r))) {
 		bdbm_msg ("bdbm_queue_enqueue failed");
+		bdbm_credit_put (p->credits, 0, CREDIT_CLASS_HOST);
+		bdbm_vclock_release ();
+	} else if (atomic64_xchg (&p->is_idle, 0) == 0) {
+		bdbm_vclock_release ();
 	}
 
 	/* wake up thread if it sleeps */
@@ -40,10 +40,12 @@ THE SOFTWARE.
 #include "hlm_nobuf.h"
 #include "hlm_dftl.h"
 #include "uthread.h"
+#include "ufile.h"
 
 #include "algo/no_ftl.h"
 #include "algo/block_ftl.h"
 #include "algo/page_ftl.h"
+#include "algo/dftl.h"
 #include "queue/queue.h"
 
 
@@ -122,33 +124,20 @@ int __fetch_me_and_make_req (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* r)
 		bdbm_msg ("GC invokation: %d", i);
 	}
 
-	/* STEP1: read missing mapping entries */
+	/* STEP1: read missing mapping entries; the loads of all the missing
+	 * slots go to llm together and we wake up when the last one arrives */
 	nr_missed_dir = r->len;
 	{
-		bdbm_llm_req_t** rr = (bdbm_llm_req_t**)bdbm_malloc (sizeof (bdbm_llm_req_t*) * nr_missed_dir);
-
-		/* FIXME: need to improve to exploit parallelism */
-		memset (rr, 0x00, sizeof (bdbm_llm_req_t*) * nr_missed_dir);
-		for (i = 0; i < nr_missed_dir; i++) {
-			/* check the availability of mapping entries again */
-			if (p->ftl->check_mapblk (bdi, r->lpa + i) == 0)
-				continue;
+		bdbm_dftl_fetch_t* f = NULL;
 
-			/* fetch mapping entries to DRAM from Flash */
-			if ((rr[i] = p->ftl->prepare_mapblk_load (bdi, r->lpa + i)) == NULL)
-				continue;
-
-			/* send read requets to llm */
-			bdbm_sema_lock (rr[i]->done);
-			bdi->ptr_llm_inf->make_req (bdi, rr[i]);
-		}
-		for (i = 0; i < nr_missed_dir; i++) {
-			if (rr[i]) {
-				bdbm_sema_lock (rr[i]->done);
-				p->ftl->finish_mapblk_load (bdi, rr[i]);
-			}
+		if ((f = bdbm_dftl_fetch_create (nr_missed_dir)) == NULL) {
+			bdbm_error ("bdbm_dftl_fetch_create failed");
+			return 1;
 		}
-		bdbm_free (rr);
+		for (i = 0; i < nr_missed_dir; i++)
+			bdbm_dftl_fetch_add (bdi, f, r->lpa + i);
+		bdbm_dftl_fetch_wait (bdi, f);
+		bdbm_dftl_fetch_destroy (f);
 	}
 
 	/* STEP2: send origianl requests to llm */
@@ -293,12 +282,13 @@ uint32_t hlm_dftl_make_req (
 			break;
 	}
 
-	/* see if there are missing entries */
+	/* see if there are missing entries (every lpa is looked up once,
+	 * so that the FTL can keep the hit ratio of its mapping cache) */
 	if (r->req_type == REQTYPE_WRITE ||
 		r->req_type == REQTYPE_READ) {
 		for (i = 0; i < r->len; i++) {
-			if ((avail = p->ftl->check_mapblk (bdi, r->lpa + i)) == 1)
-				break;
+			if (p->ftl->check_mapblk (bdi, r->lpa + i) == 1)
+				avail = 1;
 		}
 	} else if (r->req_type == REQTYPE_TRIM) {
 		/* don't fetch mapping entries for TRIM */
@@ -330,6 +320,11 @@ uint32_t hlm_dftl_make_req (
 		ret = __fetch_me_and_make_req (bdi, r);
 	}
 
+	/* the host request is on its way to llm; now write back dirty mapping
+	 * pages that are close to eviction, so that a later miss does not
+	 * have to wait for them to be programmed */
+	bdbm_dftl_clean_mapblks (bdi);
+
 #ifdef USE_THREAD
 	bdbm_sema_unlock (&p->ftl_lock);
 
@@ -349,6 +344,11 @@ void hlm_dftl_end_req (
 {
 	if (r->done && r->ds) {
 		/* FIXME: r->done is set to not NULL for mapblk */
+		if (r->req_type == REQTYPE_META_READ && r->ptr_hlm_req != NULL) {
+			/* a load that belongs to a fetch batch */
+			bdbm_dftl_fetch_arrived (r);
+			return;
+		}
 		bdbm_sema_unlock (r->done);
 		return;
 	}
@@ -47,7 +47,7 @@ THE SOFTWARE.
 #include "algo/block_ftl.h"
 #include "algo/page_ftl.h"
 
-#define BUFFERING_LLM_COUNT	(320)
+#define BUFFERING_LLM_COUNT	(320)	// at least; rounded up to a multiple of ch x bank
 #define ENTRY_SHIFT	3
 
 /* interface for hlm_nobuf */
@@ -63,7 +63,7 @@ bdbm_hlm_inf_t _hlm_nobuf_inf = {
 
 /* data structures for hlm_nobuf */
 typedef struct {
-	bdbm_llm_req_t* buffered_lr[BUFFERING_LLM_COUNT];
+	bdbm_llm_req_t** buffered_lr; // queuing_threshold entries
 	uint64_t cur_buf_ofs;
 	
 	uint64_t cur_lr_idx;
@@ -72,7 +72,7 @@ typedef struct {
 
 	uint64_t flush_threshold; // ch x bank
 	uint64_t flush_lpn_count; // flush_threshold x subpages/page
-	uint64_t queuing_threshold; // ch x bank x 4
+	uint64_t queuing_threshold; // a multiple of flush_threshold
 
 	// utilization
 	uint64_t cumulative_check_count;
@@ -89,7 +89,7 @@ typedef struct {
 } bdbm_hlm_hash_entry;
 
 bdbm_hlm_hash_entry* hash_info = NULL;
-bdbm_hlm_hash_entry hash_entry[BUFFERING_LLM_COUNT*BDBM_MAX_PAGES]; // 320 x 8
+bdbm_hlm_hash_entry* hash_entry = NULL; // queuing_threshold x 8
 
 void __hlm_nobuf_add_entry(bdbm_hlm_hash_entry* entry) {
 	HASH_ADD_INT(hash_info, id, entry);
@@ -110,7 +110,6 @@ bdbm_hlm_hash_entry* __hlm_nobuf_find_entry(int user_id) {
 uint32_t hlm_nobuf_create (bdbm_drv_info_t* bdi)
 {
 	bdbm_hlm_nobuf_private_t* p;
-    int i = 0;
 
 	/* create private */
 	if ((p = (bdbm_hlm_nobuf_private_t*)bdbm_malloc
@@ -119,11 +118,6 @@ uint32_t hlm_nobuf_create (bdbm_drv_info_t* bdi)
 		return 1;
 	}
 
-	for (i = 0; i < BUFFERING_LLM_COUNT; i++)
-	{
-		p->buffered_lr[i] = NULL;
-	}
-	
 	p->cur_buf_ofs = 0;
 
 	p->cur_lr_idx = 0;
@@ -132,7 +126,23 @@ uint32_t hlm_nobuf_create (bdbm_drv_info_t* bdi)
 
 	p->flush_threshold = bdi->parm_dev.nr_channels * bdi->parm_dev.nr_chips_per_channel;
 	p->flush_lpn_count = p->flush_threshold * bdi->parm_dev.nr_planes * bdi->parm_dev.nr_subpages_per_page;
-	p->queuing_threshold = BUFFERING_LLM_COUNT; // ch x bank x 4	
+
+	// the buffer wraps around at a flush boundary and keeps at least two flushes
+	p->queuing_threshold = (BUFFERING_LLM_COUNT + p->flush_threshold - 1) / p->flush_threshold;
+	if (p->queuing_threshold < 2)
+		p->queuing_threshold = 2;
+	p->queuing_threshold *= p->flush_threshold;
+
+	if ((p->buffered_lr = (bdbm_llm_req_t**)bdbm_zmalloc 
+			(sizeof (bdbm_llm_req_t*) * p->queuing_threshold)) == NULL ||
+		(hash_entry = (bdbm_hlm_hash_entry*)bdbm_zmalloc 
+			(sizeof (bdbm_hlm_hash_entry) * (p->queuing_threshold << ENTRY_SHIFT))) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		if (p->buffered_lr)
+			bdbm_free (p->buffered_lr);
+		bdbm_free (p);
+		return 1;
+	}
 	
 	// utilization
 	p->cumulative_check_count = 0;
@@ -151,6 +161,14 @@ void hlm_nobuf_destroy (bdbm_drv_info_t* bdi)
 {
 	bdbm_hlm_nobuf_private_t* p = (bdbm_hlm_nobuf_private_t*)(_hlm_nobuf_inf.ptr_private);
 
+	/* free the write buffer */
+	HASH_CLEAR (hh, hash_info);
+	if (hash_entry) {
+		bdbm_free (hash_entry);
+		hash_entry = NULL;
+	}
+	bdbm_free (p->buffered_lr);
+
 	/* free priv */
 	bdbm_free (p);
 }
@@ -217,6 +235,7 @@ int __hlm_flush_buffer(bdbm_drv_info_t* bdi)
 	int llm_idx = p->flush_lr_idx;
 	bdbm_llm_req_t* llm_req;
 	bdbm_hlm_hash_entry * entry;
+	bdbm_vclock_waiter_t w = { 0, 0 };
 
 //	bdbm_msg("flush_buffer start: %lld, %lld, %lld - %lld", p->cur_lr_idx, p->flush_lr_idx, p->queuing_lr_count, p->utilization);
 
@@ -237,7 +256,9 @@ int __hlm_flush_buffer(bdbm_drv_info_t* bdi)
 			}
 
 			ftl->do_gc(bdi, 100);
+			bdbm_vclock_block (&w);
 		}
+		bdbm_vclock_unblock (&w);
 		
 		if (ftl->map_lpa_to_ppa (bdi, &(llm_req->logaddr), &(llm_req->phyaddr), 0) != 0) 
 		{
@@ -438,8 +459,10 @@ void _display_hex_values (uint8_t* host)
 uint32_t __hlm_nobuf_make_rw_req (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* hr)
 {
 	bdbm_ftl_inf_t* ftl = BDBM_GET_FTL_INF(bdi);
+	bdbm_ftl_params* dp = BDBM_GET_DRIVER_PARAMS (bdi);
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
 	bdbm_llm_req_t* lr = NULL;
-	uint64_t i = 0, sp_ofs;
+	uint64_t i = 0, j, sp_ofs;
 	static uint64_t loop_cnt = 0;
 
 	bdbm_hlm_nobuf_private_t* p = (bdbm_hlm_nobuf_private_t*)(_hlm_nobuf_inf.ptr_private);
@@ -467,6 +490,17 @@ uint32_t __hlm_nobuf_make_rw_req (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* hr)
 
 	/* perform mapping with the FTL */
 	bdbm_hlm_for_each_llm_req (lr, hr, i) {
+		/* a block-level FTL may merge blocks to map this llm-req, and the
+		 * merge only waits for what llm already has; so hand the previous
+		 * llm-req over to llm first */
+		if (dp->mapping_type != MAPPING_POLICY_PAGE && 
+			bdbm_is_write (hr->req_type) && i > 0) {
+			if (bdi->ptr_llm_inf->make_req (bdi, &hr->llm_reqs[i-1]) != 0) {
+				bdbm_error ("oops! make_req () failed");
+				bdbm_bug_on (1);
+			}
+		}
+
 		/* (1) get the physical locations through the FTL */
 		if (bdbm_is_normal (lr->req_type)) {
 			/* handling normal I/O operations */
@@ -482,6 +516,22 @@ uint32_t __hlm_nobuf_make_rw_req (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* hr)
 					}
 				}
 			} 
+			else if (bdbm_is_write (lr->req_type) && 
+					 dp->mapping_type != MAPPING_POLICY_PAGE)
+			{
+				/* block-level FTLs put a page at the offset given by its lpa,
+				 * so writes go straight to the FTL without the write buffer */
+				if (ftl->get_free_ppa (bdi, lr->logaddr.lpa[0], &lr->phyaddr) != 0) {
+					bdbm_error ("`ftl->get_free_ppa' failed");
+					goto fail;
+				}
+				if (ftl->map_lpa_to_ppa (bdi, &lr->logaddr, &lr->phyaddr, 0) != 0) {
+					bdbm_error ("`ftl->map_lpa_to_ppa' failed");
+					goto fail;
+				}
+				for (j = 0; j < np->nr_subpages_per_page; j++)
+					((int64_t*)lr->foob.data)[j] = lr->logaddr.lpa[0];
+			}
 			else if (bdbm_is_write (lr->req_type)) 
 			{
 				int32_t ret = __hlm_buffered_write(bdi, lr); 
@@ -517,6 +567,17 @@ uint32_t __hlm_nobuf_make_rw_req (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* hr)
 				goto fail;
 			}
 
+			/* get_free_ppa could move the previous data (e.g., a merge of
+			 * block-ftl), so look it up again */
+			if (bdbm_is_rmw (lr->req_type) &&
+				ftl->get_ppa (bdi, lr->logaddr.lpa[0], &lr->phyaddr_src, &sp_ofs) != 0) {
+				bdbm_error ("`ftl->get_ppa' failed");
+				goto fail;
+			}
+			/* the whole page belongs to lpa[0] (map-unit == io-unit) */
+			for (j = 0; j < np->nr_subpages_per_page; j++)
+				((int64_t*)lr->foob.data)[j] = lr->logaddr.lpa[0];
+
 			if (ftl->map_lpa_to_ppa (bdi, &lr->logaddr, phyaddr, 0) != 0) {
 					bdbm_error ("`ftl->map_lpa_to_ppa' failed");
 					goto fail;
@@ -535,7 +596,15 @@ uint32_t __hlm_nobuf_make_rw_req (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* hr)
 	}
 	
 	/* (3) send llm_req to llm */
-	if (bdi->ptr_llm_inf->make_reqs == NULL) 
+	if (dp->mapping_type != MAPPING_POLICY_PAGE && bdbm_is_write (hr->req_type))
+	{
+		/* the others were sent while mapping */
+		if (bdi->ptr_llm_inf->make_req (bdi, &hr->llm_reqs[hr->nr_llm_reqs-1]) != 0) {
+			bdbm_error ("oops! make_req () failed");
+			bdbm_bug_on (1);
+		}
+	}
+	else if (bdi->ptr_llm_inf->make_reqs == NULL) 
 	{
 		/* send individual llm-reqs to llm */
 		bdbm_hlm_for_each_llm_req (lr, hr, i) {
@@ -571,9 +640,15 @@ fail:
 
 void __hlm_nobuf_check_background_gc (bdbm_drv_info_t* bdi)
 {
+	bdbm_ftl_params* dp = BDBM_GET_DRIVER_PARAMS (bdi);
 	bdbm_ftl_inf_t* ftl = (bdbm_ftl_inf_t*)BDBM_GET_FTL_INF(bdi);
 	bdbm_hlm_nobuf_private_t* p = (bdbm_hlm_nobuf_private_t*)(_hlm_nobuf_inf.ptr_private);
 
+	/* block-level FTLs collect a block when a write needs it
+	 * (see __hlm_nobuf_check_ondemand_gc) */
+	if (dp->mapping_type != MAPPING_POLICY_PAGE)
+		return;
+
 	if (ftl->is_gc_needed (bdi, 0)) 
 	{
 		ftl->do_gc (bdi, p->utilization);
@@ -602,7 +677,7 @@ void __hlm_nobuf_check_ondemand_gc (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* hr)
 	} else if (dp->mapping_type == MAPPING_POLICY_RSD ||
 			   dp->mapping_type == MAPPING_POLICY_BLOCK) {
 		/* perform mapping with the FTL */
-		if (hr->req_type == REQTYPE_WRITE && ftl->is_gc_needed != NULL) {
+		if (bdbm_is_write (hr->req_type) && ftl->is_gc_needed != NULL) {
 			bdbm_llm_req_t* lr = NULL;
 			uint64_t i = 0;
 			bdbm_hlm_for_each_llm_req (lr, hr, i) {
@@ -623,8 +698,15 @@ uint32_t hlm_nobuf_make_req (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* hr)
 {
 	uint32_t ret;
 	bdbm_stopwatch_t sw;
+	bdbm_vclock_waiter_t w = { 0, 0 };
 	bdbm_stopwatch_start (&sw);
 
+	/* the host runs on its own here (with hlm_buf, its thread holds it) */
+	if (bdi->parm_ftl.hlm_type == HLM_NO_BUFFER) {
+		bdbm_vclock_host_submit ();
+		bdbm_vclock_hold ();
+	}
+
 	/* is req_type correct? */
 //	bdbm_bug_on (!bdbm_is_normal (hr->req_type));
 
@@ -637,15 +719,20 @@ uint32_t hlm_nobuf_make_req (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* hr)
 		}
 	} else {
 		/* do we need to do garbage collection? */
+		if (bdi->parm_ftl.mapping_type != MAPPING_POLICY_PAGE)
+			__hlm_nobuf_check_ondemand_gc (bdi, hr);
 		while ((ret = __hlm_nobuf_make_rw_req (bdi, hr)) == 2)
 		{
 			__hlm_nobuf_check_background_gc(bdi); 
+			bdbm_vclock_block (&w);	/* the write buffer is full */
 		}
+		bdbm_vclock_unblock (&w);
 	} 
 
 	if (bdi->parm_ftl.hlm_type == HLM_NO_BUFFER)
 	{
 		__hlm_nobuf_check_background_gc(bdi); 
+		bdbm_vclock_release ();
 	}
 
 	return ret;
@@ -661,6 +748,7 @@ void __hlm_nobuf_end_blkio_req (bdbm_drv_info_t* bdi, bdbm_llm_req_t* lr)
 
 	if (atomic64_read (&hr->nr_llm_reqs_done) == hr->nr_llm_reqs) {
 		/* finish the host request */
+		bdbm_vclock_host_wake ();
 		bdi->ptr_host_inf->end_req (bdi, hr);
 	}
 }
@@ -25,6 +25,8 @@ THE SOFTWARE.
 #ifndef _BDBM_HLM_REQ_POOL_H
 #define _BDBM_HLM_REQ_POOL_H
 
+#include "whist.h"
+
 typedef struct {
 	bdbm_spinlock_t lock;
 	struct list_head used_list;
@@ -33,9 +35,10 @@ typedef struct {
 	int32_t map_unit;	/* bytes */
 	int32_t io_unit;	/* bytes */
 	int8_t in_place_rmw; /* if it is set (1), the FTL uses in-place-rmw */
+	bdbm_whist_t* whist;	/* workload histograms of reqs built by this pool */
 } bdbm_hlm_reqs_pool_t;
 
-bdbm_hlm_reqs_pool_t* bdbm_hlm_reqs_pool_create (int32_t mapping_unit_size, int32_t io_unit_size);
+bdbm_hlm_reqs_pool_t* bdbm_hlm_reqs_pool_create (int32_t mapping_unit_size, int32_t io_unit_size, uint64_t nr_lpas);
 void bdbm_hlm_reqs_pool_destroy (bdbm_hlm_reqs_pool_t* pool);
 bdbm_hlm_req_t* bdbm_hlm_reqs_pool_get_item (bdbm_hlm_reqs_pool_t* pool);
 void bdbm_hlm_reqs_pool_free_item (bdbm_hlm_reqs_pool_t* pool, bdbm_hlm_req_t* req);
@@ -42,7 +42,8 @@ THE SOFTWARE.
 #include "bdbm_drv.h"
 #include "hlm_nobuf.h"
 #include "hlm_rsd.h"
-#include "uthash.h"
+#include "umemory.h"
+#include "ufile.h"
 
 #include "algo/no_ftl.h"
 #include "algo/block_ftl.h"
@@ -57,12 +58,18 @@ bdbm_hlm_inf_t _hlm_rsd_inf = {
 	.destroy = hlm_rsd_destroy,
 	.make_req = hlm_rsd_make_req,
 	.end_req = hlm_rsd_end_req,
+	.load = hlm_rsd_load,
+	.store = hlm_rsd_store,
 };
 
+/* how many segments' worth of pages can be buffered before the oldest 
+ * buffers are pushed to NAND flash */
+#define HLM_RSD_MAX_BUFFERED_SEGS	4
+#define HLM_RSD_SNAPSHOT_MAGIC		0x52534442ULL	/* "RSDB" */
+
 typedef struct {
-	uint32_t seg_no;
-	bdbm_hlm_req_t* hlm_req;
-	UT_hash_handle hh;	/* hash header */
+	bdbm_hlm_req_t* hlm_req;	/* pages buffered for a segment (NULL: empty) */
+	uint64_t last_used;
 } segment_buf_t;
 
 /* data structures for hlm_rsd */
@@ -71,19 +78,27 @@ typedef struct {
 	bdbm_ftl_inf_t* ptr_ftl_inf;	/* for hlm_nobuff (it must be on top of this structure) */
 #endif
 
-	/* buffers for segments; NOTE: the contents of buffers must be materialized
-	 * to NAND flash when a flush command arrives. */
+	/* buffers for segments, indexed by segment numbers; NOTE: the contents 
+	 * of buffers must be materialized to NAND flash when a flush command arrives. */
 	segment_buf_t* seg_buf;
+	uint64_t nr_segs;
+	uint64_t nr_pgs_per_seg;
+	uint64_t nr_buffered_pgs;
+	uint64_t max_buffered_pgs;
+	uint64_t clock;
 }bdbm_hlm_rsd_private_t;
 
+uint32_t __hlm_rsd_flush_seg (bdbm_drv_info_t* bdi, uint64_t seg_no);
+
 /* interface functions for hlm_rsd */
 uint32_t hlm_rsd_create (bdbm_drv_info_t* bdi)
 {
 	bdbm_hlm_rsd_private_t* p = NULL;
 	bdbm_ftl_params* parms = BDBM_GET_DRIVER_PARAMS(bdi);
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
 
 	/* create private */
-	if ((p = (bdbm_hlm_rsd_private_t*)bdbm_malloc
+	if ((p = (bdbm_hlm_rsd_private_t*)bdbm_zmalloc
 			(sizeof(bdbm_hlm_rsd_private_t))) == NULL) {
 		bdbm_error ("bdbm_malloc failed");
 		return 1;
@@ -101,6 +116,17 @@ uint32_t hlm_rsd_create (bdbm_drv_info_t* bdi)
 	if (parms->mapping_type != MAPPING_POLICY_SEGMENT)
 		bdbm_warning ("ftl is not for RSD!!!");
 
+	/* a segment is a block of every chip (see block_ftl) */
+	p->nr_segs = np->nr_blocks_per_chip;
+	p->nr_pgs_per_seg = np->nr_pages_per_block * np->nr_chips_per_ssd;
+	p->max_buffered_pgs = HLM_RSD_MAX_BUFFERED_SEGS * p->nr_pgs_per_seg;
+	if ((p->seg_buf = (segment_buf_t*)bdbm_zmalloc
+			(sizeof (segment_buf_t) * p->nr_segs)) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		bdbm_free (p);
+		return 1;
+	}
+
 	/* keep the private structure */
 	bdi->ptr_hlm_inf->ptr_private = (void*)p;
 
@@ -110,36 +136,38 @@ uint32_t hlm_rsd_create (bdbm_drv_info_t* bdi)
 void hlm_rsd_destroy (bdbm_drv_info_t* bdi)
 {
 	bdbm_hlm_rsd_private_t* p = (bdbm_hlm_rsd_private_t*)BDBM_HLM_PRIV(bdi);
+	uint64_t seg_no;
+
+	/* materialize the buffers that were not kept in a snapshot */
+	for (seg_no = 0; seg_no < p->nr_segs; seg_no++)
+		__hlm_rsd_flush_seg (bdi, seg_no);
 
 	/* free priv */
+	bdbm_free (p->seg_buf);
 	bdbm_free (p);
 }
 
-bdbm_hlm_req_t* __hlm_rsd_duplicate_hlm_req (
+bdbm_hlm_req_t* __hlm_rsd_create_hlm_req (
 	bdbm_drv_info_t* bdi, 
-	bdbm_hlm_req_t* hlm_req)
+	uint64_t lpa,
+	uint64_t len)
 {
 	bdbm_hlm_req_t* new_hlm_req = NULL;
 	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
 	uint32_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
 	uint32_t i = 0;
 
-	if (hlm_req->req_type != REQTYPE_WRITE) {
+	if ((new_hlm_req = (bdbm_hlm_req_t*)bdbm_zmalloc (sizeof (bdbm_hlm_req_t))) == NULL) {
 		bdbm_bug_on (1);
 	}
 
-	if ((new_hlm_req = (bdbm_hlm_req_t*)bdbm_malloc (sizeof (bdbm_hlm_req_t))) == NULL) {
-		bdbm_bug_on (1);
-	}
-
-	new_hlm_req->req_type = hlm_req->req_type;
-	new_hlm_req->lpa = hlm_req->lpa;
-	new_hlm_req->len = hlm_req->len;
+	new_hlm_req->req_type = REQTYPE_WRITE;
+	new_hlm_req->lpa = lpa;
+	new_hlm_req->len = len;
 	new_hlm_req->nr_done_reqs = 0;
 	new_hlm_req->ptr_host_req = NULL;
 	new_hlm_req->ret = 0;
 	new_hlm_req->queued = 1;	/* mark it queued */
-	new_hlm_req->sw = hlm_req->sw;
 
 	if ((new_hlm_req->pptr_kpgs = (uint8_t**)bdbm_malloc
 			(sizeof(uint8_t*) * new_hlm_req->len * nr_kp_per_fp)) == NULL) {
@@ -150,10 +178,32 @@ bdbm_hlm_req_t* __hlm_rsd_duplicate_hlm_req (
 		bdbm_bug_on (1);
 	}
 	for (i = 0; i < new_hlm_req->len * nr_kp_per_fp; i++) {
-		new_hlm_req->kpg_flags[i] = hlm_req->kpg_flags[i];
 		if ((new_hlm_req->pptr_kpgs[i] = (uint8_t*)bdbm_malloc (KERNEL_PAGE_SIZE)) == NULL) {
 			bdbm_bug_on (1);
 		}
+	}
+
+	return new_hlm_req;
+}
+
+bdbm_hlm_req_t* __hlm_rsd_duplicate_hlm_req (
+	bdbm_drv_info_t* bdi, 
+	bdbm_hlm_req_t* hlm_req)
+{
+	bdbm_hlm_req_t* new_hlm_req = NULL;
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+	uint32_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
+	uint32_t i = 0;
+
+	if (hlm_req->req_type != REQTYPE_WRITE) {
+		bdbm_bug_on (1);
+	}
+
+	new_hlm_req = __hlm_rsd_create_hlm_req (bdi, hlm_req->lpa, hlm_req->len);
+	new_hlm_req->sw = hlm_req->sw;
+
+	for (i = 0; i < new_hlm_req->len * nr_kp_per_fp; i++) {
+		new_hlm_req->kpg_flags[i] = hlm_req->kpg_flags[i];
 		bdbm_memcpy (
 			new_hlm_req->pptr_kpgs[i], 
 			hlm_req->pptr_kpgs[i], 
@@ -163,6 +213,49 @@ bdbm_hlm_req_t* __hlm_rsd_duplicate_hlm_req (
 	return new_hlm_req;
 }
 
+/* append the pages of 'hlm_req' to the end of a buffered req */
+void __hlm_rsd_append_hlm_req (
+	bdbm_drv_info_t* bdi, 
+	bdbm_hlm_req_t* buf_req,
+	bdbm_hlm_req_t* hlm_req)
+{
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+	uint32_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
+	uint64_t nr_old = buf_req->len * nr_kp_per_fp;
+	uint64_t nr_new = hlm_req->len * nr_kp_per_fp;
+	uint8_t** pptr_kpgs = NULL;
+	uint8_t* kpg_flags = NULL;
+	uint64_t i = 0;
+
+	bdbm_bug_on (buf_req->lpa + buf_req->len != hlm_req->lpa);
+
+	if ((pptr_kpgs = (uint8_t**)bdbm_malloc (sizeof(uint8_t*) * (nr_old + nr_new))) == NULL) {
+		bdbm_bug_on (1);
+	}
+	if ((kpg_flags = (uint8_t*)bdbm_malloc (sizeof(uint8_t) * (nr_old + nr_new))) == NULL) {
+		bdbm_bug_on (1);
+	}
+
+	/* keep the buffered pages as they are */
+	for (i = 0; i < nr_old; i++) {
+		pptr_kpgs[i] = buf_req->pptr_kpgs[i];
+		kpg_flags[i] = buf_req->kpg_flags[i];
+	}
+	for (i = 0; i < nr_new; i++) {
+		kpg_flags[nr_old + i] = hlm_req->kpg_flags[i];
+		if ((pptr_kpgs[nr_old + i] = (uint8_t*)bdbm_malloc (KERNEL_PAGE_SIZE)) == NULL) {
+			bdbm_bug_on (1);
+		}
+		bdbm_memcpy (pptr_kpgs[nr_old + i], hlm_req->pptr_kpgs[i], KERNEL_PAGE_SIZE);
+	}
+
+	bdbm_free (buf_req->pptr_kpgs);
+	bdbm_free (buf_req->kpg_flags);
+	buf_req->pptr_kpgs = pptr_kpgs;
+	buf_req->kpg_flags = kpg_flags;
+	buf_req->len += hlm_req->len;
+}
+
 void __hlm_rsd_delete_hlm_req (
 	bdbm_drv_info_t* bdi, 
 	bdbm_hlm_req_t* hlm_req)
@@ -179,18 +272,63 @@ void __hlm_rsd_delete_hlm_req (
 	bdbm_free (hlm_req);
 }
 
+/* send the buffer of a segment to NAND flash */
+uint32_t __hlm_rsd_flush_seg (
+	bdbm_drv_info_t* bdi, 
+	uint64_t seg_no)
+{
+	bdbm_hlm_rsd_private_t* p = (bdbm_hlm_rsd_private_t*)BDBM_HLM_PRIV(bdi);
+	segment_buf_t* b = &p->seg_buf[seg_no];
+	bdbm_hlm_req_t* hlm_req = b->hlm_req;
+	uint32_t ret = 0;
+
+	if (hlm_req == NULL)
+		return 0;
+
+	b->hlm_req = NULL;
+	p->nr_buffered_pgs -= hlm_req->len;
+
+	if ((ret = hlm_nobuf_make_req (bdi, hlm_req)) != 0) {
+		bdbm_error ("hlm_nobuf_make_req failed");
+		__hlm_rsd_delete_hlm_req (bdi, hlm_req);
+	}
+
+	return ret;
+}
+
+/* back-pressure: push the least recently used buffers to NAND flash 
+ * until 'nr_pgs' more pages fit in the buffers */
+void __hlm_rsd_make_room (
+	bdbm_drv_info_t* bdi, 
+	uint64_t nr_pgs)
+{
+	bdbm_hlm_rsd_private_t* p = (bdbm_hlm_rsd_private_t*)BDBM_HLM_PRIV(bdi);
+
+	while (p->nr_buffered_pgs > 0 && 
+		   p->nr_buffered_pgs + nr_pgs > p->max_buffered_pgs) {
+		uint64_t seg_no, victim = -1;
+
+		for (seg_no = 0; seg_no < p->nr_segs; seg_no++) {
+			if (p->seg_buf[seg_no].hlm_req == NULL)
+				continue;
+			if (victim == -1 || p->seg_buf[seg_no].last_used < p->seg_buf[victim].last_used)
+				victim = seg_no;
+		}
+		__hlm_rsd_flush_seg (bdi, victim);
+	}
+}
+
 uint32_t __hlm_rsd_make_rm_seg (
 	bdbm_drv_info_t* bdi, 
 	uint32_t seg_no)
 {
 	bdbm_hlm_rsd_private_t* p = (bdbm_hlm_rsd_private_t*)BDBM_HLM_PRIV(bdi);
-	segment_buf_t* b = NULL;
+	segment_buf_t* b = &p->seg_buf[seg_no];
 
-	HASH_FIND_INT (p->seg_buf, &seg_no, b);
-	if (b != NULL) {
-		HASH_DEL (p->seg_buf, b);
+	if (b->hlm_req != NULL) {
+		p->nr_buffered_pgs -= b->hlm_req->len;
 		__hlm_rsd_delete_hlm_req (bdi, b->hlm_req);
-		bdbm_free (b);
+		b->hlm_req = NULL;
 	}
 
 	return 0;
@@ -215,21 +353,11 @@ uint32_t __hlm_rsd_make_req_r (
 
 	/* [step1] is there a req in seg buff? */
 	seg_no = ftl->get_segno (bdi, new_hlm_req->lpa);
+	b = &p->seg_buf[seg_no];
 
-	HASH_FIND_INT (p->seg_buf, &seg_no, b);
-
-	if (b != NULL) {
+	if (b->hlm_req != NULL) {
 		uint64_t lpa_new, lpa_old, new_ofs, old_ofs, i;
 
-		/* see if 'old_hlm_req' is valid or not */
-		if (b->hlm_req == NULL) {
-			bdbm_warning ("old_hlm_req is NULL");
-			bdbm_bug_on (1);
-		}
-		if (b->seg_no != seg_no) {
-			bdbm_warning ("seg_no is different (%u %u)", b->seg_no, seg_no);
-			bdbm_bug_on (1);
-		}
 		old_hlm_req = b->hlm_req;
 
 		if ((new_hlm_req->lpa + new_hlm_req->len - 1) < old_hlm_req->lpa) {
@@ -296,6 +424,7 @@ uint32_t __hlm_rsd_make_req_w (
 	uint32_t ret = 0;
 
 	uint64_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
+	uint64_t seg_end;
 	uint32_t seg_no;
 
 	/* if get_segno is not available, handle reqs normally */
@@ -306,20 +435,12 @@ uint32_t __hlm_rsd_make_req_w (
 
 	/* [step1] is there a req in seg buff? */
 	seg_no = ftl->get_segno (bdi, new_hlm_req->lpa);
+	seg_end = (uint64_t)(seg_no + 1) * p->nr_pgs_per_seg;
+	b = &p->seg_buf[seg_no];
 
-	HASH_FIND_INT (p->seg_buf, &seg_no, b);
-
-	if (b != NULL) {
-		/* see if 'old_hlm_req' is valid or not */
-		if (b->hlm_req == NULL) {
-			bdbm_warning ("old_hlm_req is NULL");
-			bdbm_bug_on (1);
-		}
-		if (b->seg_no != seg_no) {
-			bdbm_warning ("seg_no is different (%u %u)", b->seg_no, seg_no);
-			bdbm_bug_on (1);
-		}
+	if (b->hlm_req != NULL) {
 		old_hlm_req = b->hlm_req;
+		b->last_used = ++p->clock;
 
 		/* see if new and old ones can be merged or not */
 		if ((old_hlm_req->lpa + old_hlm_req->len - 1) == new_hlm_req->lpa) {
@@ -338,6 +459,7 @@ uint32_t __hlm_rsd_make_req_w (
 						old_hlm_req->pptr_kpgs[ofs+i],
 						new_hlm_req->pptr_kpgs[i],
 						KERNEL_PAGE_SIZE);
+					old_hlm_req->kpg_flags[ofs+i] = MEMFLAG_KMAP_PAGE;
 
 #if 0
 					bdbm_msg ("\t\tmemcpy: new (%u) => old (%u)", ofs+i, i);
@@ -364,66 +486,54 @@ uint32_t __hlm_rsd_make_req_w (
 				new_hlm_req->pptr_kpgs+=nr_kp_per_fp;
 				new_hlm_req->kpg_flags+=nr_kp_per_fp;
 			}
-		} else {
+		} 
+
+		if (new_hlm_req != NULL && 
+			(old_hlm_req->lpa + old_hlm_req->len) != new_hlm_req->lpa) {
 			/* This is not a common case, but this is not error as well.
 			 * For RISA, we submit it before writing new req */
+			if ((ret = __hlm_rsd_flush_seg (bdi, seg_no)) != 0)
+				goto done;
 		}
-
-		/* remove it from the hash table */
-		HASH_DEL (p->seg_buf, b);
-		bdbm_free (b);
 	}
 
-	/* [step2] submit a prev req if it is available */
-	if (old_hlm_req) {
-#if 0
-		bdbm_msg ("\t[%u] CACHE-WRITE: %llu(%llu) [%x %x %x ... %x]", 
-			seg_no,
-			old_hlm_req->lpa, 
-			old_hlm_req->len,
-			old_hlm_req->pptr_kpgs[1][0],
-			old_hlm_req->pptr_kpgs[1][1],
-			old_hlm_req->pptr_kpgs[1][2],
-			old_hlm_req->pptr_kpgs[1][511]);
-#endif
+	/* [step2] keep the req until its segment is filled up */
+	if (new_hlm_req) {
+		uint32_t i = 0;
 
-		if ((ret = hlm_nobuf_make_req (bdi, old_hlm_req)) != 0) {
-			bdbm_error ("hlm_nobuf_make_req failed");
-			__hlm_rsd_delete_hlm_req (bdi, old_hlm_req);
+		if (new_hlm_req->lpa + new_hlm_req->len > seg_end) {
+			/* it spans segments; send it to NAND flash after the buffer */
+			if ((ret = __hlm_rsd_flush_seg (bdi, seg_no)) != 0)
+				goto done;
+			ret = hlm_nobuf_make_req (bdi, new_hlm_req);
 			goto done;
 		}
-	}
 
-	/* [step3] submit or keep the req */
-	if (new_hlm_req) {
-		if (new_hlm_req->kpg_flags[new_hlm_req->len * nr_kp_per_fp - 1] == MEMFLAG_FRAG_PAGE) {
-			uint32_t i = 0;
+		/* it could flush the buffer of this segment as well */
+		__hlm_rsd_make_room (bdi, new_hlm_req->len);
+
 #if 0
-			bdbm_msg ("\t[%u] CACHE: %llu(%llu) [%x %x %x ... %x]", 
-				seg_no,
-				new_hlm_req->lpa, 
-				new_hlm_req->len, 
-				new_hlm_req->pptr_kpgs[1][0],
-				new_hlm_req->pptr_kpgs[1][1],
-				new_hlm_req->pptr_kpgs[1][2],
-				new_hlm_req->pptr_kpgs[1][511]);
+		bdbm_msg ("\t[%u] CACHE: %llu(%llu)", seg_no, new_hlm_req->lpa, new_hlm_req->len);
 #endif
-			/* put the req into the buffer */
-			if ((b = (segment_buf_t*)bdbm_malloc (sizeof (segment_buf_t))) == NULL) {
-				bdbm_bug_on (1);
-			}
-			b->seg_no = seg_no;
+		if (b->hlm_req == NULL)
 			b->hlm_req = __hlm_rsd_duplicate_hlm_req (bdi, new_hlm_req);
-			HASH_ADD_INT (p->seg_buf, seg_no, b);
+		else
+			__hlm_rsd_append_hlm_req (bdi, b->hlm_req, new_hlm_req);
+		p->nr_buffered_pgs += new_hlm_req->len;
+		b->last_used = ++p->clock;
+
+		/* finish the req */
+		for (i = 0; i < new_hlm_req->len * nr_kp_per_fp; i++)
+			new_hlm_req->kpg_flags[i] |= MEMFLAG_DONE;
+		bdi->ptr_host_inf->end_req (bdi, new_hlm_req);
+	}
 
-			/* finish the req */
-			for (i = 0; i < new_hlm_req->len * nr_kp_per_fp; i++)
-				new_hlm_req->kpg_flags[i] |= MEMFLAG_DONE;
-			bdi->ptr_host_inf->end_req (bdi, new_hlm_req);
-		} else {
-			/* submit the req to NAND flash */
-			ret = hlm_nobuf_make_req (bdi, new_hlm_req);
-		}
+	/* [step3] a buffer that reaches the end of its segment goes to NAND 
+	 * flash in one go, unless its last page waits for the rest of it */
+	if (b->hlm_req != NULL && 
+		b->hlm_req->lpa + b->hlm_req->len == seg_end &&
+		b->hlm_req->kpg_flags[b->hlm_req->len * nr_kp_per_fp - 1] != MEMFLAG_FRAG_PAGE) {
+		ret = __hlm_rsd_flush_seg (bdi, seg_no);
 	}
 
 done:
@@ -495,3 +605,126 @@ void hlm_rsd_end_req (
 	}
 }
 
+/* a snapshot of hlm_rsd: a header {magic, nr_segs, nr_pgs_per_seg, nr_bufs} 
+ * followed by {seg_no, lpa, len, kpg_flags, kernel pages} for every buffer */
+uint32_t hlm_rsd_load (bdbm_drv_info_t* bdi, const char* fn)
+{
+	bdbm_hlm_rsd_private_t* p = (bdbm_hlm_rsd_private_t*)BDBM_HLM_PRIV(bdi);
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+	uint64_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
+	bdbm_file_t fp = 0;
+	uint64_t hdr[4] = {0, };
+	uint64_t n, i, pos = 0;
+	uint32_t ret = 1;
+
+	fp = bdbm_fopen (fn, O_RDWR, 0777);
+#if defined (KERNEL_MODE)
+	if (fp == NULL) {
+#else
+	if (fp < 0) {
+#endif
+		bdbm_error ("bdbm_fopen failed");
+		return 1;
+	}
+
+	pos += bdbm_fread (fp, pos, (uint8_t*)hdr, sizeof (hdr));
+	if (hdr[0] != HLM_RSD_SNAPSHOT_MAGIC || 
+		hdr[1] != p->nr_segs ||
+		hdr[2] != p->nr_pgs_per_seg) {
+		bdbm_error ("'%s' is not an rsd snapshot of this device", fn);
+		goto out;
+	}
+
+	for (n = 0; n < hdr[3]; n++) {
+		uint64_t ent[3] = {0, };
+		bdbm_hlm_req_t* r = NULL;
+
+		pos += bdbm_fread (fp, pos, (uint8_t*)ent, sizeof (ent));
+		if (ent[0] >= p->nr_segs || 
+			ent[2] == 0 || ent[2] > p->nr_pgs_per_seg ||
+			p->seg_buf[ent[0]].hlm_req != NULL) {
+			bdbm_error ("invalid segment buffer (seg: %llu, lpa: %llu, len: %llu)", 
+				ent[0], ent[1], ent[2]);
+			goto out;
+		}
+
+		r = __hlm_rsd_create_hlm_req (bdi, ent[1], ent[2]);
+		pos += bdbm_fread (fp, pos, r->kpg_flags, r->len * nr_kp_per_fp);
+		for (i = 0; i < r->len * nr_kp_per_fp; i++)
+			pos += bdbm_fread (fp, pos, r->pptr_kpgs[i], KERNEL_PAGE_SIZE);
+
+		p->seg_buf[ent[0]].hlm_req = r;
+		p->seg_buf[ent[0]].last_used = ++p->clock;
+		p->nr_buffered_pgs += r->len;
+	}
+
+	bdbm_msg ("[hlm_rsd] %llu segment buffers (%llu pages) are loaded from '%s'", 
+		hdr[3], p->nr_buffered_pgs, fn);
+	ret = 0;
+
+out:
+	bdbm_fclose (fp);
+	return ret;
+}
+
+uint32_t hlm_rsd_store (bdbm_drv_info_t* bdi, const char* fn)
+{
+	bdbm_hlm_rsd_private_t* p = (bdbm_hlm_rsd_private_t*)BDBM_HLM_PRIV(bdi);
+	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS (bdi);
+	uint64_t nr_kp_per_fp = np->page_main_size / KERNEL_PAGE_SIZE;
+	bdbm_file_t fp = 0;
+	uint64_t hdr[4] = {0, };
+	uint64_t seg_no, i, pos = 0, size = 0;
+
+	fp = bdbm_fopen (fn, O_CREAT | O_WRONLY, 0777);
+#if defined (KERNEL_MODE)
+	if (fp == NULL) {
+#else
+	if (fp < 0) {
+#endif
+		bdbm_error ("bdbm_fopen failed");
+		return 1;
+	}
+
+	hdr[0] = HLM_RSD_SNAPSHOT_MAGIC;
+	hdr[1] = p->nr_segs;
+	hdr[2] = p->nr_pgs_per_seg;
+	for (seg_no = 0; seg_no < p->nr_segs; seg_no++)
+		if (p->seg_buf[seg_no].hlm_req != NULL)
+			hdr[3]++;
+	pos += bdbm_fwrite (fp, pos, (uint8_t*)hdr, sizeof (hdr));
+	size += sizeof (hdr);
+
+	for (seg_no = 0; seg_no < p->nr_segs; seg_no++) {
+		bdbm_hlm_req_t* r = p->seg_buf[seg_no].hlm_req;
+		uint64_t ent[3];
+
+		if (r == NULL)
+			continue;
+
+		ent[0] = seg_no;
+		ent[1] = r->lpa;
+		ent[2] = r->len;
+		pos += bdbm_fwrite (fp, pos, (uint8_t*)ent, sizeof (ent));
+		pos += bdbm_fwrite (fp, pos, r->kpg_flags, r->len * nr_kp_per_fp);
+		for (i = 0; i < r->len * nr_kp_per_fp; i++)
+			pos += bdbm_fwrite (fp, pos, r->pptr_kpgs[i], KERNEL_PAGE_SIZE);
+		size += sizeof (ent) + r->len * nr_kp_per_fp * (1 + KERNEL_PAGE_SIZE);
+	}
+	bdbm_fsync (fp);
+	bdbm_fclose (fp);
+
+	/* if it is not written completely, leave the buffers to hlm_rsd_destroy */
+	if (pos != size) {
+		bdbm_error ("failed to write '%s' (%llu/%llu bytes)", fn, pos, size);
+		return 1;
+	}
+
+	/* the buffers live in the snapshot now */
+	for (seg_no = 0; seg_no < p->nr_segs; seg_no++)
+		__hlm_rsd_make_rm_seg (bdi, seg_no);
+
+	bdbm_msg ("[hlm_rsd] %llu segment buffers are stored to '%s'", hdr[3], fn);
+
+	return 0;
+}
@@ -44,6 +44,7 @@ THE SOFTWARE.
 
 #include "queue/queue.h"
 #include "queue/prior_queue.h"
+#include "queue/credit.h"
 
 #include "llm_mq.h"
 
@@ -51,6 +52,27 @@ THE SOFTWARE.
  * it is useful for debugging */
 /*#define ENABLE_SEQ_DBG*/
 
+/* the llm thread spins (yielding) for up to this many us before it blocks;
+ * the budget doubles when an event arrives while spinning and halves when
+ * the thread has to block, so it stays short when the device is idle */
+#define LLM_MQ_SPIN_MIN_US	2
+#define LLM_MQ_SPIN_MAX_US	64
+
+/* deadlines and dispatch shares of the QoS classes; once the ftl runs short
+ * of free blocks, GC gets the bigger shares so that it keeps up with writes */
+static const struct {
+	int64_t deadline_us;
+	uint32_t share;
+	uint32_t share_gc_urgent;
+} __llm_mq_qos[QOS_NR_CLASSES] = {
+	{ 1000,		8,	2 },	/* QOS_CLASS_HOST_READ */
+	{ 5000,		4,	2 },	/* QOS_CLASS_HOST_WRITE */
+	{ 10000,	2,	4 },	/* QOS_CLASS_GC_READ */
+	{ 10000,	2,	4 },	/* QOS_CLASS_GC_WRITE */
+	{ 20000,	1,	2 },	/* QOS_CLASS_ERASE */
+	{ 2000,		2,	2 },	/* QOS_CLASS_META */
+};
+
 
 /* llm interface */
 bdbm_llm_inf_t _llm_mq_inf = {
@@ -64,11 +86,46 @@ bdbm_llm_inf_t _llm_mq_inf = {
 	.get_queuing_count = llm_mq_get_queuing_count,
 };
 
+/* the reqs occupying a punit: 'active' holds punit_locks[] and 'preempt' is
+ * a read that suspended it; whichever finishes last releases the punit */
+typedef struct {
+	bdbm_llm_req_t* active;
+	bdbm_llm_req_t* preempt;
+	uint32_t nr_suspends;	/* # of times 'active' has been suspended */
+} bdbm_llm_mq_punit_t;
+
 /* private */
 struct bdbm_llm_mq_private {
 	uint64_t nr_punits;
+	uint64_t nr_planes;
 	bdbm_sema_t* punit_locks;
 	bdbm_prior_queue_t* q;
+	bdbm_credit_t* credits;	/* per-punit flow control (NULL: disabled) */
+
+	/* for event-driven dispatching */
+	atomic64_t* punit_events;	/* set when a punit may have become dispatchable */
+	atomic64_t nr_events;
+	atomic64_t is_sleeping;
+	uint64_t spin_budget;	/* in us */
+
+	/* for program/erase suspension */
+	uint32_t max_suspends;
+	bdbm_llm_mq_punit_t* punits;
+	bdbm_spinlock_t punit_state_lock;
+	atomic64_t nr_suspends;
+
+	/* for multi-plane reads and batched programs/erases */
+	uint32_t mp_read_fusion;
+	uint64_t nr_fused_reads;
+	uint32_t cmd_batch;
+	uint64_t nr_batched_cmds;
+	uint64_t nr_batched_reqs;
+
+	/* for deadline scheduling */
+	bdbm_stopwatch_t epoch;	/* deadlines are in us since then */
+	uint32_t qos_shares[2][QOS_NR_CLASSES];	/* [1]: GC is urgent */
+	uint8_t qos_sched;	/* the scheduler in use; parm_ftl.qos_sched may change */
+	uint8_t gc_urgent;
 
 	/* for debugging */
 #if defined(ENABLE_SEQ_DBG)
@@ -79,13 +136,398 @@ struct bdbm_llm_mq_private {
 	bdbm_thread_t* llm_thread;
 };
 
+/* NOTE: a req holds a credit of its punit from llm_mq_make_req () until it
+ * completes; host and GC reqs are charged to different classes so that
+ * neither of them can take all the credits while the other waits */
+static uint8_t __llm_mq_credit_class (bdbm_llm_req_t* r)
+{
+	return bdbm_is_gc (r->req_type) ? CREDIT_CLASS_GC : CREDIT_CLASS_HOST;
+}
+
+static void __llm_mq_get_credit (
+	struct bdbm_llm_mq_private* p, 
+	uint64_t punit_id, 
+	bdbm_llm_req_t* r)
+{
+	if (p->credits && punit_id < p->nr_punits)
+		bdbm_credit_get (p->credits, punit_id, __llm_mq_credit_class (r));
+}
+
+static void __llm_mq_charge_credit (
+	struct bdbm_llm_mq_private* p, 
+	uint64_t punit_id, 
+	bdbm_llm_req_t* r)
+{
+	if (p->credits && punit_id < p->nr_punits)
+		bdbm_credit_charge (p->credits, punit_id, __llm_mq_credit_class (r));
+}
+
+static void __llm_mq_put_credit (
+	struct bdbm_llm_mq_private* p, 
+	uint64_t punit_id, 
+	bdbm_llm_req_t* r)
+{
+	if (p->credits && punit_id < p->nr_punits)
+		bdbm_credit_put (p->credits, punit_id, __llm_mq_credit_class (r));
+}
+
+/* wake up thread only if it sleeps; the one that clears is_sleeping holds
+ * the virtual clock for it */
+static void __llm_mq_wakeup (struct bdbm_llm_mq_private* p)
+{
+	if (atomic64_read (&p->is_sleeping)) {
+		bdbm_vclock_hold ();
+		if (atomic64_xchg (&p->is_sleeping, 0))
+			bdbm_thread_wakeup (p->llm_thread);
+		else
+			bdbm_vclock_release ();
+	}
+}
+
+/* NOTE: it must be called after the state change that makes punit_id
+ * dispatchable (a new req or a released punit) is visible */
+static void __llm_mq_signal (
+	struct bdbm_llm_mq_private* p, 
+	uint64_t punit_id)
+{
+	atomic64_set (&p->punit_events[punit_id], 1);
+	atomic64_inc (&p->nr_events);
+	smp_mb ();
+
+	__llm_mq_wakeup (p);
+}
+
+/* NOTE: the next turn of an lpa may be queued on any punit */
+static void __llm_mq_signal_all (struct bdbm_llm_mq_private* p)
+{
+	uint64_t loop;
+
+	for (loop = 0; loop < p->nr_punits; loop++)
+		atomic64_set (&p->punit_events[loop], 1);
+	atomic64_inc (&p->nr_events);
+	smp_mb ();
+
+	__llm_mq_wakeup (p);
+}
+
+static void __llm_mq_remove (
+	struct bdbm_llm_mq_private* p, 
+	bdbm_prior_queue_item_t* qitem,
+	uint64_t punit_id)
+{
+	if (bdbm_prior_queue_remove (p->q, qitem, punit_id))
+		__llm_mq_signal_all (p);
+}
+
+/* the WRITE of RMW waits in the queue of its punit until READ flips
+ * req_type (see llm_mq_end_req ()) */
+static uint8_t __llm_mq_is_ready (void* req)
+{
+	bdbm_llm_req_t* r = (bdbm_llm_req_t*)req;
+
+	if (r->req_type != REQTYPE_RMW_WRITE)
+		return 0;
+	smp_rmb ();
+	return 1;
+}
+
+static uint8_t __llm_mq_qos_class (bdbm_llm_req_t* r)
+{
+	if (bdbm_is_erase (r->req_type))
+		return QOS_CLASS_ERASE;
+	if (bdbm_is_meta (r->req_type))
+		return QOS_CLASS_META;
+	if (bdbm_is_gc (r->req_type))
+		return bdbm_is_read (r->req_type) ? QOS_CLASS_GC_READ : QOS_CLASS_GC_WRITE;
+	if (bdbm_is_rmw (r->req_type) || bdbm_is_write (r->req_type))
+		return QOS_CLASS_HOST_WRITE;
+	return QOS_CLASS_HOST_READ;
+}
+
+static int64_t __llm_mq_now_us (struct bdbm_llm_mq_private* p)
+{
+	return bdbm_stopwatch_get_elapsed_time_us (&p->epoch);
+}
+
+static void __llm_mq_update_qos (
+	bdbm_drv_info_t* bdi, 
+	struct bdbm_llm_mq_private* p, 
+	bdbm_llm_req_t* r)
+{
+	int64_t lat_us = __llm_mq_now_us (p) - r->qos_enq_us;
+
+	pmu_update_qos (bdi, r->qos_class, lat_us, 
+		(lat_us > __llm_mq_qos[r->qos_class].deadline_us) ? 1 : 0);
+}
+
+static void __llm_mq_set_active (
+	struct bdbm_llm_mq_private* p, 
+	uint64_t punit_id, 
+	bdbm_llm_req_t* r)
+{
+	if (p->max_suspends == 0)
+		return;
+
+	bdbm_spin_lock (&p->punit_state_lock);
+	p->punits[punit_id].active = r;
+	p->punits[punit_id].nr_suspends = 0;
+	bdbm_spin_unlock (&p->punit_state_lock);
+}
+
+/* NOTE: it returns 1 if the caller has to unlock punit_locks[punit_id] */
+static uint8_t __llm_mq_release_punit (
+	struct bdbm_llm_mq_private* p, 
+	uint64_t punit_id, 
+	bdbm_llm_req_t* r)
+{
+	bdbm_llm_mq_punit_t* pu = &p->punits[punit_id];
+	uint8_t ret;
+
+	if (p->max_suspends == 0)
+		return 1;
+
+	bdbm_spin_lock (&p->punit_state_lock);
+	if (pu->preempt == r)
+		pu->preempt = NULL;
+	else
+		pu->active = NULL;
+	ret = (pu->active == NULL && pu->preempt == NULL) ? 1 : 0;
+	bdbm_spin_unlock (&p->punit_state_lock);
+
+	return ret;
+}
+
+struct __llm_mq_mp_match {
+	bdbm_llm_req_t* head;
+	uint64_t nr_planes;
+	uint64_t planes;	/* bitmap of the planes already in the command */
+};
+
+static uint8_t __llm_mq_is_mp_read (bdbm_llm_req_t* r)
+{
+	/* RMW reads turn into writes on completion; keep them on their own */
+	return (bdbm_is_read (r->req_type) && !bdbm_is_rmw (r->req_type)) ? 1 : 0;
+}
+
+static uint8_t __llm_mq_mp_match (void* req, void* arg)
+{
+	bdbm_llm_req_t* r = (bdbm_llm_req_t*)req;
+	struct __llm_mq_mp_match* m = (struct __llm_mq_mp_match*)arg;
+
+	if (!__llm_mq_is_mp_read (r))
+		return 0;
+	if (r->phyaddr.page_no != m->head->phyaddr.page_no)
+		return 0;
+	if (m->planes & (1ULL << (r->phyaddr.block_no % m->nr_planes)))
+		return 0;
+	return 1;
+}
+
+struct __llm_mq_batch_match {
+	bdbm_llm_req_t* tail;
+};
+
+static uint8_t __llm_mq_is_batch_write (bdbm_llm_req_t* r)
+{
+	return (bdbm_is_write (r->req_type) && !bdbm_is_meta (r->req_type)) ? 1 : 0;
+}
+
+static uint8_t __llm_mq_batch_match (void* req, void* arg)
+{
+	bdbm_llm_req_t* r = (bdbm_llm_req_t*)req;
+	bdbm_llm_req_t* tail = ((struct __llm_mq_batch_match*)arg)->tail;
+
+	if (__llm_mq_is_batch_write (tail)) {
+		/* cache program: the next page of the same block */
+		if (!__llm_mq_is_batch_write (r))
+			return 0;
+		if (r->phyaddr.block_no != tail->phyaddr.block_no)
+			return 0;
+		if (r->phyaddr.page_no != tail->phyaddr.page_no + 1)
+			return 0;
+		return 1;
+	}
+
+	/* multi-block erase: any other block of the same punit */
+	if (!bdbm_is_erase (r->req_type))
+		return 0;
+	if (r->phyaddr.block_no == tail->phyaddr.block_no)
+		return 0;
+	return 1;
+}
+
+/* NOTE: programs to the next pages of the same block and erases of other
+ * blocks queued to the same punit are chained to r, so that the device
+ * runs them as one command (cache program / multi-block erase) */
+static void __llm_mq_batch_reqs (
+	bdbm_drv_info_t* bdi, 
+	struct bdbm_llm_mq_private* p, 
+	uint64_t punit_id, 
+	bdbm_llm_req_t* r)
+{
+	struct __llm_mq_batch_match m;
+	uint64_t nr_reqs = 1;
+
+	if (p->cmd_batch <= 1)
+		return;
+	if (!__llm_mq_is_batch_write (r) && !bdbm_is_erase (r->req_type))
+		return;
+
+	m.tail = r;
+	while (nr_reqs < p->cmd_batch) {
+		bdbm_prior_queue_item_t* qitem = NULL;
+		bdbm_llm_req_t* f = NULL;
+
+		if ((f = (bdbm_llm_req_t*)bdbm_prior_queue_dequeue_match 
+				(p->q, punit_id, __llm_mq_batch_match, (void*)&m, &qitem)) == NULL)
+			break;
+
+		f->ptr_qitem = qitem;
+		f->ptr_mp_next = NULL;
+		pmu_update_q (bdi, f);
+
+		m.tail->ptr_mp_next = (void*)f;
+		m.tail = f;
+		nr_reqs++;
+	}
+
+	if (nr_reqs > 1) {
+		p->nr_batched_cmds++;
+		p->nr_batched_reqs += nr_reqs;
+	}
+}
+
+/* NOTE: a multi-plane read needs the same page offset on every plane; r is
+ * chained with such reads queued to the same punit, so that the device
+ * serves them with a single tR. It must be called for every req the thread
+ * dispatches because it also resets r->ptr_mp_next */
+static void __llm_mq_fuse_reqs (
+	bdbm_drv_info_t* bdi, 
+	struct bdbm_llm_mq_private* p, 
+	uint64_t punit_id, 
+	bdbm_llm_req_t* r)
+{
+	struct __llm_mq_mp_match m;
+	bdbm_llm_req_t* tail = r;
+	uint64_t nr_reqs = 1;
+
+	r->ptr_mp_next = NULL;
+
+	if (!__llm_mq_is_mp_read (r)) {
+		__llm_mq_batch_reqs (bdi, p, punit_id, r);
+		return;
+	}
+	if (!p->mp_read_fusion)
+		return;
+
+	m.head = r;
+	m.nr_planes = bdi->parm_dev.nr_planes;
+	m.planes = 1ULL << (r->phyaddr.block_no % m.nr_planes);
+
+	while (nr_reqs < m.nr_planes) {
+		bdbm_prior_queue_item_t* qitem = NULL;
+		bdbm_llm_req_t* f = NULL;
+
+		if ((f = (bdbm_llm_req_t*)bdbm_prior_queue_dequeue_match 
+				(p->q, punit_id, __llm_mq_mp_match, (void*)&m, &qitem)) == NULL)
+			break;
+
+		f->ptr_qitem = qitem;
+		f->ptr_mp_next = NULL;
+		pmu_update_q (bdi, f);
+
+		m.planes |= 1ULL << (f->phyaddr.block_no % m.nr_planes);
+		tail->ptr_mp_next = (void*)f;
+		tail = f;
+		nr_reqs++;
+		p->nr_fused_reads++;
+	}
+}
+
+/* NOTE: the reqs fused into r do not hold the punit; they finish before r
+ * releases it */
+static void __llm_mq_end_fused_reqs (
+	bdbm_drv_info_t* bdi, 
+	struct bdbm_llm_mq_private* p, 
+	bdbm_llm_req_t* r)
+{
+	bdbm_llm_req_t* f = (bdbm_llm_req_t*)r->ptr_mp_next;
+
+	r->ptr_mp_next = NULL;
+	while (f != NULL) {
+		bdbm_llm_req_t* next = (bdbm_llm_req_t*)f->ptr_mp_next;
+
+		f->ptr_mp_next = NULL;
+		__llm_mq_remove (p, (bdbm_prior_queue_item_t*)f->ptr_qitem, f->phyaddr.punit_id);
+		__llm_mq_put_credit (p, f->phyaddr.punit_id, f);
+
+		pmu_update_tot (bdi, f);
+		pmu_inc (bdi, f);
+		__llm_mq_update_qos (bdi, p, f);
+
+		bdi->ptr_hlm_inf->end_req (bdi, f);
+		f = next;
+	}
+}
+
+/* NOTE: if a program/erase keeps the punit busy and a host read is waiting
+ * for it, send the read anyway so that the device suspends the operation;
+ * each operation is suspended at most max_suspends times so that it is not
+ * starved by a stream of reads */
+static void __llm_mq_try_preempt (
+	bdbm_drv_info_t* bdi, 
+	struct bdbm_llm_mq_private* p, 
+	uint64_t punit_id)
+{
+	bdbm_llm_mq_punit_t* pu = &p->punits[punit_id];
+	bdbm_prior_queue_item_t* qitem = NULL;
+	bdbm_llm_req_t* r = NULL;
+
+	if (p->max_suspends == 0)
+		return;
+
+	bdbm_spin_lock (&p->punit_state_lock);
+	if (pu->active == NULL || pu->preempt != NULL || 
+		pu->nr_suspends >= p->max_suspends ||
+		(!bdbm_is_write (pu->active->req_type) && !bdbm_is_erase (pu->active->req_type))) {
+		bdbm_spin_unlock (&p->punit_state_lock);
+		return;
+	}
+	if ((r = (bdbm_llm_req_t*)bdbm_prior_queue_dequeue_high (p->q, punit_id, &qitem)) == NULL) {
+		bdbm_spin_unlock (&p->punit_state_lock);
+		return;
+	}
+	pu->preempt = r;
+	pu->nr_suspends++;
+	bdbm_spin_unlock (&p->punit_state_lock);
+
+	atomic64_inc (&p->nr_suspends);
+	r->ptr_qitem = qitem;
+
+	pmu_update_q (bdi, r);
+	__llm_mq_fuse_reqs (bdi, p, punit_id, r);
+
+	if (bdi->ptr_dm_inf->make_req (bdi, r)) {
+		/* TODO: I do not check whether it works well or not */
+		bdi->ptr_llm_inf->end_req (bdi, r);
+		bdbm_warning ("oops! make_req failed");
+	}
+}
+
+/* NOTE: a punit is only visited when its event flag is set, i.e., when a
+ * req was queued to it or it was released by a completion; anything that
+ * can make a punit dispatchable goes through __llm_mq_signal () */
 int __llm_mq_thread (void* arg)
 {
 	bdbm_drv_info_t* bdi = (bdbm_drv_info_t*)arg;
 	struct bdbm_llm_mq_private* p = (struct bdbm_llm_mq_private*)BDBM_LLM_PRIV(bdi);
+	bdbm_ftl_inf_t* ftl = BDBM_GET_FTL_INF(bdi);
+	uint64_t max_bypass;
 	uint64_t loop;
-	uint64_t cnt = 0;
-	uint64_t empty_loop = 0;
+	uint64_t seen;
+	uint8_t has_event;
+	bdbm_stopwatch_t sw;
+	int ret;
 
 	if (p == NULL || p->q == NULL || p->llm_thread == NULL) {
 		bdbm_msg ("invalid parameters (p=%p, p->q=%p, p->llm_thread=%p",
@@ -93,29 +535,51 @@ int __llm_mq_thread (void* arg)
 		return 0;
 	}
 
+	/* the virtual clock waits while the thread runs (see __llm_mq_wakeup ()) */
+	bdbm_vclock_hold ();
+
 	for (;;) {
-		/* give a chance to other processes if Q is empty */
-		if (bdbm_prior_queue_is_all_empty (p->q)) {
-			empty_loop++;
+		seen = atomic64_read (&p->nr_events);
 
-			if ((empty_loop % 1000) == 0)
-			{
-				/* ok... go to sleep */
-				if (bdbm_thread_schedule(p->llm_thread) == SIGKILL)
-					break;
-			}
+		/* the scheduler may be switched at run time (llm_mq_set_read_prio ()) */
+		if (p->qos_sched != (bdi->parm_ftl.qos_sched ? 1 : 0)) {
+			p->qos_sched = bdi->parm_ftl.qos_sched ? 1 : 0;
+			p->gc_urgent = 0;
+			bdbm_prior_queue_set_classes (p->q, p->qos_sched ? QOS_NR_CLASSES : 0, p->qos_shares[0]);
+		}
 
-			continue;
-		}	
+		/* reads may not starve writes once the ftl runs out of free blocks;
+		 * otherwise GC falls behind and every write ends up waiting on it */
+		if (p->qos_sched) {
+			uint8_t gc_urgent = (ftl->is_gc_urgent && ftl->is_gc_urgent (bdi)) ? 1 : 0;
+			if (gc_urgent != p->gc_urgent) {
+				p->gc_urgent = gc_urgent;
+				bdbm_prior_queue_set_classes (p->q, QOS_NR_CLASSES, p->qos_shares[gc_urgent]);
+			}
+		} else {
+			max_bypass = bdi->parm_ftl.read_prio_bypass;
+			if (max_bypass > bdi->parm_ftl.read_prio_gc_bypass && 
+				ftl->is_gc_urgent && ftl->is_gc_urgent (bdi))
+				max_bypass = bdi->parm_ftl.read_prio_gc_bypass;
+			bdbm_prior_queue_set_max_bypass (p->q, max_bypass);
+		}
 
-		/* send reqs until Q becomes empty */
+		/* send reqs to the punits that were signaled */
 		for (loop = 0; loop < p->nr_punits; loop++) {
 			bdbm_prior_queue_item_t* qitem = NULL;
 			bdbm_llm_req_t* r = NULL;
+
+			if (atomic64_read (&p->punit_events[loop]) == 0)
+				continue;
+
+			/* clear it first so that a signal from now on is not lost */
+			atomic64_set (&p->punit_events[loop], 0);
+			smp_mb ();
 			
-			/* if pu is busy, then go to the next pnit */
+			/* if pu is busy, its completion signals it again */
 			if (!bdbm_sema_try_lock (&p->punit_locks[loop]))
 			{
+				__llm_mq_try_preempt (bdi, p, loop);
 				continue;
 			}
 
@@ -127,12 +591,9 @@ int __llm_mq_thread (void* arg)
 			r->ptr_qitem = qitem;
 
 			pmu_update_q (bdi, r);
+			__llm_mq_fuse_reqs (bdi, p, loop, r);
 
-			if (cnt % 100000 == 0) 
-			{
-			//	bdbm_msg ("llm_make_req: %llu, %llu", cnt, bdbm_prior_queue_get_nr_items (p->q));
-				bdbm_thread_yield();	
-			}
+			__llm_mq_set_active (p, loop, r);
 
 			if (bdi->ptr_dm_inf->make_req (bdi, r)) {
 				bdbm_sema_unlock (&p->punit_locks[loop]);
@@ -141,13 +602,52 @@ int __llm_mq_thread (void* arg)
 				bdi->ptr_llm_inf->end_req (bdi, r);
 				bdbm_warning ("oops! make_req failed");
 			}
-
-			cnt++;
-			empty_loop = 0;
 //bdbm_msg("  6. llm make req");
 		}
+
+		if (atomic64_read (&p->nr_events) != seen)
+			continue;
+
+		/* nothing to do; spin for a while before going to sleep unless the
+		 * device runs on a virtual clock, where spinning buys nothing */
+		has_event = 0;
+		bdbm_stopwatch_start (&sw);
+		do {
+			if (atomic64_read (&p->nr_events) != seen) {
+				has_event = 1;
+				break;
+			}
+			bdbm_thread_yield ();
+		} while (!bdbm_vclock_is_enabled () && 
+			bdbm_stopwatch_get_elapsed_time_us (&sw) < p->spin_budget);
+		if (has_event) {
+			if (p->spin_budget < LLM_MQ_SPIN_MAX_US)
+				p->spin_budget *= 2;
+			continue;
+		}
+		if (p->spin_budget > LLM_MQ_SPIN_MIN_US)
+			p->spin_budget /= 2;
+
+		/* ok... go to sleep unless an event came in meanwhile */
+		bdbm_thread_schedule_setup (p->llm_thread);
+		atomic64_set (&p->is_sleeping, 1);
+		smp_mb ();
+		if (atomic64_read (&p->nr_events) != seen) {
+			if (atomic64_xchg (&p->is_sleeping, 0) == 0)
+				bdbm_vclock_release ();	/* a waker held it for us */
+			bdbm_thread_schedule_cancel (p->llm_thread);
+			continue;
+		}
+		bdbm_vclock_release ();
+		ret = bdbm_thread_schedule_sleep (p->llm_thread);
+		if (atomic64_xchg (&p->is_sleeping, 0))
+			bdbm_vclock_hold ();	/* nobody woke it up */
+		if (ret == SIGKILL)
+			break;
 	}
 
+	bdbm_vclock_release ();
+
 	return 0;
 }
 
@@ -165,12 +665,22 @@ uint32_t llm_mq_create (bdbm_drv_info_t* bdi)
 
 	/* get the total number of parallel units */
 	p->nr_punits = BDBM_GET_NR_PUNITS (bdi->parm_dev);
+	p->nr_planes = (bdi->parm_dev.nr_planes > 0) ? bdi->parm_dev.nr_planes : 1;
 
 	/* create queue */
-	if ((p->q = bdbm_prior_queue_create (p->nr_punits, INFINITE_QUEUE)) == NULL) {
+	if ((p->q = bdbm_prior_queue_create (p->nr_punits, INFINITE_QUEUE, bdi->parm_ftl.dispatch_window)) == NULL) {
 		bdbm_error ("bdbm_prior_queue_create failed");
 		goto fail;
 	}
+	bdbm_prior_queue_set_ready_fn (p->q, __llm_mq_is_ready);
+
+	/* create per-punit credits */
+	p->credits = NULL;
+	if (bdi->parm_ftl.llm_credits > 0 && 
+		(p->credits = bdbm_credit_create (p->nr_punits, bdi->parm_ftl.llm_credits)) == NULL) {
+		bdbm_error ("bdbm_credit_create failed");
+		goto fail;
+	}
 
 	/* create completion locks for parallel units */
 	if ((p->punit_locks = (bdbm_sema_t*)bdbm_malloc_atomic
@@ -179,9 +689,49 @@ uint32_t llm_mq_create (bdbm_drv_info_t* bdi)
 		goto fail;
 	}
 
+	/* create per-punit event flags */
+	if ((p->punit_events = (atomic64_t*)bdbm_malloc_atomic
+			(sizeof (atomic64_t) * p->nr_punits)) == NULL) {
+		bdbm_error ("bdbm_malloc_atomic failed");
+		goto fail;
+	}
+
+	/* create per-punit states for suspension */
+	if ((p->punits = (bdbm_llm_mq_punit_t*)bdbm_malloc_atomic
+			(sizeof (bdbm_llm_mq_punit_t) * p->nr_punits)) == NULL) {
+		bdbm_error ("bdbm_malloc_atomic failed");
+		goto fail;
+	}
+
 	for (loop = 0; loop < p->nr_punits; loop++) {
 		bdbm_sema_init (&p->punit_locks[loop]);
+		atomic64_set (&p->punit_events[loop], 0);
+		p->punits[loop].active = NULL;
+		p->punits[loop].preempt = NULL;
+		p->punits[loop].nr_suspends = 0;
+	}
+	atomic64_set (&p->nr_events, 0);
+	atomic64_set (&p->is_sleeping, 0);
+	p->spin_budget = LLM_MQ_SPIN_MIN_US;
+	p->max_suspends = (bdi->parm_dev.device_caps & DEVICE_CAP_SUSPEND) ? 
+		bdi->parm_ftl.max_suspends : 0;
+	p->mp_read_fusion = (bdi->parm_dev.device_caps & DEVICE_CAP_MP_READ) && bdi->parm_dev.nr_planes > 1 ? 
+		bdi->parm_ftl.mp_read_fusion : 0;
+	p->nr_fused_reads = 0;
+	p->cmd_batch = (bdi->parm_dev.device_caps & DEVICE_CAP_BATCH) ? bdi->parm_ftl.cmd_batch : 0;
+	p->nr_batched_cmds = 0;
+	p->nr_batched_reqs = 0;
+	bdbm_stopwatch_start (&p->epoch);
+	for (loop = 0; loop < QOS_NR_CLASSES; loop++) {
+		p->qos_shares[0][loop] = __llm_mq_qos[loop].share;
+		p->qos_shares[1][loop] = __llm_mq_qos[loop].share_gc_urgent;
 	}
+	p->qos_sched = bdi->parm_ftl.qos_sched ? 1 : 0;
+	p->gc_urgent = 0;
+	if (p->qos_sched)
+		bdbm_prior_queue_set_classes (p->q, QOS_NR_CLASSES, p->qos_shares[0]);
+	bdbm_spin_lock_init (&p->punit_state_lock);
+	atomic64_set (&p->nr_suspends, 0);
 
 	/* keep the private structures for llm_nt */
 	bdi->ptr_llm_inf->ptr_private = (void*)p;
@@ -201,8 +751,14 @@ uint32_t llm_mq_create (bdbm_drv_info_t* bdi)
 	return 0;
 
 fail:
+	if (p->punits)
+		bdbm_free_atomic (p->punits);
+	if (p->punit_events)
+		bdbm_free_atomic (p->punit_events);
 	if (p->punit_locks)
 		bdbm_free_atomic (p->punit_locks);
+	if (p->credits)
+		bdbm_credit_destroy (p->credits);
 	if (p->q)
 		bdbm_prior_queue_destroy (p->q);
 	if (p)
@@ -234,14 +790,109 @@ void llm_mq_destroy (bdbm_drv_info_t* bdi)
 		bdbm_sema_lock (&p->punit_locks[loop]);
 	}
 
+	bdbm_msg ("# of program/erase suspensions = %llu", atomic64_read (&p->nr_suspends));
+	bdbm_msg ("# of reads fused into multi-plane reads = %llu", p->nr_fused_reads);
+	bdbm_msg ("# of batched program/erase commands = %llu (%llu reqs)", p->nr_batched_cmds, p->nr_batched_reqs);
+	if (p->credits)
+		bdbm_msg ("# of waits for llm credits = %llu", bdbm_credit_get_nr_waits (p->credits));
+
 	/* release all the relevant data structures */
+	if (p->credits)
+		bdbm_credit_destroy (p->credits);
 	if (p->q)
 		bdbm_prior_queue_destroy (p->q);
+	if (p->punits)
+		bdbm_free_atomic (p->punits);
+	if (p->punit_events)
+		bdbm_free_atomic (p->punit_events);
+	if (p->punit_locks)
+		bdbm_free_atomic (p->punit_locks);
 	if (p) 
 		bdbm_free_atomic (p);
 	bdbm_msg ("done");
 }
 
+static void __llm_mq_get_attr (
+	struct bdbm_llm_mq_private* p, 
+	bdbm_llm_req_t* r,
+	bdbm_phyaddr_t* phyaddr,
+	bdbm_prior_queue_attr_t* a)
+{
+	/* host reads may overtake writes and GC copies queued on the same punit */
+	a->prio = PRIOR_QUEUE_PRIO_NORMAL;
+	if (bdbm_is_read (r->req_type) && !bdbm_is_gc (r->req_type))
+		a->prio = PRIOR_QUEUE_PRIO_HIGH;
+
+	r->qos_class = __llm_mq_qos_class (r);
+	a->cls = r->qos_class;
+	a->deadline = __llm_mq_now_us (p) + __llm_mq_qos[r->qos_class].deadline_us;
+
+	/* a program of a multi-plane page covers the blocks of all its planes
+	 * (block_no + plane), so they are ordered as one */
+	a->blk = phyaddr->block_no / p->nr_planes;
+	if (bdbm_is_erase (r->req_type)) {
+		a->kind = PRIOR_QUEUE_KIND_ERASE;
+		a->lpa = PRIOR_QUEUE_NO_LPA;
+	} else {
+		a->kind = bdbm_is_read (r->req_type) ? PRIOR_QUEUE_KIND_READ : PRIOR_QUEUE_KIND_PROGRAM;
+		a->lpa = r->logaddr.lpa[0];
+	}
+}
+
+static uint32_t __llm_mq_enqueue (
+	struct bdbm_llm_mq_private* p, 
+	uint64_t punit_id, 
+	bdbm_llm_req_t* r)
+{
+	bdbm_prior_queue_attr_t a;
+	uint32_t ret;
+
+	__llm_mq_get_attr (p, r, &r->phyaddr, &a);
+
+	/* the per-punit ring is bounded; wait for the llm thread to drain it */
+	while ((ret = bdbm_prior_queue_enqueue (p->q, punit_id, &a, (void*)r))) {
+		if (punit_id >= p->nr_punits) {
+			bdbm_msg ("bdbm_prior_queue_enqueue failed");
+			break;
+		}
+		bdbm_thread_yield ();
+	}
+	if (ret == 0)
+		__llm_mq_signal (p, punit_id);
+
+	return ret;
+}
+
+/* NOTE: READ of RMW and its WRITE take their slots and their lpa turn at
+ * once here, so the completion of READ never has to wait for a slot */
+static uint32_t __llm_mq_enqueue_rmw (
+	struct bdbm_llm_mq_private* p, 
+	bdbm_llm_req_t* r)
+{
+	bdbm_prior_queue_attr_t a, dst_a;
+	uint64_t punit_id = r->phyaddr_src.punit_id;
+	uint64_t dst_punit_id = r->phyaddr_dst.punit_id;
+	uint32_t ret;
+
+	__llm_mq_get_attr (p, r, &r->phyaddr_src, &a);
+	dst_a = a;
+	dst_a.prio = PRIOR_QUEUE_PRIO_NORMAL;
+	dst_a.kind = PRIOR_QUEUE_KIND_PROGRAM;
+	dst_a.blk = r->phyaddr_dst.block_no;
+
+	while ((ret = bdbm_prior_queue_enqueue_pair (p->q, punit_id, &a, dst_punit_id, &dst_a, (void*)r))) {
+		if (punit_id >= p->nr_punits || dst_punit_id >= p->nr_punits) {
+			bdbm_msg ("bdbm_prior_queue_enqueue_pair failed");
+			break;
+		}
+		bdbm_thread_yield ();
+	}
+	if (ret == 0)
+		__llm_mq_signal (p, punit_id);
+
+	return ret;
+}
+
 uint32_t llm_mq_make_req (bdbm_drv_info_t* bdi, bdbm_llm_req_t* r)
 {
 	uint32_t ret;
@@ -253,23 +904,14 @@ uint32_t llm_mq_make_req (bdbm_drv_info_t* bdi, bdbm_llm_req_t* r)
 
 	/* obtain the elapsed time taken by FTL algorithms */
 	pmu_update_sw (bdi, r);
+	r->qos_enq_us = __llm_mq_now_us (p);
 
-	/* wait until there are enough free slots in Q */
-	while (bdbm_prior_queue_get_nr_items (p->q) >= p->nr_punits*2 /*96*/) {
-		bdbm_thread_yield ();
-	}
-
-	/* put a request into Q */
+	/* put a request into Q; it blocks until the punit has a free credit */
 	if (bdbm_is_rmw (r->req_type) && bdbm_is_read (r->req_type)) {
-		/* step 1: put READ first */
+		/* put READ, and WRITE to phyaddr_dst that waits until READ is done */
 		r->phyaddr = r->phyaddr_src;
-		if ((ret = bdbm_prior_queue_enqueue (p->q, r->phyaddr_src.punit_id, r->logaddr.lpa[0], (void*)r))) {
-			bdbm_msg ("bdbm_prior_queue_enqueue failed");
-		}
-		/* step 2: put WRITE second with the same LPA */
-		if ((ret = bdbm_prior_queue_enqueue (p->q, r->phyaddr_dst.punit_id, r->logaddr.lpa[0], (void*)r))) {
-			bdbm_msg ("bdbm_prior_queue_enqueue failed");
-		}
+		__llm_mq_get_credit (p, r->phyaddr_src.punit_id, r);
+		ret = __llm_mq_enqueue_rmw (p, r);
 	} else if (bdbm_is_rmw (r->req_type) && bdbm_is_read (r->req_type)) {
 		bdbm_bug_on (1);
 	} else {
@@ -280,13 +922,9 @@ uint32_t llm_mq_make_req (bdbm_drv_info_t* bdi, bdbm_llm_req_t* r)
 			return 0;
 		}
 
-		if ((ret = bdbm_prior_queue_enqueue (p->q, r->phyaddr.punit_id, r->logaddr.lpa[0], (void*)r))) {
-			bdbm_msg ("bdbm_prior_queue_enqueue failed");
-		}
+		__llm_mq_get_credit (p, r->phyaddr.punit_id, r);
+		ret = __llm_mq_enqueue (p, r->phyaddr.punit_id, r);
 	}
-	
-	/* wake up thread if it sleeps */
-	bdbm_thread_wakeup (p->llm_thread);
 
 	return ret;
 }
@@ -329,7 +967,7 @@ uint32_t llm_mq_merge_read_reqs (bdbm_llm_req_t* dst_lr, bdbm_llm_req_t* src_lr)
 
 uint32_t llm_mq_make_reqs (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* hlm_req)
 {
-	uint64_t idx = 0;
+	uint64_t idx = 0, i;
 	bdbm_llm_req_t* cur_lr = NULL, *dst_lr = NULL;
 	uint64_t merged_count = 0;
 
@@ -353,8 +991,13 @@ uint32_t llm_mq_make_reqs (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* hlm_req)
 
 					// bound - should be zero.
 					dst_lr->logaddr.lpa[0] = cur_lr->logaddr.lpa[0];
-					dst_lr->fmain.kp_stt[0] = cur_lr->fmain.kp_stt[0];
-					dst_lr->fmain.kp_ptr[0] = cur_lr->fmain.kp_ptr[0];
+
+					/* take over all the kernel pages; dst_lr still holds
+					 * the ones of its own (already merged) read */
+					for (i = 0; i < BDBM_MAX_PAGES; i++) {
+						dst_lr->fmain.kp_stt[i] = cur_lr->fmain.kp_stt[i];
+						dst_lr->fmain.kp_ptr[i] = cur_lr->fmain.kp_ptr[i];
+					}
 					
 					dst_lr->phyaddr.punit_id = cur_lr->phyaddr.punit_id; 
 					dst_lr->phyaddr.channel_no = cur_lr->phyaddr.channel_no;
@@ -423,35 +1066,56 @@ void llm_mq_end_req (bdbm_drv_info_t* bdi, bdbm_llm_req_t* r)
 {
 	struct bdbm_llm_mq_private* p = (struct bdbm_llm_mq_private*)BDBM_LLM_PRIV(bdi);
 	bdbm_prior_queue_item_t* qitem = (bdbm_prior_queue_item_t*)r->ptr_qitem;
+	uint64_t i;
 
 	if (bdbm_is_rmw (r->req_type) && bdbm_is_read(r->req_type)) {
+		/* r may complete as soon as WRITE is let go; do not touch it afterwards */
+		uint64_t src_punit_id = r->phyaddr.punit_id;
+		uint64_t dst_punit_id = r->phyaddr_dst.punit_id;
+
 		/* get a parallel unit ID */
 		/*bdbm_msg ("unlock: %lld", r->phyaddr.punit_id);*/
-		bdbm_sema_unlock (&p->punit_locks[r->phyaddr.punit_id]);
+		if (__llm_mq_release_punit (p, src_punit_id, r))
+			bdbm_sema_unlock (&p->punit_locks[src_punit_id]);
 		/*bdbm_msg ("LLM Done: lpa=%llu", r->logaddr.lpa[0]);*/
 
 		pmu_inc (bdi, r);
 
-		/* change its type to WRITE if req_type is RMW */
-		r->req_type = REQTYPE_RMW_WRITE;
-		r->phyaddr = r->phyaddr_dst;
+		/* WRITE moves the credit to its punit without waiting because this
+		 * is a completion path */
+		__llm_mq_charge_credit (p, dst_punit_id, r);
+		__llm_mq_put_credit (p, src_punit_id, r);
 
-		/* remove it from the Q; this automatically triggers another request to be sent to NAND flash */
-		bdbm_prior_queue_remove (p->q, qitem, r->phyaddr.punit_id);
+		/* READ filled the holes of the page, so WRITE programs all of it */
+		for (i = 0; i < bdi->parm_dev.nr_subpages_per_page; i++)
+			r->fmain.kp_stt[i] = KP_STT_DATA;
 
-		/* wake up thread if it sleeps */
-		bdbm_thread_wakeup (p->llm_thread);
+		/* change its type to WRITE; this lets go of WRITE that was queued
+		 * with READ, so the Q never looks empty and nothing waits here */
+		r->phyaddr = r->phyaddr_dst;
+		smp_wmb ();
+		r->req_type = REQTYPE_RMW_WRITE;
+
+		bdbm_prior_queue_remove (p->q, qitem, src_punit_id);
+		__llm_mq_signal (p, src_punit_id);
+		__llm_mq_signal (p, dst_punit_id);
 	} else {
+		__llm_mq_end_fused_reqs (bdi, p, r);
+
 		/* get a parallel unit ID */
-		bdbm_prior_queue_remove (p->q, qitem, r->phyaddr.punit_id);
+		__llm_mq_remove (p, qitem, r->phyaddr.punit_id);
 
 		/* complete a lock */
 		/*bdbm_msg ("unlock: %lld", r->phyaddr.punit_id);*/
-		bdbm_sema_unlock (&p->punit_locks[r->phyaddr.punit_id]);
+		if (__llm_mq_release_punit (p, r->phyaddr.punit_id, r))
+			bdbm_sema_unlock (&p->punit_locks[r->phyaddr.punit_id]);
+		__llm_mq_signal (p, r->phyaddr.punit_id);
+		__llm_mq_put_credit (p, r->phyaddr.punit_id, r);
  
 		/* update the elapsed time taken by NAND devices */
 		pmu_update_tot (bdi, r);
 		pmu_inc (bdi, r);
+		__llm_mq_update_qos (bdi, p, r);
 
 		/* finish a request */
 		bdi->ptr_hlm_inf->end_req (bdi, r);
@@ -463,6 +1127,29 @@ void llm_mq_end_req (bdbm_drv_info_t* bdi, bdbm_llm_req_t* r)
 	}
 }
 
+/* NOTE: it switches between the deadline scheduler (qos_sched = 1) and
+ * read priority (qos_sched = 0) while reqs are in flight; the llm thread
+ * picks the new setting up before it dispatches again */
+void llm_mq_set_read_prio (
+	bdbm_drv_info_t* bdi, 
+	uint32_t qos_sched, 
+	uint32_t read_prio_bypass, 
+	uint32_t read_prio_gc_bypass)
+{
+	struct bdbm_llm_mq_private* p = (struct bdbm_llm_mq_private*)BDBM_LLM_PRIV(bdi);
+
+	bdi->parm_ftl.qos_sched = qos_sched;
+	bdi->parm_ftl.read_prio_bypass = read_prio_bypass;
+	bdi->parm_ftl.read_prio_gc_bypass = read_prio_gc_bypass;
+	smp_mb ();
+
+	bdbm_msg ("qos scheduling = %u, read priority bypass = %u (%u under GC)", 
+		qos_sched, read_prio_bypass, read_prio_gc_bypass);
+
+	if (p != NULL)
+		__llm_mq_signal_all (p);
+}
+
 uint32_t llm_mq_get_queuing_count(bdbm_drv_info_t* bdi)
 {
 	struct bdbm_llm_mq_private* p = (struct bdbm_llm_mq_private*)BDBM_LLM_PRIV(bdi);
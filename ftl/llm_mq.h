@@ -33,6 +33,7 @@ uint32_t llm_mq_make_req (bdbm_drv_info_t* bdi, bdbm_llm_req_t* req);
 uint32_t llm_mq_make_reqs (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* req);
 void llm_mq_flush (bdbm_drv_info_t* bdi);
 void llm_mq_end_req (bdbm_drv_info_t* bdi, bdbm_llm_req_t* req);
+void llm_mq_set_read_prio (bdbm_drv_info_t* bdi, uint32_t qos_sched, uint32_t read_prio_bypass, uint32_t read_prio_gc_bypass);
 
 uint32_t llm_mq_get_queuing_count(bdbm_drv_info_t* bdi);
 #endif
@@ -27,11 +27,21 @@ THE SOFTWARE.
 #include <linux/types.h>
 #include <linux/slab.h>
 #include <linux/kernel.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+
+#define __pmu_nr_cpus() num_possible_cpus ()
+#define __pmu_cpu_id() raw_smp_processor_id ()
 
 #elif defined(USER_MODE)
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+#define __pmu_nr_cpus() sysconf (_SC_NPROCESSORS_CONF)
+#define __pmu_cpu_id() sched_getcpu ()
 
 #else
 #error Invalid Platform (KERNEL_MODE or USER_MODE)
@@ -46,9 +56,101 @@ THE SOFTWARE.
 
 
 #ifdef USE_PMU
+static const char* qos_class_names[QOS_NR_CLASSES] = {
+	"host read", "host write", "gc read", "gc write", "erase", "meta",
+};
+
+static const char* qos_class_keys[QOS_NR_CLASSES] = {
+	"host_read", "host_write", "gc_read", "gc_write", "erase", "meta",
+};
+
+static const char* pmu_stage_names[PMU_NR_STAGES] = {
+	"sw", "queue", "device", "total",
+};
+
+static inline bdbm_pmu_cpu_t* __pmu_get_cpu (bdbm_drv_info_t* bdi)
+{
+	int cpu = __pmu_cpu_id ();
+
+	/* a thread can migrate right after this; it is fine because the 
+	 * slots are updated with atomic adds */
+	if (bdi->pm.cpus == NULL)
+		return NULL;
+	if (cpu < 0)
+		cpu = 0;
+	return &bdi->pm.cpus[cpu % bdi->pm.nr_cpus];
+}
+
+static inline uint64_t __pmu_lat_bucket (int64_t lat_us)
+{
+	uint64_t v = (lat_us < 0) ? 0 : lat_us;
+	uint64_t e = 0, b;
+
+	if (v < (1ULL << BDBM_PMU_LAT_SUB_BITS))
+		return v;
+
+	/* keep the top (BDBM_PMU_LAT_SUB_BITS + 1) bits of 'v' */
+	while ((v >> e) >= (2ULL << BDBM_PMU_LAT_SUB_BITS))
+		e++;
+	b = ((e + 1) << BDBM_PMU_LAT_SUB_BITS) + (v >> e) - (1ULL << BDBM_PMU_LAT_SUB_BITS);
+
+	return (b < BDBM_PMU_LAT_BUCKETS) ? b : BDBM_PMU_LAT_BUCKETS - 1;
+}
+
+/* the smallest latency (us) above bucket 'b' */
+static inline uint64_t __pmu_lat_bucket_upper (uint64_t b)
+{
+	uint64_t sub = b & ((1ULL << BDBM_PMU_LAT_SUB_BITS) - 1);
+
+	if (b < (1ULL << BDBM_PMU_LAT_SUB_BITS))
+		return b + 1;
+	return (sub + (1ULL << BDBM_PMU_LAT_SUB_BITS) + 1) << ((b >> BDBM_PMU_LAT_SUB_BITS) - 1);
+}
+
+static inline uint64_t __pmu_lat_bucket_lower (uint64_t b)
+{
+	uint64_t sub = b & ((1ULL << BDBM_PMU_LAT_SUB_BITS) - 1);
+
+	if (b < (1ULL << BDBM_PMU_LAT_SUB_BITS))
+		return b;
+	return (sub + (1ULL << BDBM_PMU_LAT_SUB_BITS)) << ((b >> BDBM_PMU_LAT_SUB_BITS) - 1);
+}
+
+static uint8_t __pmu_get_class (uint32_t req_type)
+{
+	if (bdbm_is_erase (req_type))
+		return QOS_CLASS_ERASE;
+	if (bdbm_is_meta (req_type))
+		return QOS_CLASS_META;
+	if (bdbm_is_gc (req_type))
+		return bdbm_is_read (req_type) ? QOS_CLASS_GC_READ : QOS_CLASS_GC_WRITE;
+	if (bdbm_is_rmw (req_type) || bdbm_is_write (req_type))
+		return QOS_CLASS_HOST_WRITE;
+	return QOS_CLASS_HOST_READ;
+}
+
+static inline int64_t __pmu_now_us (bdbm_drv_info_t* bdi)
+{
+	return bdbm_stopwatch_get_elapsed_time_us (&bdi->pm.exetime);
+}
+
+static void __pmu_update_lat (
+	bdbm_drv_info_t* bdi, 
+	bdbm_llm_req_t* req, 
+	uint32_t stage, 
+	int64_t lat_us)
+{
+	bdbm_pmu_cpu_t* c = __pmu_get_cpu (bdi);
+
+	if (c == NULL)
+		return;
+	atomic64_inc (&c->lat[__pmu_get_class (req->req_type)][stage][__pmu_lat_bucket (lat_us)]);
+}
+
 void pmu_create (bdbm_drv_info_t* bdi)
 {
 	uint64_t i, punit;
+	long nr_cpus = __pmu_nr_cpus ();
 	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS(bdi);
 
 	bdbm_spin_lock_init (&bdi->pm.pmu_lock);
@@ -96,6 +198,22 @@ void pmu_create (bdbm_drv_info_t* bdi)
 		for (i = 0; i < punit; i++) 
 			atomic64_set (&bdi->pm.util_w[i], 0);
 	}
+
+	/* QoS classes */
+	for (i = 0; i < QOS_NR_CLASSES; i++) {
+		atomic64_set (&bdi->pm.qos_cnt[i], 0);
+		atomic64_set (&bdi->pm.qos_lat_us[i], 0);
+		atomic64_set (&bdi->pm.qos_lat_max_us[i], 0);
+		atomic64_set (&bdi->pm.qos_missed[i], 0);
+	}
+
+	/* latency histograms */
+	if (nr_cpus <= 0)
+		nr_cpus = 1;
+	bdi->pm.cpus = (bdbm_pmu_cpu_t*)bdbm_zmalloc (sizeof (bdbm_pmu_cpu_t) * nr_cpus);
+	bdi->pm.nr_cpus = (bdi->pm.cpus) ? nr_cpus : 0;
+	if (bdi->pm.cpus == NULL)
+		bdbm_warning ("bdbm_zmalloc failed; latency histograms are disabled");
 }
 
 void pmu_destory (bdbm_drv_info_t* bdi)
@@ -104,6 +222,8 @@ void pmu_destory (bdbm_drv_info_t* bdi)
 		bdbm_free_atomic (bdi->pm.util_r);
 	if (bdi->pm.util_w)
 		bdbm_free_atomic (bdi->pm.util_w);
+	if (bdi->pm.cpus)
+		bdbm_free (bdi->pm.cpus);
 }
 
 /* 
@@ -222,6 +342,16 @@ void pmu_inc_meta_write (bdbm_drv_info_t* bdi)
 void pmu_update_sw (bdbm_drv_info_t* bdi, bdbm_llm_req_t* req) 
 {
 	bdbm_hlm_req_t* h = (bdbm_hlm_req_t*)req->ptr_hlm_req;
+	int64_t now = __pmu_now_us (bdi);
+	int64_t sw = 0;
+
+	/* the time spent in hlm and FTL is known for host reqs only */
+	if (h != NULL && (bdbm_is_normal (req->req_type) || bdbm_is_rmw (req->req_type))) {
+		sw = bdbm_stopwatch_get_elapsed_time_us (&h->sw);
+		__pmu_update_lat (bdi, req, PMU_STAGE_SW, sw);
+	}
+	req->pmu_start_us = now - sw;
+	req->pmu_stamp_us = now;
 
 	/*return;*/
 
@@ -292,6 +422,10 @@ void pmu_update_gc_sw (bdbm_drv_info_t* bdi, bdbm_stopwatch_t* sw)
 void pmu_update_q (bdbm_drv_info_t* bdi, bdbm_llm_req_t* req)
 {
 	bdbm_hlm_req_t* h = (bdbm_hlm_req_t*)req->ptr_hlm_req;
+	int64_t now = __pmu_now_us (bdi);
+
+	__pmu_update_lat (bdi, req, PMU_STAGE_QUEUE, now - req->pmu_stamp_us);
+	req->pmu_stamp_us = now;
 
 	/*return;*/
 
@@ -362,6 +496,12 @@ void pmu_update_gc_q (bdbm_drv_info_t* bdi, bdbm_stopwatch_t* sw)
 void pmu_update_tot (bdbm_drv_info_t* bdi, bdbm_llm_req_t* req)
 {
 	bdbm_hlm_req_t* h = (bdbm_hlm_req_t*)req->ptr_hlm_req;
+	int64_t now = __pmu_now_us (bdi);
+
+	/* without pmu_update_q (e.g., llm_noq_lock), the device stage 
+	 * includes the time spent in llm */
+	__pmu_update_lat (bdi, req, PMU_STAGE_DEVICE, now - req->pmu_stamp_us);
+	__pmu_update_lat (bdi, req, PMU_STAGE_TOTAL, now - req->pmu_start_us);
 
 	/*return;*/
 
@@ -426,6 +566,143 @@ void pmu_update_gc_tot (bdbm_drv_info_t* bdi, bdbm_stopwatch_t* sw)
 }
 
 
+
+/* 
+ * update the latency of a QoS class; it is called when an llm_req completes
+ **/
+void pmu_update_qos (bdbm_drv_info_t* bdi, uint8_t cls, int64_t lat_us, uint8_t missed)
+{
+	bdbm_pmu_cpu_t* c = __pmu_get_cpu (bdi);
+	int64_t max;
+
+	if (cls >= QOS_NR_CLASSES)
+		return;
+	if (lat_us < 0)
+		lat_us = 0;
+
+	atomic64_inc (&bdi->pm.qos_cnt[cls]);
+	atomic64_add (lat_us, &bdi->pm.qos_lat_us[cls]);
+	if (missed)
+		atomic64_inc (&bdi->pm.qos_missed[cls]);
+
+	if (c != NULL)
+		atomic64_inc (&c->qos[cls][__pmu_lat_bucket (lat_us)]);
+
+	max = atomic64_read (&bdi->pm.qos_lat_max_us[cls]);
+	while (lat_us > max) {
+		int64_t old = atomic64_cmpxchg (&bdi->pm.qos_lat_max_us[cls], max, lat_us);
+		if (old == max)
+			break;
+		max = old;
+	}
+}
+
+void pmu_snapshot (bdbm_drv_info_t* bdi, bdbm_pmu_snapshot_t* s)
+{
+	uint64_t i, c, t, b;
+
+	bdbm_memset (s, 0x00, sizeof (bdbm_pmu_snapshot_t));
+
+	for (i = 0; i < bdi->pm.nr_cpus; i++) {
+		bdbm_pmu_cpu_t* p = &bdi->pm.cpus[i];
+
+		for (c = 0; c < QOS_NR_CLASSES; c++) {
+			for (t = 0; t < PMU_NR_STAGES; t++)
+				for (b = 0; b < BDBM_PMU_LAT_BUCKETS; b++)
+					s->lat[c][t][b] += atomic64_read (&p->lat[c][t][b]);
+			for (b = 0; b < BDBM_PMU_LAT_BUCKETS; b++)
+				s->qos[c][b] += atomic64_read (&p->qos[c][b]);
+		}
+	}
+}
+
+/* the upper bound (us) of the bucket that has the percentile 'p10k' / 100
+ * (e.g., 9990 for p99.9); it returns 0 if 'hist' is empty */
+uint64_t pmu_get_lat_percentile (uint64_t* hist, uint64_t p10k)
+{
+	uint64_t n = 0, sum = 0, b;
+
+	for (b = 0; b < BDBM_PMU_LAT_BUCKETS; b++)
+		n += hist[b];
+	if (n == 0)
+		return 0;
+
+	for (b = 0; b < BDBM_PMU_LAT_BUCKETS - 1; b++) {
+		sum += hist[b];
+		if (sum * 10000 >= n * p10k)
+			break;
+	}
+	return __pmu_lat_bucket_upper (b);
+}
+
+static uint64_t __pmu_get_lat_count (uint64_t* hist)
+{
+	uint64_t n = 0, b;
+
+	for (b = 0; b < BDBM_PMU_LAT_BUCKETS; b++)
+		n += hist[b];
+	return n;
+}
+
+/* 
+ * export a snapshot as CSV lines; it returns the # of bytes written to 'buf' 
+ * (the output is truncated if 'buf' is too small)
+ *
+ * lat,<class>,<stage>,<# of reqs>,<p50>,<p90>,<p99>,<p99.9>,<p99.99>
+ * hist,<class>,<stage>,<lower bound (us)>:<count>,... (non-empty buckets)
+ *
+ * 'qos' is used as the stage for the llm latency of QoS classes
+ */
+static int __pmu_export_hist (
+	char* buf, 
+	int size, 
+	const char* cls, 
+	const char* stage, 
+	uint64_t* hist)
+{
+	uint64_t b;
+	int len = 0;
+
+	len += snprintf (buf + len, size - len, "lat,%s,%s,%llu,%llu,%llu,%llu,%llu,%llu\n", 
+		cls, stage, 
+		(unsigned long long)__pmu_get_lat_count (hist),
+		(unsigned long long)pmu_get_lat_percentile (hist, 5000),
+		(unsigned long long)pmu_get_lat_percentile (hist, 9000),
+		(unsigned long long)pmu_get_lat_percentile (hist, 9900),
+		(unsigned long long)pmu_get_lat_percentile (hist, 9990),
+		(unsigned long long)pmu_get_lat_percentile (hist, 9999));
+	if (len < size)
+		len += snprintf (buf + len, size - len, "hist,%s,%s", cls, stage);
+	for (b = 0; b < BDBM_PMU_LAT_BUCKETS && len < size; b++) {
+		if (hist[b] == 0)
+			continue;
+		len += snprintf (buf + len, size - len, ",%llu:%llu", 
+			(unsigned long long)__pmu_lat_bucket_lower (b), 
+			(unsigned long long)hist[b]);
+	}
+	if (len < size)
+		len += snprintf (buf + len, size - len, "\n");
+
+	return (len < size) ? len : size;
+}
+
+int pmu_export (bdbm_pmu_snapshot_t* s, char* buf, int size)
+{
+	uint64_t c, t;
+	int len = 0;
+
+	for (c = 0; c < QOS_NR_CLASSES; c++) {
+		for (t = 0; t < PMU_NR_STAGES; t++)
+			len += __pmu_export_hist (buf + len, size - len, 
+				qos_class_keys[c], pmu_stage_names[t], s->lat[c][t]);
+		len += __pmu_export_hist (buf + len, size - len, 
+			qos_class_keys[c], "qos", s->qos[c]);
+	}
+
+	return len;
+}
+
+
 /* display performance results */
 char format[1024];
 char str[1024];
@@ -435,6 +712,7 @@ void pmu_display (bdbm_drv_info_t* bdi)
 	uint64_t i, j;
 	struct timeval exetime;
 	bdbm_device_params_t* np = BDBM_GET_DEVICE_PARAMS(bdi);
+	bdbm_pmu_snapshot_t* s = NULL;
 
 	bdbm_msg ("-----------------------------------------------");
 	bdbm_msg ("< PERFORMANCE SUMMARY >");
@@ -530,6 +808,50 @@ void pmu_display (bdbm_drv_info_t* bdi)
 		bdbm_msg ("%s", format);
 		bdbm_memset (format, 0x00, sizeof (format));
 	}
+	bdbm_msg ("");
+
+	if ((s = (bdbm_pmu_snapshot_t*)bdbm_malloc (sizeof (bdbm_pmu_snapshot_t))) == NULL) {
+		bdbm_error ("bdbm_malloc failed");
+		bdbm_msg ("-----------------------------------------------");
+		bdbm_msg ("-----------------------------------------------");
+		return;
+	}
+	pmu_snapshot (bdi, s);
+
+	bdbm_msg ("[8] QoS Classes (us)");
+	for (i = 0; i < QOS_NR_CLASSES; i++) {
+		uint64_t n = atomic64_read (&bdi->pm.qos_cnt[i]);
+
+		if (n == 0)
+			continue;
+		bdbm_msg ("%-10s: %llu reqs, avg:%llu p50:<%llu p99:<%llu p99.9:<%llu max:%llu, %llu missed deadlines",
+			qos_class_names[i], n,
+			atomic64_read (&bdi->pm.qos_lat_us[i]) / n,
+			pmu_get_lat_percentile (s->qos[i], 5000),
+			pmu_get_lat_percentile (s->qos[i], 9900),
+			pmu_get_lat_percentile (s->qos[i], 9990),
+			atomic64_read (&bdi->pm.qos_lat_max_us[i]),
+			atomic64_read (&bdi->pm.qos_missed[i]));
+	}
+	bdbm_msg ("");
+
+	bdbm_msg ("[9] Latency Percentiles (us)");
+	for (i = 0; i < QOS_NR_CLASSES; i++) {
+		for (j = 0; j < PMU_NR_STAGES; j++) {
+			uint64_t n = __pmu_get_lat_count (s->lat[i][j]);
+
+			if (n == 0)
+				continue;
+			bdbm_msg ("%-10s %-6s: %llu reqs, p50:<%llu p90:<%llu p99:<%llu p99.9:<%llu p99.99:<%llu",
+				qos_class_names[i], pmu_stage_names[j], n,
+				pmu_get_lat_percentile (s->lat[i][j], 5000),
+				pmu_get_lat_percentile (s->lat[i][j], 9000),
+				pmu_get_lat_percentile (s->lat[i][j], 9900),
+				pmu_get_lat_percentile (s->lat[i][j], 9990),
+				pmu_get_lat_percentile (s->lat[i][j], 9999));
+		}
+	}
+	bdbm_free (s);
 
 	bdbm_msg ("-----------------------------------------------");
 	bdbm_msg ("-----------------------------------------------");
@@ -572,4 +894,10 @@ void pmu_update_w_tot (bdbm_drv_info_t* bdi, bdbm_stopwatch_t* sw) {}
 void pmu_update_rmw_tot (bdbm_drv_info_t* bdi, bdbm_stopwatch_t* sw) {}
 void pmu_update_gc_tot (bdbm_drv_info_t* bdi, bdbm_stopwatch_t* sw) {}
 
+void pmu_update_qos (bdbm_drv_info_t* bdi, uint8_t cls, int64_t lat_us, uint8_t missed) {}
+
+void pmu_snapshot (bdbm_drv_info_t* bdi, bdbm_pmu_snapshot_t* s) {}
+uint64_t pmu_get_lat_percentile (uint64_t* hist, uint64_t p10k) { return 0; }
+int pmu_export (bdbm_pmu_snapshot_t* s, char* buf, int size) { return 0; }
+
 #endif
@@ -4,6 +4,12 @@
 #include "utime.h"
 #include "umemory.h"
 
+/* latency histograms folded from every CPU (see bdbm_pmu_cpu_t) */
+typedef struct {
+	uint64_t lat[QOS_NR_CLASSES][PMU_NR_STAGES][BDBM_PMU_LAT_BUCKETS];
+	uint64_t qos[QOS_NR_CLASSES][BDBM_PMU_LAT_BUCKETS];
+} bdbm_pmu_snapshot_t;
+
 /* performance monitor functions */
 void pmu_create (bdbm_drv_info_t* bdi);
 void pmu_destory (bdbm_drv_info_t* bdi);
@@ -40,4 +46,11 @@ void pmu_update_w_tot (bdbm_drv_info_t* bdi, bdbm_stopwatch_t* req);
 void pmu_update_rmw_tot (bdbm_drv_info_t* bdi, bdbm_stopwatch_t* req);
 void pmu_update_gc_tot (bdbm_drv_info_t* bdi, bdbm_stopwatch_t* sw);
 
+void pmu_update_qos (bdbm_drv_info_t* bdi, uint8_t cls, int64_t lat_us, uint8_t missed);
+
+/* latency histograms */
+void pmu_snapshot (bdbm_drv_info_t* bdi, bdbm_pmu_snapshot_t* s);
+uint64_t pmu_get_lat_percentile (uint64_t* hist, uint64_t p10k);
+int pmu_export (bdbm_pmu_snapshot_t* s, char* buf, int size);
+
 #endif
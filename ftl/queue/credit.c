@@ -0,0 +1,227 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#if defined (KERNEL_MODE)
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+
+#elif defined (USER_MODE)
+#include <stdio.h>
+#include <stdint.h>
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "bdbm_drv.h"
+#include "debug.h"
+#include "umemory.h"
+#include "credit.h"
+
+
+static uint8_t can_grant (
+	bdbm_credit_t* c, 
+	bdbm_credit_pool_t* cp, 
+	uint8_t cls)
+{
+	uint8_t other = (cls == CREDIT_CLASS_HOST) ? CREDIT_CLASS_GC : CREDIT_CLASS_HOST;
+
+	if (cp->used[CREDIT_CLASS_HOST] + cp->used[CREDIT_CLASS_GC] >= c->nr_credits)
+		return 0;
+	if (cp->used[cls] < c->share || list_empty (&cp->waiters[other]))
+		return 1;
+	return 0;
+}
+
+/* NOTE: it must be called with cp->lock held; the granted waiters are moved
+ * to 'granted' and must be woken up after the lock is released */
+static void grant_waiters (
+	bdbm_credit_t* c, 
+	bdbm_credit_pool_t* cp, 
+	struct list_head* granted)
+{
+	for (;;) {
+		uint8_t cls = cp->next_cls;
+		bdbm_credit_waiter_t* w;
+
+		if (list_empty (&cp->waiters[cls]) || !can_grant (c, cp, cls)) {
+			cls = (cls == CREDIT_CLASS_HOST) ? CREDIT_CLASS_GC : CREDIT_CLASS_HOST;
+			if (list_empty (&cp->waiters[cls]) || !can_grant (c, cp, cls))
+				break;
+		}
+
+		w = list_entry (cp->waiters[cls].next, bdbm_credit_waiter_t, list);
+		list_move_tail (&w->list, granted);
+		cp->used[cls]++;
+		cp->next_cls = (cls == CREDIT_CLASS_HOST) ? CREDIT_CLASS_GC : CREDIT_CLASS_HOST;
+	}
+}
+
+static void wake_waiters (struct list_head* granted)
+{
+	bdbm_credit_waiter_t* w = NULL;
+	bdbm_credit_waiter_t* tmp = NULL;
+
+	/* w lives on the stack of its owner; do not touch it after unlocking.
+	 * the owner gave up its hold on the virtual clock while waiting, so
+	 * it is taken back here before the owner runs again */
+	list_for_each_entry_safe (w, tmp, granted, list) {
+		list_del (&w->list);
+		bdbm_vclock_hold ();
+		bdbm_sema_unlock (&w->wait);
+	}
+}
+
+bdbm_credit_t* bdbm_credit_create (
+	uint64_t nr_pools, 
+	int64_t nr_credits)
+{
+	bdbm_credit_t* c;
+	uint64_t loop;
+
+	if ((c = bdbm_malloc (sizeof (bdbm_credit_t))) == NULL) {
+		bdbm_msg ("bdbm_malloc failed");
+		return NULL;
+	}
+	c->nr_pools = nr_pools;
+	c->nr_credits = (nr_credits <= 0) ? 1 : nr_credits;
+	c->share = (c->nr_credits + 1) / 2;	/* both classes together never fall short of nr_credits */
+
+	if ((c->pools = bdbm_malloc (sizeof (bdbm_credit_pool_t) * c->nr_pools)) == NULL) {
+		bdbm_msg ("bdbm_malloc failed");
+		bdbm_free (c);
+		return NULL;
+	}
+
+	for (loop = 0; loop < c->nr_pools; loop++) {
+		bdbm_credit_pool_t* cp = &c->pools[loop];
+
+		bdbm_spin_lock_init (&cp->lock);
+		cp->used[CREDIT_CLASS_HOST] = 0;
+		cp->used[CREDIT_CLASS_GC] = 0;
+		INIT_LIST_HEAD (&cp->waiters[CREDIT_CLASS_HOST]);
+		INIT_LIST_HEAD (&cp->waiters[CREDIT_CLASS_GC]);
+		cp->next_cls = CREDIT_CLASS_HOST;
+		cp->nr_waits = 0;
+	}
+
+	return c;
+}
+
+/* NOTE: it must be called when no one waits for credits */
+void bdbm_credit_destroy (bdbm_credit_t* c)
+{
+	uint64_t loop;
+
+	if (c == NULL)
+		return;
+
+	for (loop = 0; loop < c->nr_pools; loop++) {
+		bdbm_credit_pool_t* cp = &c->pools[loop];
+
+		if (!list_empty (&cp->waiters[CREDIT_CLASS_HOST]) || 
+			!list_empty (&cp->waiters[CREDIT_CLASS_GC])) {
+			bdbm_warning ("hmm.. there are still some waiters in the pool %llu", loop);
+		}
+		bdbm_spin_lock_destory (&cp->lock);
+	}
+	bdbm_free (c->pools);
+	bdbm_free (c);
+}
+
+/* NOTE: it may sleep; never call it from a completion path. On the virtual
+ * clock, the caller must hold it (see bdbm_vclock_hold ()) */
+void bdbm_credit_get (
+	bdbm_credit_t* c, 
+	uint64_t pool, 
+	uint8_t cls)
+{
+	bdbm_credit_pool_t* cp = &c->pools[pool];
+	bdbm_credit_waiter_t w;
+	unsigned long flags;
+
+	bdbm_spin_lock_irqsave (&cp->lock, flags);
+	/* do not barge in front of the waiters of the same class */
+	if (list_empty (&cp->waiters[cls]) && can_grant (c, cp, cls)) {
+		cp->used[cls]++;
+		bdbm_spin_unlock_irqrestore (&cp->lock, flags);
+		return;
+	}
+
+	bdbm_sema_init (&w.wait);
+	bdbm_sema_lock (&w.wait);
+	list_add_tail (&w.list, &cp->waiters[cls]);
+	cp->nr_waits++;
+	bdbm_spin_unlock_irqrestore (&cp->lock, flags);
+
+	/* the credit is already charged to cls when it is handed over */
+	bdbm_vclock_release ();
+	bdbm_sema_lock (&w.wait);
+	bdbm_sema_free (&w.wait);
+}
+
+/* NOTE: a req that continues as another req (e.g., RMW) must not block; it
+ * is charged even if it goes beyond nr_credits */
+void bdbm_credit_charge (
+	bdbm_credit_t* c, 
+	uint64_t pool, 
+	uint8_t cls)
+{
+	bdbm_credit_pool_t* cp = &c->pools[pool];
+	unsigned long flags;
+
+	bdbm_spin_lock_irqsave (&cp->lock, flags);
+	cp->used[cls]++;
+	bdbm_spin_unlock_irqrestore (&cp->lock, flags);
+}
+
+void bdbm_credit_put (
+	bdbm_credit_t* c, 
+	uint64_t pool, 
+	uint8_t cls)
+{
+	bdbm_credit_pool_t* cp = &c->pools[pool];
+	struct list_head granted;
+	unsigned long flags;
+
+	INIT_LIST_HEAD (&granted);
+
+	bdbm_spin_lock_irqsave (&cp->lock, flags);
+	bdbm_bug_on (cp->used[cls] <= 0);
+	cp->used[cls]--;
+	grant_waiters (c, cp, &granted);
+	bdbm_spin_unlock_irqrestore (&cp->lock, flags);
+
+	wake_waiters (&granted);
+}
+
+uint64_t bdbm_credit_get_nr_waits (bdbm_credit_t* c)
+{
+	uint64_t loop, nr_waits = 0;
+
+	for (loop = 0; loop < c->nr_pools; loop++)
+		nr_waits += c->pools[loop].nr_waits;
+	return nr_waits;
+}
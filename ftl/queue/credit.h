@@ -0,0 +1,67 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef _BLUEDBM_CREDIT_H
+#define _BLUEDBM_CREDIT_H
+
+/* NOTE: a credit pool bounds the # of in-flight reqs of a resource (e.g.,
+ * a punit); a submitter takes a credit before queueing a req and blocks
+ * when none is left, and the credit is returned when the req completes.
+ * Each class is guaranteed half of the credits of a pool; a class can
+ * borrow the rest only while no one of the other class is waiting */
+
+enum BDBM_CREDIT_CLASS {
+	CREDIT_CLASS_HOST = 0,
+	CREDIT_CLASS_GC,
+	CREDIT_NR_CLASSES,
+};
+
+typedef struct {
+	struct list_head list;
+	bdbm_sema_t wait;	/* unlocked when a credit is handed over */
+} bdbm_credit_waiter_t;
+
+typedef struct {
+	bdbm_spinlock_t lock;
+	int64_t used[CREDIT_NR_CLASSES];
+	struct list_head waiters[CREDIT_NR_CLASSES];	/* FIFO */
+	uint8_t next_cls;	/* who goes first when both classes wait */
+	uint64_t nr_waits;
+} __attribute__ ((aligned (64))) bdbm_credit_pool_t;
+
+typedef struct {
+	uint64_t nr_pools;
+	int64_t nr_credits;	/* per pool */
+	int64_t share;	/* per class per pool */
+	bdbm_credit_pool_t* pools;
+} bdbm_credit_t;
+
+bdbm_credit_t* bdbm_credit_create (uint64_t nr_pools, int64_t nr_credits);
+void bdbm_credit_destroy (bdbm_credit_t* c);
+void bdbm_credit_get (bdbm_credit_t* c, uint64_t pool, uint8_t cls);
+void bdbm_credit_charge (bdbm_credit_t* c, uint64_t pool, uint8_t cls);
+void bdbm_credit_put (bdbm_credit_t* c, uint64_t pool, uint8_t cls);
+uint64_t bdbm_credit_get_nr_waits (bdbm_credit_t* c);
+
+#endif
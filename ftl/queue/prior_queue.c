@@ -41,95 +41,208 @@ THE SOFTWARE.
 #include "prior_queue.h"
 
 
-/*static uint64_t max_queue_items = 0;*/
-
-static uint64_t get_highest_priority_tag (
-	bdbm_prior_queue_t* mq, 
+static bdbm_prior_lpa_t* get_lpa (
+	bdbm_prior_queue_t* mq,
 	uint64_t lpa)
 {
-	bdbm_prior_lpa_item_t* q = NULL;
+	return &mq->lpas[lpa & (mq->nr_lpas - 1)];
+}
 
-	HASH_FIND_INT (mq->hash_lpa, &lpa, q);
-	if (q)
-		return q->cur_tag;
-	return -1;
+/* NOTE: an lpa may be mapped to a different punit on every write, so its
+ * turns are kept in mq->lpas, which all the punits share */
+static uint8_t has_lpa_turn (
+	bdbm_prior_queue_t* mq,
+	bdbm_prior_queue_item_t* q)
+{
+	if (q->tag == 0)
+		return 1;
+	return ((uint64_t)atomic64_read (&get_lpa (mq, q->lpa)->cur_tag) + 1 == q->tag) ? 1 : 0;
 }
 
-static void remove_highest_priority_tag (
-	bdbm_prior_queue_t* mq, 
-	uint64_t lpa)
+/* NOTE: reads may go ahead of anything but an older program or erase of
+ * their block; programs and erases go in the order they came in, and an
+ * erase also waits for every older or issued item of its block */
+static uint8_t is_eligible (
+	bdbm_prior_queue_t* mq,
+	bdbm_prior_queue_punit_t* pq,
+	bdbm_prior_queue_item_t* q)
 {
-	bdbm_prior_lpa_item_t* q = NULL;
-
-	HASH_FIND_INT (mq->hash_lpa, &lpa, q);
-	if (q && q->lpa == lpa) {
-		if (q->max_tag == q->cur_tag) {
-			HASH_DEL (mq->hash_lpa, q);
-			bdbm_free_atomic (q);
-			q = NULL;
-		} else if (q->max_tag > q->cur_tag)
-			q->cur_tag++;
-		else {
-			bdbm_error ("oops!!!");
-			bdbm_bug_on (1);
+	bdbm_prior_queue_item_t* p = NULL;
+
+	if (!has_lpa_turn (mq, q))
+		return 0;
+	if ((q->flags & PRIOR_QUEUE_ITEM_F_HOLD) && !mq->is_ready (q->ptr_req))
+		return 0;
+
+	for (p = list_entry (q->list.prev, bdbm_prior_queue_item_t, list);
+		 &p->list != &pq->pending;
+		 p = list_entry (p->list.prev, bdbm_prior_queue_item_t, list)) {
+		if (p->kind != PRIOR_QUEUE_KIND_READ &&
+			(q->kind != PRIOR_QUEUE_KIND_READ || p->blk == q->blk))
+			return 0;
+		if (q->kind == PRIOR_QUEUE_KIND_ERASE && p->blk == q->blk)
+			return 0;
+	}
+
+	if (q->kind == PRIOR_QUEUE_KIND_ERASE) {
+		list_for_each_entry (p, &pq->issued, list) {
+			if (p->lock != PRIOR_QUEUE_ITEM_DONE && p->blk == q->blk)
+				return 0;
 		}
 	}
+
+	return 1;
 }
 
-static uint64_t get_new_priority_tag (
-	bdbm_prior_queue_t* mq, 
-	uint64_t lpa)
+/* give back the items whose requests were completed by bdbm_prior_queue_remove () */
+static void reap_done_items (bdbm_prior_queue_t* mq, bdbm_prior_queue_punit_t* pq)
 {
-	bdbm_prior_lpa_item_t* q = NULL;
+	bdbm_prior_queue_item_t* q = NULL;
+	bdbm_prior_queue_item_t* tmp = NULL;
 
-	HASH_FIND_INT (mq->hash_lpa, &lpa, q);
-	if (q == NULL) {
-		if ((q = (bdbm_prior_lpa_item_t*)bdbm_malloc_atomic 
-				(sizeof (bdbm_prior_lpa_item_t))) == NULL) {
-			bdbm_error ("bdbm_malloc_atomic failed");
-			bdbm_bug_on (1);
-		}
-		q->lpa = lpa;
-		q->max_tag = 1;
-		q->cur_tag = 1;
-		HASH_ADD_INT (mq->hash_lpa, lpa, q);
-	} else
-		q->max_tag++;
+	list_for_each_entry_safe (q, tmp, &pq->issued, list) {
+		if (q->lock != PRIOR_QUEUE_ITEM_DONE)
+			continue;
+		smp_rmb ();
+		list_move (&q->list, &pq->free_items);
+	}
+}
 
-	return q->max_tag;
+/* move published slots from the ring to the pending list */
+static void drain_ring (bdbm_prior_queue_t* mq, bdbm_prior_queue_punit_t* pq)
+{
+	bdbm_prior_queue_cell_t* c = NULL;
+	bdbm_prior_queue_item_t* q = NULL;
+
+	while (!list_empty (&pq->free_items)) {
+		c = &pq->cells[pq->deq_pos & (mq->ring_size - 1)];
+		if ((uint64_t)atomic64_read (&c->seq) != pq->deq_pos + 1)
+			break;	/* not published yet */
+		smp_rmb ();
+
+		q = list_entry (pq->free_items.next, bdbm_prior_queue_item_t, list);
+		q->ptr_req = c->ptr_req;
+		q->lpa = c->lpa;
+		q->blk = c->blk;
+		q->tag = c->tag;
+		q->kind = c->kind;
+		q->flags = c->flags;
+		q->prio = c->prio;
+		q->cls = c->cls;
+		q->deadline = c->deadline;
+		q->lock = PRIOR_QUEUE_ITEM_QUEUED;
+		list_move_tail (&q->list, &pq->pending);
+
+		/* hand the slot back to producers */
+		smp_mb ();
+		atomic64_set (&c->seq, pq->deq_pos + mq->ring_size);
+		pq->deq_pos++;
+	}
+}
+
+static uint64_t get_ring_size (int64_t max_size)
+{
+	uint64_t ring_size = 1;
+
+	if (max_size == INFINITE_PRIOR_QUEUE)
+		return DEFAULT_PRIOR_QUEUE_RING;
+	while (ring_size < max_size)
+		ring_size <<= 1;
+	return ring_size;
+}
+
+static int init_punit (bdbm_prior_queue_t* mq, bdbm_prior_queue_punit_t* pq)
+{
+	uint64_t loop;
+
+	bdbm_spin_lock_init (&pq->enq_lock);
+	atomic64_set (&pq->enq_pos, 0);
+	atomic64_set (&pq->qic, 0);
+	pq->deq_pos = 0;
+	pq->nr_ooo = 0;
+	pq->nr_bypassed = 0;
+	for (loop = 0; loop < PRIOR_QUEUE_MAX_CLASSES; loop++)
+		pq->tokens[loop] = 0;
+	INIT_LIST_HEAD (&pq->pending);
+	INIT_LIST_HEAD (&pq->issued);
+	INIT_LIST_HEAD (&pq->free_items);
+
+	pq->cells = bdbm_malloc (sizeof (bdbm_prior_queue_cell_t) * mq->ring_size);
+	pq->items = bdbm_malloc (sizeof (bdbm_prior_queue_item_t) * mq->ring_size);
+	if (pq->cells == NULL || pq->items == NULL) {
+		bdbm_error ("bdbm_malloc failed");
+		return -1;
+	}
+
+	for (loop = 0; loop < mq->ring_size; loop++) {
+		atomic64_set (&pq->cells[loop].seq, loop);
+		list_add_tail (&pq->items[loop].list, &pq->free_items);
+	}
+
+	return 0;
+}
+
+static void free_punit (bdbm_prior_queue_punit_t* pq)
+{
+	if (pq->cells)
+		bdbm_free (pq->cells);
+	if (pq->items)
+		bdbm_free (pq->items);
+	bdbm_spin_lock_destory (&pq->enq_lock);
+}
+
+static uint8_t always_ready (void* req)
+{
+	return 1;
 }
 
 bdbm_prior_queue_t* bdbm_prior_queue_create (
 	uint64_t nr_queues, 
-	int64_t max_size)
+	int64_t max_size,
+	uint64_t window)
 {
 	bdbm_prior_queue_t* mq;
 	uint64_t loop;
 
 	/* create a private structure */
-	if ((mq = bdbm_malloc_atomic (sizeof (bdbm_prior_queue_t))) == NULL) {
-		bdbm_msg ("bdbm_malloc_alloc failed");
+	if ((mq = bdbm_malloc (sizeof (bdbm_prior_queue_t))) == NULL) {
+		bdbm_msg ("bdbm_malloc failed");
 		return NULL;
 	}
 	mq->nr_queues = nr_queues;
 	mq->max_size = max_size;
-	mq->qic = 0;
-	bdbm_spin_lock_init (&mq->lock);
+	mq->ring_size = get_ring_size (max_size);
+	mq->window = (window == 0) ? 1 : window;
+	mq->max_bypass = 0;
+	mq->nr_classes = 0;
+	mq->is_ready = always_ready;
+	mq->pq = NULL;
+
+	/* keep lpa buckets sparse, so unrelated lpas rarely wait for each other */
+	mq->nr_lpas = DEFAULT_PRIOR_QUEUE_LPAS;
+	while (mq->nr_lpas < 4 * mq->nr_queues * mq->ring_size)
+		mq->nr_lpas <<= 1;
+	if ((mq->lpas = bdbm_zmalloc (sizeof (bdbm_prior_lpa_t) * mq->nr_lpas)) == NULL) {
+		bdbm_msg ("bdbm_zmalloc failed");
+		bdbm_free (mq);
+		return NULL;
+	}
 
-	/* create linked-lists */
-	if ((mq->qlh = bdbm_malloc_atomic (sizeof (struct list_head) * mq->nr_queues)) == NULL) {
-		bdbm_msg ("bdbm_malloc_alloc failed");
-		bdbm_free_atomic (mq);
+	/* create per-punit queues */
+	if ((mq->pq = bdbm_zmalloc (sizeof (bdbm_prior_queue_punit_t) * mq->nr_queues)) == NULL) {
+		bdbm_msg ("bdbm_zmalloc failed");
+		bdbm_free (mq->lpas);
+		bdbm_free (mq);
 		return NULL;
 	}
 
-	for (loop = 0; loop < mq->nr_queues; loop++)
-	{
-		INIT_LIST_HEAD (&mq->qlh[loop]);
-		mq->aQic[loop] = 0;	
+	for (loop = 0; loop < mq->nr_queues; loop++) {
+		if (init_punit (mq, &mq->pq[loop]) != 0) {
+			mq->nr_queues = loop + 1;
+			bdbm_prior_queue_destroy (mq);
+			return NULL;
+		}
 	}
-	/* create hash */
-	mq->hash_lpa = NULL;
 
 	return mq;
 }
@@ -137,209 +250,483 @@ bdbm_prior_queue_t* bdbm_prior_queue_create (
 /* NOTE: it must be called when mq is empty. */
 void bdbm_prior_queue_destroy (bdbm_prior_queue_t* mq)
 {
-	bdbm_prior_lpa_item_t *c, *tmp;
+	uint64_t loop, nr_ooo = 0;
 
 	if (mq == NULL)
 		return;
 
-	HASH_ITER (hh, mq->hash_lpa, c, tmp) {
-		bdbm_warning ("hmm.. there are still some items in the hash table");
-		HASH_DEL (mq->hash_lpa, c);
-		bdbm_free_atomic (c);
+	for (loop = 0; loop < mq->nr_queues; loop++) {
+		nr_ooo += mq->pq[loop].nr_ooo;
+		free_punit (&mq->pq[loop]);
 	}
-	bdbm_free_atomic (mq->qlh);
-	bdbm_free_atomic (mq);
+	for (loop = 0; loop < mq->nr_lpas; loop++) {
+		if (atomic64_read (&mq->lpas[loop].cur_tag) != atomic64_read (&mq->lpas[loop].max_tag)) {
+			bdbm_warning ("hmm.. there are still some lpas waiting for their turns");
+			break;
+		}
+	}
+	bdbm_msg ("# of out-of-order dispatches = %llu (window = %llu)", nr_ooo, mq->window);
+	bdbm_free (mq->lpas);
+	bdbm_free (mq->pq);
+	bdbm_free (mq);
+}
+
+/* NOTE: the caller holds pq->enq_lock, so no other producer takes a slot
+ * of pq; the consumer may still free slots meanwhile */
+static bdbm_prior_queue_cell_t* claim_cell (
+	bdbm_prior_queue_t* mq, 
+	bdbm_prior_queue_punit_t* pq,
+	uint64_t nr_cells)
+{
+	int64_t pos = atomic64_read (&pq->enq_pos);
+	bdbm_prior_queue_cell_t* c;
+
+	/* all the nr_cells slots have to be free before taking the first one */
+	c = &pq->cells[(pos + nr_cells - 1) & (mq->ring_size - 1)];
+	if (atomic64_read (&c->seq) != pos + nr_cells - 1)
+		return NULL;	/* the ring is full */
+	smp_mb ();
+
+	c = &pq->cells[pos & (mq->ring_size - 1)];
+	atomic64_set (&pq->enq_pos, pos + nr_cells);
+	return c;
+}
+
+static void fill_cell (
+	bdbm_prior_queue_cell_t* c,
+	bdbm_prior_queue_attr_t* a,
+	uint64_t tag,
+	uint8_t flags,
+	void* req)
+{
+	c->ptr_req = req;
+	c->lpa = a->lpa;
+	c->blk = a->blk;
+	c->tag = tag;
+	c->kind = a->kind;
+	c->flags = flags;
+	c->prio = a->prio;
+	c->cls = a->cls;
+	c->deadline = a->deadline;
+}
+
+static void publish_cell (
+	bdbm_prior_queue_t* mq, 
+	bdbm_prior_queue_punit_t* pq,
+	bdbm_prior_queue_cell_t* c)
+{
+	int64_t pos = atomic64_read (&c->seq);	/* a claimed slot keeps its position */
+
+	atomic64_inc (&pq->qic);
+	smp_wmb ();
+	atomic64_set (&c->seq, pos + 1);
+}
+
+static uint64_t get_new_tag (
+	bdbm_prior_queue_t* mq,
+	uint64_t lpa)
+{
+	if (lpa == PRIOR_QUEUE_NO_LPA)
+		return 0;
+	return atomic64_inc_return (&get_lpa (mq, lpa)->max_tag);
 }
 
+/* NOTE: it can be called from any context that may take a spinlock and
+ * never waits for the consumer; it returns 1 if the ring of qid is full.
+ * The lpa turn is taken together with the slot, so the turns of an lpa
+ * never run against the order of the ring */
 uint8_t bdbm_prior_queue_enqueue (
 	bdbm_prior_queue_t* mq, 
 	uint64_t qid, 
-	uint64_t lpa, 
+	bdbm_prior_queue_attr_t* a,
 	void* req)
 {
-	uint32_t ret = 1;
+	bdbm_prior_queue_punit_t* pq;
+	bdbm_prior_queue_cell_t* c;
 	unsigned long flags;
 
 	if (qid >= mq->nr_queues) {
 		bdbm_error ("qid is invalid (%llu)", qid);
 		return 1;
 	}
+	pq = &mq->pq[qid];
 
-	bdbm_spin_lock_irqsave (&mq->lock, flags);
-	if (mq->max_size == INFINITE_PRIOR_QUEUE || mq->qic < mq->max_size) {
-		bdbm_prior_queue_item_t* q = NULL;
-		if ((q = bdbm_malloc_atomic (sizeof (bdbm_prior_queue_item_t))) == NULL) {
-			bdbm_error ("bdbm_malloc_atomic failed");
-			bdbm_bug_on (1);
-		} else {
-			q->tag = get_new_priority_tag (mq, lpa);;
-			q->lpa = lpa;
-			q->lock = 0;
-			q->ptr_req = (void*)req;
-			list_add_tail (&q->list, &mq->qlh[qid]);	/* add to tail */
-			mq->qic++;
-			ret = 0;
-			
-			mq->aQic[qid]++;
-
-			/*
-			if (mq->qic > max_queue_items) {
-				max_queue_items = mq->qic;
-				bdbm_msg ("max queue items: %llu", max_queue_items);
-			}
-			*/
-		}
+	bdbm_spin_lock_irqsave (&pq->enq_lock, flags);
+	if ((c = claim_cell (mq, pq, 1)) == NULL) {
+		bdbm_spin_unlock_irqrestore (&pq->enq_lock, flags);
+		return 1;
 	}
-	bdbm_spin_unlock_irqrestore (&mq->lock, flags);
+	fill_cell (c, a, get_new_tag (mq, a->lpa), 0, req);
+	bdbm_spin_unlock_irqrestore (&pq->enq_lock, flags);
+
+	publish_cell (mq, pq, c);
+
+	return 0;
+}
+
+/* NOTE: it queues req to qid and, at the same time, a placeholder of it
+ * to dst_qid (e.g., the read and the write of a read-modify-write). The
+ * placeholder is not dispatched until mq->is_ready (req) says so, and it
+ * inherits the lpa turn of the first one, so nothing has to be queued when
+ * the first one completes. It returns 1 if either ring is full */
+uint8_t bdbm_prior_queue_enqueue_pair (
+	bdbm_prior_queue_t* mq, 
+	uint64_t qid, 
+	bdbm_prior_queue_attr_t* a,
+	uint64_t dst_qid, 
+	bdbm_prior_queue_attr_t* dst_a,
+	void* req)
+{
+	bdbm_prior_queue_punit_t* pq;
+	bdbm_prior_queue_punit_t* dst_pq;
+	bdbm_prior_queue_punit_t* outer;
+	bdbm_prior_queue_punit_t* inner;
+	bdbm_prior_queue_cell_t* c = NULL;
+	bdbm_prior_queue_cell_t* dst_c = NULL;
+	unsigned long flags;
+	unsigned long inner_flags;
+	uint64_t tag;
+
+	if (qid >= mq->nr_queues || dst_qid >= mq->nr_queues) {
+		bdbm_error ("qid is invalid (%llu, %llu)", qid, dst_qid);
+		return 1;
+	}
+	pq = &mq->pq[qid];
+	dst_pq = &mq->pq[dst_qid];
+
+	/* lock in the order of qids, so two pairs never wait for each other */
+	outer = (qid <= dst_qid) ? pq : dst_pq;
+	inner = (qid <= dst_qid) ? dst_pq : pq;
+	bdbm_spin_lock_irqsave (&outer->enq_lock, flags);
+	if (inner != outer)
+		bdbm_spin_lock_irqsave (&inner->enq_lock, inner_flags);
+
+	if (qid == dst_qid) {
+		if ((c = claim_cell (mq, pq, 2)) != NULL)
+			dst_c = &pq->cells[(c - pq->cells + 1) & (mq->ring_size - 1)];
+	} else if ((c = claim_cell (mq, pq, 1)) != NULL) {
+		if ((dst_c = claim_cell (mq, dst_pq, 1)) == NULL)
+			atomic64_dec (&pq->enq_pos);	/* nobody else could take it meanwhile */
+	}
+
+	if (dst_c != NULL) {
+		tag = get_new_tag (mq, a->lpa);
+		fill_cell (c, a, tag, PRIOR_QUEUE_ITEM_F_KEEP_LPA, req);
+		fill_cell (dst_c, dst_a, tag, PRIOR_QUEUE_ITEM_F_HOLD, req);
+		dst_c->lpa = a->lpa;
+	}
+
+	if (inner != outer)
+		bdbm_spin_unlock_irqrestore (&inner->enq_lock, inner_flags);
+	bdbm_spin_unlock_irqrestore (&outer->enq_lock, flags);
+
+	if (dst_c == NULL)
+		return 1;	/* either ring is full */
+
+	publish_cell (mq, pq, c);
+	publish_cell (mq, dst_pq, dst_c);
 
-	return ret;
+	return 0;
+}
+
+/* NOTE: is_ready () is called by the consumer of a punit to see whether
+ * a placeholder queued by bdbm_prior_queue_enqueue_pair () may go; it
+ * must be set before anything is queued */
+void bdbm_prior_queue_set_ready_fn (
+	bdbm_prior_queue_t* mq, 
+	uint8_t (*is_ready) (void* req))
+{
+	mq->is_ready = (is_ready == NULL) ? always_ready : is_ready;
 }
 
+/* NOTE: it only tells whether qid has outstanding items; it can be called
+ * from any context */
 uint8_t bdbm_prior_queue_is_empty (
 	bdbm_prior_queue_t* mq, 
 	uint64_t qid)
 {
-	unsigned long flags;
-	struct list_head* pos = NULL;
-	bdbm_prior_queue_item_t* q = NULL;
-	uint8_t ret = 1;
+	return (atomic64_read (&mq->pq[qid].qic) == 0) ? 1 : 0;
+}
 
-	bdbm_spin_lock_irqsave (&mq->lock, flags);
-	if (mq->qic > 0) {
-		list_for_each (pos, &mq->qlh[qid]) {
-			q = list_entry (pos, bdbm_prior_queue_item_t, list);
-			if (q && q->lock == 0)
-				break;
-			q = NULL;
-			break; /* [CAUSION] it could incur a dead-lock problem */
+/* NOTE: it must be called only if mq->nr_classes > 0 */
+static uint8_t get_class (
+	bdbm_prior_queue_t* mq, 
+	bdbm_prior_queue_item_t* q)
+{
+	return (q->cls < mq->nr_classes) ? q->cls : mq->nr_classes - 1;
+}
+
+static void* issue_item (
+	bdbm_prior_queue_t* mq, 
+	bdbm_prior_queue_punit_t* pq, 
+	bdbm_prior_queue_item_t* q,
+	bdbm_prior_queue_item_t** oq)
+{
+	if (&q->list != pq->pending.next)
+		pq->nr_ooo++;
+
+	/* every dispatch is charged, including those outside dequeue_edf () */
+	if (mq->nr_classes > 0)
+		pq->tokens[get_class (mq, q)]--;
+
+	q->lock = PRIOR_QUEUE_ITEM_ISSUED;	/* mark it use */
+	list_move_tail (&q->list, &pq->issued);
+	*oq = q;
+
+	return q->ptr_req;
+}
+
+/* the eligible item with the earliest deadline among the classes that have
+ * tokens left; 'starved' is set if some eligible item was skipped only
+ * because its class ran out of tokens. Since is_eligible () lets only the
+ * oldest program or erase of a punit go, deadlines reorder reads alone; a
+ * GC program never passes a host program of the same active block, and a
+ * GC erase never passes a host read of its victim */
+static bdbm_prior_queue_item_t* pick_edf (
+	bdbm_prior_queue_t* mq, 
+	bdbm_prior_queue_punit_t* pq, 
+	uint8_t* starved)
+{
+	bdbm_prior_queue_item_t* q = NULL;
+	bdbm_prior_queue_item_t* best = NULL;
+	uint64_t nr_scanned = 0;
+
+	*starved = 0;
+	list_for_each_entry (q, &pq->pending, list) {
+		if (nr_scanned++ == mq->window)
+			break;
+		if (!is_eligible (mq, pq, q))
+			continue;
+		if (pq->tokens[get_class (mq, q)] <= 0) {
+			*starved = 1;
+			continue;
 		}
-		if (q != NULL)
-			ret = 0;
+		/* ties go to the older one */
+		if (best == NULL || q->deadline < best->deadline)
+			best = q;
 	}
-	bdbm_spin_unlock_irqrestore (&mq->lock, flags);
+	return best;
+}
 
-	return ret;
+/* NOTE: every class gets mq->shares[cls] dispatches per round, and within
+ * those the earliest deadline goes first; a new round starts only when all
+ * the classes that have eligible items used up their shares, so an idle
+ * class does not hold the punit back */
+static void* dequeue_edf (
+	bdbm_prior_queue_t* mq, 
+	bdbm_prior_queue_punit_t* pq,
+	bdbm_prior_queue_item_t** oq)
+{
+	bdbm_prior_queue_item_t* q = NULL;
+	uint8_t starved = 0;
+	uint64_t cls;
+
+	if ((q = pick_edf (mq, pq, &starved)) == NULL) {
+		if (!starved)
+			return NULL;
+		for (cls = 0; cls < mq->nr_classes; cls++)
+			pq->tokens[cls] = mq->shares[cls];
+		if ((q = pick_edf (mq, pq, &starved)) == NULL)
+			return NULL;
+	}
+	return issue_item (mq, pq, q, oq);
 }
 
+/* NOTE: only a single consumer may call it for a given qid. It looks at
+ * the first mq->window pending items and only at those is_eligible () lets
+ * go, so an item blocked by lpa or block ordering does not stall the items
+ * queued behind it. Among them, the oldest HIGH item
+ * wins over older NORMAL ones unless mq->max_bypass HIGH items in a row
+ * already did so; with classes set, dequeue_edf () picks among them instead */
 void* bdbm_prior_queue_dequeue (
 	bdbm_prior_queue_t* mq, 
 	uint64_t qid,
 	bdbm_prior_queue_item_t** oq)
 {
-	unsigned long flags;
-	struct list_head* pos = NULL;
+	bdbm_prior_queue_punit_t* pq = &mq->pq[qid];
 	bdbm_prior_queue_item_t* q = NULL;
-	void* req = NULL;
-
-	bdbm_spin_lock_irqsave (&mq->lock, flags);
-	if (mq->qic > 0) {
-		list_for_each (pos, &mq->qlh[qid]) {
-			if ((q = list_entry (pos, bdbm_prior_queue_item_t, list))) {
-				if (q->lock == 0) {
-					uint64_t highest_tag = get_highest_priority_tag (mq, q->lpa);
-					if (highest_tag == q->tag)
-					{
-						break;
-					}
-				}
-			}
-			q = NULL;
-			break; /* [CAUSION] it could incur a dead-lock problem */
-		}
-		if (q != NULL) {
-			q->lock = 1;	/* mark it use */
-			req = q->ptr_req;
-			*oq= q;
+	bdbm_prior_queue_item_t* first = NULL;
+	bdbm_prior_queue_item_t* high = NULL;
+	uint64_t nr_scanned = 0;
+	uint8_t can_bypass;
+
+	if (atomic64_read (&pq->qic) == 0)
+		return NULL;
+
+	reap_done_items (mq, pq);
+	drain_ring (mq, pq);
+
+	if (mq->nr_classes > 0)
+		return dequeue_edf (mq, pq, oq);
+
+	can_bypass = (pq->nr_bypassed < mq->max_bypass) ? 1 : 0;
+
+	list_for_each_entry (q, &pq->pending, list) {
+		if (nr_scanned++ == mq->window)
+			break;
+		if (!is_eligible (mq, pq, q))
+			continue;
+		if (first == NULL) {
+			first = q;
+			if (q->prio == PRIOR_QUEUE_PRIO_HIGH || !can_bypass)
+				break;
+		} else if (q->prio == PRIOR_QUEUE_PRIO_HIGH) {
+			high = q;
+			break;
 		}
 	}
-	bdbm_spin_unlock_irqrestore (&mq->lock, flags);
+	if (first == NULL)
+		return NULL;
 
-	return req;
+	if (high != NULL) {
+		pq->nr_bypassed++;
+		q = high;
+	} else {
+		if (first->prio != PRIOR_QUEUE_PRIO_HIGH)
+			pq->nr_bypassed = 0;
+		q = first;
+	}
+	return issue_item (mq, pq, q, oq);
 }
 
-uint8_t bdbm_prior_queue_remove (
+/* NOTE: the same as bdbm_prior_queue_dequeue (), but it only returns the
+ * oldest eligible HIGH item and ignores the bypass bound; it is used to pick
+ * a read that may suspend the operation running on a busy punit */
+void* bdbm_prior_queue_dequeue_high (
 	bdbm_prior_queue_t* mq, 
-	bdbm_prior_queue_item_t* q,
-	uint64_t qid)
+	uint64_t qid,
+	bdbm_prior_queue_item_t** oq)
 {
-	unsigned long flags;
+	bdbm_prior_queue_punit_t* pq = &mq->pq[qid];
+	bdbm_prior_queue_item_t* q = NULL;
+	uint64_t nr_scanned = 0;
+
+	if (atomic64_read (&pq->qic) == 0)
+		return NULL;
 
-	bdbm_spin_lock_irqsave (&mq->lock, flags);
-	if (q) {
-		remove_highest_priority_tag (mq, q->lpa);
-		list_del (&q->list);
-		bdbm_free_atomic (q);
-		mq->qic--;
+	reap_done_items (mq, pq);
+	drain_ring (mq, pq);
 
-		mq->aQic[qid]--;
-		/*bdbm_msg ("[QUEUE] # of items in queue = %llu", mq->qic);*/
+	list_for_each_entry (q, &pq->pending, list) {
+		if (nr_scanned++ == mq->window)
+			return NULL;
+		if (q->prio == PRIOR_QUEUE_PRIO_HIGH && 
+			q->kind == PRIOR_QUEUE_KIND_READ &&
+			is_eligible (mq, pq, q))
+			return issue_item (mq, pq, q, oq);
 	}
-	bdbm_spin_unlock_irqrestore (&mq->lock, flags);
 
-	return 0;
+	return NULL;
 }
 
-uint8_t bdbm_prior_queue_move (
+/* NOTE: only a single consumer may call it for a given qid, right after
+ * it has dequeued from qid. It returns the oldest eligible item within the
+ * window for which match () returns 1 */
+void* bdbm_prior_queue_dequeue_match (
 	bdbm_prior_queue_t* mq, 
 	uint64_t qid,
-	bdbm_prior_queue_item_t* q)
+	uint8_t (*match) (void* req, void* arg),
+	void* arg,
+	bdbm_prior_queue_item_t** oq)
 {
-	unsigned long flags;
+	bdbm_prior_queue_punit_t* pq = &mq->pq[qid];
+	bdbm_prior_queue_item_t* q = NULL;
+	uint64_t nr_scanned = 0;
 
-	bdbm_spin_lock_irqsave (&mq->lock, flags);
-	if (q) {
-		list_del (&q->list); /* remove from the list */
-		q->lock = 0;
-		list_add (&q->list, &mq->qlh[qid]);	/* add to tail */
+	list_for_each_entry (q, &pq->pending, list) {
+		if (nr_scanned++ == mq->window)
+			return NULL;
+		if (is_eligible (mq, pq, q) && match (q->ptr_req, arg))
+			return issue_item (mq, pq, q, oq);
 	}
-	bdbm_spin_unlock_irqrestore (&mq->lock, flags);
 
-	return 0;
+	return NULL;
 }
 
-uint8_t bdbm_prior_queue_is_full (bdbm_prior_queue_t* mq)
+/* NOTE: it can be called from any context; the consumer recycles q
+ * the next time it dequeues from qid. It ends the lpa turn of q and
+ * returns 1 if a later turn of it may be waiting in some punit, so the
+ * caller knows whom to wake up */
+uint8_t bdbm_prior_queue_remove (
+	bdbm_prior_queue_t* mq, 
+	bdbm_prior_queue_item_t* q,
+	uint64_t qid)
 {
-	uint8_t ret = 0;
-	unsigned long flags;
-
-	bdbm_spin_lock_irqsave (&mq->lock, flags);
-	if (mq->max_size != INFINITE_PRIOR_QUEUE) {
-		if (mq->qic > mq->max_size) {
- 			bdbm_error ("oops!!!");
-			bdbm_bug_on (mq->qic > mq->max_size);
-		}
-		if (mq->qic == mq->max_size)
-			ret = 1;
+	bdbm_prior_lpa_t* l = NULL;
+	uint64_t tag;
+	uint8_t waiters = 0;
+
+	if (q == NULL)
+		return 0;
+
+	/* q belongs to the consumer once it is done */
+	tag = q->tag;
+	if (tag != 0 && !(q->flags & PRIOR_QUEUE_ITEM_F_KEEP_LPA))
+		l = get_lpa (mq, q->lpa);
+
+	smp_wmb ();
+	q->lock = PRIOR_QUEUE_ITEM_DONE;
+	atomic64_dec (&mq->pq[qid].qic);
+
+	if (l) {
+		smp_mb ();
+		atomic64_inc (&l->cur_tag);
+		waiters = ((uint64_t)atomic64_read (&l->max_tag) > tag) ? 1 : 0;
 	}
-	bdbm_spin_unlock_irqrestore (&mq->lock, flags);
 
-	return ret;
+	return waiters;
 }
 
-uint8_t bdbm_prior_queue_is_all_empty (bdbm_prior_queue_t* mq)
+/* NOTE: it can be changed at any time; the consumer picks it up on its
+ * next dequeue */
+void bdbm_prior_queue_set_max_bypass (
+	bdbm_prior_queue_t* mq, 
+	uint64_t max_bypass)
 {
-	uint8_t ret = 0;
-	unsigned long flags;
+	mq->max_bypass = max_bypass;
+}
 
+/* NOTE: it enables the deadline scheduler (nr_classes > 0) that replaces
+ * the HIGH/NORMAL bypass rule of bdbm_prior_queue_dequeue (); items of
+ * a class >= nr_classes are scheduled as the last class. It must be called
+ * by the consumer or before the consumer starts */
+void bdbm_prior_queue_set_classes (
+	bdbm_prior_queue_t* mq, 
+	uint64_t nr_classes, 
+	const uint32_t* shares)
+{
+	uint64_t cls;
+
+	if (nr_classes > PRIOR_QUEUE_MAX_CLASSES)
+		nr_classes = PRIOR_QUEUE_MAX_CLASSES;
+	for (cls = 0; cls < nr_classes; cls++)
+		mq->shares[cls] = (shares[cls] == 0) ? 1 : shares[cls];
+	mq->nr_classes = nr_classes;
+}
+
+uint8_t bdbm_prior_queue_is_full (bdbm_prior_queue_t* mq)
+{
+	if (mq->max_size == INFINITE_PRIOR_QUEUE)
+		return 0;
+
+	return (bdbm_prior_queue_get_nr_items (mq) >= mq->max_size) ? 1 : 0;
+}
+
+uint8_t bdbm_prior_queue_is_all_empty (bdbm_prior_queue_t* mq)
+{
 	if (mq == NULL)
 		return 1;
 
-	bdbm_spin_lock_irqsave (&mq->lock, flags);
-	if (mq->qic == 0)
-		ret = 1;	/* q is empty */
-	bdbm_spin_unlock_irqrestore (&mq->lock, flags);
-
-	return ret;
+	return (bdbm_prior_queue_get_nr_items (mq) == 0) ? 1 : 0;
 }
 
 uint64_t bdbm_prior_queue_get_nr_items (bdbm_prior_queue_t* mq)
 {
 	uint64_t nr_items = 0;
-	unsigned long flags;
+	uint64_t loop;
 
-	bdbm_spin_lock_irqsave (&mq->lock, flags);
-	nr_items = mq->qic;
-	bdbm_spin_unlock_irqrestore (&mq->lock, flags);
+	for (loop = 0; loop < mq->nr_queues; loop++)
+		nr_items += atomic64_read (&mq->pq[loop].qic);
 
 	return nr_items;
 }
@@ -25,44 +25,136 @@ THE SOFTWARE.
 #ifndef _BLUEDBM_PRIOR_QUEUE_MQ_H
 #define _BLUEDBM_PRIOR_QUEUE_MQ_H
 
-#include "../3rd/uthash.h"
 
 enum BDBM_PRIOR_QUEUE_SIZE {
 	INFINITE_PRIOR_QUEUE = -1,
+	DEFAULT_PRIOR_QUEUE_RING = 256,	/* per-punit ring slots (power of 2) */
+	DEFAULT_PRIOR_QUEUE_LPAS = 4096,	/* min # of lpa buckets (power of 2) */
 };
 
+/* max # of classes of the deadline scheduler */
+#define PRIOR_QUEUE_MAX_CLASSES	8
+
+enum BDBM_PRIOR_QUEUE_PRIO {
+	PRIOR_QUEUE_PRIO_HIGH = 0,	/* e.g., host reads */
+	PRIOR_QUEUE_PRIO_NORMAL,
+};
+
+enum BDBM_PRIOR_QUEUE_ITEM_STATE {
+	PRIOR_QUEUE_ITEM_QUEUED = 0,
+	PRIOR_QUEUE_ITEM_ISSUED,
+	PRIOR_QUEUE_ITEM_DONE,
+};
+
+/* reads may be reordered; programs and erases leave a punit in the order
+ * they came in, and an erase never overtakes an older item of its block */
+enum BDBM_PRIOR_QUEUE_KIND {
+	PRIOR_QUEUE_KIND_READ = 0,
+	PRIOR_QUEUE_KIND_PROGRAM,
+	PRIOR_QUEUE_KIND_ERASE,
+};
+
+enum BDBM_PRIOR_QUEUE_ITEM_FLAG {
+	PRIOR_QUEUE_ITEM_F_HOLD = 0x01,	/* not eligible until mq->is_ready () says so */
+	PRIOR_QUEUE_ITEM_F_KEEP_LPA = 0x02,	/* its lpa turn goes on to its HOLD partner */
+};
+
+#define PRIOR_QUEUE_NO_LPA	((uint64_t)-1)	/* not ordered by lpa */
+
+/* what a producer tells about a req */
+typedef struct {
+	uint64_t lpa;	/* PRIOR_QUEUE_NO_LPA for erases */
+	uint64_t blk;	/* block in the punit */
+	uint8_t kind;	/* BDBM_PRIOR_QUEUE_KIND */
+	uint8_t prio;
+	uint8_t cls;
+	int64_t deadline;
+} bdbm_prior_queue_attr_t;
+
 typedef struct {
 	struct list_head list; /* list header */
 	void* ptr_req;
 	uint64_t lpa;
-	uint64_t tag;
-	uint8_t lock;
+	uint64_t blk;
+	uint64_t tag;	/* turn in the order of its lpa (0: none) */
+	uint8_t kind;
+	uint8_t flags;
+	uint8_t prio;
+	uint8_t cls;
+	int64_t deadline;
+	volatile uint8_t lock;	/* BDBM_PRIOR_QUEUE_ITEM_STATE */
 } bdbm_prior_queue_item_t;
 
+/* turns of the lpas hashed to a bucket; a req may go when all the turns
+ * before its own are done. Different lpas may share a bucket, which only
+ * orders them needlessly */
+typedef struct {
+	atomic64_t max_tag;	/* the last turn handed out */
+	atomic64_t cur_tag;	/* the last turn done */
+} bdbm_prior_lpa_t;
+
+/* a slot of the submission ring; seq tells producers and the consumer
+ * whose turn it is (bounded MPSC ring) */
 typedef struct {
-	struct list_head list;	/* list header */
+	atomic64_t seq;
+	void* ptr_req;
 	uint64_t lpa;
-	uint64_t cur_tag;
-	uint64_t max_tag;
-	UT_hash_handle hh;	/* hash header */
-} bdbm_prior_lpa_item_t;
+	uint64_t blk;
+	uint64_t tag;
+	uint8_t kind;
+	uint8_t flags;
+	uint8_t prio;
+	uint8_t cls;
+	int64_t deadline;
+} bdbm_prior_queue_cell_t;
+
+/* NOTE: a punit queue has any number of producers (enqueue, remove) but
+ * exactly one consumer (dequeue); producers of a punit take enq_lock so
+ * that their lpa turns are in the order of their slots, and everything
+ * below 'consumer-private' is touched by the consumer only */
+typedef struct {
+	/* producer side */
+	bdbm_spinlock_t enq_lock;
+	atomic64_t enq_pos;
+	atomic64_t qic; /* queue item count */
+	bdbm_prior_queue_cell_t* cells;
+
+	/* consumer-private */
+	uint64_t deq_pos;
+	struct list_head pending;	/* drained items in arrival order */
+	struct list_head issued;	/* items returned by dequeue */
+	struct list_head free_items;
+	bdbm_prior_queue_item_t* items;
+	uint64_t nr_ooo;	/* # of reqs dispatched ahead of an older one */
+	uint64_t nr_bypassed;	/* # of HIGH reqs in a row that overtook a NORMAL one */
+	int64_t tokens[PRIOR_QUEUE_MAX_CLASSES];	/* dispatches left in this round */
+} __attribute__ ((aligned (64))) bdbm_prior_queue_punit_t;
 
 typedef struct {
 	uint64_t nr_queues;
 	int64_t max_size;
-	int64_t qic; /* queue item count */
-	int64_t aQic[64];
-	bdbm_spinlock_t lock; /* queue lock */
-	struct list_head* qlh; /* queue list header */
- 	bdbm_prior_lpa_item_t* hash_lpa;	/* lpa hash */
+	uint64_t ring_size;
+	uint64_t window;	/* # of pending items dequeue looks at */
+	uint64_t max_bypass;	/* bound of nr_bypassed; 0 disables priority */
+	uint64_t nr_classes;	/* 0: no deadline scheduling */
+	int64_t shares[PRIOR_QUEUE_MAX_CLASSES];	/* dispatches per round */
+	uint64_t nr_lpas;	/* # of lpa buckets (power of 2) */
+	bdbm_prior_lpa_t* lpas;	/* shared by all the punits */
+	uint8_t (*is_ready) (void* req);
+	bdbm_prior_queue_punit_t* pq;
 } bdbm_prior_queue_t;
 
-bdbm_prior_queue_t* bdbm_prior_queue_create (uint64_t nr_queues, int64_t size);
+bdbm_prior_queue_t* bdbm_prior_queue_create (uint64_t nr_queues, int64_t size, uint64_t window);
 void bdbm_prior_queue_destroy (bdbm_prior_queue_t* mq);
-uint8_t bdbm_prior_queue_enqueue (bdbm_prior_queue_t* mq, uint64_t qid, uint64_t lpa, void* req);
+uint8_t bdbm_prior_queue_enqueue (bdbm_prior_queue_t* mq, uint64_t qid, bdbm_prior_queue_attr_t* a, void* req);
+uint8_t bdbm_prior_queue_enqueue_pair (bdbm_prior_queue_t* mq, uint64_t qid, bdbm_prior_queue_attr_t* a, uint64_t dst_qid, bdbm_prior_queue_attr_t* dst_a, void* req);
+void bdbm_prior_queue_set_ready_fn (bdbm_prior_queue_t* mq, uint8_t (*is_ready) (void* req));
 void* bdbm_prior_queue_dequeue (bdbm_prior_queue_t* mq, uint64_t qid, bdbm_prior_queue_item_t** out_q);
+void* bdbm_prior_queue_dequeue_high (bdbm_prior_queue_t* mq, uint64_t qid, bdbm_prior_queue_item_t** out_q);
+void* bdbm_prior_queue_dequeue_match (bdbm_prior_queue_t* mq, uint64_t qid, uint8_t (*match) (void* req, void* arg), void* arg, bdbm_prior_queue_item_t** out_q);
 uint8_t bdbm_prior_queue_remove (bdbm_prior_queue_t* mq, bdbm_prior_queue_item_t* q, uint64_t qid);
-uint8_t bdbm_prior_queue_move (bdbm_prior_queue_t* mq, uint64_t quid, bdbm_prior_queue_item_t* q);
+void bdbm_prior_queue_set_max_bypass (bdbm_prior_queue_t* mq, uint64_t max_bypass);
+void bdbm_prior_queue_set_classes (bdbm_prior_queue_t* mq, uint64_t nr_classes, const uint32_t* shares);
 uint8_t bdbm_prior_queue_is_full (bdbm_prior_queue_t* mq);
 uint8_t bdbm_prior_queue_is_empty (bdbm_prior_queue_t* mq, uint64_t qid);
 uint8_t bdbm_prior_queue_is_all_empty (bdbm_prior_queue_t* mq);
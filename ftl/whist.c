@@ -0,0 +1,254 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#if defined(KERNEL_MODE)
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+
+#define __whist_nr_cpus() num_possible_cpus ()
+#define __whist_cpu_id() raw_smp_processor_id ()
+
+#elif defined(USER_MODE)
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+
+#define __whist_nr_cpus() sysconf (_SC_NPROCESSORS_CONF)
+#define __whist_cpu_id() sched_getcpu ()
+
+#else
+#error Invalid Platform (KERNEL_MODE or USER_MODE)
+#endif
+
+#include "debug.h"
+#include "params.h"
+#include "bdbm_drv.h"
+#include "umemory.h"
+#include "utime.h"
+#include "whist.h"
+
+
+static inline bdbm_whist_cpu_t* __whist_get_cpu (bdbm_whist_t* wh)
+{
+	int cpu = __whist_cpu_id ();
+
+	/* a thread can migrate right after this; it is fine because the 
+	 * slots are updated with atomic adds */
+	if (cpu < 0)
+		cpu = 0;
+	return &wh->cpus[cpu % wh->nr_cpus];
+}
+
+static inline uint64_t __whist_log2_bucket (uint64_t v)
+{
+	uint64_t b = 0;
+
+	while (v > 1 && b < BDBM_WHIST_IAT_BUCKETS - 1) {
+		v >>= 1;
+		b++;
+	}
+	return b;
+}
+
+bdbm_whist_t* bdbm_whist_create (uint64_t nr_lpas)
+{
+	bdbm_whist_t* wh = NULL;
+	long nr_cpus = __whist_nr_cpus ();
+
+	if (nr_cpus <= 0)
+		nr_cpus = 1;
+
+	if ((wh = (bdbm_whist_t*)bdbm_zmalloc (sizeof (bdbm_whist_t))) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		return NULL;
+	}
+
+	if ((wh->cpus = (bdbm_whist_cpu_t*)bdbm_zmalloc 
+			(sizeof (bdbm_whist_cpu_t) * nr_cpus)) == NULL) {
+		bdbm_error ("bdbm_zmalloc failed");
+		bdbm_free (wh);
+		return NULL;
+	}
+
+	wh->nr_cpus = nr_cpus;
+	wh->nr_lpas = nr_lpas;
+	wh->lpas_per_region = 
+		(nr_lpas + BDBM_WHIST_HEAT_BUCKETS - 1) / BDBM_WHIST_HEAT_BUCKETS;
+	if (wh->lpas_per_region == 0)
+		wh->lpas_per_region = 1;
+
+	return wh;
+}
+
+void bdbm_whist_destroy (bdbm_whist_t* wh)
+{
+	if (wh == NULL)
+		return;
+	bdbm_free (wh->cpus);
+	bdbm_free (wh);
+}
+
+void bdbm_whist_reset (bdbm_whist_t* wh)
+{
+	bdbm_memset (wh->cpus, 0x00, sizeof (bdbm_whist_cpu_t) * wh->nr_cpus);
+}
+
+void bdbm_whist_update_req (
+	bdbm_whist_t* wh, 
+	uint32_t type, 
+	uint64_t nr_kpages)
+{
+	bdbm_whist_cpu_t* c = __whist_get_cpu (wh);
+	uint32_t now = time_get_timestamp_in_us ();
+	uint32_t prev = (uint32_t)atomic64_xchg (&c->last_arrival_us, now);
+
+	if (nr_kpages >= BDBM_WHIST_SIZE_BUCKETS)
+		atomic64_inc (&c->size[type][BDBM_WHIST_SIZE_BUCKETS-1]);
+	else
+		atomic64_inc (&c->size[type][nr_kpages]);
+	atomic64_add (nr_kpages, &c->nr_kpages[type]);
+
+	/* the first request on this CPU has no predecessor */
+	if (prev != 0)
+		atomic64_inc (&c->iat[__whist_log2_bucket ((uint32_t)(now - prev))]);
+}
+
+void bdbm_whist_update_lpa (bdbm_whist_t* wh, int64_t lpa)
+{
+	bdbm_whist_cpu_t* c = __whist_get_cpu (wh);
+
+	if (lpa < 0)
+		return;
+	atomic64_inc (&c->heat[(lpa / wh->lpas_per_region) % BDBM_WHIST_HEAT_BUCKETS]);
+}
+
+void bdbm_whist_snapshot (bdbm_whist_t* wh, bdbm_whist_snapshot_t* s)
+{
+	uint64_t i, j, t;
+
+	bdbm_memset (s, 0x00, sizeof (bdbm_whist_snapshot_t));
+	s->lpas_per_region = wh->lpas_per_region;
+
+	for (i = 0; i < wh->nr_cpus; i++) {
+		bdbm_whist_cpu_t* c = &wh->cpus[i];
+
+		for (t = 0; t < WHIST_IO_TYPES; t++) {
+			for (j = 0; j < BDBM_WHIST_SIZE_BUCKETS; j++) {
+				s->size[t][j] += atomic64_read (&c->size[t][j]);
+				s->nr_reqs[t] += atomic64_read (&c->size[t][j]);
+			}
+			s->nr_kpages[t] += atomic64_read (&c->nr_kpages[t]);
+		}
+		for (j = 0; j < BDBM_WHIST_HEAT_BUCKETS; j++)
+			s->heat[j] += atomic64_read (&c->heat[j]);
+		for (j = 0; j < BDBM_WHIST_IAT_BUCKETS; j++)
+			s->iat[j] += atomic64_read (&c->iat[j]);
+	}
+}
+
+/* 
+ * export a snapshot as 'name,v0,v1,...' lines; it returns the # of bytes
+ * written to 'buf' (the output is truncated if 'buf' is too small) 
+ */
+static int __whist_export_line (
+	char* buf, 
+	int size, 
+	const char* name, 
+	uint64_t* v, 
+	uint64_t n)
+{
+	uint64_t i;
+	int len = 0;
+
+	len += snprintf (buf + len, size - len, "%s", name);
+	for (i = 0; i < n && len < size; i++)
+		len += snprintf (buf + len, size - len, ",%llu", (unsigned long long)v[i]);
+	if (len < size)
+		len += snprintf (buf + len, size - len, "\n");
+
+	return (len < size) ? len : size;
+}
+
+int bdbm_whist_export (bdbm_whist_snapshot_t* s, char* buf, int size)
+{
+	int len = 0;
+
+	len += __whist_export_line (buf + len, size - len, "size_r", 
+		s->size[WHIST_IO_READ], BDBM_WHIST_SIZE_BUCKETS);
+	len += __whist_export_line (buf + len, size - len, "size_w", 
+		s->size[WHIST_IO_WRITE], BDBM_WHIST_SIZE_BUCKETS);
+	len += __whist_export_line (buf + len, size - len, "iat_log2_us", 
+		s->iat, BDBM_WHIST_IAT_BUCKETS);
+	len += __whist_export_line (buf + len, size - len, "heat", 
+		s->heat, BDBM_WHIST_HEAT_BUCKETS);
+
+	return len;
+}
+
+void bdbm_whist_display (bdbm_whist_t* wh)
+{
+	bdbm_whist_snapshot_t* s = NULL;
+	uint64_t i, hottest = 0;
+
+	if ((s = (bdbm_whist_snapshot_t*)bdbm_malloc (sizeof (bdbm_whist_snapshot_t))) == NULL) {
+		bdbm_error ("bdbm_malloc failed");
+		return;
+	}
+	bdbm_whist_snapshot (wh, s);
+
+	bdbm_msg ("-----------------------------------------------");
+	bdbm_msg ("< WORKLOAD HISTOGRAMS >");
+	bdbm_msg ("read reqs: %llu (%llu kpages), write reqs: %llu (%llu kpages)",
+		s->nr_reqs[WHIST_IO_READ], s->nr_kpages[WHIST_IO_READ],
+		s->nr_reqs[WHIST_IO_WRITE], s->nr_kpages[WHIST_IO_WRITE]);
+
+	for (i = 0; i < BDBM_WHIST_SIZE_BUCKETS; i++) {
+		if (s->size[WHIST_IO_READ][i] == 0 && s->size[WHIST_IO_WRITE][i] == 0)
+			continue;
+		bdbm_msg ("size %s%llu kpages: R %llu, W %llu", 
+			(i == BDBM_WHIST_SIZE_BUCKETS - 1) ? ">=" : "", i,
+			s->size[WHIST_IO_READ][i], s->size[WHIST_IO_WRITE][i]);
+	}
+
+	for (i = 0; i < BDBM_WHIST_IAT_BUCKETS; i++) {
+		if (s->iat[i] == 0)
+			continue;
+		bdbm_msg ("inter-arrival (per CPU) < %llu us: %llu", 1ULL << (i + 1), s->iat[i]);
+	}
+
+	for (i = 0; i < BDBM_WHIST_HEAT_BUCKETS; i++) {
+		if (s->heat[i] > s->heat[hottest])
+			hottest = i;
+	}
+	bdbm_msg ("hottest region: lpa %llu-%llu (%llu writes)", 
+		hottest * s->lpas_per_region, 
+		(hottest + 1) * s->lpas_per_region - 1,
+		s->heat[hottest]);
+	bdbm_msg ("-----------------------------------------------");
+
+	bdbm_free (s);
+}
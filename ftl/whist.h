@@ -0,0 +1,82 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2014-2015 CSAIL, MIT
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef _BLUEDBM_WHIST_H
+#define _BLUEDBM_WHIST_H
+
+/* 
+ * per-instance workload histograms (request size, LPA heat, inter-arrival time)
+ *
+ * every CPU updates its own slot with atomic adds, so the hot path never
+ * takes a lock; readers fold all the slots into a snapshot.
+ */
+
+#define BDBM_WHIST_SIZE_BUCKETS		(64)	/* unit: kernel-page; the last bucket keeps larger ones */
+#define BDBM_WHIST_HEAT_BUCKETS		(1024)	/* # of LPA regions */
+#define BDBM_WHIST_IAT_BUCKETS		(32)	/* log2 (us) */
+
+enum BDBM_WHIST_IO_TYPE {
+	WHIST_IO_READ = 0,
+	WHIST_IO_WRITE,
+	WHIST_IO_TYPES,
+};
+
+typedef struct {
+	atomic64_t size[WHIST_IO_TYPES][BDBM_WHIST_SIZE_BUCKETS];
+	atomic64_t nr_kpages[WHIST_IO_TYPES];
+	atomic64_t heat[BDBM_WHIST_HEAT_BUCKETS];
+	atomic64_t iat[BDBM_WHIST_IAT_BUCKETS];	/* between reqs issued on the same CPU */
+	atomic64_t last_arrival_us;
+} __attribute__ ((aligned (64))) bdbm_whist_cpu_t;
+
+typedef struct {
+	uint64_t nr_cpus;
+	uint64_t nr_lpas;
+	uint64_t lpas_per_region;
+	bdbm_whist_cpu_t* cpus;
+} bdbm_whist_t;
+
+typedef struct {
+	uint64_t size[WHIST_IO_TYPES][BDBM_WHIST_SIZE_BUCKETS];
+	uint64_t nr_reqs[WHIST_IO_TYPES];
+	uint64_t nr_kpages[WHIST_IO_TYPES];
+	uint64_t heat[BDBM_WHIST_HEAT_BUCKETS];
+	uint64_t iat[BDBM_WHIST_IAT_BUCKETS];
+	uint64_t lpas_per_region;
+} bdbm_whist_snapshot_t;
+
+bdbm_whist_t* bdbm_whist_create (uint64_t nr_lpas);
+void bdbm_whist_destroy (bdbm_whist_t* wh);
+void bdbm_whist_reset (bdbm_whist_t* wh);
+
+/* hot-path updates */
+void bdbm_whist_update_req (bdbm_whist_t* wh, uint32_t type, uint64_t nr_kpages);
+void bdbm_whist_update_lpa (bdbm_whist_t* wh, int64_t lpa);
+
+/* queries and exports */
+void bdbm_whist_snapshot (bdbm_whist_t* wh, bdbm_whist_snapshot_t* s);
+int bdbm_whist_export (bdbm_whist_snapshot_t* s, char* buf, int size);
+void bdbm_whist_display (bdbm_whist_t* wh);
+
+#endif /* _BLUEDBM_WHIST_H */
@@ -127,6 +127,17 @@ enum BDBM_REQTYPE {
 #define bdbm_is_erase(type) (((type & REQTYPE_IO_ERASE) == REQTYPE_IO_ERASE) ? 1 : 0)
 #define bdbm_is_trim(type) (((type & REQTYPE_IO_TRIM) == REQTYPE_IO_TRIM) ? 1 : 0)
 
+/* QoS classes of llm reqs; each has its own deadline and dispatch share */
+enum BDBM_QOS_CLASS {
+	QOS_CLASS_HOST_READ = 0,
+	QOS_CLASS_HOST_WRITE,	/* including RMW */
+	QOS_CLASS_GC_READ,
+	QOS_CLASS_GC_WRITE,
+	QOS_CLASS_ERASE,
+	QOS_CLASS_META,
+	QOS_NR_CLASSES,
+};
+
 
 /* a physical address */
 typedef struct {
@@ -142,11 +153,15 @@ typedef struct {
 //#define BDBM_MAX_PAGES	(4)	//16KB x 1P	
 
 /* a bluedbm blockio request */
+#if defined (KERNEL_MODE)
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,3,0)
 #define BDBM_BLKIO_MAX_VECS 512
 #else
 #define BDBM_BLKIO_MAX_VECS 256
 #endif
+#else
+#define BDBM_BLKIO_MAX_VECS 256
+#endif
 
 typedef struct {
 	uint64_t bi_rw; /* REQTYPE_WRITE or REQTYPE_READ */
@@ -194,6 +209,11 @@ typedef struct {
 	uint8_t dma;	/* need to do DMA or not */
 	void* ptr_hlm_req;
 	void* ptr_qitem;
+	void* ptr_mp_next;	/* next req fused into the same device command */
+	uint8_t qos_class;	/* BDBM_QOS_CLASS */
+	int64_t qos_enq_us;	/* when llm received it */
+	int64_t pmu_start_us;	/* when it was issued by hlm (see pmu_update_sw) */
+	int64_t pmu_stamp_us;	/* when its current PMU stage began */
 	bdbm_sema_t* done;	/* maybe used by applications that require direct notifications from an interrupt handler */
 
 	/* logical / physical info */
@@ -266,6 +286,8 @@ typedef struct {
 	void (*destroy) (bdbm_drv_info_t* bdi);
 	uint32_t (*make_req) (bdbm_drv_info_t* bdi, bdbm_hlm_req_t* req);
 	void (*end_req) (bdbm_drv_info_t* bdi, bdbm_llm_req_t* req);
+	uint32_t (*load) (bdbm_drv_info_t* bdi, const char* fn);
+	uint32_t (*store) (bdbm_drv_info_t* bdi, const char* fn);
 } bdbm_hlm_inf_t;
 
 /* a generic low-level memory manager interface */
@@ -333,6 +355,7 @@ typedef struct {
 	uint32_t (*invalidate_lpa) (bdbm_drv_info_t* bdi, int64_t lpa, uint64_t len);
 	uint32_t (*do_gc) (bdbm_drv_info_t* bdi, int64_t lpa);
 	uint8_t (*is_gc_needed) (bdbm_drv_info_t* bdi, int64_t lpa);
+	uint8_t (*is_gc_urgent) (bdbm_drv_info_t* bdi);	/* optional; no side effects */
 
 	uint32_t (*get_token) (bdbm_drv_info_t* bdi);
 	void (*consume_token) (bdbm_drv_info_t* bdi, uint32_t used_token);
@@ -356,6 +379,27 @@ typedef struct {
 
 
 /* for performance monitoring */
+enum BDBM_PMU_STAGE {
+	PMU_STAGE_SW = 0,	/* hlm and FTL (host reqs only) */
+	PMU_STAGE_QUEUE,	/* waiting in llm */
+	PMU_STAGE_DEVICE,	/* NAND devices */
+	PMU_STAGE_TOTAL,	/* all of the above */
+	PMU_NR_STAGES,
+};
+
+/* log-linear latency buckets (us): values below 2^BDBM_PMU_LAT_SUB_BITS get 
+ * their own buckets and every power of two above is split into 
+ * 2^BDBM_PMU_LAT_SUB_BITS linear buckets, so a bucket is within 1/16 of its 
+ * values; the last bucket keeps everything beyond 2^28 us */
+#define BDBM_PMU_LAT_SUB_BITS	(4)
+#define BDBM_PMU_LAT_BUCKETS	((28 - BDBM_PMU_LAT_SUB_BITS + 1) << BDBM_PMU_LAT_SUB_BITS)
+
+/* every CPU updates its own slot with atomic adds; readers fold them */
+typedef struct {
+	atomic64_t lat[QOS_NR_CLASSES][PMU_NR_STAGES][BDBM_PMU_LAT_BUCKETS];
+	atomic64_t qos[QOS_NR_CLASSES][BDBM_PMU_LAT_BUCKETS];	/* llm latency (queueing + device) */
+} __attribute__ ((aligned (64))) bdbm_pmu_cpu_t;
+
 typedef struct {
 	bdbm_spinlock_t pmu_lock;
 	bdbm_stopwatch_t exetime;
@@ -383,6 +427,16 @@ typedef struct {
 	uint64_t time_gc_tot;
 	atomic64_t* util_r;
 	atomic64_t* util_w;
+
+	/* per-QoS-class llm latency (queueing + device) */
+	atomic64_t qos_cnt[QOS_NR_CLASSES];
+	atomic64_t qos_lat_us[QOS_NR_CLASSES];	/* sum */
+	atomic64_t qos_lat_max_us[QOS_NR_CLASSES];
+	atomic64_t qos_missed[QOS_NR_CLASSES];	/* # of reqs finished after their deadlines */
+
+	/* per-CPU latency histograms */
+	uint64_t nr_cpus;
+	bdbm_pmu_cpu_t* cpus;
 } bdbm_perf_monitor_t;
 
 /* the main data-structure for bdbm_drv */
@@ -46,6 +46,8 @@ THE SOFTWARE.
 #define PLANE_NUMBER	(2)
 #define GC_FACTOR		(0)
 
+#define READ_PRIO_GC_BYPASS		(1)	// default read-over-write bound while on-demand GC is pending
+
 #define GC_BACKGROUND_THRESHOLD		(0+5)*2
 #define GC_ONDEMAND_THRESHOLD		(0+4)*2 // + MAX_COPY_BACK)
 
@@ -64,6 +66,13 @@ typedef enum {
 	DEVICE_TYPE_END,
 } bdbm_device_type_t;
 
+/* optional device features the llm may use */
+enum BDBM_DEVICE_CAPS {
+	DEVICE_CAP_SUSPEND = 0x01,	/* a read may suspend a program/erase on a busy punit */
+	DEVICE_CAP_MP_READ = 0x02,	/* a read may carry reads to other planes (ptr_mp_next) */
+	DEVICE_CAP_BATCH = 0x04,	/* a program/erase may carry more programs/erases (ptr_mp_next) */
+};
+
 /* default parameters for a device driver */
 enum BDBM_MAPPING_POLICY {
 	MAPPING_POLICY_NOT_SPECIFIED = 0,
@@ -131,8 +140,23 @@ typedef struct {
 	uint32_t hlm_type;
 	uint32_t mapping_type;
 	uint32_t snapshot;	/* 0: disable (default), 1: enable */
+	uint32_t dispatch_window;	/* # of queued reqs per punit the llm may look at */
+	uint32_t read_prio_bypass;	/* # of writes a read may overtake in a row (0: FIFO) */
+	uint32_t read_prio_gc_bypass;	/* bound of read_prio_bypass while on-demand GC is pending */
+	uint32_t max_suspends;	/* # of times a read may suspend one program/erase (0: disable) */
+	uint32_t mp_read_fusion;	/* 1: fuse reads to other planes into one command */
+	uint32_t cmd_batch;	/* max # of programs/erases batched into one command (0 or 1: disable) */
+	uint32_t llm_credits;	/* # of in-flight llm reqs per punit (0: unlimited) */
+	uint32_t qos_sched;	/* 1: earliest-deadline-first within per-class shares; 0: read_prio_bypass */
+	uint32_t dftl_cache_kb;	/* DRAM budget for cached DFTL mapping pages */
+	uint32_t nr_log_blocks;	/* page-mapped log blocks for block mapping */
 } bdbm_ftl_params;
 
+#define BDBM_IMAGE_PATH_LEN	256
+#define BDBM_NAND_PROFILE_LEN	32
+#define BDBM_MAX_PAGE_TYPES		4	/* up to 4 bits per cell (QLC) */
+#define BDBM_NR_DMA_LEVELS		9	/* DMA time by # of busy channels; more use the last one */
+
 typedef struct {
 	uint64_t nr_channels;
 	uint64_t nr_chips_per_channel;
@@ -142,20 +166,31 @@ typedef struct {
 	uint64_t page_main_size;
 	uint64_t page_oob_size;
 	uint32_t device_type;
+	uint32_t device_caps;	/* BDBM_DEVICE_CAPS */
+	uint32_t virtual_clock;	/* 1: the timing model runs on a virtual clock (ramdrive timing only) */
+	uint32_t page_store;	/* 1: ramdrive keeps page data deduplicated and compressed */
+	char ramssd_image[BDBM_IMAGE_PATH_LEN];	/* user-mode ramdrive: a file mapped as the NAND image ("": none) */
+	uint32_t ramssd_sync_ms;	/* msync interval of the image (0: on store and close only) */
 	uint64_t device_capacity_in_byte;
+
+	/* NAND timing per page type; the type of a page is page_no % nr_page_types */
+	char nand_profile[BDBM_NAND_PROFILE_LEN];	/* the name of the profile in use */
+	uint64_t nr_page_types;	/* # of bits per cell */
+	uint64_t page_type_prog_time_us[BDBM_MAX_PAGE_TYPES];
+	uint64_t page_type_read_time_us[BDBM_MAX_PAGE_TYPES];
 #ifdef DWHONG
-	uint64_t page_lsb_prog_time_us;
-	uint64_t page_msb_prog_time_us;
 //	uint64_t read_dma_time_us;
 //	uint64_t prog_dma_time_us;
 //	uint64_t gc_read_dma_time_us;	
-	uint64_t read_dma_time_us[9];	
-	uint64_t prog_dma_time_us[9];
+	uint64_t read_dma_time_us[BDBM_NR_DMA_LEVELS];
+	uint64_t prog_dma_time_us[BDBM_NR_DMA_LEVELS];
 #else
 	uint64_t page_prog_time_us;
 #endif
 	uint64_t page_read_time_us;
 	uint64_t block_erase_time_us;
+	uint64_t suspend_time_us;	/* tSUS: program/erase suspend latency */
+	uint64_t resume_time_us;	/* extra time a resumed program/erase takes */
 
 	uint64_t nr_blocks_per_channel;
 	uint64_t nr_blocks_per_ssd;